@@ -18,6 +18,7 @@
 #define INCLUDE_DEJAVIEW_EXT_BASE_THREADING_THREAD_POOL_H_
 
 #include <condition_variable>
+#include <cstddef>
 #include <functional>
 #include <list>
 #include <mutex>
@@ -57,6 +58,11 @@ class ThreadPool {
   // This task should not block for IO as this can cause starvation.
   void PostTask(std::function<void()>);
 
+  // Runs |fn| with every index in [0, count) as tasks of this pool and returns
+  // once all of them returned. Must not be called from a task of this pool,
+  // which would then wait for itself.
+  void RunAndWait(size_t count, const std::function<void(size_t)>& fn);
+
  private:
   void RunThreadLoop();
 
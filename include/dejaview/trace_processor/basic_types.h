@@ -168,6 +168,12 @@ struct DEJAVIEW_EXPORT_COMPONENT Config {
   // When set to true, trace processor will perform additional runtime checks
   // to catch additional classes of SQL errors.
   bool enable_extra_checks = false;
+
+  // The number of threads decompressing and decoding the trace while it gets
+  // parsed, including the calling thread. 0 uses one per core, 1 parses the
+  // trace on the calling thread only. Tables are always filled by the calling
+  // thread. Ignored in WASM builds.
+  uint32_t parse_threads = 0;
 };
 
 // Represents a dynamically typed value returned by SQL.
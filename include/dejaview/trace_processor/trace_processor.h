@@ -119,6 +119,19 @@ class DEJAVIEW_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
   virtual std::string GetCurrentTraceName() = 0;
   virtual void SetCurrentTraceName(const std::string&) = 0;
 
+  // Writes a snapshot of the tables of the loaded trace to |path|, which
+  // LoadSnapshot() opens without parsing the trace again. Only valid after
+  // NotifyEndOfFile().
+  virtual base::Status SaveSnapshot(const std::string& path) = 0;
+
+  // Loads the tables of a trace from the snapshot at |path|, written by
+  // SaveSnapshot() of the same build of trace processor, instead of parsing a
+  // trace: no data should have been passed to Parse() and NotifyEndOfFile()
+  // should not be called. Tables built by importers' state which is only kept
+  // during parsing (e.g. for trace-wide postprocessing) are not restored.
+  // Nothing is loaded on error, and it can be called again.
+  virtual base::Status LoadSnapshot(const std::string& path) = 0;
+
   // Enables "meta-tracing" of trace processor.
   // Metatracing involves tracing trace processor itself to root-cause
   // performace issues in trace processor. See |DisableAndReadMetatrace| for
@@ -47,6 +47,24 @@ void ThreadPool::PostTask(std::function<void()> fn) {
   thread_waiter_.notify_one();
 }
 
+void ThreadPool::RunAndWait(size_t count,
+                            const std::function<void(size_t)>& fn) {
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t pending = count;
+  for (size_t i = 0; i < count; ++i) {
+    PostTask([&, i] {
+      fn(i);
+      std::lock_guard<std::mutex> guard(mutex);
+      if (--pending == 0) {
+        done.notify_one();
+      }
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&pending]() { return pending == 0; });
+}
+
 void ThreadPool::RunThreadLoop() {
   for (;;) {
     std::function<void()> fn;
@@ -18,6 +18,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <vector>
 
 #include "dejaview/ext/base/waitable_event.h"
 #include "test/gtest_and_gmock.h"
@@ -103,6 +104,17 @@ TEST(ThreadPoolTest, StressTest) {
   cv.wait(lock, [&count]() { return count == 1024u; });
 }
 
+TEST(ThreadPoolTest, RunAndWait) {
+  base::ThreadPool pool(4);
+  std::vector<uint32_t> runs(1024);
+  pool.RunAndWait(runs.size(), [&runs](size_t i) { runs[i]++; });
+  for (uint32_t count : runs) {
+    ASSERT_EQ(count, 1u);
+  }
+
+  pool.RunAndWait(0, [](size_t) { FAIL(); });
+}
+
 }  // namespace
 }  // namespace base
 }  // namespace dejaview
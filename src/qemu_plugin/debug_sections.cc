@@ -0,0 +1,184 @@
+#include "debug_sections.h"
+
+#include <algorithm>
+#include <string_view>
+#include <thread>
+
+#include "dejaview/ext/base/threading/thread_pool.h"
+#include "src/trace_processor/util/gzip_utils.h"
+
+#include "dwarf/elf.h"
+
+#include "qemu_helpers.h"
+
+using std::string_view;
+
+namespace {
+
+// Not defined by the FreeBSD headers yet.
+constexpr uint32_t kElfCompressZstd = 2;
+
+}  // namespace
+
+std::string_view* dwarf::File::GetFieldByName(std::string_view name) {
+  if (name == "aranges") {
+    return &debug_aranges;
+  } else if (name == "addr") {
+    return &debug_addr;
+  } else if (name == "str") {
+    return &debug_str;
+  } else if (name == "str_offsets") {
+    return &debug_str_offsets;
+  } else if (name == "line_str") {
+    return &debug_line_str;
+  } else if (name == "info") {
+    return &debug_info;
+  } else if (name == "types") {
+    return &debug_types;
+  } else if (name == "abbrev") {
+    return &debug_abbrev;
+  } else if (name == "line") {
+    return &debug_line;
+  } else if (name == "loc") {
+    return &debug_loc;
+  } else if (name == "pubnames") {
+    return &debug_pubnames;
+  } else if (name == "pubtypes") {
+    return &debug_pubtypes;
+  } else if (name == "ranges") {
+    return &debug_ranges;
+  } else if (name == "rnglists") {
+    return &debug_rnglists;
+  } else {
+    return nullptr;
+  }
+}
+
+struct ChdrMunger {
+  template <class From, class Func>
+  void operator()(const From& from, Elf64_Chdr* to, Func func) {
+    to->ch_type = func(from.ch_type);
+    to->ch_size = func(from.ch_size);
+    to->ch_addralign   = func(from.ch_addralign);
+  }
+};
+
+bool DebugSections::Init(ElfFile &elf) {
+  std::vector<CompressedSection> compressed;
+  bool warned_zstd = false;
+  for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+    ElfFile::Section section;
+    elf.ReadSection(i, &section);
+    string_view name = section.GetName();
+    string_view contents = section.contents();
+    uint64_t uncompressed_size = 0;
+
+    if (section.header().sh_flags & SHF_COMPRESSED) {
+      // Standard ELF section compression, produced when you link with
+      //   --compress-debug-sections=zlib-gabi
+      Elf64_Chdr chdr;
+      std::string_view range;
+      elf.ReadStruct<Elf32_Chdr>(contents, 0, ChdrMunger(), &range, &chdr);
+      if (chdr.ch_type != ELFCOMPRESS_ZLIB) {
+        if (chdr.ch_type == kElfCompressZstd && !warned_zstd) {
+          QEMU_LOG() << "zstd compressed debug info isn't supported, relink "
+                     << "with --compress-debug-sections=zlib" << std::endl;
+          warned_zstd = true;
+        }
+        // Unknown compression format.
+        continue;
+      }
+      uncompressed_size = chdr.ch_size;
+      contents.remove_prefix(range.size());
+    }
+
+    if (name.find(".debug_") == 0) {
+      name.remove_prefix(string_view(".debug_").size());
+    } else if (name.find(".zdebug_") == 0) {
+      // GNU format compressed debug info, produced when you link with
+      //   --compress-debug-sections=zlib-gnu
+      name.remove_prefix(string_view(".zdebug_").size());
+      if (ReadBytes(4, &contents) != "ZLIB") {
+        continue;  // Bad compression header.
+      }
+      uncompressed_size = ReadBigEndian<uint64_t>(&contents);
+    }
+
+    static constexpr string_view dwo_str(".dwo");
+    if (name.size() >= dwo_str.size() &&
+        name.rfind(".dwo") == name.size() - dwo_str.size()) {
+      name.remove_suffix(dwo_str.size());
+    }
+
+    if (string_view* member = m_dwarf.GetFieldByName(name)) {
+      if (uncompressed_size) {
+        compressed.push_back({member, contents, uncompressed_size, 0});
+      } else {
+        *member = section.contents();
+      }
+    }
+  }
+
+  if (!compressed.empty())
+    Inflate(compressed);
+
+  return !m_dwarf.debug_info.empty();
+}
+
+void DebugSections::Inflate(std::vector<CompressedSection> &sections) {
+  if (!dejaview::trace_processor::util::IsGzipSupported()) {
+    QEMU_LOG() << "Compressed debug info needs a build with zlib" << std::endl;
+    return;
+  }
+
+  // All sections are inflated in a single arena
+  size_t arena_size = 0;
+  for (CompressedSection &section : sections) {
+    section.offset = arena_size;
+    arena_size += section.size;
+  }
+  m_arena.reset(new char[arena_size]);
+
+  // Sections are independent zlib streams, .debug_info usually dominates
+  uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+  thread_count = std::min(thread_count, static_cast<uint32_t>(sections.size()));
+  // Not std::vector<bool>, whose elements share words between threads
+  std::vector<uint8_t> inflated(sections.size());
+  {
+    dejaview::base::ThreadPool pool(thread_count);
+    pool.RunAndWait(sections.size(), [&](size_t s) {
+      inflated[s] = InflateSection(sections[s], &m_arena[sections[s].offset]);
+    });
+  }
+
+  for (size_t i = 0; i < sections.size(); i++) {
+    if (!inflated[i]) {
+      QEMU_LOG() << "Failed to inflate a compressed debug section" << std::endl;
+      continue;
+    }
+    *sections[i].member = string_view(&m_arena[sections[i].offset],
+                                      sections[i].size);
+  }
+}
+
+bool DebugSections::InflateSection(const CompressedSection &section,
+                                   char *out) {
+  using dejaview::trace_processor::util::GzipDecompressor;
+  GzipDecompressor decompressor;
+  decompressor.Feed(reinterpret_cast<const uint8_t *>(section.contents.data()),
+                    section.contents.size());
+  size_t written = 0;
+  for (;;) {
+    GzipDecompressor::Result result = decompressor.ExtractOutput(
+        reinterpret_cast<uint8_t *>(out + written), section.size - written);
+    if (result.ret == GzipDecompressor::ResultCode::kError)
+      return false;
+    written += result.bytes_written;
+    if (result.ret == GzipDecompressor::ResultCode::kEof)
+      return written == section.size;
+    // The whole input was fed, running out of it or of space is an error
+    if (result.ret == GzipDecompressor::ResultCode::kNeedsMoreInput ||
+        written == section.size)
+      return false;
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef SRC_QEMU_PLUGIN_DEBUG_SECTIONS_H_
+#define SRC_QEMU_PLUGIN_DEBUG_SECTIONS_H_
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "dwarf/debug_info.h"
+
+class ElfFile;
+
+// The DWARF sections of an ELF file, shared by everything that reads debug
+// info. The views point into the ELF mapping and are only valid as long as it,
+// except for compressed sections which get inflated in an arena owned by this.
+class DebugSections {
+public:
+  DebugSections() {}
+
+  bool Init(ElfFile &elf);
+  const dwarf::File &dwarf() const { return m_dwarf; }
+
+private:
+  struct CompressedSection {
+    std::string_view *member;
+    std::string_view contents;
+    uint64_t size;
+    size_t offset;
+  };
+
+  void Inflate(std::vector<CompressedSection> &sections);
+  static bool InflateSection(const CompressedSection &section, char *out);
+
+  dwarf::File m_dwarf = {};
+  std::unique_ptr<char[]> m_arena;
+};
+
+#endif  // SRC_QEMU_PLUGIN_DEBUG_SECTIONS_H_
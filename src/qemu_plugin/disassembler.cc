@@ -2,6 +2,9 @@
 
 #include <string.h>
 
+#include <optional>
+#include <utility>
+
 extern "C" {
 #include "qemu_api.h"
 }
@@ -42,7 +45,43 @@ Disassembler *Disassembler::Initialize(const char *arch) {
   return new Disassembler(new_handle);
 }
 
-void Disassembler::is_call_or_ret(struct qemu_insn *insn, bool &is_call, bool &is_ret) {
+// Returns the target of an unconditional jump to an immediate address, or 0
+static uint64_t direct_jump_target(cs_insn *insn) {
+  if (target->arch == CS_ARCH_X86) {
+    const cs_x86 &x86 = insn->detail->x86;
+    if (insn->id == X86_INS_JMP && x86.op_count == 1 &&
+        x86.operands[0].type == X86_OP_IMM)
+      return static_cast<uint64_t>(x86.operands[0].imm);
+  } else if (target->arch == CS_ARCH_ARM64) {
+    // b.cond is also ARM64_INS_B, but with a condition code
+    const cs_arm64 &arm64 = insn->detail->arm64;
+    if (insn->id == ARM64_INS_B && arm64.cc == ARM64_CC_INVALID &&
+        arm64.op_count == 1 && arm64.operands[0].type == ARM64_OP_IMM)
+      return static_cast<uint64_t>(arm64.operands[0].imm);
+  }
+  return 0;
+}
+
+// Not every Capstone version puts these in CS_GRP_INT or CS_GRP_IRET
+static bool is_interrupt(cs_insn *insn) {
+  if (target->arch == CS_ARCH_X86)
+    return insn->id == X86_INS_SYSCALL || insn->id == X86_INS_SYSENTER;
+  return insn->id == ARM64_INS_SVC || insn->id == ARM64_INS_HVC ||
+         insn->id == ARM64_INS_SMC;
+}
+
+static bool is_interrupt_ret(cs_insn *insn) {
+  if (target->arch == CS_ARCH_X86)
+    return insn->id == X86_INS_IRET || insn->id == X86_INS_IRETD ||
+           insn->id == X86_INS_IRETQ || insn->id == X86_INS_SYSRET ||
+           insn->id == X86_INS_SYSEXIT;
+  return insn->id == ARM64_INS_ERET;
+}
+
+Disassembler::InsnClass Disassembler::classify(struct qemu_insn *insn,
+                                               uint64_t &jump_target) {
+  jump_target = 0;
+
   // Extract the content of the instruction
   uint8_t insn_buf[16];
   uint64_t insn_vaddr = qemu_plugin_insn_vaddr(insn);
@@ -52,17 +91,174 @@ void Disassembler::is_call_or_ret(struct qemu_insn *insn, bool &is_call, bool &i
   cs_insn* cs_insn;
   size_t count =
       cs_disasm(*cs_handle, insn_buf, insn_size, insn_vaddr, 0, &cs_insn);
+  if (count == 0)
+    return kOther;
 
-  // And figure out if it's a call or ret
-  if (count > 0) {
-    // TODO: Handle CS_GRP_IRET and CS_GRP_INT ?
-    is_call = cs_insn_group(*cs_handle, cs_insn, CS_GRP_CALL);
-    is_ret = cs_insn_group(*cs_handle, cs_insn, CS_GRP_RET);
-    cs_free(cs_insn, count);
-  }
+  // And figure out how it changes the control flow. Exception returns are
+  // checked first because some of them are also in the RET group.
+  InsnClass ret = kOther;
+  if (cs_insn_group(*cs_handle, cs_insn, CS_GRP_IRET) ||
+      is_interrupt_ret(cs_insn))
+    ret = kInterruptRet;
+  else if (cs_insn_group(*cs_handle, cs_insn, CS_GRP_INT) ||
+           is_interrupt(cs_insn))
+    ret = kInterrupt;
+  else if (cs_insn_group(*cs_handle, cs_insn, CS_GRP_CALL))
+    ret = kCall;
+  else if (cs_insn_group(*cs_handle, cs_insn, CS_GRP_RET))
+    ret = kRet;
+  else
+    jump_target = direct_jump_target(cs_insn);
+
+  cs_free(cs_insn, count);
+  return ret;
 }
 
 Disassembler::~Disassembler() {
   // Stop the Capstone engine
   cs_close(cs_handle);
 }
+
+// Operands reading or writing memory, both when Capstone doesn't know
+static void set_access(uint8_t access, Disassembler::MemOperand &operand) {
+  operand.read = !access || (access & CS_AC_READ);
+  operand.write = !access || (access & CS_AC_WRITE);
+}
+
+static void x86_memory_operands(
+    cs_insn *insn, size_t index,
+    std::vector<Disassembler::MemOperand> &operands) {
+  // These only compute an address
+  if (insn->id == X86_INS_LEA || insn->id == X86_INS_NOP)
+    return;
+  const cs_x86 &x86 = insn->detail->x86;
+  for (uint8_t i = 0; i < x86.op_count; i++) {
+    const cs_x86_op &op = x86.operands[i];
+    if (op.type != X86_OP_MEM)
+      continue;
+    // Per-CPU data is addressed relative to gs
+    const x86_op_mem &mem = op.mem;
+    if (mem.segment != X86_REG_INVALID || mem.base == X86_REG_RSP)
+      continue;
+
+    Disassembler::MemOperand operand = {};
+    operand.insn_index = index;
+    operand.size = op.size;
+    set_access(op.access, operand);
+    if (mem.base == X86_REG_RIP && mem.index == X86_REG_INVALID) {
+      operand.absolute = true;
+      operand.address = insn->address + insn->size +
+                        static_cast<uint64_t>(mem.disp);
+    } else if (mem.base == X86_REG_INVALID && mem.index == X86_REG_INVALID) {
+      operand.absolute = true;
+      operand.address = static_cast<uint64_t>(mem.disp);
+    } else if (mem.base != X86_REG_RIP) {
+      operand.offset = mem.disp;
+    } else {
+      continue;
+    }
+    operands.push_back(operand);
+  }
+}
+
+// w registers are the lower half of x registers
+static unsigned int arm64_full_register(unsigned int reg) {
+  if (reg >= ARM64_REG_W0 && reg <= ARM64_REG_W28)
+    return ARM64_REG_X0 + (reg - ARM64_REG_W0);
+  return reg;
+}
+
+// Globals are addressed with an adrp of their page, optionally followed by an
+// add of their offset in the page, then a load or store relative to that
+// register. |pages| tracks the registers known to hold such an address.
+static void arm64_memory_operands(
+    csh handle, cs_insn *insn, size_t index,
+    std::vector<std::pair<unsigned int, uint64_t>> &pages,
+    std::vector<Disassembler::MemOperand> &operands) {
+  auto known = [&pages](unsigned int reg) -> const uint64_t * {
+    for (const auto &page : pages) {
+      if (page.first == arm64_full_register(reg))
+        return &page.second;
+    }
+    return nullptr;
+  };
+
+  const cs_arm64 &arm64 = insn->detail->arm64;
+  for (uint8_t i = 0; i < arm64.op_count; i++) {
+    const cs_arm64_op &op = arm64.operands[i];
+    if (op.type != ARM64_OP_MEM)
+      continue;
+    const arm64_op_mem &mem = op.mem;
+    if (mem.base == ARM64_REG_SP || mem.base == ARM64_REG_X29)
+      continue;
+
+    Disassembler::MemOperand operand = {};
+    operand.insn_index = index;
+    set_access(op.access, operand);
+    const uint64_t *page = known(mem.base);
+    if (page && mem.index == ARM64_REG_INVALID) {
+      operand.absolute = true;
+      operand.address = *page + static_cast<uint64_t>(mem.disp);
+    } else {
+      operand.offset = mem.disp;
+    }
+    operands.push_back(operand);
+  }
+
+  // What this instruction loads in a register, before anything it overwrites
+  // is forgotten
+  std::optional<uint64_t> loaded;
+  if (insn->id == ARM64_INS_ADRP && arm64.op_count == 2 &&
+      arm64.operands[1].type == ARM64_OP_IMM) {
+    loaded = static_cast<uint64_t>(arm64.operands[1].imm);
+  } else if (insn->id == ARM64_INS_ADD && arm64.op_count == 3 &&
+             arm64.operands[1].type == ARM64_OP_REG &&
+             arm64.operands[2].type == ARM64_OP_IMM &&
+             known(arm64.operands[1].reg)) {
+    loaded = *known(arm64.operands[1].reg) +
+             static_cast<uint64_t>(arm64.operands[2].imm);
+  }
+
+  cs_regs regs_read, regs_write;
+  uint8_t read_count, write_count;
+  if (cs_regs_access(handle, insn, regs_read, &read_count, regs_write,
+                     &write_count) != CS_ERR_OK) {
+    pages.clear();
+    return;
+  }
+  for (uint8_t i = 0; i < write_count; i++) {
+    unsigned int reg = arm64_full_register(regs_write[i]);
+    for (size_t j = pages.size(); j > 0; j--) {
+      if (pages[j - 1].first == reg)
+        pages.erase(pages.begin() + static_cast<ptrdiff_t>(j - 1));
+    }
+  }
+  if (loaded)
+    pages.emplace_back(arm64_full_register(arm64.operands[0].reg), *loaded);
+}
+
+void Disassembler::memoryOperands(struct qemu_tb *tb,
+                                  std::vector<MemOperand> &operands) {
+  operands.clear();
+  std::vector<std::pair<unsigned int, uint64_t>> pages;
+  size_t n_insns = qemu_plugin_tb_n_insns(tb);
+  for (size_t i = 0; i < n_insns; i++) {
+    struct qemu_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+    uint8_t insn_buf[16];
+    uint64_t insn_vaddr = qemu_plugin_insn_vaddr(insn);
+    size_t insn_size = qemu_plugin_insn_data(insn, insn_buf, sizeof(insn_buf));
+
+    cs_insn* cs_insn;
+    size_t count =
+        cs_disasm(*cs_handle, insn_buf, insn_size, insn_vaddr, 1, &cs_insn);
+    if (count == 0) {
+      pages.clear();
+      continue;
+    }
+    if (target->arch == CS_ARCH_X86)
+      x86_memory_operands(cs_insn, i, operands);
+    else
+      arm64_memory_operands(*cs_handle, cs_insn, i, pages, operands);
+    cs_free(cs_insn, count);
+  }
+}
@@ -2,15 +2,51 @@
 #define SRC_QEMU_PLUGIN_DISASSEMBLER_H_
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
 
 #include <capstone/capstone.h>
 
 struct qemu_insn;
+struct qemu_tb;
 
 class Disassembler {
 public:
+  // What an instruction does to the control flow, as far as the shadow call
+  // stack is concerned.
+  enum InsnClass {
+    kOther,
+    kCall,
+    kRet,
+    // Synchronous exceptions such as syscall, int or svc
+    kInterrupt,
+    // Returns from an exception such as iret, sysret or eret
+    kInterruptRet,
+  };
+
+  // An explicit memory operand of the instruction |insn_index| of a block.
+  // Its address is known statically when |absolute|, otherwise it is |offset|
+  // bytes away from a register.
+  struct MemOperand {
+    size_t insn_index;
+    bool absolute;
+    uint64_t address;
+    int64_t offset;
+    // In bytes, 0 when unknown
+    uint8_t size;
+    // Both are set when unknown
+    bool read;
+    bool write;
+  };
+
   static Disassembler *Initialize(const char *arch);
-  void is_call_or_ret(struct qemu_insn *insn, bool &is_call, bool &_is_ret);
+  // Classifies |insn|. For unconditional direct jumps, which could be tail
+  // calls, |jump_target| is set to the destination, it is 0 otherwise.
+  InsnClass classify(struct qemu_insn *insn, uint64_t &jump_target);
+  // Lists the memory operands of the instructions of |tb|, except for those
+  // addressing the stack or per-CPU data.
+  void memoryOperands(struct qemu_tb *tb, std::vector<MemOperand> &operands);
   ~Disassembler();
 
 private:
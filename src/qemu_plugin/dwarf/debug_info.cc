@@ -240,6 +240,7 @@ void CU::ReadTopLevelDIE(InfoReader& reader) {
         }
       });
 
+  stmt_list_ = stmt_list;
   if (stmt_list) {
     if (unit_name_.empty()) {
       auto iter = reader.stmt_list_map_.find(*stmt_list);
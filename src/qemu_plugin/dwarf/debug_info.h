@@ -49,6 +49,7 @@
 #define SRC_QEMU_PLUGIN_DWARF_DEBUG_INFO_H_
 
 #include <functional>
+#include <optional>
 #include <string_view>
 #include <unordered_map>
 
@@ -251,6 +252,9 @@ class CUIter {
 class CU {
  public:
   DIEReader GetDIEReader();
+  // Reader positioned at a DIE, given its offset from the start of the unit
+  // like in DW_FORM_ref4 references.
+  DIEReader GetDIEReaderAt(uint64_t die_offset);
 
   const File& dwarf() const { return *dwarf_; }
   const CU& skeleton() const { return *skeleton_; }
@@ -260,6 +264,8 @@ class CU {
   uint64_t addr_base() const { return addr_base_; }
   uint64_t str_offsets_base() const { return str_offsets_base_; }
   uint64_t range_lists_base() const { return range_lists_base_; }
+  // Offset of the unit's line number program in .debug_line, if any.
+  std::optional<uint64_t> stmt_list() const { return stmt_list_; }
   const AbbrevTable& unit_abbrev() const { return *unit_abbrev_; }
 
   void AddIndirectString(std::string_view range) const {
@@ -307,6 +313,7 @@ class CU {
   uint64_t addr_base_ = 0;
   uint64_t str_offsets_base_ = 0;
   uint64_t range_lists_base_ = 0;
+  std::optional<uint64_t> stmt_list_;
 
   std::function<void(std::string_view)> strp_callback_;
 };
@@ -323,6 +330,15 @@ class DIEReader {
 
   void ReadChildren(const CU& cu, const AbbrevTable::Abbrev* code, std::function<void(const AbbrevTable::Abbrev *)> f);
 
+  // Nesting level of the last entry read, counting its own children if it
+  // has any. Tells direct children apart in ReadChildren() callbacks.
+  int depth() const { return depth_; }
+
+  // Offset of the next entry from the start of the unit.
+  uint64_t unit_offset(const CU& cu) const {
+    return static_cast<uint64_t>(remaining_.data() - cu.entire_unit().data());
+  }
+
  private:
   // Internal APIs.
   friend class CU;
@@ -362,6 +378,12 @@ void DIEReader::ReadAttributes(const CU& cu, const AbbrevTable::Abbrev* abbrev,
 
 inline DIEReader CU::GetDIEReader() { return DIEReader(data_); }
 
+inline DIEReader CU::GetDIEReaderAt(uint64_t die_offset) {
+  std::string_view data = entire_unit_;
+  SkipBytes(die_offset, &data);
+  return DIEReader(data);
+}
+
 }  // namespace dwarf
 
 #endif  // SRC_QEMU_PLUGIN_DWARF_DEBUG_INFO_H_
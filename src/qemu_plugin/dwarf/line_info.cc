@@ -77,12 +77,16 @@ void LineInfoReader::SeekToOffset(uint64_t offset, uint8_t address_size) {
   sizes_.SetAddressSize(address_size);
   data = sizes_.ReadInitialLength(&data);
   sizes_.ReadDWARFVersion(&data);
+  if (sizes_.dwarf_version() >= 5) {
+    sizes_.SetAddressSize(ReadFixed<uint8_t>(&data));
+    ReadFixed<uint8_t>(&data);  // segment_selector_size
+  }
   uint64_t header_length = sizes_.ReadDWARFOffset(&data);
   string_view program = data;
   SkipBytes(header_length, &program);
 
   params_.minimum_instruction_length = ReadFixed<uint8_t>(&data);
-  if (sizes_.dwarf_version() == 4) {
+  if (sizes_.dwarf_version() >= 4) {
     params_.maximum_operations_per_instruction = ReadFixed<uint8_t>(&data);
 
     if (params_.maximum_operations_per_instruction == 0) {
@@ -106,45 +110,145 @@ void LineInfoReader::SeekToOffset(uint64_t offset, uint8_t address_size) {
     standard_opcode_lengths_[i] = ReadFixed<uint8_t>(&data);
   }
 
-  // Read include_directories.
   include_directories_.clear();
+  filenames_.clear();
+  expanded_filenames_.clear();
+
+  if (sizes_.dwarf_version() >= 5) {
+    ReadEntriesV5(&data);
+  } else {
+    ReadEntriesV4(&data);
+  }
 
+  info_ = LineInfo(params_.default_is_stmt);
+  remaining_ = program;
+  shadow_ = false;
+}
+
+void LineInfoReader::ReadEntriesV4(string_view* data) {
   // Implicit current directory entry.
   include_directories_.push_back(string_view());
 
   while (true) {
-    string_view dir = ReadNullTerminated(&data);
+    string_view dir = ReadNullTerminated(data);
     if (dir.empty()) {
       break;
     }
     include_directories_.push_back(dir);
   }
 
-  // Read file_names.
-  filenames_.clear();
-  expanded_filenames_.clear();
-
   // Filename 0 is unused.
   filenames_.push_back(FileName());
   while (true) {
     FileName file_name;
-    file_name.name = ReadNullTerminated(&data);
+    file_name.name = ReadNullTerminated(data);
     if (file_name.name.empty()) {
       break;
     }
-    file_name.directory_index = ReadLEB128<uint32_t>(&data);
-    file_name.modified_time = ReadLEB128<uint64_t>(&data);
-    file_name.file_size = ReadLEB128<uint64_t>(&data);
+    file_name.directory_index = ReadLEB128<uint32_t>(data);
+    file_name.modified_time = ReadLEB128<uint64_t>(data);
+    file_name.file_size = ReadLEB128<uint64_t>(data);
     if (file_name.directory_index >= include_directories_.size()) {
       QEMU_LOG() << "directory index out of range\n";
       exit(1);
     }
     filenames_.push_back(file_name);
   }
+}
 
-  info_ = LineInfo(params_.default_is_stmt);
-  remaining_ = program;
-  shadow_ = false;
+// DWARF 5 describes directory and file entries with a list of (content type,
+// form) pairs. Entries are 0-based and strings usually live in .debug_line_str.
+void LineInfoReader::ReadEntriesV5(string_view* data) {
+  auto read_formats = [data]() {
+    std::vector<std::pair<uint64_t, uint64_t>> formats;
+    uint8_t count = ReadFixed<uint8_t>(data);
+    for (uint8_t i = 0; i < count; i++) {
+      uint64_t content_type = ReadLEB128<uint64_t>(data);
+      uint64_t form = ReadLEB128<uint64_t>(data);
+      formats.emplace_back(content_type, form);
+    }
+    return formats;
+  };
+
+  auto read_entry = [this, data](
+      const std::vector<std::pair<uint64_t, uint64_t>>& formats) {
+    FileName entry = {};
+    for (const auto& format : formats) {
+      string_view str;
+      uint64_t num = 0;
+      switch (format.second) {
+        case DW_FORM_string:
+          str = ReadNullTerminated(data);
+          break;
+        case DW_FORM_line_strp:
+        case DW_FORM_strp: {
+          string_view strs = format.second == DW_FORM_line_strp
+                                 ? file_.debug_line_str
+                                 : file_.debug_str;
+          SkipBytes(sizes_.ReadDWARFOffset(data), &strs);
+          str = ReadNullTerminated(&strs);
+          break;
+        }
+        case DW_FORM_udata:
+          num = ReadLEB128<uint64_t>(data);
+          break;
+        case DW_FORM_data1:
+          num = ReadFixed<uint8_t>(data);
+          break;
+        case DW_FORM_data2:
+          num = ReadFixed<uint16_t>(data);
+          break;
+        case DW_FORM_data4:
+          num = ReadFixed<uint32_t>(data);
+          break;
+        case DW_FORM_data8:
+          num = ReadFixed<uint64_t>(data);
+          break;
+        case DW_FORM_data16:
+          SkipBytes(16, data);
+          break;
+        case DW_FORM_block:
+          SkipBytes(ReadLEB128<uint64_t>(data), data);
+          break;
+        default:
+          QEMU_LOG() << "Unexpected form in line table header: "
+                     << format.second << "\n";
+          exit(1);
+      }
+      switch (format.first) {
+        case DW_LNCT_path:
+          entry.name = str;
+          break;
+        case DW_LNCT_directory_index:
+          entry.directory_index = static_cast<uint32_t>(num);
+          break;
+        case DW_LNCT_timestamp:
+          entry.modified_time = num;
+          break;
+        case DW_LNCT_size:
+          entry.file_size = num;
+          break;
+      }
+    }
+    return entry;
+  };
+
+  auto directory_formats = read_formats();
+  uint64_t directory_count = ReadLEB128<uint64_t>(data);
+  for (uint64_t i = 0; i < directory_count; i++) {
+    include_directories_.push_back(read_entry(directory_formats).name);
+  }
+
+  auto file_formats = read_formats();
+  uint64_t file_count = ReadLEB128<uint64_t>(data);
+  for (uint64_t i = 0; i < file_count; i++) {
+    FileName file_name = read_entry(file_formats);
+    if (file_name.directory_index >= include_directories_.size()) {
+      QEMU_LOG() << "directory index out of range\n";
+      exit(1);
+    }
+    filenames_.push_back(file_name);
+  }
 }
 
 bool LineInfoReader::ReadLineInfo() {
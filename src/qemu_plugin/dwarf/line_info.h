@@ -105,6 +105,8 @@ class LineInfoReader {
 
   LineInfo info_;
 
+  void ReadEntriesV4(std::string_view* data);
+  void ReadEntriesV5(std::string_view* data);
   void DoAdvance(uint64_t advance, uint8_t max_per_instr);
   void Advance(uint64_t amount);
   uint8_t AdjustedOpcode(uint8_t op);
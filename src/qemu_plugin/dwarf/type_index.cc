@@ -0,0 +1,254 @@
+#include "type_index.h"
+
+#include "dwarf_constants.h"
+#include "dwarf_util.h"
+#include "util.h"
+
+using std::string_view;
+using namespace dwarf2reader;
+
+namespace dwarf {
+
+namespace {
+
+// Anonymous structs and unions nested deeper than this aren't looked into.
+constexpr int kMaxAnonymousNesting = 4;
+// Typedefs and qualifiers followed to find the size of a type.
+constexpr int kMaxTypeHops = 8;
+
+// Only references within the unit can be followed from a DIEReader.
+bool IsUnitReference(uint16_t form) {
+  return form == DW_FORM_ref1 || form == DW_FORM_ref2 ||
+         form == DW_FORM_ref4 || form == DW_FORM_ref8;
+}
+
+// Looks for |member| among the members of the struct or union at |die_reader|,
+// and inside its anonymous struct and union members. Offsets are relative to
+// the start of that struct.
+std::optional<TypeIndex::Member> FindMemberIn(CU& cu, DIEReader die_reader,
+                                              uint64_t unit_offset,
+                                              string_view member,
+                                              int nesting) {
+  const AbbrevTable::Abbrev* abbrev = die_reader.ReadCode(cu);
+  // .debug_pubtypes may also point at declarations.
+  if (!abbrev || !abbrev->has_child ||
+      (abbrev->tag != DW_TAG_structure_type &&
+       abbrev->tag != DW_TAG_union_type)) {
+    return std::nullopt;
+  }
+  uint64_t struct_size = 0;
+  die_reader.ReadAttributes(cu, abbrev, [&](uint16_t tag, AttrValue value) {
+    if (tag == DW_AT_byte_size) {
+      struct_size = value.ToUint(cu).value_or(0);
+    }
+  });
+
+  int level = die_reader.depth();
+  std::optional<TypeIndex::Member> found;
+  std::vector<uint64_t> offsets;
+  // Offsets and types of the anonymous members.
+  std::vector<std::pair<uint64_t, uint64_t>> anonymous;
+  die_reader.ReadChildren(cu, abbrev, [&](const AbbrevTable::Abbrev* child) {
+    string_view name;
+    std::optional<uint64_t> offset;
+    std::optional<uint64_t> type;
+    die_reader.ReadAttributes(cu, child, [&](uint16_t tag, AttrValue value) {
+      if (tag == DW_AT_name && value.IsString()) {
+        name = value.GetString(cu);
+      } else if (tag == DW_AT_data_member_location) {
+        offset = value.ToUint(cu);
+      } else if (tag == DW_AT_type && IsUnitReference(value.form())) {
+        type = value.GetUint(cu);
+      }
+    });
+    // Types defined inline have children of their own, skip those.
+    bool direct = die_reader.depth() - (child->has_child ? 1 : 0) == level;
+    if (!direct || child->tag != DW_TAG_member) {
+      return;
+    }
+    // Union members have no location, they all start at 0.
+    uint64_t at = offset.value_or(0);
+    offsets.push_back(at);
+    if (found) {
+      return;
+    }
+    if (name == member) {
+      found = TypeIndex::Member{at, std::nullopt, struct_size};
+      if (type) {
+        found->type = TypeIndex::Location{unit_offset, *type};
+      }
+    } else if (name.empty() && type) {
+      anonymous.emplace_back(at, *type);
+    }
+  });
+  if (found) {
+    for (uint64_t at : offsets) {
+      if (at > found->offset && at < found->end) {
+        found->end = at;
+      }
+    }
+    return found;
+  }
+  if (nesting >= kMaxAnonymousNesting) {
+    return std::nullopt;
+  }
+
+  for (const auto& [offset, type] : anonymous) {
+    std::optional<TypeIndex::Member> inner = FindMemberIn(
+        cu, cu.GetDIEReaderAt(type), unit_offset, member, nesting + 1);
+    if (inner) {
+      inner->offset += offset;
+      inner->end += offset;
+      return inner;
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+void TypeIndex::Build() {
+  types_.clear();
+  from_pubtypes_ = ReadPubTypes();
+  if (!from_pubtypes_) {
+    types_.clear();
+    ScanInfo();
+  }
+}
+
+const std::vector<TypeIndex::Location>& TypeIndex::Find(
+    string_view name) const {
+  static const std::vector<Location> kNotFound;
+  auto it = types_.find(name);
+  return it == types_.end() ? kNotFound : it->second;
+}
+
+DIEReader TypeIndex::Seek(InfoReader& reader, const Location& location,
+                          CU* cu) const {
+  CUIter iter =
+      reader.GetCUIter(InfoReader::Section::kDebugInfo, location.unit_offset);
+  if (!iter.NextCU(reader, cu)) {
+    QEMU_LOG() << "Type index points past .debug_info\n";
+    exit(1);
+  }
+  return cu->GetDIEReaderAt(location.die_offset);
+}
+
+std::optional<TypeIndex::Member> TypeIndex::FindMember(
+    string_view type, string_view member) const {
+  for (const Location& location : Find(type)) {
+    InfoReader reader(file_, /*skeleton=*/nullptr);
+    CU cu;
+    DIEReader die_reader = Seek(reader, location, &cu);
+    std::optional<Member> found =
+        FindMemberIn(cu, die_reader, location.unit_offset, member, 0);
+    if (found) {
+      return found;
+    }
+  }
+  return std::nullopt;
+}
+
+uint64_t TypeIndex::TypeSize(const Location& location) const {
+  InfoReader reader(file_, /*skeleton=*/nullptr);
+  CU cu;
+  Seek(reader, location, &cu);
+  uint64_t die_offset = location.die_offset;
+  for (int hops = 0; hops < kMaxTypeHops; hops++) {
+    DIEReader die_reader = cu.GetDIEReaderAt(die_offset);
+    const AbbrevTable::Abbrev* abbrev = die_reader.ReadCode(cu);
+    if (!abbrev) {
+      return 0;
+    }
+    uint64_t size = 0;
+    std::optional<uint64_t> next;
+    die_reader.ReadAttributes(cu, abbrev, [&](uint16_t tag, AttrValue value) {
+      if (tag == DW_AT_byte_size) {
+        size = value.ToUint(cu).value_or(0);
+      } else if (tag == DW_AT_type && IsUnitReference(value.form())) {
+        next = value.GetUint(cu);
+      }
+    });
+    bool alias = abbrev->tag == DW_TAG_typedef ||
+                 abbrev->tag == DW_TAG_const_type ||
+                 abbrev->tag == DW_TAG_volatile_type;
+    if (size || !alias || !next) {
+      return size;
+    }
+    die_offset = *next;
+  }
+  return 0;
+}
+
+// Each set of .debug_pubtypes lists the (offset, name) pairs of a unit.
+bool TypeIndex::ReadPubTypes() {
+  string_view section = file_.debug_pubtypes;
+  if (section.empty()) {
+    return false;
+  }
+
+  while (!section.empty()) {
+    CompilationUnitSizes sizes;
+    string_view set = sizes.ReadInitialLength(&section);
+    sizes.ReadDWARFVersion(&set);
+    if (sizes.dwarf_version() != 2) {
+      // Unknown format, the scan will do.
+      return false;
+    }
+    uint64_t unit_offset = sizes.ReadDWARFOffset(&set);
+    sizes.ReadDWARFOffset(&set);  // debug_info_length
+
+    while (!set.empty()) {
+      uint64_t die_offset = sizes.ReadDWARFOffset(&set);
+      if (die_offset == 0) {
+        break;
+      }
+      string_view name = ReadNullTerminated(&set);
+      types_[name].push_back({unit_offset, die_offset});
+    }
+  }
+  return !types_.empty();
+}
+
+void TypeIndex::ScanInfo() {
+  InfoReader reader(file_);
+  CUIter iter = reader.GetCUIter(InfoReader::Section::kDebugInfo);
+  CU cu;
+
+  while (iter.NextCU(reader, &cu)) {
+    uint64_t unit_offset =
+        static_cast<uint64_t>(cu.entire_unit().data() - file_.debug_info.data());
+    DIEReader die_reader = cu.GetDIEReader();
+    uint64_t die_offset = die_reader.unit_offset(cu);
+    while (auto abbrev = die_reader.ReadCode(cu)) {
+      bool is_type = abbrev->tag == DW_TAG_structure_type ||
+                     abbrev->tag == DW_TAG_union_type ||
+                     abbrev->tag == DW_TAG_class_type ||
+                     abbrev->tag == DW_TAG_enumeration_type;
+      if (is_type && abbrev->has_child) {
+        string_view name;
+        bool declaration = false;
+        die_reader.ReadAttributes(
+            cu, abbrev, [&](uint16_t tag, AttrValue value) {
+              if (tag == DW_AT_name && value.IsString()) {
+                name = value.GetString(cu);
+              } else if (tag == DW_AT_declaration) {
+                declaration = true;
+              }
+            });
+        // Only the first definition of a type is kept.
+        if (!name.empty() && !declaration) {
+          std::vector<Location>& locations = types_[name];
+          if (locations.empty()) {
+            locations.push_back({unit_offset, die_offset});
+          }
+        }
+      } else {
+        die_reader.ReadAttributes(cu, abbrev, [](uint16_t, AttrValue) {});
+      }
+      die_offset = die_reader.unit_offset(cu);
+    }
+  }
+}
+
+}  // namespace dwarf
@@ -0,0 +1,91 @@
+#ifndef SRC_QEMU_PLUGIN_DWARF_TYPE_INDEX_H_
+#define SRC_QEMU_PLUGIN_DWARF_TYPE_INDEX_H_
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "debug_info.h"
+
+// Index of the named types of .debug_info, to find the definition of a struct
+// without walking every DIE of every CU each time.
+//
+// Usage overview:
+//   dwarf::TypeIndex types(file);
+//   types.Build();
+//
+//   for (const dwarf::TypeIndex::Location& location : types.Find("task_struct")) {
+//     dwarf::InfoReader reader(file);
+//     dwarf::CU cu;
+//     dwarf::DIEReader die_reader = types.Seek(reader, location, &cu);
+//     const dwarf::AbbrevTable::Abbrev* abbrev = die_reader.ReadCode(cu);
+//     // ...
+//   }
+//
+//   std::optional<dwarf::TypeIndex::Member> pid =
+//       types.FindMember("task_struct", "pid");
+
+namespace dwarf {
+
+class TypeIndex {
+ public:
+  explicit TypeIndex(const File& file) : file_(file) {}
+  TypeIndex(const TypeIndex&) = delete;
+  TypeIndex& operator=(const TypeIndex&) = delete;
+
+  // Position of a DIE: its unit in .debug_info and its offset in the unit.
+  struct Location {
+    uint64_t unit_offset;
+    uint64_t die_offset;
+  };
+
+  // Uses .debug_pubtypes when present, otherwise indexes the complete
+  // definitions of all named types in a single pass over .debug_info.
+  void Build();
+
+  // Candidate DIEs for |name|. Entries coming from .debug_pubtypes may be
+  // declarations, callers have to skip DIEs without children. Names are views
+  // into the debug sections which must outlive the index.
+  const std::vector<Location>& Find(std::string_view name) const;
+
+  // Reads the header of the unit containing |location| into |cu| and returns a
+  // reader positioned on the DIE.
+  DIEReader Seek(InfoReader& reader, const Location& location, CU* cu) const;
+
+  // A member of a struct or union, as found by FindMember().
+  struct Member {
+    // From the start of the outer struct, through anonymous members.
+    uint64_t offset;
+    // The DIE of its type, when it has one.
+    std::optional<Location> type;
+    // Where the next member starts, or the end of the struct directly
+    // containing it, from the start of the outer struct.
+    uint64_t end;
+  };
+
+  // Looks for |member| in the first definition of the struct or union named
+  // |type| which has it, also inside its anonymous struct and union members.
+  // Members of types defined inline in it aren't considered.
+  std::optional<Member> FindMember(std::string_view type,
+                                   std::string_view member) const;
+
+  // Size of the type at |location|, through typedefs and qualifiers, or 0 when
+  // it has none (eg. arrays).
+  uint64_t TypeSize(const Location& location) const;
+
+  bool from_pubtypes() const { return from_pubtypes_; }
+
+ private:
+  bool ReadPubTypes();
+  void ScanInfo();
+
+  const File& file_;
+  bool from_pubtypes_ = false;
+  std::unordered_map<std::string_view, std::vector<Location>> types_;
+};
+
+}  // namespace dwarf
+
+#endif  // SRC_QEMU_PLUGIN_DWARF_TYPE_INDEX_H_
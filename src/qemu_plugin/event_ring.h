@@ -0,0 +1,73 @@
+#ifndef SRC_QEMU_PLUGIN_EVENT_RING_H_
+#define SRC_QEMU_PLUGIN_EVENT_RING_H_
+
+#include <cinttypes>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "symbolizer.h"
+
+// A call (function != 0) or a return (function == 0) observed by the tracer.
+struct tracing_event {
+  uint64_t ts;
+  uint64_t track_uuid;
+  FunctionId function;
+};
+
+// Single-producer single-consumer ring of events.
+//
+// The producer is the vCPU thread executing the guest code and the consumer is
+// the writer thread. Neither side takes a lock: the producer publishes events
+// by bumping m_head and the consumer releases slots by bumping m_tail. When
+// the ring is full the producer waits for the writer to catch up, which keeps
+// memory bounded.
+class EventRing {
+public:
+  static constexpr uint64_t kCapacity = 256 * 1024;
+  static_assert((kCapacity & (kCapacity - 1)) == 0,
+                "kCapacity must be a power of two");
+
+  EventRing() : m_events(new tracing_event[kCapacity]) {}
+
+  // Producer side.
+  inline void Push(const tracing_event &e) {
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_cachedTail == kCapacity) {
+      m_cachedTail = m_tail.load(std::memory_order_acquire);
+      while (head - m_cachedTail == kCapacity) {
+        std::this_thread::yield();
+        m_cachedTail = m_tail.load(std::memory_order_acquire);
+      }
+    }
+    m_events[head & (kCapacity - 1)] = e;
+    m_head.store(head + 1, std::memory_order_release);
+  }
+
+  // Consumer side: returns the number of readable events. Those can be read
+  // with At() until they are released with Pop().
+  inline uint64_t Available() const {
+    return m_head.load(std::memory_order_acquire) -
+           m_tail.load(std::memory_order_relaxed);
+  }
+  inline const tracing_event &At(uint64_t i) const {
+    return m_events[(m_tail.load(std::memory_order_relaxed) + i) &
+                    (kCapacity - 1)];
+  }
+  inline void Pop(uint64_t count) {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + count,
+                 std::memory_order_release);
+  }
+
+private:
+  std::unique_ptr<tracing_event[]> m_events;
+
+  // Written by the producer only.
+  alignas(64) std::atomic<uint64_t> m_head{0};
+  uint64_t m_cachedTail = 0;
+  // Written by the consumer only.
+  alignas(64) std::atomic<uint64_t> m_tail{0};
+};
+
+#endif  // SRC_QEMU_PLUGIN_EVENT_RING_H_
@@ -0,0 +1,102 @@
+#include "fake_qemu_api.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include "qemu_api.h"
+}
+
+namespace {
+
+struct FakeRegister {
+  const char *name;
+  uint64_t value;
+};
+
+FakeRegister registers[] = {{"gs_base", 0}, {"rsp", 0}, {"rbp", 0}};
+constexpr size_t kRegisterCount = sizeof(registers) / sizeof(registers[0]);
+bool log_output = false;
+
+}  // namespace
+
+namespace fake_qemu {
+
+void SetRegister(const char *name, uint64_t value) {
+  for (FakeRegister &reg : registers) {
+    if (strcmp(reg.name, name) == 0) {
+      reg.value = value;
+      return;
+    }
+  }
+  fprintf(stderr, "Unknown fake register %s\n", name);
+  abort();
+}
+
+void SetLogOutput(bool enabled) {
+  log_output = enabled;
+}
+
+}  // namespace fake_qemu
+
+extern "C" {
+
+void qemu_plugin_outs(const char *str) {
+  if (log_output)
+    fputs(str, stderr);
+}
+
+GLibArray *g_byte_array_new(void) {
+  return static_cast<GLibArray *>(calloc(1, sizeof(GLibArray)));
+}
+
+void *g_byte_array_free(GLibArray *array, bool free_segment) {
+  char *data = array->data;
+  free(array);
+  if (free_segment) {
+    free(data);
+    return nullptr;
+  }
+  return data;
+}
+
+GLibArray *g_byte_array_set_size(GLibArray *array, unsigned int length) {
+  if (length > array->len)
+    array->data = static_cast<char *>(realloc(array->data, length));
+  array->len = length;
+  return array;
+}
+
+// Like QEMU's, the array itself is freed by the caller but not its data
+GLibArray *qemu_plugin_get_registers(void) {
+  static qemu_reg_descriptor descriptors[kRegisterCount];
+  for (size_t i = 0; i < kRegisterCount; i++) {
+    descriptors[i].handle = reinterpret_cast<qemu_reg *>(&registers[i]);
+    descriptors[i].name = registers[i].name;
+    descriptors[i].feature = "org.gnu.gdb.i386.core";
+  }
+  GLibArray *array = static_cast<GLibArray *>(malloc(sizeof(GLibArray)));
+  array->data = reinterpret_cast<char *>(descriptors);
+  array->len = kRegisterCount;
+  return array;
+}
+
+int qemu_plugin_read_register(qemu_reg *handle, GLibArray *buf) {
+  const FakeRegister *reg = reinterpret_cast<const FakeRegister *>(handle);
+  unsigned int offset = buf->len;
+  g_byte_array_set_size(buf, offset + sizeof(reg->value));
+  memcpy(buf->data + offset, &reg->value, sizeof(reg->value));
+  return sizeof(reg->value);
+}
+
+bool qemu_plugin_read_memory_vaddr(uint64_t addr, void *data, size_t len) {
+  if (!addr)
+    return false;
+  GLibArray *buf = static_cast<GLibArray *>(data);
+  g_byte_array_set_size(buf, static_cast<unsigned int>(len));
+  memcpy(buf->data, reinterpret_cast<const void *>(addr), len);
+  return true;
+}
+
+}  // extern "C"
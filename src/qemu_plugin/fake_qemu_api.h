@@ -0,0 +1,18 @@
+#ifndef SRC_QEMU_PLUGIN_FAKE_QEMU_API_H_
+#define SRC_QEMU_PLUGIN_FAKE_QEMU_API_H_
+
+#include <cinttypes>
+
+// Implements the part of qemu_api.h the tracer uses, so that it can run
+// outside of QEMU, e.g. in benchmarks. Guest virtual addresses are host
+// addresses and the registers of the only vCPU are whatever got set here.
+namespace fake_qemu {
+
+// Sets an x86_64 register: gs_base, rsp or rbp.
+void SetRegister(const char *name, uint64_t value);
+// Plugin output is discarded unless enabled.
+void SetLogOutput(bool enabled);
+
+}  // namespace fake_qemu
+
+#endif  // SRC_QEMU_PLUGIN_FAKE_QEMU_API_H_
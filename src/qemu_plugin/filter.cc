@@ -0,0 +1,179 @@
+#include "filter.h"
+
+#include <optional>
+
+#include "dejaview/ext/base/string_splitter.h"
+#include "dejaview/ext/base/string_utils.h"
+#include "src/trace_processor/util/glob.h"
+
+#include "qemu_helpers.h"
+#include "vmi.h"
+
+using dejaview::trace_processor::util::GlobMatcher;
+
+static GlobMatcher MatcherOf(const std::string &pattern) {
+  return GlobMatcher::FromPattern(dejaview::base::StringView(pattern));
+}
+
+bool Filter::Parse(const std::string &spec) {
+  for (dejaview::base::StringSplitter splitter(spec, ';'); splitter.Next();) {
+    if (!ParseClause(splitter.cur_token())) {
+      QEMU_LOG() << "Bad filter clause: " << splitter.cur_token() << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Filter::ParseClause(const std::string &clause) {
+  size_t colon = clause.find(':');
+  if (colon == std::string::npos)
+    return false;
+  std::string key = clause.substr(0, colon);
+  std::string value = clause.substr(colon + 1);
+  bool negated = !key.empty() && key[0] == '!';
+  if (negated)
+    key = key.substr(1);
+  if (value.empty())
+    return false;
+
+  if (key == "func" || key == "file") {
+    m_functionClauses.push_back(Clause{key == "func" ? kFunc : kFile, negated,
+                                       MatcherOf(value), 0});
+    m_hasCodeClauses |= !negated;
+    m_hasFunctionClauses |= !negated;
+  } else if (key == "addr") {
+    size_t dash = value.find('-');
+    if (dash == std::string::npos)
+      return false;
+    // Base 0 accepts both decimal and 0x prefixed addresses
+    std::optional<uint64_t> start =
+        dejaview::base::StringToUInt64(value.substr(0, dash), 0);
+    std::optional<uint64_t> end =
+        dejaview::base::StringToUInt64(value.substr(dash + 1), 0);
+    if (!start || !end || *start >= *end)
+      return false;
+    m_ranges.push_back(AddressRange{*start, *end, negated});
+    m_hasCodeClauses |= !negated;
+  } else if (key == "pid") {
+    std::optional<uint64_t> pid = dejaview::base::StringToUInt64(value);
+    if (!pid)
+      return false;
+    m_tasks.push_back(Clause{kPid, negated, std::nullopt, *pid});
+  } else if (key == "comm") {
+    m_tasks.push_back(Clause{kComm, negated, MatcherOf(value), 0});
+  } else if (negated) {
+    // The remaining clauses have nothing to negate
+    return false;
+  } else if (key == "space") {
+    if (value == "kernel")
+      m_space = kKernel;
+    else if (value == "user")
+      m_space = kUser;
+    else
+      return false;
+  } else if (key == "max_depth") {
+    std::optional<uint64_t> depth = dejaview::base::StringToUInt64(value);
+    if (!depth)
+      return false;
+    m_maxDepth = static_cast<size_t>(*depth);
+  } else if (key == "ignore_below") {
+    m_functionClauses.push_back(
+        Clause{kIgnoreBelowFunc, false, MatcherOf(value), 0});
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void Filter::Compile(Symbolizer &symbolizer) {
+  if (m_functionClauses.empty())
+    return;
+
+  // Addresses without symbols are only ever matched by addr clauses
+  m_functions.assign(symbolizer.symbolCount() + 1, 0);
+  std::string name, filename;
+  int line;
+  for (FunctionId id = 1; id < m_functions.size(); id++) {
+    symbolizer.describeFunction(id, name, filename, line);
+    m_functions[id] = MatchFunction(name, filename);
+  }
+  m_symbolizer = &symbolizer;
+  m_lazyFlags = std::make_unique<LazyFlagTable>();
+}
+
+uint8_t Filter::MatchFunction(const std::string &name,
+                              const std::string &filename) const {
+  uint8_t flags = 0;
+  for (const Clause &clause : m_functionClauses) {
+    const std::string &subject = clause.kind == kFile ? filename : name;
+    if (!clause.matcher->Matches(dejaview::base::StringView(subject)))
+      continue;
+    if (clause.kind == kIgnoreBelowFunc)
+      flags |= kIgnoreBelow;
+    else
+      flags |= clause.negated ? kExcluded : kIncluded;
+  }
+  return flags;
+}
+
+bool Filter::IncludesFunctionSlow(FunctionId interned, FunctionId resolved) {
+  uint8_t flags = LazyFlags(resolved);
+  if (flags & kExcluded)
+    return false;
+  if (!m_hasFunctionClauses || (flags & kIncluded))
+    return true;
+  // Still traced if IncludesCode() matched the block to an addr clause
+  return LazyFlags(interned) & kIncluded;
+}
+
+uint8_t Filter::Classify(FunctionId function) {
+  uint64_t address;
+  if (m_symbolizer->unknownAddress(function, &address)) {
+    uint8_t flags = kClassified;
+    for (const AddressRange &range : m_ranges) {
+      if (address >= range.start && address < range.end)
+        flags |= range.negated ? kExcluded : kIncluded;
+    }
+    return flags;
+  }
+  std::string name, filename;
+  int line;
+  m_symbolizer->describeFunction(function, name, filename, line);
+  return kClassified | MatchFunction(name, filename);
+}
+
+Filter::LazyFlagTable::~LazyFlagTable() {
+  for (std::atomic<std::atomic<uint8_t> *> &chunk : m_chunks)
+    delete[] chunk.load(std::memory_order_relaxed);
+}
+
+std::atomic<uint8_t> *Filter::LazyFlagTable::AllocateChunk(size_t index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::atomic<uint8_t> *chunk = m_chunks[index].load(std::memory_order_relaxed);
+  if (!chunk) {
+    chunk = new std::atomic<uint8_t>[kChunkSize]();
+    m_chunks[index].store(chunk, std::memory_order_release);
+  }
+  return chunk;
+}
+
+bool Filter::IncludesTask(const TaskInfo &task) const {
+  bool included = true;
+  for (const Clause &clause : m_tasks) {
+    if (!clause.negated)
+      included = false;
+  }
+  for (const Clause &clause : m_tasks) {
+    bool matches;
+    if (clause.kind == kPid) {
+      matches = clause.pid == task.pid || clause.pid == task.tgid;
+    } else {
+      matches = clause.matcher->Matches(dejaview::base::StringView(task.comm));
+    }
+    if (matches && clause.negated)
+      return false;
+    included |= matches;
+  }
+  return included;
+}
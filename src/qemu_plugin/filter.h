@@ -0,0 +1,178 @@
+#ifndef SRC_QEMU_PLUGIN_FILTER_H_
+#define SRC_QEMU_PLUGIN_FILTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "src/trace_processor/util/glob.h"
+#include "symbolizer.h"
+
+struct TaskInfo;
+
+// Decides what gets traced, from the filter= arguments of the plugin.
+//
+// A spec is a list of clauses separated by ';':
+//   func:<glob>          code of the functions whose name matches
+//   file:<glob>          code of the functions declared in a matching file
+//   addr:<start>-<end>   code between two addresses, end excluded
+//   space:kernel|user    only code of that address space
+//   pid:<pid>            tasks with that pid or tgid
+//   comm:<glob>          tasks whose name matches
+//   max_depth:<n>        no slices nested deeper than n
+//   ignore_below:<glob>  no slices under the functions whose name matches
+// func, file, addr, pid and comm clauses can be negated with a leading '!'.
+// Code (or a task) is traced if it matches any clause of its kind, or there is
+// none, and no negated one.
+//
+// Code clauses are resolved once per function by Compile() so that checking a
+// translation block is a lookup. Excluded blocks get no callbacks at all.
+// Userspace code is only interned by address at translation time, its symbol
+// depends on the process running it (see UserSymbols): func, file and
+// ignore_below clauses are matched against userspace functions the first time
+// they run instead.
+class Filter {
+public:
+  Filter() {}
+
+  // Adds the clauses of |spec|. Returns false and logs why on syntax errors.
+  bool Parse(const std::string &spec);
+  // Must be called once the symbols are loaded, before any other method.
+  // |symbolizer| must outlive the Filter.
+  void Compile(Symbolizer &symbolizer);
+
+  bool IncludesCode(uint64_t address, FunctionId function) const {
+    if (m_space != kAnySpace && IsKernelAddress(address) != (m_space == kKernel))
+      return false;
+    uint8_t flags = function < m_functions.size() ? m_functions[function] : 0;
+    if (flags & kExcluded)
+      return false;
+    // Userspace code which may match func or file clauses once resolved is
+    // checked by IncludesFunction() when it runs
+    bool deferred = m_hasFunctionClauses && function >= m_functions.size() &&
+                    !IsKernelAddress(address);
+    bool included = !m_hasCodeClauses || (flags & kIncluded) || deferred;
+    for (const AddressRange &range : m_ranges) {
+      if (address >= range.start && address < range.end) {
+        if (range.negated)
+          return false;
+        included = true;
+      }
+    }
+    return included;
+  }
+  // Whether a call into code interned as |interned| at translation time,
+  // which resolved to |resolved| in the process running it, passes the func
+  // and file clauses. Only userspace functions weren't already checked by
+  // IncludesCode().
+  bool IncludesFunction(FunctionId interned, FunctionId resolved) {
+    return !m_lazyFlags || interned < m_functions.size() ||
+           IncludesFunctionSlow(interned, resolved);
+  }
+  bool IgnoresBelow(FunctionId function) {
+    if (function < m_functions.size())
+      return m_functions[function] & kIgnoreBelow;
+    return m_lazyFlags && (LazyFlags(function) & kIgnoreBelow);
+  }
+
+  bool HasTaskClauses() const { return !m_tasks.empty(); }
+  bool IncludesTask(const TaskInfo &task) const;
+
+  size_t max_depth() const { return m_maxDepth; }
+
+private:
+  enum Space { kAnySpace, kKernel, kUser };
+  enum FunctionFlags : uint8_t {
+    kIncluded = 1 << 0,
+    kExcluded = 1 << 1,
+    kIgnoreBelow = 1 << 2,
+    // Set once a function past the kernel symbols got its flags
+    kClassified = 1 << 7,
+  };
+  enum ClauseKind { kFunc, kFile, kIgnoreBelowFunc, kPid, kComm };
+
+  struct Clause {
+    ClauseKind kind;
+    bool negated;
+    // Compiled once by Parse(), for all but pid clauses
+    std::optional<dejaview::trace_processor::util::GlobMatcher> matcher;
+    uint64_t pid;
+  };
+  struct AddressRange {
+    uint64_t start;
+    uint64_t end;
+    bool negated;
+  };
+
+  // FunctionFlags of the functions past the kernel symbols, indexed by
+  // FunctionId. Chunks are allocated as IDs get used and never move, so that
+  // vCPU threads read them without locking.
+  class LazyFlagTable {
+  public:
+    LazyFlagTable() = default;
+    ~LazyFlagTable();
+
+    std::atomic<uint8_t> &operator[](FunctionId function) {
+      std::atomic<uint8_t> *chunk =
+          m_chunks[function >> kChunkBits].load(std::memory_order_acquire);
+      if (!chunk)
+        chunk = AllocateChunk(function >> kChunkBits);
+      return chunk[function & (kChunkSize - 1)];
+    }
+
+  private:
+    static constexpr unsigned kChunkBits = 20;
+    static constexpr size_t kChunkSize = size_t(1) << kChunkBits;
+    static constexpr size_t kChunks = size_t(1) << (32 - kChunkBits);
+
+    std::atomic<uint8_t> *AllocateChunk(size_t index);
+
+    std::mutex m_mutex;
+    std::atomic<std::atomic<uint8_t> *> m_chunks[kChunks] = {};
+  };
+
+  // Both x86_64 and aarch64 map the kernel in the upper half
+  static bool IsKernelAddress(uint64_t address) { return address >> 63; }
+
+  bool ParseClause(const std::string &clause);
+  // Returns the flags given to a function by func, file and ignore_below
+  // clauses.
+  uint8_t MatchFunction(const std::string &name,
+                        const std::string &filename) const;
+  bool IncludesFunctionSlow(FunctionId interned, FunctionId resolved);
+  // Flags of |function| past the kernel symbols, matched the first time.
+  uint8_t LazyFlags(FunctionId function) {
+    std::atomic<uint8_t> &slot = (*m_lazyFlags)[function];
+    uint8_t flags = slot.load(std::memory_order_relaxed);
+    if (!(flags & kClassified)) {
+      // Racing threads compute the same flags
+      flags = Classify(function);
+      slot.store(flags, std::memory_order_relaxed);
+    }
+    return flags;
+  }
+  uint8_t Classify(FunctionId function);
+
+  std::vector<Clause> m_functionClauses;
+  std::vector<Clause> m_tasks;
+  std::vector<AddressRange> m_ranges;
+  bool m_hasCodeClauses = false;
+  // Whether there are func or file clauses which aren't negated
+  bool m_hasFunctionClauses = false;
+  Space m_space = kAnySpace;
+  size_t m_maxDepth = std::numeric_limits<size_t>::max();
+
+  // FunctionFlags of the kernel symbols indexed by FunctionId, filled by
+  // Compile()
+  std::vector<uint8_t> m_functions;
+  // Only when there are func, file or ignore_below clauses
+  Symbolizer *m_symbolizer = nullptr;
+  std::unique_ptr<LazyFlagTable> m_lazyFlags;
+};
+
+#endif  // SRC_QEMU_PLUGIN_FILTER_H_
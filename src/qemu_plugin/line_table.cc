@@ -0,0 +1,228 @@
+#include "line_table.h"
+
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+#include "dejaview/ext/base/threading/thread_pool.h"
+
+#include "dwarf/debug_info.h"
+#include "dwarf/line_info.h"
+
+#include "qemu_helpers.h"
+#include "symbol_cache.h"
+
+using namespace dwarf2reader;
+
+// Rows decoded from a single unit, files are local to the unit.
+struct LineTable::Unit {
+  std::vector<Row> rows;
+  std::vector<Row> functions;
+  std::vector<std::string> files;
+};
+
+void LineTable::DecodeUnit(const dwarf::File &dwarf, uint64_t offset,
+                           Unit *out) {
+  dwarf::InfoReader info_reader(dwarf, /*skeleton=*/nullptr);
+  dwarf::CUIter iter =
+      info_reader.GetCUIter(dwarf::InfoReader::Section::kDebugInfo, offset);
+  dwarf::CU cu;
+  if (!iter.NextCU(info_reader, &cu) || !cu.stmt_list())
+    return;
+
+  dwarf::LineInfoReader line_reader(dwarf);
+  line_reader.SeekToOffset(*cu.stmt_list(), cu.unit_sizes().address_size());
+
+  // Maps file indices of the unit to indices in out->files
+  std::vector<uint32_t> file_ids;
+  auto intern_file = [&](uint32_t index) {
+    if (index >= file_ids.size())
+      file_ids.resize(index + 1, kNoFile);
+    if (file_ids[index] == kNoFile) {
+      file_ids[index] = static_cast<uint32_t>(out->files.size());
+      out->files.push_back(line_reader.GetExpandedFilename(index));
+    }
+    return file_ids[index];
+  };
+
+  while (line_reader.ReadLineInfo()) {
+    const dwarf::LineInfoReader::LineInfo &info = line_reader.lineinfo();
+    uint32_t file = info.end_sequence ? kNoFile : intern_file(info.file);
+    out->rows.push_back({info.address, file, info.line});
+  }
+
+  // Concrete functions, their decl_file indexes the same file table
+  dwarf::DIEReader die_reader = cu.GetDIEReader();
+  while (auto abbrev = die_reader.ReadCode(cu)) {
+    if (abbrev->tag != DW_TAG_subprogram) {
+      die_reader.ReadAttributes(cu, abbrev, [](uint16_t, dwarf::AttrValue) {});
+      continue;
+    }
+    std::optional<uint64_t> low_pc, decl_file, decl_line;
+    die_reader.ReadAttributes(
+        cu, abbrev, [&](uint16_t tag, dwarf::AttrValue value) {
+          switch (tag) {
+            case DW_AT_low_pc:
+              if (value.IsUint())
+                low_pc = value.GetUint(cu);
+              break;
+            case DW_AT_decl_file:
+              decl_file = value.ToUint(cu);
+              break;
+            case DW_AT_decl_line:
+              decl_line = value.ToUint(cu);
+              break;
+          }
+        });
+    // File 0 only exists from DWARF 5 onwards
+    bool has_file = decl_file && (*decl_file || cu.unit_sizes().dwarf_version() >= 5);
+    if (low_pc && *low_pc && has_file && decl_line) {
+      out->functions.push_back({*low_pc,
+                                intern_file(static_cast<uint32_t>(*decl_file)),
+                                static_cast<uint32_t>(*decl_line)});
+    }
+  }
+}
+
+void LineTable::Build(const dwarf::File &dwarf) {
+  if (dwarf.debug_info.empty() || dwarf.debug_line.empty())
+    return;
+
+  // Only the unit headers are read here, the units themselves are the bulk
+  std::vector<uint64_t> offsets;
+  {
+    dwarf::InfoReader reader(dwarf, /*skeleton=*/nullptr);
+    dwarf::CUIter iter = reader.GetCUIter(dwarf::InfoReader::Section::kDebugInfo);
+    dwarf::CU cu;
+    while (iter.NextCU(reader, &cu)) {
+      if (cu.stmt_list())
+        offsets.push_back(static_cast<uint64_t>(cu.entire_unit().data() -
+                                                dwarf.debug_info.data()));
+    }
+  }
+
+  std::vector<Unit> units(offsets.size());
+  uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+  thread_count = std::min(thread_count, static_cast<uint32_t>(units.size()));
+  {
+    dejaview::base::ThreadPool pool(thread_count);
+    pool.RunAndWait(units.size(), [&](size_t u) {
+      DecodeUnit(dwarf, offsets[u], &units[u]);
+    });
+  }
+
+  // Merge all units, interning file names across them
+  std::unordered_map<std::string, uint32_t> file_ids;
+  size_t row_count = 0, function_count = 0;
+  for (const Unit &unit : units) {
+    row_count += unit.rows.size();
+    function_count += unit.functions.size();
+  }
+  m_rows.reserve(row_count);
+  m_functions.reserve(function_count);
+  for (Unit &unit : units) {
+    std::vector<uint32_t> global_ids;
+    global_ids.reserve(unit.files.size());
+    for (std::string &file : unit.files) {
+      auto it = file_ids.find(file);
+      if (it == file_ids.end()) {
+        it = file_ids.emplace(file, static_cast<uint32_t>(m_files.size())).first;
+        m_files.push_back(std::move(file));
+      }
+      global_ids.push_back(it->second);
+    }
+    for (Row row : unit.rows) {
+      if (row.file != kNoFile)
+        row.file = global_ids[row.file];
+      m_rows.push_back(row);
+    }
+    for (Row row : unit.functions) {
+      row.file = global_ids[row.file];
+      m_functions.push_back(row);
+    }
+    unit = Unit();
+  }
+
+  // A sequence starting where another one ends has to win over its end
+  std::sort(m_rows.begin(), m_rows.end(), [](const Row &a, const Row &b) {
+    if (a.address != b.address)
+      return a.address < b.address;
+    return a.file == kNoFile && b.file != kNoFile;
+  });
+  size_t out = 0;
+  for (const Row &row : m_rows) {
+    if (out > 0 && m_rows[out - 1].address == row.address) {
+      m_rows[out - 1] = row;
+      continue;
+    }
+    if (out > 0 && m_rows[out - 1].file == row.file &&
+        m_rows[out - 1].line == row.line)
+      continue;
+    m_rows[out++] = row;
+  }
+  m_rows.resize(out);
+  m_rows.shrink_to_fit();
+
+  std::sort(m_functions.begin(), m_functions.end(),
+            [](const Row &a, const Row &b) { return a.address < b.address; });
+
+  QEMU_LOG() << "Indexed " << m_rows.size() << " lines and "
+             << m_functions.size() << " functions from " << units.size()
+             << " compilation units" << std::endl;
+}
+
+bool LineTable::Lookup(uint64_t address, std::string &filename,
+                       int &line_number) const {
+  auto it = std::upper_bound(
+      m_rows.begin(), m_rows.end(), address,
+      [](uint64_t addr, const Row &row) { return addr < row.address; });
+  if (it == m_rows.begin())
+    return false;
+  --it;
+  if (it->file == kNoFile)
+    return false;
+  filename = m_files[it->file];
+  line_number = static_cast<int>(it->line);
+  return true;
+}
+
+bool LineTable::LookupFunction(uint64_t address, std::string &filename,
+                               int &line_number) const {
+  auto it = std::lower_bound(
+      m_functions.begin(), m_functions.end(), address,
+      [](const Row &row, uint64_t addr) { return row.address < addr; });
+  if (it == m_functions.end() || it->address != address)
+    return Lookup(address, filename, line_number);
+  filename = m_files[it->file];
+  line_number = static_cast<int>(it->line);
+  return true;
+}
+
+bool LineTable::Load(SymbolCache &cache) {
+  std::vector<Row> rows, functions;
+  std::vector<char> files;
+  if (!cache.Read(&rows) || !cache.Read(&functions) || !cache.Read(&files))
+    return false;
+  m_rows = std::move(rows);
+  m_functions = std::move(functions);
+  m_files.clear();
+  for (size_t start = 0; start < files.size();) {
+    size_t end = start;
+    while (end < files.size() && files[end])
+      end++;
+    m_files.emplace_back(&files[start], end - start);
+    start = end + 1;
+  }
+  return true;
+}
+
+void LineTable::Save(SymbolCache &cache) const {
+  std::vector<char> files;
+  for (const std::string &file : m_files) {
+    files.insert(files.end(), file.begin(), file.end());
+    files.push_back('\0');
+  }
+  cache.Append(m_rows);
+  cache.Append(m_functions);
+  cache.Append(files);
+}
@@ -0,0 +1,50 @@
+#ifndef SRC_QEMU_PLUGIN_LINE_TABLE_H_
+#define SRC_QEMU_PLUGIN_LINE_TABLE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class SymbolCache;
+namespace dwarf {
+struct File;
+}
+
+// Address to source location index built from the DWARF of all compilation
+// units. Units are decoded in parallel and merged into arrays sorted by
+// address, file names are stored once.
+class LineTable {
+public:
+  LineTable() {}
+
+  void Build(const dwarf::File &dwarf);
+  bool Load(SymbolCache &cache);
+  void Save(SymbolCache &cache) const;
+
+  // Location of the line containing |address|, from .debug_line. Thread-safe.
+  bool Lookup(uint64_t address, std::string &filename, int &line_number) const;
+  // Location of the declaration of the function starting at |address|, from
+  // .debug_info, or of the line at |address| otherwise. Thread-safe.
+  bool LookupFunction(uint64_t address, std::string &filename,
+                      int &line_number) const;
+
+private:
+  // Marks the end of a sequence, addresses past it have no line information.
+  static constexpr uint32_t kNoFile = UINT32_MAX;
+
+  struct Row {
+    uint64_t address;
+    uint32_t file;
+    uint32_t line;
+  };
+
+  struct Unit;
+  static void DecodeUnit(const dwarf::File &dwarf, uint64_t offset, Unit *out);
+
+  // Only rows where the location changes are kept.
+  std::vector<Row> m_rows;
+  std::vector<Row> m_functions;
+  std::vector<std::string> m_files;
+};
+
+#endif  // SRC_QEMU_PLUGIN_LINE_TABLE_H_
@@ -32,6 +32,7 @@ struct GLibArray {
 };
 extern GLibArray *g_byte_array_new(void);
 extern void *g_byte_array_free(GLibArray *array, bool free);
+extern GLibArray *g_byte_array_set_size(GLibArray *array, unsigned int length);
 
 // Register reading
 struct qemu_reg;
@@ -101,6 +102,42 @@ extern void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu
     (struct qemu_insn *insn, enum qemu_plugin_op op,
      qemu_plugin_u64 entry, uint64_t imm);
 
+// Memory access callback
+typedef uint32_t qemu_meminfo_t;
+
+enum qemu_mem_rw {
+    QEMU_MEM_R = 1, QEMU_MEM_W, QEMU_MEM_RW,
+};
+
+extern void qemu_plugin_register_vcpu_mem_cb
+    (struct qemu_insn *insn,
+     void (*cb)(unsigned int vcpu_id, qemu_meminfo_t info, uint64_t vaddr,
+                void *userdata),
+     enum qemu_cb_flags flags, enum qemu_mem_rw rw, void *userdata);
+
+enum qemu_mem_value_type {
+    QEMU_MEM_VALUE_U8, QEMU_MEM_VALUE_U16, QEMU_MEM_VALUE_U32,
+    QEMU_MEM_VALUE_U64, QEMU_MEM_VALUE_U128,
+};
+
+typedef struct {
+    enum qemu_mem_value_type type;
+    union {
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        struct {
+            uint64_t low;
+            uint64_t high;
+        } u128;
+    } data;
+} qemu_mem_value;
+
+extern unsigned int qemu_plugin_mem_size_shift(qemu_meminfo_t info);
+extern bool qemu_plugin_mem_is_store(qemu_meminfo_t info);
+extern qemu_mem_value qemu_plugin_mem_get_value(qemu_meminfo_t info);
+
 // Plugin exit callbacks
 extern void qemu_plugin_register_atexit_cb
     (uint64_t id, void (*cb)(uint64_t id, void *userdata), void *userdata);
@@ -27,3 +27,68 @@ qemu_reg *get_gs_base_handle(void) {
     ret = get_reg_handle("gs_base");
   return ret;
 }
+
+qemu_reg *get_sp_handle(void) {
+  static qemu_reg *ret = nullptr;
+  // x86_64 calls it rsp, aarch64 sp
+  if (!ret)
+    ret = get_reg_handle("rsp");
+  if (!ret)
+    ret = get_reg_handle("sp");
+  return ret;
+}
+
+qemu_reg *get_fp_handle(void) {
+  static qemu_reg *ret = nullptr;
+  // x86_64 calls it rbp, aarch64 x29
+  if (!ret)
+    ret = get_reg_handle("rbp");
+  if (!ret)
+    ret = get_reg_handle("x29");
+  return ret;
+}
+
+qemu_reg *get_lr_handle(void) {
+  static qemu_reg *ret = get_reg_handle("x30");
+  return ret;
+}
+
+static uint64_t read_register(qemu_reg *handle) {
+  // Read on every call and ret, so the buffer is reused
+  static thread_local GLibArray *reg = g_byte_array_new();
+  uint64_t value = 0;
+
+  g_byte_array_set_size(reg, 0);
+  if (!handle || qemu_plugin_read_register(handle, reg) < 0)
+    return 0;
+  memcpy(&value, reg->data, sizeof(value));
+  return value;
+}
+
+uint64_t read_stack_pointer(void) {
+  return read_register(get_sp_handle());
+}
+
+uint64_t read_frame_pointer(void) {
+  return read_register(get_fp_handle());
+}
+
+uint64_t read_entry_return_address(void) {
+  // aarch64 calls leave it in the link register, x86_64 calls push it
+  if (qemu_reg *lr = get_lr_handle())
+    return read_register(lr);
+  uint64_t ret = 0;
+  if (!read_memory(read_stack_pointer(), &ret, sizeof(ret)))
+    return 0;
+  return ret;
+}
+
+bool read_memory(uint64_t addr, void *data, size_t size) {
+  static thread_local GLibArray *buf = g_byte_array_new();
+
+  g_byte_array_set_size(buf, 0);
+  if (!qemu_plugin_read_memory_vaddr(addr, buf, size))
+    return false;
+  memcpy(data, buf->data, size);
+  return true;
+}
@@ -23,5 +23,21 @@ private:
 };
 
 qemu_reg *get_gs_base_handle(void);
+qemu_reg *get_sp_handle(void);
+qemu_reg *get_fp_handle(void);
+// Only aarch64 has a link register, returns nullptr elsewhere.
+qemu_reg *get_lr_handle(void);
+
+// Reads the stack pointer of the current vCPU. Must be called from a callback
+// registered with QEMU_CB_R_REGS.
+uint64_t read_stack_pointer(void);
+// Same for the frame pointer.
+uint64_t read_frame_pointer(void);
+// Reads where the function the vCPU just entered will return, before its
+// prologue ran. Same requirements.
+uint64_t read_entry_return_address(void);
+
+// Reads |size| bytes of guest virtual memory, from a vCPU thread.
+bool read_memory(uint64_t addr, void *data, size_t size);
 
 #endif  // SRC_QEMU_PLUGIN_QEMU_HELPERS_H_
@@ -1,10 +1,15 @@
 #include "dejaview/ext/base/string_utils.h"
 
+#include <cstdlib>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "disassembler.h"
+#include "filter.h"
 #include "qemu_helpers.h"
 #include "tracer.h"
+#include "watchpoints.h"
 
 extern "C" {
 #include "qemu_api.h"
@@ -18,48 +23,202 @@ __attribute__((visibility("default"))) int qemu_plugin_version = 4;
 static Disassembler *disassembler;
 static Tracer *tracer;
 
+// What the last instruction of the previous block was, if it leads to a slice
+enum LastInsn : uint64_t {
+  kLastInsnOther = 0,
+  kLastInsnCall,
+  kLastInsnInterrupt,
+};
+
 // This keeps per-CPU counters to:
 // - Count instructions
-// - Remember if the previous instruction was a call
+// - Remember if the previous instruction was a call or an interrupt
+// - Count instructions since the last sample, in sampling mode
 typedef struct {
   uint64_t insn_count;
   uint64_t last_insn_is_call;
+  uint64_t since_sample;
 } CpuScoreboard;
 static struct qemu_scoreboard* cpu_sb;
 static qemu_plugin_u64 insn_count;
 static qemu_plugin_u64 last_insn_is_call;
+static qemu_plugin_u64 since_sample;
+
+// Sampling mode takes a sample every this many instructions
+static uint64_t sample_period;
+static constexpr uint64_t kDefaultSamplePeriod = 1000000;
 
 // When landing somewhere after a call, log the instruction
 static void log_call_landing(unsigned int vcpu_id, void* udata) {
   // Reset the last instruction's type
-  qemu_plugin_u64_set(last_insn_is_call, vcpu_id, 0);
+  uint64_t last_insn = qemu_plugin_u64_get(last_insn_is_call, vcpu_id);
+  qemu_plugin_u64_set(last_insn_is_call, vcpu_id, kLastInsnOther);
 
   // Use the number of executed instructions as "timestamp"
   uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
 
-  // And fill it with information depending on whether it's a call or ret
-  uint64_t addr = *(static_cast<uint64_t *>(udata));
-  tracer->LogCall(addr, vcpu_id, ts);
+  // The landing function was resolved at translation time
+  FunctionId function = static_cast<FunctionId>(reinterpret_cast<uintptr_t>(udata));
+  if (last_insn == kLastInsnInterrupt)
+    tracer->LogException(function, vcpu_id, ts, read_stack_pointer());
+  else
+    tracer->LogCall(function, vcpu_id, ts, read_stack_pointer());
+}
+
+// When entering the scheduler's task switch, left out by the filter
+static void log_task_switch(unsigned int vcpu_id, void* udata) {
+  qemu_plugin_u64_set(last_insn_is_call, vcpu_id, kLastInsnOther);
+  uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
+  FunctionId function = static_cast<FunctionId>(reinterpret_cast<uintptr_t>(udata));
+  tracer->LogTaskSwitch(function, vcpu_id, ts);
 }
 
 // When returning from somewhere, close the slice we opened earlier
 static void log_ret(unsigned int vcpu_id, void* /*udata*/) {
   uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
-  tracer->LogRet(vcpu_id, ts);
+  tracer->LogRet(vcpu_id, ts, read_stack_pointer());
+}
+
+// When returning from an exception, close its slice
+static void log_exception_return(unsigned int vcpu_id, void* /*udata*/) {
+  uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
+  tracer->LogExceptionReturn(vcpu_id, ts);
+}
+
+// When jumping to the start of a function, it may be a tail call
+static void log_tail_call(unsigned int vcpu_id, void* udata) {
+  uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
+  FunctionId function = static_cast<FunctionId>(reinterpret_cast<uintptr_t>(udata));
+  tracer->LogTailCall(function, vcpu_id, ts, read_stack_pointer());
+}
+
+// Every sample_period instructions, sample what the vCPU is running
+static void log_sample(unsigned int vcpu_id, void* udata) {
+  qemu_plugin_u64_set(since_sample, vcpu_id, 0);
+  uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
+  // Samples of excluded code are dropped, rather than deferred to the next
+  // traced block which would skew the profile
+  uint64_t addr = reinterpret_cast<uintptr_t>(udata);
+  if (addr)
+    tracer->LogSample(addr, vcpu_id, ts);
+}
+
+// When an instruction which can touch a watched range accessed memory
+static void log_watch_hit(unsigned int vcpu_id, qemu_meminfo_t info,
+                          uint64_t vaddr, void* udata) {
+  uint64_t ts = qemu_plugin_u64_get(insn_count, vcpu_id);
+  // The watch and the function of the instruction were packed at translation
+  uint64_t packed = reinterpret_cast<uintptr_t>(udata);
+  FunctionId function = static_cast<FunctionId>(packed >> 32);
+  size_t watch = static_cast<size_t>(packed & 0xffffffff);
+
+  qemu_mem_value mem_value = qemu_plugin_mem_get_value(info);
+  uint64_t value = 0;
+  switch (mem_value.type) {
+    case QEMU_MEM_VALUE_U8:
+      value = mem_value.data.u8;
+      break;
+    case QEMU_MEM_VALUE_U16:
+      value = mem_value.data.u16;
+      break;
+    case QEMU_MEM_VALUE_U32:
+      value = mem_value.data.u32;
+      break;
+    case QEMU_MEM_VALUE_U64:
+      value = mem_value.data.u64;
+      break;
+    case QEMU_MEM_VALUE_U128:
+      value = mem_value.data.u128.low;
+      break;
+  }
+  tracer->LogWatchHit(watch, function, vcpu_id, ts, vaddr,
+                      1ull << qemu_plugin_mem_size_shift(info), value,
+                      qemu_plugin_mem_is_store(info));
+}
+
+// Only the instructions of |tb| with a memory operand which can touch a
+// watched range get a memory callback, everything else runs at full speed.
+static void register_watch_callbacks(struct qemu_tb* tb, FunctionId function) {
+  const Watchpoints &watchpoints = tracer->watchpoints();
+  std::vector<Disassembler::MemOperand> operands;
+  disassembler->memoryOperands(tb, operands);
+  ssize_t registered = -1;
+  for (const Disassembler::MemOperand &operand : operands) {
+    // One callback per instruction covers all its operands
+    if (static_cast<ssize_t>(operand.insn_index) == registered)
+      continue;
+    bool reads = operand.read && (watchpoints.access() & Watchpoints::kRead);
+    bool writes = operand.write && (watchpoints.access() & Watchpoints::kWrite);
+    if (!reads && !writes)
+      continue;
+    ssize_t watch =
+        operand.absolute
+            ? watchpoints.MatchAddress(operand.address, operand.size)
+            : watchpoints.MatchOffset(operand.offset, operand.size);
+    if (watch < 0)
+      continue;
+
+    qemu_mem_rw rw = reads && writes ? QEMU_MEM_RW
+                                     : (writes ? QEMU_MEM_W : QEMU_MEM_R);
+    uint64_t packed = (static_cast<uint64_t>(function) << 32) |
+                      static_cast<uint64_t>(watch);
+    qemu_plugin_register_vcpu_mem_cb(
+        qemu_plugin_tb_get_insn(tb, operand.insn_index), log_watch_hit,
+        QEMU_CB_NO_REGS, rw,
+        reinterpret_cast<void *>(static_cast<uintptr_t>(packed)));
+    registered = static_cast<ssize_t>(operand.insn_index);
+  }
+}
+
+// In sampling mode, blocks only get inline counters plus a conditional
+// callback which only fires once the sampling period elapsed. Samples are
+// taken at block boundaries so whole blocks are counted at once.
+static void vcpu_tb_trans_sample(uint64_t /*id*/, struct qemu_tb* tb) {
+  struct qemu_insn* first_insn = qemu_plugin_tb_get_insn(tb, 0);
+  uint64_t tb_vaddr = qemu_plugin_insn_vaddr(first_insn);
+  FunctionId function = tracer->InternFunction(tb_vaddr);
+  uint64_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+  qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+      first_insn, QEMU_INLINE_ADD_U64, insn_count, n_insns);
+  qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+      first_insn, QEMU_INLINE_ADD_U64, since_sample, n_insns);
+  uint64_t sampled = tracer->TracesCode(tb_vaddr, function) ? tb_vaddr : 0;
+  qemu_plugin_register_vcpu_insn_exec_cond_cb(
+      first_insn, log_sample, QEMU_CB_R_REGS, QEMU_COND_GE, since_sample,
+      sample_period, reinterpret_cast<void *>(static_cast<uintptr_t>(sampled)));
 }
 
 // When TCG translates a new translation block, register callbacks for
-// interesting instructions (calls/rets and possible landing pads)
+// interesting instructions (calls/rets and possible landing pads). Blocks
+// excluded by the filter only get inline operations, which are much cheaper
+// than callbacks.
 static void vcpu_tb_trans(uint64_t /*id*/, struct qemu_tb* tb) {
   // Only the first instruction of a block could be landed on by a call or ret
   struct qemu_insn* first_insn = qemu_plugin_tb_get_insn(tb, 0);
-  // We never free those: :(
-  uint64_t *first_insn_vaddr = new uint64_t(qemu_plugin_insn_vaddr(first_insn));
+  uint64_t tb_vaddr = qemu_plugin_insn_vaddr(first_insn);
+  // Symbolize it once here rather than every time it gets executed
+  FunctionId function = tracer->InternFunction(tb_vaddr);
+  bool traced = tracer->TracesCode(tb_vaddr, function);
 
-  // If this instruction is executed immediately after a call, log it
-  qemu_plugin_register_vcpu_insn_exec_cond_cb(
-      first_insn, log_call_landing, QEMU_CB_R_REGS, QEMU_COND_NE,
-      last_insn_is_call, 0, first_insn_vaddr);
+  if (traced) {
+    // If this instruction is executed immediately after a call, log it
+    qemu_plugin_register_vcpu_insn_exec_cond_cb(
+        first_insn, log_call_landing, QEMU_CB_R_REGS, QEMU_COND_NE,
+        last_insn_is_call, kLastInsnOther,
+        reinterpret_cast<void *>(static_cast<uintptr_t>(function)));
+  } else if (tracer->SwitchesTask(function)) {
+    // However it is entered, the task running on the vCPU must be read again
+    // after a context switch, even if the filter leaves the scheduler out
+    qemu_plugin_register_vcpu_insn_exec_cb(
+        first_insn, log_task_switch, QEMU_CB_NO_REGS,
+        reinterpret_cast<void *>(static_cast<uintptr_t>(function)));
+  } else {
+    // Calls into excluded code are not logged, but must not be mistaken for
+    // calls into the next traced block either
+    qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+        first_insn, QEMU_INLINE_STORE_U64, last_insn_is_call, kLastInsnOther);
+  }
 
   // We only need the correct instructions count at basic block boundaries.
   // Call callbacks know they are 1 instruction ahead and manually keep
@@ -72,29 +231,68 @@ static void vcpu_tb_trans(uint64_t /*id*/, struct qemu_tb* tb) {
         insn, QEMU_INLINE_ADD_U64, insn_count, 1);
   }
 
-  // Only the last instruction of a block could be a call or ret, so figure out
-  // if it's either of those
-  bool is_call = false, is_ret = false;
-  disassembler->is_call_or_ret(last_insn, is_call, is_ret);
+  // Watched memory is whatever touches it, code left out by the filter too
+  if (!tracer->watchpoints().empty())
+    register_watch_callbacks(tb, function);
 
-  // Set the appropriate "last instruction type" per-cpu flag on those
-  if (is_call)
-    qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
-        last_insn, QEMU_INLINE_STORE_U64, last_insn_is_call, 1);
-  else if (is_ret)
-    qemu_plugin_register_vcpu_insn_exec_cb(
-        last_insn, log_ret, QEMU_CB_NO_REGS, nullptr);
+  // Only the last instruction of a block could change the control flow, so
+  // figure out how
+  uint64_t jump_target = 0;
+  Disassembler::InsnClass insn_class =
+      disassembler->classify(last_insn, jump_target);
+
+  // Set the appropriate "last instruction type" per-cpu flag on calls and
+  // interrupts, which are logged where they land, even from excluded code.
+  // Everything else needs the stack pointer before the instruction executes.
+  if (!traced && insn_class != Disassembler::kCall &&
+      insn_class != Disassembler::kInterrupt)
+    return;
+  switch (insn_class) {
+    case Disassembler::kCall:
+      qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+          last_insn, QEMU_INLINE_STORE_U64, last_insn_is_call, kLastInsnCall);
+      break;
+    case Disassembler::kInterrupt:
+      qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+          last_insn, QEMU_INLINE_STORE_U64, last_insn_is_call,
+          kLastInsnInterrupt);
+      break;
+    case Disassembler::kRet:
+      qemu_plugin_register_vcpu_insn_exec_cb(
+          last_insn, log_ret, QEMU_CB_R_REGS, nullptr);
+      break;
+    case Disassembler::kInterruptRet:
+      qemu_plugin_register_vcpu_insn_exec_cb(
+          last_insn, log_exception_return, QEMU_CB_NO_REGS, nullptr);
+      break;
+    case Disassembler::kOther:
+      if (jump_target) {
+        // Jumping back to the start of the current function is just a loop
+        FunctionId callee = tracer->InternFunctionStart(jump_target);
+        if (callee && callee != function) {
+          // A tail call into excluded code only ends the caller's slice
+          if (!tracer->TracesCode(jump_target, callee))
+            callee = 0;
+          qemu_plugin_register_vcpu_insn_exec_cb(
+              last_insn, log_tail_call, QEMU_CB_R_REGS,
+              reinterpret_cast<void *>(static_cast<uintptr_t>(callee)));
+        }
+      }
+      break;
+  }
 }
 
-// Initialize the "scoreboard" of a new online vCPU
+// Initialize the "scoreboard" and the event ring of a new online vCPU
 static void vcpu_init(uint64_t /*id*/, unsigned int vcpu_id) {
-  qemu_plugin_u64_set(last_insn_is_call, vcpu_id, 0);
+  qemu_plugin_u64_set(last_insn_is_call, vcpu_id, kLastInsnOther);
   qemu_plugin_u64_set(insn_count, vcpu_id, 0);
+  qemu_plugin_u64_set(since_sample, vcpu_id, 0);
+  tracer->InitVcpu(vcpu_id);
 }
 
 // Plugin exit point
 static void plugin_exit(uint64_t /*id*/, void* /*p*/) {
-  tracer->WriteToDisk();
+  tracer->Finish();
 
   delete tracer;
   delete disassembler;
@@ -102,6 +300,15 @@ static void plugin_exit(uint64_t /*id*/, void* /*p*/) {
   qemu_plugin_scoreboard_free(cpu_sb);
 }
 
+// Symbols are cached in $XDG_CACHE_HOME/dejaview, or ~/.cache/dejaview
+static std::string default_cache_dir() {
+  if (const char* xdg_cache = getenv("XDG_CACHE_HOME"))
+    return std::string(xdg_cache) + "/dejaview";
+  if (const char* home = getenv("HOME"))
+    return std::string(home) + "/.cache/dejaview";
+  return "";
+}
+
 // Plugin entry point
 __attribute__((visibility("default")))
 int qemu_plugin_install(uint64_t id, const struct qemu_info* info, int argc,
@@ -110,7 +317,15 @@ int qemu_plugin_install(uint64_t id, const struct qemu_info* info, int argc,
   std::string kernel_path;
   std::string starting_from;
   std::string dest_path("trace.dvtrace");
+  std::string cache_dir = default_cache_dir();
   uint64_t min_insns = 0;
+  Filter filter;
+  Watchpoints watchpoints;
+  std::string sysroot;
+  bool compress = false;
+  uint64_t snapshot_every = 0;
+  bool sample = false;
+  std::optional<uint64_t> period;
   for (int i = 0; i < argc; ++i) {
     std::string arg = argv[i];
     size_t eq_pos = arg.find('=');
@@ -124,6 +339,48 @@ int qemu_plugin_install(uint64_t id, const struct qemu_info* info, int argc,
         dest_path = std::string(value);
       } else if (key == "starting_from") {
         starting_from = std::string(value);
+      } else if (key == "cache_dir") {
+        cache_dir = std::string(value);
+      } else if (key == "filter") {
+        if (!filter.Parse(value))
+          return 1;
+      } else if (key == "watch") {
+        if (!watchpoints.Parse(value))
+          return 1;
+      } else if (key == "watch_access") {
+        if (!watchpoints.ParseAccess(value)) {
+          QEMU_LOG() << "Bad value for watch_access: " << value << "\n";
+          return 1;
+        }
+      } else if (key == "sysroot") {
+        sysroot = value;
+      } else if (key == "compression") {
+        if (value == "gzip") {
+          compress = true;
+        } else if (value != "none") {
+          QEMU_LOG() << "Bad value for compression: " << value << "\n";
+          return 1;
+        }
+      } else if (key == "snapshot_every") {
+        std::optional<uint64_t> every = dejaview::base::StringToUInt64(value);
+        if (!every.has_value()) {
+          QEMU_LOG() << "Bad value for snapshot_every: " << value << "\n";
+          return 1;
+        }
+        snapshot_every = every.value();
+      } else if (key == "mode") {
+        if (value == "sample") {
+          sample = true;
+        } else if (value != "trace") {
+          QEMU_LOG() << "Bad value for mode: " << value << "\n";
+          return 1;
+        }
+      } else if (key == "period") {
+        period = dejaview::base::StringToUInt64(value);
+        if (!period.has_value() || !period.value()) {
+          QEMU_LOG() << "Bad value for period: " << value << "\n";
+          return 1;
+        }
       } else if (key == "min_insns") {
         std::optional<uint64_t> min = dejaview::base::StringToUInt64(value);
         if (!min.has_value()) {
@@ -141,6 +398,17 @@ int qemu_plugin_install(uint64_t id, const struct qemu_info* info, int argc,
     }
   }
 
+  if (period.has_value() && !sample) {
+    QEMU_LOG() << "period requires mode=sample\n";
+    return 1;
+  }
+  sample_period = period.value_or(kDefaultSamplePeriod);
+  // Samples don't keep track of the task running between them
+  if (sample && !watchpoints.empty()) {
+    QEMU_LOG() << "watch requires mode=trace\n";
+    return 1;
+  }
+
   // Initialize objects
   disassembler = Disassembler::Initialize(info->target_name);
   if (!disassembler) {
@@ -148,7 +416,10 @@ int qemu_plugin_install(uint64_t id, const struct qemu_info* info, int argc,
     return 1;
   }
 
-  tracer = new Tracer(dest_path, kernel_path, starting_from, min_insns);
+  tracer = new Tracer(dest_path, kernel_path, starting_from, min_insns,
+                      static_cast<size_t>(info->max_vcpus), cache_dir,
+                      std::move(filter), std::move(watchpoints),
+                      std::move(sysroot), compress, snapshot_every);
 
   // QEMU's per-CPU scoreboard keeps track of instruction counts and types
   cpu_sb = qemu_plugin_scoreboard_new(sizeof(CpuScoreboard));
@@ -156,12 +427,15 @@ int qemu_plugin_install(uint64_t id, const struct qemu_info* info, int argc,
   insn_count.offset = offsetof(CpuScoreboard, insn_count);
   last_insn_is_call.score = cpu_sb;
   last_insn_is_call.offset = offsetof(CpuScoreboard, last_insn_is_call);
+  since_sample.score = cpu_sb;
+  since_sample.offset = offsetof(CpuScoreboard, since_sample);
 
   // Register a callback for each vCPU initialization to populate this
   qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
   // Register a callback for the translation of each new basic block
-  qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
-  // And register an exit callback to save the trace to a file
+  qemu_plugin_register_vcpu_tb_trans_cb(
+      id, sample ? vcpu_tb_trans_sample : vcpu_tb_trans);
+  // And register an exit callback to flush the rest of the trace to disk
   qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
   return 0;
@@ -0,0 +1,279 @@
+#include "snapshotter.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <chrono>
+#include <memory>
+
+#include "dejaview/ext/base/string_utils.h"
+
+#include "qemu_helpers.h"
+
+using dejaview::base::SockFamily;
+using dejaview::base::SockType;
+using dejaview::base::UnixSocketRaw;
+
+// How often the instruction count of the record gets polled
+static constexpr auto kPollPeriod = std::chrono::milliseconds(100);
+// Reads time out that often to notice Stop(), even while QEMU is busy saving a
+// snapshot, which can take a while with a lot of guest memory.
+static constexpr uint32_t kReadTimeoutMs = 200;
+
+static std::string ToJsonString(const Json::Value &value) {
+  Json::StreamWriterBuilder builder;
+  builder["commentStyle"] = "None";
+  builder["indentation"] = "";
+  return Json::writeString(builder, value);
+}
+
+Snapshotter::Snapshotter(std::string qmpAddress, uint64_t every,
+                         SnapshotFunction onSnapshot)
+    : m_qmpAddress(std::move(qmpAddress)), m_every(every),
+      m_onSnapshot(std::move(onSnapshot)) {}
+
+Snapshotter::~Snapshotter() {
+  Stop();
+}
+
+std::string Snapshotter::FindQmpAddress(
+    const std::vector<std::string> &cmdline) {
+  for (size_t i = 0; i + 1 < cmdline.size(); i++) {
+    if (cmdline[i] != "-qmp")
+      continue;
+    // Eg: tcp:localhost:4444,server,nowait or unix:/tmp/qmp.sock,server=on
+    std::string chardev = cmdline[i + 1].substr(0, cmdline[i + 1].find(','));
+    if (chardev.rfind("tcp:", 0) == 0) {
+      std::string address = chardev.substr(4);
+      // QEMU listens on all interfaces when the host is left out, as in
+      // tcp::4444
+      if (address.rfind(':', 0) == 0)
+        return "127.0.0.1" + address;
+      return address;
+    }
+    if (chardev.rfind("unix:", 0) == 0)
+      return chardev.substr(5);
+  }
+  return "";
+}
+
+// UnixSocketRaw aborts on addresses it can't parse or resolve, so TCP
+// addresses are checked beforehand.
+static bool IsValidAddress(const std::string &address, SockFamily family) {
+  std::string host;
+  std::string port;
+  int ai_family;
+  switch (family) {
+    case SockFamily::kUnix:
+      return true;
+    case SockFamily::kInet: {
+      std::vector<std::string> parts =
+          dejaview::base::SplitString(address, ":");
+      if (parts.size() != 2)
+        return false;
+      host = parts[0];
+      port = parts[1];
+      ai_family = AF_INET;
+      break;
+    }
+    case SockFamily::kInet6: {
+      // Eg: [::1]:4444
+      size_t end = address.find(']');
+      if (address[0] != '[' || end == std::string::npos ||
+          address.compare(end, 2, "]:") != 0) {
+        return false;
+      }
+      host = address.substr(1, end - 1);
+      port = address.substr(end + 2);
+      ai_family = AF_INET6;
+      break;
+    }
+    default:
+      return false;
+  }
+  std::optional<uint32_t> port_number = dejaview::base::CStringToUInt32(
+      port.c_str());
+  if (host.empty() || !port_number.has_value() || *port_number == 0 ||
+      *port_number > 65535) {
+    return false;
+  }
+  struct addrinfo hints {};
+  hints.ai_family = ai_family;
+  struct addrinfo *addr_info = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addr_info) != 0)
+    return false;
+  freeaddrinfo(addr_info);
+  return true;
+}
+
+void Snapshotter::Start() {
+  m_thread = std::thread(&Snapshotter::ThreadMain, this);
+}
+
+void Snapshotter::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_cv.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void Snapshotter::ThreadMain() {
+  if (!Connect()) {
+    QEMU_LOG() << "Failed to connect to QMP at " << m_qmpAddress << " ("
+               << m_error << "), no snapshots will be saved\n";
+    return;
+  }
+
+  uint64_t next_icount = m_every;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_cv.wait_for(lock, kPollPeriod, [this] { return m_stopping; })) {
+    lock.unlock();
+    std::optional<uint64_t> icount = QueryIcount();
+    if (!icount.has_value()) {
+      // Either not recording or QEMU is going away
+      QEMU_LOG() << "Stopped saving snapshots: " << m_error << "\n";
+      lock.lock();
+      break;
+    }
+    if (*icount >= next_icount) {
+      std::optional<uint64_t> snapshot_icount = SaveSnapshot();
+      if (snapshot_icount.has_value())
+        next_icount = *snapshot_icount + m_every;
+    }
+    lock.lock();
+  }
+  m_socket.Shutdown();
+}
+
+bool Snapshotter::Connect() {
+  SockFamily family = dejaview::base::GetSockFamily(m_qmpAddress.c_str());
+  if (!IsValidAddress(m_qmpAddress, family)) {
+    m_error = "invalid or unresolvable address";
+    return false;
+  }
+  m_socket = UnixSocketRaw::CreateMayFail(family, SockType::kStream);
+  if (!m_socket || !m_socket.Connect(m_qmpAddress) ||
+      !m_socket.SetRxTimeout(kReadTimeoutMs)) {
+    m_error = "connection failed";
+    return false;
+  }
+
+  // QEMU greets with its version then waits for capabilities negotiation
+  std::optional<Json::Value> greeting = ReadReply();
+  if (!greeting.has_value() || !greeting->isMember("QMP")) {
+    m_error = "no QMP greeting";
+    return false;
+  }
+  return Execute("qmp_capabilities").has_value();
+}
+
+std::optional<Json::Value> Snapshotter::Execute(const std::string &command,
+                                                const Json::Value &arguments) {
+  Json::Value cmd;
+  cmd["execute"] = command;
+  if (!arguments.isNull())
+    cmd["arguments"] = arguments;
+  std::string serialized = ToJsonString(cmd);
+  if (m_socket.SendStr(serialized) != static_cast<ssize_t>(serialized.size())) {
+    m_error = command + ": failed to send";
+    return std::nullopt;
+  }
+
+  std::optional<Json::Value> reply = ReadReply();
+  if (!reply.has_value()) {
+    m_error = command + ": no reply";
+    return std::nullopt;
+  }
+  if (reply->isMember("error")) {
+    m_error = command + ": " + (*reply)["error"]["desc"].asString();
+    return std::nullopt;
+  }
+  return (*reply)["return"];
+}
+
+std::optional<Json::Value> Snapshotter::ReadReply() {
+  std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  for (;;) {
+    size_t eol = m_received.find('\n');
+    if (eol != std::string::npos) {
+      std::string line = m_received.substr(0, eol);
+      m_received.erase(0, eol + 1);
+      Json::Value root;
+      if (!reader->parse(line.data(), line.data() + line.size(), &root,
+                         nullptr)) {
+        return std::nullopt;
+      }
+      // Asynchronous events (STOP, RESUME...) can come before any reply
+      if (root.isMember("event"))
+        continue;
+      return root;
+    }
+
+    char buf[4096];
+    ssize_t rsize = m_socket.Receive(buf, sizeof(buf));
+    if (rsize > 0) {
+      m_received.append(buf, static_cast<size_t>(rsize));
+      continue;
+    }
+    if (rsize == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return std::nullopt;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stopping)
+      return std::nullopt;
+  }
+}
+
+std::optional<uint64_t> Snapshotter::QueryIcount() {
+  std::optional<Json::Value> replay = Execute("query-replay");
+  if (!replay.has_value())
+    return std::nullopt;
+  if ((*replay)["mode"].asString() != "record") {
+    m_error = "QEMU isn't recording, pass -icount rr=record";
+    return std::nullopt;
+  }
+  return (*replay)["icount"].asUInt64();
+}
+
+std::optional<uint64_t> Snapshotter::SaveSnapshot() {
+  // Don't resume a VM somebody else paused
+  std::optional<Json::Value> status = Execute("query-status");
+  if (!status.has_value() || !(*status)["running"].asBool())
+    return std::nullopt;
+
+  // The VM is stopped so that the instruction count is the snapshot's
+  if (!Execute("stop").has_value())
+    return std::nullopt;
+  std::optional<uint64_t> icount = QueryIcount();
+  bool saved = false;
+  if (icount.has_value()) {
+    std::string name = "dejaview-" + std::to_string(*icount);
+    Json::Value arguments;
+    arguments["command-line"] = "savevm " + name;
+    std::optional<Json::Value> output =
+        Execute("human-monitor-command", arguments);
+    // HMP commands report errors in their output, eg. when record/replay
+    // can't snapshot right now
+    if (output.has_value() && !output->asString().empty()) {
+      m_error = dejaview::base::TrimWhitespace(output->asString());
+    } else if (output.has_value()) {
+      m_onSnapshot(name, *icount);
+      saved = true;
+    }
+  }
+  Execute("cont");
+
+  // Failures are retried at the next poll, only log the first one in a row
+  if (!saved) {
+    if (!m_loggedFailure)
+      QEMU_LOG() << "Failed to save a snapshot: " << m_error << "\n";
+    m_loggedFailure = true;
+    return std::nullopt;
+  }
+  m_loggedFailure = false;
+  return icount;
+}
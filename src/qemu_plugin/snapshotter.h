@@ -0,0 +1,73 @@
+#ifndef SRC_QEMU_PLUGIN_SNAPSHOTTER_H_
+#define SRC_QEMU_PLUGIN_SNAPSHOTTER_H_
+
+#include <cinttypes>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json/json.h>
+
+#include "dejaview/ext/base/unix_socket.h"
+
+// Periodically saves VM snapshots while recording, so that a replay seeking to
+// an instruction starts from the nearest snapshot rather than from the boot.
+//
+// Plugins can't save snapshots themselves, so a background thread talks to the
+// QMP monitor QEMU was started with: it polls the instruction count of the
+// record and every |every| instructions, stops the VM, saves a snapshot named
+// after that instruction count in the disk image and resumes the VM.
+class Snapshotter {
+public:
+  using SnapshotFunction =
+      std::function<void(const std::string & /*name*/, uint64_t /*icount*/)>;
+
+  Snapshotter(std::string qmpAddress, uint64_t every,
+              SnapshotFunction onSnapshot);
+  ~Snapshotter();
+
+  // Returns the address of the first QMP monitor in a QEMU command line, as
+  // accepted by UnixSocketRaw::Connect(), or an empty string.
+  static std::string FindQmpAddress(const std::vector<std::string> &cmdline);
+
+  // Saves snapshots from a background thread until Stop().
+  void Start();
+  void Stop();
+
+private:
+  void ThreadMain();
+  bool Connect();
+  // Runs a QMP command and returns what it returned, nullopt on errors.
+  std::optional<Json::Value> Execute(const std::string &command,
+                                     const Json::Value &arguments = Json::Value());
+  // Reads the next JSON object sent by QEMU, skipping events.
+  std::optional<Json::Value> ReadReply();
+  std::optional<uint64_t> QueryIcount();
+  // Returns the instruction count of the snapshot, or nullopt if it couldn't
+  // be saved right now.
+  std::optional<uint64_t> SaveSnapshot();
+
+  std::string m_qmpAddress;
+  uint64_t m_every;
+  SnapshotFunction m_onSnapshot;
+
+  // Only accessed by the snapshot thread.
+  dejaview::base::UnixSocketRaw m_socket;
+  std::string m_received;
+  // Why the last command failed
+  std::string m_error;
+  bool m_loggedFailure = false;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stopping = false;
+
+  std::thread m_thread;
+};
+
+#endif  // SRC_QEMU_PLUGIN_SNAPSHOTTER_H_
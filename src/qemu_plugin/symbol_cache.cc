@@ -0,0 +1,122 @@
+#include "symbol_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "dejaview/ext/base/file_utils.h"
+#include "dejaview/ext/base/scoped_file.h"
+#include "src/trace_processor/util/build_id.h"
+
+#include "dwarf/elf.h"
+
+#include "qemu_helpers.h"
+
+namespace {
+
+// Bump whenever the layout of anything cached changes.
+constexpr char kMagic[8] = {'D', 'J', 'V', 'S', 'Y', 'M', '0', '2'};
+
+// Arrays are padded so that they all start 8-byte aligned.
+constexpr size_t kAlignment = 8;
+
+std::string ReadBuildId(ElfFile &elf) {
+  ElfFile::Section section;
+  if (!elf.FindSectionByName(".note.gnu.build-id", &section))
+    return "";
+  for (ElfFile::NoteIter notes(section); !notes.IsDone(); notes.Next()) {
+    if (notes.type() == NT_GNU_BUILD_ID &&
+        notes.name() == "GNU") {
+      std::string_view desc = notes.descriptor();
+      return dejaview::trace_processor::BuildId::FromRaw(
+                 std::string(desc.data(), desc.size()))
+          .ToHex();
+    }
+  }
+  return "";
+}
+
+}  // namespace
+
+std::string SymbolCache::PathFor(const std::string &cacheDir, ElfFile &elf) {
+  if (cacheDir.empty())
+    return "";
+  std::string build_id = ReadBuildId(elf);
+  if (build_id.empty()) {
+    QEMU_LOG() << "No build-id, symbols won't be cached" << std::endl;
+    return "";
+  }
+  return cacheDir + "/" + build_id + ".symcache";
+}
+
+bool SymbolCache::Open(const std::string &path) {
+  if (!dejaview::base::FileExists(path))
+    return false;
+  m_mmap = dejaview::base::ReadMmapWholeFile(path.c_str());
+  if (!m_mmap.IsValid() || m_mmap.length() < sizeof(kMagic))
+    return false;
+  m_remaining = std::string_view(static_cast<const char *>(m_mmap.data()),
+                                 m_mmap.length());
+  if (memcmp(m_remaining.data(), kMagic, sizeof(kMagic)) != 0)
+    return false;
+  m_remaining.remove_prefix(sizeof(kMagic));
+  return true;
+}
+
+bool SymbolCache::ReadBytes(std::string_view *out) {
+  uint64_t size;
+  if (m_remaining.size() < sizeof(size))
+    return false;
+  memcpy(&size, m_remaining.data(), sizeof(size));
+  m_remaining.remove_prefix(sizeof(size));
+  uint64_t padded = (size + kAlignment - 1) & ~(kAlignment - 1);
+  if (m_remaining.size() < padded)
+    return false;
+  *out = m_remaining.substr(0, size);
+  m_remaining.remove_prefix(padded);
+  return true;
+}
+
+void SymbolCache::AppendBytes(const void *data, size_t size) {
+  if (m_buffer.empty())
+    m_buffer.assign(kMagic, sizeof(kMagic));
+  uint64_t size64 = size;
+  m_buffer.append(reinterpret_cast<const char *>(&size64), sizeof(size64));
+  m_buffer.append(static_cast<const char *>(data), size);
+  m_buffer.resize((m_buffer.size() + kAlignment - 1) & ~(kAlignment - 1));
+}
+
+bool SymbolCache::Save(const std::string &path) {
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos) {
+    // Creates the cache directory and its parent, e.g. ~/.cache/dejaview
+    std::string dir = path.substr(0, slash);
+    size_t parent = dir.rfind('/');
+    if (parent != std::string::npos && parent != 0)
+      dejaview::base::Mkdir(dir.substr(0, parent));
+    dejaview::base::Mkdir(dir);
+  }
+
+  // Concurrent QEMUs may race to create the same cache, only rename whole
+  // files in place.
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  {
+    dejaview::base::ScopedFile fd = dejaview::base::OpenFile(
+        tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!fd) {
+      QEMU_LOG() << "Failed to create symbol cache " << tmp_path << std::endl;
+      return false;
+    }
+    if (dejaview::base::WriteAll(*fd, m_buffer.data(), m_buffer.size()) !=
+        static_cast<ssize_t>(m_buffer.size())) {
+      QEMU_LOG() << "Failed to write symbol cache " << tmp_path << std::endl;
+      remove(tmp_path.c_str());
+      return false;
+    }
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef SRC_QEMU_PLUGIN_SYMBOL_CACHE_H_
+#define SRC_QEMU_PLUGIN_SYMBOL_CACHE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "dejaview/ext/base/scoped_mmap.h"
+
+class ElfFile;
+
+// On-disk cache of everything derived from the symbols and debug info of a
+// kernel, keyed by its build-id, so that later runs skip parsing DWARF.
+//
+// The file is a header followed by a sequence of arrays of trivially copyable
+// values. Readers must consume them in the order they were appended.
+class SymbolCache {
+public:
+  SymbolCache() {}
+
+  // Returns where the cache of |elf| lives in |cacheDir|, or an empty string
+  // if caching is disabled or the ELF has no build-id.
+  static std::string PathFor(const std::string &cacheDir, ElfFile &elf);
+
+  // Maps an existing cache file. Returns false if it is missing or stale.
+  bool Open(const std::string &path);
+  template <typename T>
+  bool Read(std::vector<T> *out);
+  template <typename T>
+  bool Read(T *out);
+
+  template <typename T>
+  void Append(const std::vector<T> &data) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable types can be cached");
+    AppendBytes(data.data(), data.size() * sizeof(T));
+  }
+  template <typename T>
+  void Append(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable types can be cached");
+    AppendBytes(&value, sizeof(T));
+  }
+  // Atomically replaces the cache file at |path|.
+  bool Save(const std::string &path);
+
+private:
+  bool ReadBytes(std::string_view *out);
+  void AppendBytes(const void *data, size_t size);
+
+  dejaview::base::ScopedMmap m_mmap;
+  std::string_view m_remaining;
+  std::string m_buffer;
+};
+
+template <typename T>
+bool SymbolCache::Read(std::vector<T> *out) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable types can be cached");
+  std::string_view bytes;
+  if (!ReadBytes(&bytes) || bytes.size() % sizeof(T))
+    return false;
+  out->resize(bytes.size() / sizeof(T));
+  if (!bytes.empty())
+    memcpy(out->data(), bytes.data(), bytes.size());
+  return true;
+}
+
+template <typename T>
+bool SymbolCache::Read(T *out) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable types can be cached");
+  std::string_view bytes;
+  if (!ReadBytes(&bytes) || bytes.size() != sizeof(T))
+    return false;
+  memcpy(out, bytes.data(), sizeof(T));
+  return true;
+}
+
+#endif  // SRC_QEMU_PLUGIN_SYMBOL_CACHE_H_
@@ -1,41 +1,166 @@
 #include "symbolizer.h"
 
+#include <algorithm>
+#include <cinttypes>
 #include <cstdio>
+#include <cstring>
 
 #include "dwarf/elf.h"
 
 #include "qemu_helpers.h"
+#include "symbol_cache.h"
 
-bool Symbolizer::Init(ElfFile &elf) {
+bool Symbolizer::Init(ElfFile &elf, const dwarf::File &dwarf) {
   if (!readSymbols(elf))
     return false;
 
+  m_lines.Build(dwarf);
+
   return true;
 }
 
-bool Symbolizer::lookupAddress(uint64_t address, std::string& name, std::string& filename, int& line_number) {
-  name = m_address_to_symbol[address];
+bool Symbolizer::Load(SymbolCache &cache) {
+  std::vector<Symbol> symbols;
+  std::vector<char> names;
+  if (!cache.Read(&symbols) || !cache.Read(&names) || !m_lines.Load(cache))
+    return false;
+  m_symbols = std::move(symbols);
+  m_names = std::move(names);
+  return true;
+}
 
-  // TODO: extract those from DWARF
-  filename = "";
-  line_number = 0;
+void Symbolizer::Save(SymbolCache &cache) const {
+  cache.Append(m_symbols);
+  cache.Append(m_names);
+  m_lines.Save(cache);
+}
+
+uint64_t Symbolizer::lookupSymbol(const std::string& symbol_name,
+                                  uint64_t *size) {
+  // Only used for a handful of symbols at startup, a linear scan will do
+  for (const Symbol &symbol : m_symbols) {
+    if (symbol_name == symbolName(symbol)) {
+      if (size)
+        *size = symbol.size;
+      return symbol.address;
+    }
+  }
+  return 0;
+}
 
-  return !name.empty();
+ssize_t Symbolizer::findSymbol(uint64_t address) const {
+  auto it = std::upper_bound(
+      m_symbols.begin(), m_symbols.end(), address,
+      [](uint64_t addr, const Symbol &symbol) { return addr < symbol.address; });
+  if (it == m_symbols.begin())
+    return -1;
+  --it;
+  if (address - it->address >= it->size)
+    return -1;
+  return it - m_symbols.begin();
 }
 
-uint64_t Symbolizer::lookupSymbol(const std::string& symbol_name) {
-  auto it = m_symbol_to_address.find(symbol_name);
-  if (it != m_symbol_to_address.end())
+FunctionId Symbolizer::internAddress(uint64_t address) {
+  ssize_t index = findSymbol(address);
+  if (index >= 0)
+    return static_cast<FunctionId>(index + 1);
+
+  std::lock_guard<std::mutex> lock(m_extraMutex);
+  auto it = m_unknownToId.find(address);
+  if (it != m_unknownToId.end())
     return it->second;
-  return 0;
+  m_extraFunctions.push_back(ExtraFunction{nullptr, address});
+  FunctionId id = static_cast<FunctionId>(m_symbols.size() + m_extraFunctions.size());
+  m_unknownToId.insert(std::make_pair(address, id));
+  return id;
+}
+
+FunctionId Symbolizer::internFunctionStart(uint64_t address) const {
+  ssize_t index = findSymbol(address);
+  if (index < 0 || m_symbols[static_cast<size_t>(index)].address != address)
+    return 0;
+  return static_cast<FunctionId>(index + 1);
+}
+
+bool Symbolizer::unknownAddress(FunctionId id, uint64_t *address) {
+  if (id <= m_symbols.size())
+    return false;
+  std::lock_guard<std::mutex> lock(m_extraMutex);
+  const ExtraFunction &extra = m_extraFunctions[id - m_symbols.size() - 1];
+  *address = extra.address;
+  return !extra.module;
+}
+
+FunctionId Symbolizer::internModuleAddress(const Symbolizer &module,
+                                           uint64_t address) {
+  ssize_t index = module.findSymbol(address);
+  if (index < 0)
+    return 0;
+  uint64_t start = module.m_symbols[static_cast<size_t>(index)].address;
+
+  std::lock_guard<std::mutex> lock(m_extraMutex);
+  auto key = std::make_pair(&module, start);
+  auto it = m_moduleToId.find(key);
+  if (it != m_moduleToId.end())
+    return it->second;
+  m_extraFunctions.push_back(ExtraFunction{&module, start});
+  FunctionId id = static_cast<FunctionId>(m_symbols.size() + m_extraFunctions.size());
+  m_moduleToId.insert(std::make_pair(key, id));
+  return id;
+}
+
+void Symbolizer::describeSymbol(const Symbol &symbol, std::string &name,
+                                std::string &filename,
+                                int &line_number) const {
+  name = symbolName(symbol);
+  m_lines.LookupFunction(symbol.address, filename, line_number);
+}
+
+bool Symbolizer::describeFunction(FunctionId id, std::string& name, std::string& filename, int& line_number) {
+  filename = "";
+  line_number = 0;
+
+  if (id == 0)
+    return false;
+  if (id <= m_symbols.size()) {
+    describeSymbol(m_symbols[id - 1], name, filename, line_number);
+    return true;
+  }
+
+  ExtraFunction extra;
+  {
+    std::lock_guard<std::mutex> lock(m_extraMutex);
+    extra = m_extraFunctions[id - m_symbols.size() - 1];
+  }
+  if (extra.module) {
+    ssize_t index = extra.module->findSymbol(extra.address);
+    extra.module->describeSymbol(
+        extra.module->m_symbols[static_cast<size_t>(index)], name, filename,
+        line_number);
+    return true;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "0x%" PRIX64, extra.address);
+  name = buf;
+  return false;
 }
 
 bool Symbolizer::readSymbols(ElfFile &elf) {
+  // Stripped binaries, like most shared libraries, only keep their dynamic
+  // symbols
+  Elf64_Word symbol_type = SHT_DYNSYM;
+  for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
+    ElfFile::Section section;
+    elf.ReadSection(i, &section);
+    if (section.header().sh_type == SHT_SYMTAB)
+      symbol_type = SHT_SYMTAB;
+  }
+
   for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
     ElfFile::Section section;
     elf.ReadSection(i, &section);
 
-    if (section.header().sh_type != SHT_SYMTAB) {
+    if (section.header().sh_type != symbol_type) {
       continue;
     }
 
@@ -61,12 +186,23 @@ bool Symbolizer::readSymbols(ElfFile &elf) {
         continue;
       }
 
-      std::string name(strtab_section.ReadString(sym.st_name));
-      uint64_t address = static_cast<uint64_t>(sym.st_value);
-      m_symbol_to_address[name] = address;
-      m_address_to_symbol[address] = name;
+      string_view name = strtab_section.ReadString(sym.st_name);
+      Symbol symbol;
+      symbol.address = static_cast<uint64_t>(sym.st_value);
+      symbol.size = static_cast<uint64_t>(sym.st_size);
+      symbol.name_offset = static_cast<uint32_t>(m_names.size());
+      m_names.insert(m_names.end(), name.begin(), name.end());
+      m_names.push_back('\0');
+      m_symbols.push_back(symbol);
     }
   }
 
+  // Aliases share an address, lookups consistently resolve to the last one
+  std::stable_sort(m_symbols.begin(), m_symbols.end(),
+                   [](const Symbol &a, const Symbol &b) {
+                     return a.address < b.address;
+                   });
+  m_symbols.shrink_to_fit();
+
   return true;
 }
@@ -3,24 +3,93 @@
 
 #include <string>
 #include <memory>
+#include <mutex>
 #include <cstdint>
+#include <map>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "line_table.h"
 
 class ElfFile;
+class SymbolCache;
+namespace dwarf {
+struct File;
+}
+
+// Function IDs are dense integers usable as interning IDs: 1..N are the
+// symbols of the ELF in address order and anything above that is either an
+// address which didn't resolve to any symbol or a symbol of a module (a
+// userspace binary, loaded in a Symbolizer of its own). 0 is never a valid ID.
+typedef uint32_t FunctionId;
 
 class Symbolizer {
 public:
   Symbolizer() {}
 
-  bool Init(ElfFile &elf);
-  bool lookupAddress(uint64_t address, std::string& name, std::string& filename, int& line_number);
-  uint64_t lookupSymbol(const std::string& symbol_name);
+  bool Init(ElfFile &elf, const dwarf::File &dwarf);
+  // Alternatively to Init(), restores what it computed from a cache.
+  bool Load(SymbolCache &cache);
+  void Save(SymbolCache &cache) const;
+  // Returns the address of a symbol, or 0. Its size is stored in |size|.
+  uint64_t lookupSymbol(const std::string& symbol_name,
+                        uint64_t *size = nullptr);
+  // Symbols are the function IDs 1 to symbolCount().
+  size_t symbolCount() const { return m_symbols.size(); }
+
+  // Resolves the function containing |address|. Thread-safe, meant to be
+  // called at translation time rather than for every event.
+  FunctionId internAddress(uint64_t address);
+  // Like internAddress() but only for the first address of a symbol, returns
+  // 0 otherwise. Thread-safe.
+  FunctionId internFunctionStart(uint64_t address) const;
+  // Returns the address an ID above symbolCount() was interned from by
+  // internAddress(), or false for symbols of modules. Thread-safe.
+  bool unknownAddress(FunctionId id, uint64_t *address);
+  // Resolves |address| in the symbols of |module| to an ID of this
+  // Symbolizer, or 0 if it isn't in any. |module| must outlive this one.
+  // Thread-safe.
+  FunctionId internModuleAddress(const Symbolizer &module, uint64_t address);
+  // Describes a function previously returned by internAddress(). Returns false
+  // for unknown functions, filename is left empty when no line info exists.
+  // Thread-safe.
+  bool describeFunction(FunctionId id, std::string& name, std::string& filename, int& line_number);
 
 private:
+  struct Symbol {
+    uint64_t address;
+    uint64_t size;
+    uint32_t name_offset;
+  };
+
+  // Functions past the symbols: a module symbol at |address|, or an unknown
+  // |address| when |module| is null.
+  struct ExtraFunction {
+    const Symbolizer *module;
+    uint64_t address;
+  };
+
   bool readSymbols(ElfFile &elf);
+  // Returns the index of the symbol containing |address| or -1.
+  ssize_t findSymbol(uint64_t address) const;
+  void describeSymbol(const Symbol &symbol, std::string &name,
+                      std::string &filename, int &line_number) const;
+  const char *symbolName(const Symbol &symbol) const {
+    return &m_names[symbol.name_offset];
+  }
+
+  // Sorted by address, immutable after Init().
+  std::vector<Symbol> m_symbols;
+  std::vector<char> m_names;
+  LineTable m_lines;
 
-  std::unordered_map<std::string, uint64_t> m_symbol_to_address;
-  std::unordered_map<uint64_t, std::string> m_address_to_symbol;
+  // Only ever touched at translation time, or when a userspace function is
+  // first seen in a process.
+  std::mutex m_extraMutex;
+  std::unordered_map<uint64_t, FunctionId> m_unknownToId;
+  std::map<std::pair<const Symbolizer *, uint64_t>, FunctionId> m_moduleToId;
+  std::vector<ExtraFunction> m_extraFunctions;
 };
 
 #endif  // SRC_QEMU_PLUGIN_SYMBOLIZER_H_
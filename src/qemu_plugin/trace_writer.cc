@@ -0,0 +1,485 @@
+#include "trace_writer.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "dejaview/ext/base/file_utils.h"
+#include "dejaview/protozero/packed_repeated_fields.h"
+#include "dejaview/protozero/scattered_heap_buffer.h"
+#include "src/trace_processor/util/gzip_frames.h"
+
+#include "protos/dejaview/trace/trace.pbzero.h"
+#include "protos/dejaview/trace/trace_packet.pbzero.h"
+#include "protos/dejaview/trace/interned_data/interned_data.pbzero.h"
+#include "protos/dejaview/trace/profiling/profile_common.pbzero.h"
+#include "protos/dejaview/trace/profiling/profile_packet.pbzero.h"
+#include "protos/dejaview/trace/qemu/call_graph_bundle.pbzero.h"
+#include "protos/dejaview/trace/qemu/trace_frame_index.pbzero.h"
+#include "protos/dejaview/trace/track_event/debug_annotation.pbzero.h"
+#include "protos/dejaview/trace/track_event/source_location.pbzero.h"
+#include "protos/dejaview/trace/track_event/track_event.pbzero.h"
+
+#include "qemu_helpers.h"
+#include "symbolizer.h"
+
+using Trace = dejaview::protos::pbzero::Trace;
+using TracePacket = dejaview::protos::pbzero::TracePacket;
+using InternedData = dejaview::protos::pbzero::InternedData;
+using Profiling = dejaview::protos::pbzero::Profiling;
+using TrackEvent = dejaview::protos::pbzero::TrackEvent;
+
+// Upper bound on the number of events encoded from one ring at once, to keep
+// the size of the intermediate buffer reasonable.
+static constexpr uint64_t kMaxEventsPerBatch = 64 * 1024;
+// Upper bound on the number of events packed in one CallGraphBundle, so that
+// the trace processor never has to hold huge packets.
+static constexpr uint64_t kMaxEventsPerBundle = 16 * 1024;
+// Frames are compressed once they hold that many bytes of packets. Large enough
+// for a good ratio, small enough for parallel decompression and seeking.
+static constexpr size_t kFrameSize = 4 * 1024 * 1024;
+// Frames aren't left pending for longer than this, so that a trace is readable
+// up to the last second or so if QEMU dies.
+static constexpr auto kMaxFrameAge = std::chrono::seconds(1);
+// The writer thread has to keep up with all the vCPUs, favor speed.
+static constexpr int kCompressionLevel = 1;
+// Interned mappings of the sampled frames: the ELF the symbols come from, and
+// addresses none of its symbols contain.
+static constexpr uint64_t kSymbolsMappingIid = 1;
+static constexpr uint64_t kUnknownMappingIid = 2;
+
+TraceWriter::TraceWriter(std::string destPath, Symbolizer *symbolizer,
+                         size_t maxVcpus, bool compress)
+    : m_destPath(destPath), m_symbolizer(symbolizer),
+      m_sequences(new std::atomic<Sequence *>[maxVcpus]),
+      m_ownedSequences(maxVcpus), m_maxVcpus(maxVcpus), m_compress(compress) {
+  for (size_t i = 0; i < m_maxVcpus; i++)
+    m_sequences[i].store(nullptr, std::memory_order_relaxed);
+  // After the sequences of the vCPUs
+  m_sampleSequence.sequence_id = static_cast<uint32_t>(maxVcpus) + 1;
+  m_watchSequenceId = static_cast<uint32_t>(maxVcpus) + 2;
+
+  m_fd = dejaview::base::OpenFile(m_destPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (m_fd.get() == -1) {
+    QEMU_LOG() << "Failed to open destination file " << m_destPath
+               << "; can't write trace.\n";
+    return;
+  }
+  m_thread = std::thread(&TraceWriter::ThreadMain, this);
+}
+
+TraceWriter::~TraceWriter() {
+  Finish();
+}
+
+EventRing *TraceWriter::AddVcpu(unsigned int vcpu_id) {
+  if (vcpu_id >= m_maxVcpus) {
+    QEMU_LOG() << "vCPU " << vcpu_id << " is out of range\n";
+    exit(1);
+  }
+  auto seq = std::make_unique<Sequence>();
+  seq->sequence_id = vcpu_id + 1;
+  Sequence *raw = seq.get();
+  m_ownedSequences[vcpu_id] = std::move(seq);
+  m_sequences[vcpu_id].store(raw, std::memory_order_release);
+  return &raw->ring;
+}
+
+void TraceWriter::SubmitPackets(std::string serialized) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_packets.push_back(std::move(serialized));
+  }
+  m_cv.notify_one();
+}
+
+void TraceWriter::SubmitSample(Sample sample) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_samples.push_back(std::move(sample));
+}
+
+void TraceWriter::SubmitWatchHit(const WatchHit &hit) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_watchHits.push_back(hit);
+}
+
+void TraceWriter::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_finishing)
+      return;
+    m_finishing = true;
+  }
+  m_cv.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+  m_fd.reset();
+  if (m_compress) {
+    QEMU_LOG() << "Wrote " << m_bytesWritten << " bytes to " << m_destPath
+               << " from " << m_bytesCompressed << " bytes of packets\n";
+  } else {
+    QEMU_LOG() << "Wrote " << m_bytesWritten << " bytes to " << m_destPath
+               << "\n";
+  }
+}
+
+void TraceWriter::ThreadMain() {
+  for (;;) {
+    bool finishing;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      finishing = m_finishing;
+    }
+    bool wrote = Drain();
+    // vCPUs are stopped by the time we finish, so once a pass over all the
+    // rings comes back empty, everything has been written.
+    if (finishing && !wrote) {
+      if (m_compress)
+        WriteFrameIndex();
+      return;
+    }
+    if (!wrote && !m_frame.empty() &&
+        std::chrono::steady_clock::now() - m_frameStart > kMaxFrameAge)
+      FlushFrame();
+    if (!wrote) {
+      // Producers never signal us to keep their path lock-free, poll instead.
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait_for(lock, std::chrono::milliseconds(1),
+                    [this] { return m_finishing || !m_packets.empty(); });
+    }
+  }
+}
+
+bool TraceWriter::Drain() {
+  // Snapshot the published events before picking up the pending packets:
+  // descriptors are queued before the events referring to them are pushed, so
+  // they are guaranteed to be written first.
+  std::vector<uint64_t> available(m_maxVcpus, 0);
+  for (size_t i = 0; i < m_maxVcpus; i++) {
+    Sequence *seq = m_sequences[i].load(std::memory_order_acquire);
+    if (seq)
+      available[i] = std::min(seq->ring.Available(), kMaxEventsPerBatch);
+  }
+
+  std::deque<std::string> packets;
+  std::deque<Sample> samples;
+  std::deque<WatchHit> watch_hits;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    packets.swap(m_packets);
+    samples.swap(m_samples);
+    watch_hits.swap(m_watchHits);
+  }
+
+  bool wrote = !packets.empty() || !samples.empty() || !watch_hits.empty();
+  for (const std::string &serialized : packets)
+    Append(serialized, true);
+
+  std::string encoded;
+  if (!samples.empty()) {
+    EncodeSamples(samples, &encoded);
+    for (const Sample &sample : samples)
+      AddToFrame(sample.ts, sample.ts);
+    Append(encoded, false);
+  }
+  if (!watch_hits.empty()) {
+    EncodeWatchHits(watch_hits, &encoded);
+    for (const WatchHit &hit : watch_hits)
+      AddToFrame(hit.ts, hit.ts);
+    Append(encoded, false);
+  }
+
+  for (size_t i = 0; i < m_maxVcpus; i++) {
+    if (!available[i])
+      continue;
+    Sequence *seq = m_sequences[i].load(std::memory_order_relaxed);
+    EncodeEvents(seq, available[i], &encoded);
+    // Timestamps only increase on a given vCPU
+    AddToFrame(seq->ring.At(0).ts, seq->ring.At(available[i] - 1).ts);
+    seq->ring.Pop(available[i]);
+    Append(encoded, false);
+    wrote = true;
+  }
+  return wrote;
+}
+
+// Concatenated Trace messages are still a valid Trace message, so every batch
+// is encoded as its own Trace and appended to the file.
+//
+// Consecutive events of a track are packed in a CallGraphBundle rather than a
+// TrackEvent each: with delta encoded timestamps, most events take 2 to 4
+// bytes instead of 20 to 30.
+void TraceWriter::EncodeEvents(Sequence *seq, uint64_t count, std::string *out) {
+  protozero::HeapBuffered<Trace> trace;
+  if (!seq->cleared) {
+    auto* packet = trace->add_packet();
+    packet->set_trusted_packet_sequence_id(seq->sequence_id);
+    packet->set_incremental_state_cleared(true);
+    if (!seq->started)
+      packet->set_first_packet_on_sequence(true);
+    seq->started = true;
+    seq->cleared = true;
+  }
+
+  protozero::PackedVarInt timestamp_deltas;
+  protozero::PackedVarInt name_iids;
+  for (uint64_t begin = 0, end; begin < count; begin = end) {
+    const tracing_event &first = seq->ring.At(begin);
+    end = begin + 1;
+    while (end < count && end - begin < kMaxEventsPerBundle &&
+           seq->ring.At(end).track_uuid == first.track_uuid)
+      end++;
+
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(first.ts);
+    packet->set_trusted_packet_sequence_id(seq->sequence_id);
+
+    timestamp_deltas.Reset();
+    name_iids.Reset();
+    InternedData *interned_data = nullptr;
+    uint64_t last_ts = first.ts;
+    for (uint64_t i = begin; i < end; i++) {
+      const tracing_event &e = seq->ring.At(i);
+      timestamp_deltas.Append(e.ts - last_ts);
+      last_ts = e.ts;
+      // Function IDs are dense so they double as interning IDs
+      name_iids.Append(e.function);
+      if (!e.function)
+        continue;
+
+      if (e.function >= seq->interned.size())
+        seq->interned.resize(e.function + 1024, false);
+      if (seq->interned[e.function])
+        continue;
+      seq->interned[e.function] = true;
+
+      if (!interned_data)
+        interned_data = packet->set_interned_data();
+      std::string function_name, file_name;
+      int line_number;
+      bool symbolized = m_symbolizer->describeFunction(
+          e.function, function_name, file_name, line_number);
+      auto* event_name = interned_data->add_event_names();
+      event_name->set_iid(e.function);
+      event_name->set_name(function_name);
+      if (symbolized && !file_name.empty()) {
+        auto* source_location = interned_data->add_source_locations();
+        source_location->set_iid(e.function);
+        // Let's skip this since it's redundant with the slice name
+        // source_location->set_function_name(function_name);
+        source_location->set_file_name(file_name);
+        source_location->set_line_number(static_cast<uint32_t>(line_number));
+      }
+    }
+    // TODO: Extract arguments and return value
+
+    auto* bundle = packet->set_call_graph_bundle();
+    bundle->set_track_uuid(first.track_uuid);
+    bundle->set_timestamp_delta(timestamp_deltas);
+    bundle->set_name_iid(name_iids);
+    bundle->set_sorted(true);
+  }
+  *out = trace.SerializeAsString();
+}
+
+void TraceWriter::EncodeSamples(const std::deque<Sample> &samples,
+                                std::string *out) {
+  protozero::HeapBuffered<Trace> trace;
+  SampleSequence &seq = m_sampleSequence;
+  if (!seq.cleared) {
+    auto* packet = trace->add_packet();
+    packet->set_trusted_packet_sequence_id(seq.sequence_id);
+    packet->set_incremental_state_cleared(true);
+    if (!seq.started)
+      packet->set_first_packet_on_sequence(true);
+    seq.started = true;
+    seq.cleared = true;
+
+    // Path components get joined after a '/' each, so this names the mapping
+    // "/kernel", which trace_processor special-cases as the kernel's when it
+    // has no range
+    auto* interned_data = packet->set_interned_data();
+    auto* path = interned_data->add_mapping_paths();
+    path->set_iid(kSymbolsMappingIid);
+    path->set_str("kernel");
+    path = interned_data->add_mapping_paths();
+    path->set_iid(kUnknownMappingIid);
+    path->set_str("unknown");
+    for (uint64_t iid : {kSymbolsMappingIid, kUnknownMappingIid}) {
+      auto* mapping = interned_data->add_mappings();
+      mapping->set_iid(iid);
+      mapping->add_path_string_ids(iid);
+    }
+  }
+
+  for (const Sample &sample : samples) {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(sample.ts);
+    packet->set_trusted_packet_sequence_id(seq.sequence_id);
+
+    auto it = seq.callstacks.find(sample.stack);
+    if (it == seq.callstacks.end()) {
+      auto* interned_data = packet->set_interned_data();
+      for (FunctionId function : sample.stack) {
+        if (function >= seq.interned.size())
+          seq.interned.resize(function + 1024, false);
+        if (seq.interned[function])
+          continue;
+        seq.interned[function] = true;
+
+        std::string function_name, file_name;
+        int line_number;
+        bool symbolized = m_symbolizer->describeFunction(
+            function, function_name, file_name, line_number);
+        auto* name = interned_data->add_function_names();
+        name->set_iid(function);
+        name->set_str(function_name);
+        auto* frame = interned_data->add_frames();
+        frame->set_iid(function);
+        frame->set_function_name_id(function);
+        frame->set_mapping_id(symbolized ? kSymbolsMappingIid
+                                         : kUnknownMappingIid);
+      }
+
+      uint64_t iid = seq.callstacks.size() + 1;
+      it = seq.callstacks.emplace(sample.stack, iid).first;
+      auto* callstack = interned_data->add_callstacks();
+      callstack->set_iid(iid);
+      for (FunctionId function : sample.stack)
+        callstack->add_frame_ids(function);
+    }
+
+    auto* perf_sample = packet->set_perf_sample();
+    perf_sample->set_cpu(sample.cpu);
+    perf_sample->set_pid(sample.tgid);
+    perf_sample->set_tid(sample.pid);
+    perf_sample->set_cpu_mode(sample.user ? Profiling::MODE_USER
+                                          : Profiling::MODE_KERNEL);
+    perf_sample->set_callstack_iid(it->second);
+  }
+  *out = trace.SerializeAsString();
+}
+
+// Hits are rare compared to calls, so they are plain TrackEvents without any
+// interning.
+void TraceWriter::EncodeWatchHits(const std::deque<WatchHit> &hits,
+                                  std::string *out) {
+  protozero::HeapBuffered<Trace> trace;
+  std::string function_name, file_name;
+  int line_number;
+  for (const WatchHit &hit : hits) {
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(hit.ts);
+    packet->set_trusted_packet_sequence_id(m_watchSequenceId);
+    if (!m_watchSequenceStarted)
+      packet->set_first_packet_on_sequence(true);
+    m_watchSequenceStarted = true;
+
+    auto* event = packet->set_track_event();
+    event->set_type(TrackEvent::TYPE_INSTANT);
+    event->set_track_uuid(hit.track_uuid);
+    event->set_name(std::string(hit.write ? "write " : "read ") + hit.watch);
+    m_symbolizer->describeFunction(hit.function, function_name, file_name,
+                                   line_number);
+    auto* annotation = event->add_debug_annotations();
+    annotation->set_name("function");
+    annotation->set_string_value(function_name);
+    annotation = event->add_debug_annotations();
+    annotation->set_name("address");
+    annotation->set_pointer_value(hit.address);
+    annotation = event->add_debug_annotations();
+    annotation->set_name("size");
+    annotation->set_uint_value(hit.size);
+    annotation = event->add_debug_annotations();
+    annotation->set_name("value");
+    annotation->set_uint_value(hit.value);
+    annotation = event->add_debug_annotations();
+    annotation->set_name("cpu");
+    annotation->set_uint_value(hit.cpu);
+  }
+  *out = trace.SerializeAsString();
+}
+
+void TraceWriter::AddToFrame(uint64_t min_ts, uint64_t max_ts) {
+  if (!m_frameInfo.has_events) {
+    m_frameInfo.min_ts = min_ts;
+    m_frameInfo.max_ts = max_ts;
+    m_frameInfo.has_events = true;
+  }
+  m_frameInfo.min_ts = std::min(m_frameInfo.min_ts, min_ts);
+  m_frameInfo.max_ts = std::max(m_frameInfo.max_ts, max_ts);
+}
+
+void TraceWriter::Append(const std::string &data, bool descriptors) {
+  if (!m_compress) {
+    Write(data);
+    return;
+  }
+  if (m_frame.empty())
+    m_frameStart = std::chrono::steady_clock::now();
+  m_frame += data;
+  m_frameInfo.has_descriptors |= descriptors;
+  if (m_frame.size() >= kFrameSize)
+    FlushFrame();
+}
+
+void TraceWriter::FlushFrame() {
+  if (m_frame.empty())
+    return;
+  std::string frame = dejaview::trace_processor::util::CompressGzipFrame(
+      reinterpret_cast<const uint8_t *>(m_frame.data()), m_frame.size(),
+      kCompressionLevel);
+  m_bytesCompressed += m_frame.size();
+  m_frame.clear();
+  m_frameInfo.offset = m_bytesWritten;
+  m_frameInfo.size = static_cast<uint32_t>(frame.size());
+  m_frames.push_back(m_frameInfo);
+  m_frameInfo = FrameInfo();
+  Write(frame);
+
+  // Interned data and incremental state don't cross frames
+  for (size_t i = 0; i < m_maxVcpus; i++) {
+    Sequence *seq = m_sequences[i].load(std::memory_order_relaxed);
+    if (seq) {
+      seq->cleared = false;
+      seq->interned.clear();
+    }
+  }
+  m_sampleSequence.cleared = false;
+  m_sampleSequence.interned.clear();
+  m_sampleSequence.callstacks.clear();
+}
+
+void TraceWriter::WriteFrameIndex() {
+  FlushFrame();
+  protozero::HeapBuffered<Trace> trace;
+  auto *index = trace->add_packet()->set_trace_frame_index();
+  for (const FrameInfo &info : m_frames) {
+    auto *frame = index->add_frames();
+    frame->set_offset(info.offset);
+    frame->set_size(info.size);
+    if (info.has_events) {
+      frame->set_min_timestamp(info.min_ts);
+      frame->set_max_timestamp(info.max_ts);
+    }
+    frame->set_has_descriptors(info.has_descriptors);
+  }
+  std::string serialized = trace.SerializeAsString();
+  uint64_t index_offset = m_bytesWritten;
+  Write(dejaview::trace_processor::util::CompressGzipFrame(
+      reinterpret_cast<const uint8_t *>(serialized.data()), serialized.size(),
+      kCompressionLevel));
+  Write(dejaview::trace_processor::util::MakeGzipFrameLocator(index_offset));
+}
+
+void TraceWriter::Write(const std::string &data) {
+  if (data.empty())
+    return;
+  ssize_t written = dejaview::base::WriteAll(m_fd.get(), data.data(), data.size());
+  if (written <= 0) {
+    QEMU_LOG() << "Failed to write trace to disk.\n";
+    return;
+  }
+  m_bytesWritten += static_cast<uint64_t>(written);
+}
@@ -0,0 +1,166 @@
+#ifndef SRC_QEMU_PLUGIN_TRACE_WRITER_H_
+#define SRC_QEMU_PLUGIN_TRACE_WRITER_H_
+
+#include <cinttypes>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dejaview/ext/base/scoped_file.h"
+
+#include "event_ring.h"
+
+class Symbolizer;
+
+// Streams the trace to disk from a background thread.
+//
+// Every vCPU gets its own EventRing and its own TracePacket sequence. The
+// writer thread merges the rings: it drains whatever each vCPU published,
+// encodes it into TracePackets and appends them to the output file. Every
+// write appends whole packets so a trace is readable even if QEMU dies before
+// plugin_exit.
+//
+// When compressing, packets are gathered in frames which are compressed and
+// written as independent gzip members, followed by a frame index on exit (see
+// src/trace_processor/util/gzip_frames.h). Every frame clears the incremental
+// state of the sequences so that it can be read without the previous ones.
+//
+// In sampling mode, vCPUs submit samples instead, which are few enough to go
+// through a locked queue. They are written as PerfSamples on a sequence of
+// their own, where their frames and callstacks are interned.
+//
+// Hits of watchpoints go through a locked queue too, and are written as
+// instant TrackEvents on the track of the task which made the access, from a
+// sequence of their own.
+class TraceWriter {
+public:
+  struct Sample {
+    uint64_t ts;
+    uint32_t cpu;
+    uint32_t pid;
+    uint32_t tgid;
+    bool user;
+    // Outermost frame first
+    std::vector<FunctionId> stack;
+  };
+
+  struct WatchHit {
+    uint64_t ts;
+    uint64_t track_uuid;
+    uint32_t cpu;
+    // The function which made the access
+    FunctionId function;
+    // Must outlive the writer
+    const char *watch;
+    bool write;
+    uint64_t address;
+    uint8_t size;
+    // The lower 64 bits of wider accesses
+    uint64_t value;
+  };
+
+  TraceWriter(std::string destPath, Symbolizer *symbolizer, size_t maxVcpus,
+              bool compress);
+  ~TraceWriter();
+
+  bool IsValid() const { return m_fd.get() != -1; }
+
+  // Creates the ring of a vCPU. Must be called once per vCPU, from any thread.
+  EventRing *AddVcpu(unsigned int vcpu_id);
+  // Queues an already serialized Trace message (e.g. descriptors). It is
+  // guaranteed to be written before any event pushed after this call.
+  void SubmitPackets(std::string serialized);
+  // Queues a sample, from any thread.
+  void SubmitSample(Sample sample);
+  // Queues the hit of a watchpoint, from any thread.
+  void SubmitWatchHit(const WatchHit &hit);
+
+  // Writes everything queued so far and stops the writer thread.
+  void Finish();
+
+private:
+  // A TracePacket sequence fed by a single vCPU.
+  struct Sequence {
+    EventRing ring;
+    uint32_t sequence_id;
+    bool started = false;
+    // Whether the incremental state was cleared in the current frame
+    bool cleared = false;
+    // Interning state is scoped to a sequence, indexed by FunctionId.
+    std::vector<bool> interned;
+  };
+
+  // The sequence of the samples of all vCPUs.
+  struct SampleSequence {
+    uint32_t sequence_id;
+    bool started = false;
+    bool cleared = false;
+    // Frames are interned by FunctionId too
+    std::vector<bool> interned;
+    std::map<std::vector<FunctionId>, uint64_t> callstacks;
+  };
+
+  // What the frame index records about a frame
+  struct FrameInfo {
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    bool has_events = false;
+    uint64_t min_ts = 0;
+    uint64_t max_ts = 0;
+    bool has_descriptors = false;
+  };
+
+  void ThreadMain();
+  // Returns true if anything was written.
+  bool Drain();
+  void EncodeEvents(Sequence *seq, uint64_t count, std::string *out);
+  void EncodeSamples(const std::deque<Sample> &samples, std::string *out);
+  void EncodeWatchHits(const std::deque<WatchHit> &hits, std::string *out);
+  // Extends the timestamp range of the current frame.
+  void AddToFrame(uint64_t min_ts, uint64_t max_ts);
+  // Writes packets to the file, or to the current frame when compressing.
+  void Append(const std::string &data, bool descriptors);
+  void FlushFrame();
+  void WriteFrameIndex();
+  void Write(const std::string &data);
+
+  std::string m_destPath;
+  dejaview::base::ScopedFile m_fd;
+  Symbolizer *m_symbolizer;
+
+  // Slots are filled once by AddVcpu() and never change afterwards.
+  std::unique_ptr<std::atomic<Sequence *>[]> m_sequences;
+  std::vector<std::unique_ptr<Sequence>> m_ownedSequences;
+  size_t m_maxVcpus;
+
+  // Only accessed by the writer thread.
+  uint64_t m_bytesWritten = 0;
+  bool m_compress;
+  uint64_t m_bytesCompressed = 0;
+  std::string m_frame;
+  FrameInfo m_frameInfo;
+  std::chrono::steady_clock::time_point m_frameStart;
+  std::vector<FrameInfo> m_frames;
+  SampleSequence m_sampleSequence;
+  uint32_t m_watchSequenceId;
+  bool m_watchSequenceStarted = false;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::string> m_packets;
+  std::deque<Sample> m_samples;
+  std::deque<WatchHit> m_watchHits;
+  bool m_finishing = false;
+
+  std::thread m_thread;
+};
+
+#endif  // SRC_QEMU_PLUGIN_TRACE_WRITER_H_
@@ -1,30 +1,38 @@
 #include "tracer.h"
 
-#include <iomanip>
+#include <algorithm>
 
 #include "dejaview/ext/base/file_utils.h"
 #include "dejaview/ext/base/scoped_mmap.h"
 #include "dejaview/ext/base/string_splitter.h"
+#include "dejaview/protozero/scattered_heap_buffer.h"
 #include "dejaview/tracing/internal/track_event_internal.h"
 
+#include "protos/dejaview/trace/trace.pbzero.h"
+#include "protos/dejaview/trace/trace_packet.pbzero.h"
 #include "protos/dejaview/trace/track_event/process_descriptor.pbzero.h"
 #include "protos/dejaview/trace/track_event/thread_descriptor.pbzero.h"
-#include "protos/dejaview/trace/track_event/source_location.pbzero.h"
 #include "protos/dejaview/trace/track_event/track_descriptor.pbzero.h"
-#include "protos/dejaview/trace/track_event/track_event.pbzero.h"
 #include "protos/dejaview/trace/qemu/qemu_info.pbzero.h"
 
+#include "debug_sections.h"
+#include "symbol_cache.h"
 #include "dwarf/elf.h"
+#include "dwarf/type_index.h"
 
 #include "qemu_helpers.h"
 
 using Trace = dejaview::protos::pbzero::Trace;
 using TracePacket = dejaview::protos::pbzero::TracePacket;
-using TrackEvent_Type = dejaview::protos::pbzero::TrackEvent_Type;
 
-Tracer::Tracer(std::string destPath, std::string kernelPath, std::string startingFrom, uint64_t minInsns)
-    : m_destPath(destPath), m_kernelPath(kernelPath), m_symbolizer(),
-      m_vmi(), m_minInsns(minInsns) {
+Tracer::Tracer(std::string destPath, std::string kernelPath, std::string startingFrom,
+               uint64_t minInsns, size_t maxVcpus, std::string cacheDir,
+               Filter filter, Watchpoints watchpoints, std::string sysroot,
+               bool compress, uint64_t snapshotEvery)
+    : m_destPath(destPath), m_kernelPath(kernelPath), m_startingFrom(0),
+      m_inhibited(false), m_symbolizer(), m_filter(std::move(filter)),
+      m_watchpoints(std::move(watchpoints)), m_vmi(maxVcpus), m_vcpus(maxVcpus),
+      m_minInsns(minInsns) {
   dejaview::base::ScopedMmap kernel_mmap = dejaview::base::ReadMmapWholeFile(kernelPath.c_str());
   if (!kernel_mmap.IsValid()) {
     QEMU_LOG() << "Error: Failed to read file: " << kernelPath << std::endl;
@@ -34,31 +42,135 @@ Tracer::Tracer(std::string destPath, std::string kernelPath, std::string startin
                                kernel_mmap.length());
   ElfFile elf(kernel_view);
 
-  m_symbolizer.Init(elf);
-  if (m_vmi.Init(elf, &m_symbolizer) < 0) {
+  TaskStructLayout task_struct;
+  std::string cache_path = SymbolCache::PathFor(cacheDir, elf);
+  bool cached = LoadCachedSymbols(cache_path, &task_struct);
+  // Watched struct members aren't cached, the debug info is read for them too.
+  // Its type index is built once for VMI and the watchpoints.
+  DebugSections debug_sections;
+  std::unique_ptr<dwarf::TypeIndex> types;
+  if (!cached || m_watchpoints.HasFields()) {
+    debug_sections.Init(elf);
+    types = std::make_unique<dwarf::TypeIndex>(debug_sections.dwarf());
+    types->Build();
+  }
+  if (!cached)
+    LoadSymbols(elf, debug_sections, *types, cache_path, &task_struct);
+  m_filter.Compile(m_symbolizer);
+  if (!m_watchpoints.empty() &&
+      !m_watchpoints.Resolve(m_symbolizer, types.get()))
+    exit(1);
+  if (m_vmi.Init(task_struct, &m_symbolizer) < 0) {
     QEMU_LOG() << "Virtual Machine Introspection failed to find some symbols. "
                << "Expect process lookup to fail." << std::endl;
   }
+  if (!sysroot.empty()) {
+    if (m_vmi.CanReadMappings()) {
+      m_userSymbols = std::make_unique<UserSymbols>(
+          std::move(sysroot), &m_vmi, &m_symbolizer, maxVcpus);
+    } else {
+      QEMU_LOG() << "The VMAs of processes can't be found from the debug "
+                 << "info, userspace won't be symbolized" << std::endl;
+    }
+  }
   if (!startingFrom.empty()) {
-    m_startingFrom = m_symbolizer.lookupSymbol(startingFrom);
-    if (m_startingFrom) {
+    uint64_t starting_from_addr = m_symbolizer.lookupSymbol(startingFrom);
+    if (starting_from_addr) {
+      m_startingFrom = m_symbolizer.internAddress(starting_from_addr);
       m_inhibited = true;
     } else {
       QEMU_LOG() << startingFrom << " not found" << std::endl;
     }
   }
 
-  protos = new protozero::HeapBuffered<Trace>();
-  auto* packet = (*protos)->add_packet();
-  packet->set_trusted_packet_sequence_id(0);
-  packet->set_incremental_state_cleared(true);
-  packet->set_first_packet_on_sequence(true);
+  m_writer = std::make_unique<TraceWriter>(destPath, &m_symbolizer, maxVcpus,
+                                           compress);
+  if (!m_writer->IsValid())
+    exit(1);
+
+  StoreQemuInfo(snapshotEvery);
+}
+
+bool Tracer::LoadCachedSymbols(const std::string &cachePath,
+                               TaskStructLayout *task_struct) {
+  if (cachePath.empty())
+    return false;
+  SymbolCache cache;
+  if (!cache.Open(cachePath) || !cache.Read(task_struct) ||
+      !m_symbolizer.Load(cache))
+    return false;
+  QEMU_LOG() << "Loaded symbols from " << cachePath << std::endl;
+  return true;
+}
+
+void Tracer::LoadSymbols(ElfFile &elf, const DebugSections &debugSections,
+                         const dwarf::TypeIndex &types,
+                         const std::string &cachePath,
+                         TaskStructLayout *task_struct) {
+  bool has_debug_info = !debugSections.dwarf().debug_info.empty();
+  if (!has_debug_info) {
+    QEMU_LOG() << "No debug info found in " << m_kernelPath << std::endl;
+  }
+  m_symbolizer.Init(elf, debugSections.dwarf());
+  *task_struct = TaskStructLayout();
+  VMI::FindTaskStructLayout(types, task_struct);
+
+  // Don't remember symbols without debug info, it may just be unreadable
+  if (!cachePath.empty() && has_debug_info) {
+    SymbolCache cache;
+    cache.Append(*task_struct);
+    m_symbolizer.Save(cache);
+    if (cache.Save(cachePath))
+      QEMU_LOG() << "Saved symbols to " << cachePath << std::endl;
+  }
+}
+
+void Tracer::InitVcpu(unsigned int vcpu_id) {
+  auto vcpu = std::make_unique<VcpuState>();
+  vcpu->ring = m_writer->AddVcpu(vcpu_id);
+  // Nothing is traced until the task is known to pass the filter
+  vcpu->traced_task = !m_filter.HasTaskClauses();
+  m_vcpus[vcpu_id] = std::move(vcpu);
+}
+
+void Tracer::Finish() {
+  // Snapshots would be recorded after the trace got closed
+  if (m_snapshotter)
+    m_snapshotter->Stop();
+
+  // vCPUs are stopped by now so their last pending event can be flushed
+  for (auto &vcpu : m_vcpus) {
+    if (vcpu && vcpu->has_pending) {
+      vcpu->ring->Push(vcpu->pending);
+      vcpu->has_pending = false;
+    }
+  }
+  m_writer->Finish();
+}
+
+void Tracer::SwitchTrack(VcpuState &vcpu, uint64_t track_uuid, uint64_t ts) {
+  std::lock_guard<std::mutex> lock(m_tracksMutex);
+  // Close all slices of the previous track
+  if (vcpu.backtrace) {
+    for (const Frame &frame : *vcpu.backtrace) {
+      if (frame.visible)
+        PushEvent(vcpu, 0, ts, vcpu.track_uuid);
+    }
+  }
+  // And re-open all slices of the current track
+  std::vector<Frame> &backtrace = track_backtrace[track_uuid];
+  for (const Frame &parent : backtrace) {
+    if (parent.visible)
+      PushEvent(vcpu, parent.function, ts, track_uuid);
+  }
 
-  StoreQemuInfo();
+  vcpu.backtrace = &backtrace;
+  vcpu.track_uuid = track_uuid;
 }
 
-void Tracer::StoreQemuInfo() {
-  auto* packet = (*protos)->add_packet();
+void Tracer::StoreQemuInfo(uint64_t snapshotEvery) {
+  protozero::HeapBuffered<Trace> trace;
+  auto* packet = trace->add_packet();
   auto* qemu_info = packet->set_qemu_info();
 
   // Store the current-working-directory
@@ -68,85 +180,93 @@ void Tracer::StoreQemuInfo() {
 
   // And the QEMU command line
   std::string cmdline;
-  std::vector<std::string> replay_cmd;
+  std::vector<std::string> record_cmd;
   if (dejaview::base::ReadFile("/proc/self/cmdline", &cmdline)) {
     dejaview::base::StringSplitter splitter(std::move(cmdline), '\0');
     while (splitter.Next()) {
       std::string token(splitter.cur_token(), splitter.cur_token_size());
       qemu_info->add_record_cmd(token);
+      record_cmd.push_back(std::move(token));
     }
   }
-}
+  m_writer->SubmitPackets(trace.SerializeAsString());
 
-uint64_t Tracer::GetTrackUuid() {
-  static uint64_t ret = 0;
-
-  if (m_vmi.IsProcessInvalidated()) {
-    uint32_t tgid = 0, pid = 0;
-    std::string comm("Boot");
-    m_vmi.GetProcessInfo(tgid, pid, comm);
-
-    auto it = pid_to_uuid.find(pid);
-    if (it == pid_to_uuid.end()) {
-      ret = pid_to_uuid.size() + 1;
-
-      auto* packet = (*protos)->add_packet();
-      auto* desc = packet->set_track_descriptor();
-      desc->set_uuid(ret);
-      auto *process = desc->set_process();
-      process->set_pid(static_cast<int32_t>(tgid));
-      process->set_process_name(comm);
-
-  /*
-      auto* packet = (*protos)->add_packet();
-      tp.track_descriptor.uuid = uuid64()
-      TODO: generate the other uuid randomly too
-      tp.track_descriptor.parent_uuid = proc_uuid
-      tp.track_descriptor.thread.pid = proc.pid
-      tp.track_descriptor.thread.tid = thread.tid
-      tp.track_descriptor.thread.thread_name = "Thread"
-  */
-
-      pid_to_uuid.insert(std::make_pair(pid, ret));
-    } else {
-      ret = it->second;
-    }
+  // Snapshots are saved through the QMP monitor QEMU got started with
+  if (!snapshotEvery)
+    return;
+  std::string qmp_address = Snapshotter::FindQmpAddress(record_cmd);
+  if (qmp_address.empty()) {
+    QEMU_LOG() << "snapshot_every requires a tcp: or unix: -qmp monitor, "
+               << "no snapshots will be saved\n";
+    return;
   }
+  m_snapshotter = std::make_unique<Snapshotter>(
+      qmp_address, snapshotEvery,
+      [this](const std::string &name, uint64_t icount) {
+        StoreSnapshot(name, icount);
+      });
+  m_snapshotter->Start();
+}
 
-  return ret;
+void Tracer::StoreSnapshot(const std::string &name, uint64_t icount) {
+  protozero::HeapBuffered<Trace> trace;
+  auto* packet = trace->add_packet();
+  auto* snapshot = packet->set_qemu_info()->add_snapshots();
+  snapshot->set_name(name);
+  snapshot->set_icount(icount);
+  m_writer->SubmitPackets(trace.SerializeAsString());
 }
 
-uint64_t Tracer::GetFunctionUuid(dejaview::protos::pbzero::TracePacket *packet, uint64_t addr) {
-  uint64_t ret;
+uint64_t Tracer::GetTrackUuid(VcpuState &vcpu, unsigned int vcpu_id) {
+  // Only re-resolve the track when this vCPU went through the scheduler
+  if (!m_vmi.IsTaskInvalidated(vcpu_id) && vcpu.backtrace)
+    return vcpu.track_uuid;
 
-  auto it = addr_to_uuid.find(addr);
-  if (it == addr_to_uuid.end()) {
-    ret = addr_to_uuid.size() + 1;
-    auto* interned_data = packet->set_interned_data();
-
-    std::string function_name, file_name;
-    int line_number;
-    if (m_symbolizer.lookupAddress(addr, function_name, file_name, line_number)) {
-      auto* source_location = interned_data->add_source_locations();
-      source_location->set_iid(ret);
-      // Let's skip this since it's redundant with the slice name
-      // source_location->set_function_name(function_name);
-      source_location->set_file_name(file_name);
-      source_location->set_line_number(static_cast<uint32_t>(line_number));
-
-      auto* event_name = interned_data->add_event_names();
-      event_name->set_iid(ret);
-      event_name->set_name(function_name);
-    } else {
-      auto* event_name = interned_data->add_event_names();
-      event_name->set_iid(ret);
+  TaskInfo task;
+  if (!m_vmi.RefreshCurrentTask(vcpu_id, &task) && vcpu.backtrace)
+    return vcpu.track_uuid;
 
-      char *name;
-      asprintf(&name, "0x%lX", addr);
-      event_name->set_name(name);
-    }
+  SetTask(vcpu, task);
+  return GetTaskTrack(task, vcpu_id);
+}
 
-    addr_to_uuid.insert(std::make_pair(addr, ret));
+void Tracer::SetTask(VcpuState &vcpu, const TaskInfo &task) {
+  vcpu.traced_task = m_filter.IncludesTask(task);
+  vcpu.pid = task.pid;
+  vcpu.tgid = task.tgid;
+  if (m_userSymbols)
+    vcpu.address_space = m_userSymbols->AddressSpaceOf(task);
+}
+
+uint64_t Tracer::GetTaskTrack(const TaskInfo &task, unsigned int vcpu_id) {
+  uint64_t ret;
+  std::lock_guard<std::mutex> lock(m_tracksMutex);
+  // Every vCPU has its own idle task, all of them with pid 0
+  uint64_t key = task.pid ? task.pid : (1ull << 32) | vcpu_id;
+  auto it = pid_to_uuid.find(key);
+  if (it == pid_to_uuid.end()) {
+    ret = pid_to_uuid.size() + 1;
+
+    protozero::HeapBuffered<Trace> trace;
+    auto* packet = trace->add_packet();
+    auto* desc = packet->set_track_descriptor();
+    desc->set_uuid(ret);
+    auto *process = desc->set_process();
+    process->set_pid(static_cast<int32_t>(task.tgid));
+    process->set_process_name(task.comm);
+    m_writer->SubmitPackets(trace.SerializeAsString());
+
+/*
+    auto* packet = (*protos)->add_packet();
+    tp.track_descriptor.uuid = uuid64()
+    TODO: generate the other uuid randomly too
+    tp.track_descriptor.parent_uuid = proc_uuid
+    tp.track_descriptor.thread.pid = proc.pid
+    tp.track_descriptor.thread.tid = thread.tid
+    tp.track_descriptor.thread.thread_name = "Thread"
+*/
+
+    pid_to_uuid.insert(std::make_pair(key, ret));
   } else {
     ret = it->second;
   }
@@ -154,59 +274,88 @@ uint64_t Tracer::GetFunctionUuid(dejaview::protos::pbzero::TracePacket *packet,
   return ret;
 }
 
-void Tracer::WriteToDisk() {
-  QEMU_LOG() << "Saving to " << m_destPath << "...     ";
-
-  const auto dest_fd = dejaview::base::OpenFile(m_destPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
-  if (dest_fd.get() == -1) {
-    QEMU_LOG() << "\nFailed to open destination file; can't write trace.\n";
+void Tracer::LogSample(uint64_t addr, unsigned int vcpu_id, uint64_t ts) {
+  VcpuState &vcpu = *m_vcpus[vcpu_id];
+  // Without call callbacks, nothing tells when the scheduler ran
+  TaskInfo task;
+  if (m_vmi.RefreshCurrentTask(vcpu_id, &task)) {
+    SetTask(vcpu, task);
+    // Names the process of the samples
+    GetTaskTrack(task, vcpu_id);
+  }
+  if (!vcpu.traced_task)
     return;
+
+  // Innermost function first, then the callers found by following the chain
+  // of frame records: the caller's frame pointer, then the return address.
+  std::vector<FunctionId> stack;
+  stack.push_back(m_symbolizer.internAddress(addr));
+  uint64_t fp = read_frame_pointer();
+  // The first block of a function runs before its prologue saved the frame
+  // pointer, so the caller is only known from the return address
+  if (m_symbolizer.internFunctionStart(addr)) {
+    uint64_t ret = read_entry_return_address();
+    if (ret)
+      stack.push_back(m_symbolizer.internAddress(ret - 1));
+  }
+  while (fp && stack.size() < kMaxSampleDepth) {
+    uint64_t record[2];
+    if (!read_memory(fp, record, sizeof(record)) || !record[1])
+      break;
+    // Return addresses may be right past the end of a noreturn caller
+    stack.push_back(m_symbolizer.internAddress(record[1] - 1));
+    // Frames only ever get older up the stack, anything else is garbage
+    if (record[0] <= fp || record[0] % sizeof(uint64_t))
+      break;
+    fp = record[0];
   }
 
-  size_t queue_size = m_queue.size();
-  size_t i = 0;
-  int last_percentage = -1;
-  while (!m_queue.empty()) {
-      i++;
-      int percentage = static_cast<int>((static_cast<double>(i) / static_cast<double>(queue_size)) * 100);
-      if (percentage != last_percentage) {
-        last_percentage = percentage;
-        QEMU_LOG() << "\b\b\b\b" << std::setw(3) << percentage << "%";
-      }
-
-      tracing_event e = m_queue.front();
-
-      // Create an event for the timeline
-      auto* packet = (*protos)->add_packet();
-      packet->set_timestamp(e.ts);
-      packet->set_trusted_packet_sequence_id(0);
-      uint64_t call_uuid = 0;
-      if (e.addr)
-        call_uuid = GetFunctionUuid(packet, e.addr);
-
-      auto* event = packet->set_track_event();
-      event->add_category_iids(1);
-      event->set_track_uuid(e.track_uuid);
-      if (e.addr) {
-        event->set_name_iid(call_uuid);
-        // TODO: skip if failed to lookup event->set_source_location_iid(call_uuid);
-      }
-      // TODO: Extract arguments and return value
-
-      event->set_type(e.addr ? TrackEvent_Type::TYPE_SLICE_BEGIN
-                             : TrackEvent_Type::TYPE_SLICE_END);
-
-      m_queue.pop_front();
-  }
-
-  (*protos)->Finalize();
-  auto serialized = protos->SerializeAsString();
-
-  QEMU_LOG() << "\n";
-  const auto exported_data =
-      dejaview::base::WriteAll(dest_fd.get(), serialized.data(), serialized.size());
-  if (exported_data <= 0) {
-    QEMU_LOG() << "Failed to write trace to disk.\n";
-    return;
+  if (m_inhibited.load(std::memory_order_relaxed)) {
+    if (std::find(stack.begin(), stack.end(), m_startingFrom) == stack.end())
+      return;
+    m_inhibited.store(false, std::memory_order_relaxed);
   }
+  FunctionId sampled = stack.front();
+  for (FunctionId &function : stack)
+    function = ResolveFunction(vcpu, vcpu_id, function);
+  if (!m_filter.IncludesFunction(sampled, stack.front()))
+    return;
+
+  TraceWriter::Sample sample;
+  sample.ts = ts;
+  sample.cpu = vcpu_id;
+  sample.pid = vcpu.pid;
+  sample.tgid = vcpu.tgid;
+  // Both x86_64 and aarch64 kernels live in the upper half
+  sample.user = !(addr >> 63);
+  sample.stack.assign(stack.rbegin(), stack.rend());
+  m_writer->SubmitSample(std::move(sample));
+}
+
+void Tracer::LogWatchHit(size_t watch, FunctionId function,
+                         unsigned int vcpu_id, uint64_t ts, uint64_t address,
+                         uint64_t size, uint64_t value, bool write) {
+  // Operands matched at translation time may only be close to the range
+  if (!m_watchpoints.Hits(watch, address, size) ||
+      m_inhibited.load(std::memory_order_relaxed))
+    return;
+  VcpuState &vcpu = *m_vcpus[vcpu_id];
+  UpdateTrack(vcpu, vcpu_id, ts);
+  if (!vcpu.traced_task)
+    return;
+
+  // Unlike calls, hits from code the function filter leaves out are kept
+  FunctionId resolved = ResolveFunction(vcpu, vcpu_id, function);
+
+  TraceWriter::WatchHit hit;
+  hit.ts = ts;
+  hit.track_uuid = vcpu.track_uuid;
+  hit.cpu = vcpu_id;
+  hit.function = resolved;
+  hit.watch = m_watchpoints.name(watch).c_str();
+  hit.write = write;
+  hit.address = address;
+  hit.size = static_cast<uint8_t>(size);
+  hit.value = value;
+  m_writer->SubmitWatchHit(hit);
 }
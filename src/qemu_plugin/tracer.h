@@ -3,112 +3,344 @@
 
 #include <cinttypes>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
-#include <deque>
-#include <stack>
+#include <vector>
 
+#include "event_ring.h"
+#include "filter.h"
 #include "symbolizer.h"
-#include "dejaview/protozero/scattered_heap_buffer.h"
-#include "protos/dejaview/trace/trace.pbzero.h"
-#include "protos/dejaview/trace/trace_packet.pbzero.h"
 #include "qemu_helpers.h"
+#include "snapshotter.h"
+#include "trace_writer.h"
+#include "user_symbols.h"
+#include "watchpoints.h"
 
 #include "vmi.h"
 
+class DebugSections;
+class ElfFile;
+namespace dwarf {
+class TypeIndex;
+}
+
 class Tracer {
 public:
-  Tracer(std::string destPath, std::string kernelPath, std::string startingFrom, uint64_t minInsns);
+  Tracer(std::string destPath, std::string kernelPath, std::string startingFrom,
+         uint64_t minInsns, size_t maxVcpus, std::string cacheDir,
+         Filter filter, Watchpoints watchpoints, std::string sysroot,
+         bool compress, uint64_t snapshotEvery);
 
-  inline void LogCall(uint64_t addr, uint64_t /*vcpu_id*/, uint64_t ts) {
-    if (m_inhibited) {
-      if (addr == m_startingFrom) {
-        m_inhibited = false;
-      } else {
-        return;
-      }
-    }
-    uint64_t track_uuid = GetTrackUuid();
-    // When context switching
-    if (track_uuid != m_prevTrackUuid) {
-      // Close all slices of the previous track
-      for (uint64_t _ : track_backtrace[m_prevTrackUuid]) {
-        tracing_event e = {};
-        e.addr = 0;
-        e.ts = ts;
-        e.track_uuid = m_prevTrackUuid;
-        m_queue.push_back(e);
-      }
-      // And re-open all slices of the current track
-      for (uint64_t parent : track_backtrace[track_uuid]) {
-        tracing_event e = {};
-        e.addr = parent;
-        e.ts = ts;
-        e.track_uuid = track_uuid;
-        m_queue.push_back(e);
-      }
+  // Must be called from the vCPU thread before it logs any event.
+  void InitVcpu(unsigned int vcpu_id);
 
-      m_prevTrackUuid = track_uuid;
-    }
+  // Resolves the function a call lands in, at translation time.
+  FunctionId InternFunction(uint64_t addr) {
+    return m_symbolizer.internAddress(addr);
+  }
+  // Resolves the function a jump could tail call, or 0 if |addr| doesn't start
+  // a function.
+  FunctionId InternFunctionStart(uint64_t addr) {
+    return m_symbolizer.internFunctionStart(addr);
+  }
+  // Whether the code at |addr|, in |function|, passes the filter. Only meant
+  // for translation time.
+  bool TracesCode(uint64_t addr, FunctionId function) const {
+    return m_filter.IncludesCode(addr, function);
+  }
+  // Whether calls to |function| must be logged, even when the filter leaves
+  // it out, for tasks to be followed across context switches. Only meant for
+  // translation time too.
+  bool SwitchesTask(FunctionId function) const {
+    return m_vmi.SwitchesTask(function);
+  }
+  // Only meant for translation time too.
+  const Watchpoints &watchpoints() const { return m_watchpoints; }
+
+  // The shadow call stack remembers the stack pointer each frame was entered
+  // with. That is the stack pointer its ret executes with, so rets pop the
+  // frame they actually return from: frames left without a ret (longjmp,
+  // indirect tail calls...) are closed along with it, and rets which don't
+  // match any frame are ignored rather than unbalancing the stack.
+  inline void LogCall(FunctionId function, unsigned int vcpu_id, uint64_t ts,
+                      uint64_t sp) {
+    if (!CheckInhibited(function))
+      return;
+    VcpuState &vcpu = *m_vcpus[vcpu_id];
+    UpdateTrack(vcpu, vcpu_id, ts);
+    // Context switches are followed whatever task the vCPU leaves
+    m_vmi.LogCall(vcpu_id, function);
+    if (!vcpu.traced_task)
+      return;
+    FunctionId resolved = ResolveFunction(vcpu, vcpu_id, function);
+    if (!m_filter.IncludesFunction(function, resolved))
+      return;
+    function = resolved;
 
-    track_backtrace[track_uuid].push_back(addr);
-    tracing_event e = {};
-    e.addr = addr;
-    e.ts = ts;
-    e.track_uuid = track_uuid;
-    m_queue.push_back(e);
-    m_vmi.LogCall(addr);
+    // A live frame can't have been entered with the same stack pointer, so
+    // the frame found there was abandoned
+    ssize_t abandoned = FindFrame(vcpu, sp);
+    if (abandoned >= 0)
+      PopFrames(vcpu, static_cast<size_t>(abandoned), ts);
+    PushFrame(vcpu, function, ts, sp, false);
   }
 
-  inline void LogRet(uint64_t /*vcpu_id*/, uint64_t ts) {
-    if (m_inhibited) {
+  // A call to the scheduler's task switch which the filter leaves out: it
+  // gets no slice, but the task of the vCPU is read again afterwards.
+  inline void LogTaskSwitch(FunctionId function, unsigned int vcpu_id,
+                            uint64_t ts) {
+    if (!CheckInhibited(function))
+      return;
+    VcpuState &vcpu = *m_vcpus[vcpu_id];
+    UpdateTrack(vcpu, vcpu_id, ts);
+    m_vmi.LogCall(vcpu_id, function);
+  }
+
+  // Synchronous exceptions (syscalls, traps...) are slices of their own,
+  // named after the handler they land in.
+  inline void LogException(FunctionId function, unsigned int vcpu_id,
+                           uint64_t ts, uint64_t sp) {
+    if (m_inhibited.load(std::memory_order_relaxed))
+      return;
+    VcpuState &vcpu = *m_vcpus[vcpu_id];
+    UpdateTrack(vcpu, vcpu_id, ts);
+    if (!vcpu.traced_task)
+      return;
+    PushFrame(vcpu, function, ts, sp, true);
+  }
+
+  inline void LogRet(unsigned int vcpu_id, uint64_t ts, uint64_t sp) {
+    if (m_inhibited.load(std::memory_order_relaxed)) {
         return;
     }
-    uint64_t track_uuid = GetTrackUuid();
-    if (track_backtrace[track_uuid].empty()) {
-      // No slice left to close
+    VcpuState &vcpu = *m_vcpus[vcpu_id];
+    UpdateTrack(vcpu, vcpu_id, ts);
+    if (!vcpu.traced_task)
+      return;
+    ssize_t frame = FindFrame(vcpu, sp);
+    if (frame < 0) {
+      // Not returning from any slice we opened
       return;
     }
-    auto last_event = m_queue.back();
-    if (last_event.addr &&
-      last_event.track_uuid == track_uuid &&
-      ts - last_event.ts < m_minInsns) {
-      m_queue.pop_back();
-    } else {
-      tracing_event e = {};
-      e.addr = 0;
-      e.ts = ts;
-      e.track_uuid = track_uuid;
-      m_queue.push_back(e);
+    PopFrames(vcpu, static_cast<size_t>(frame), ts);
+  }
+
+  // The stack pointer an exception returns with belongs to the interrupted
+  // context, so exception frames can't be matched like calls. Asynchronous
+  // interrupts aren't seen entering, only returning, so this only closes an
+  // exception frame once all the calls made from it returned.
+  inline void LogExceptionReturn(unsigned int vcpu_id, uint64_t ts) {
+    if (m_inhibited.load(std::memory_order_relaxed))
+      return;
+    VcpuState &vcpu = *m_vcpus[vcpu_id];
+    UpdateTrack(vcpu, vcpu_id, ts);
+    if (!vcpu.traced_task)
+      return;
+    if (!vcpu.backtrace->empty() && vcpu.backtrace->back().exception)
+      PopFrames(vcpu, vcpu.backtrace->size() - 1, ts);
+  }
+
+  // A jump to the start of a function, after its caller restored the stack
+  // pointer it was entered with, replaces the caller's frame.
+  inline void LogTailCall(FunctionId function, unsigned int vcpu_id,
+                          uint64_t ts, uint64_t sp) {
+    if (!CheckInhibited(function))
+      return;
+    VcpuState &vcpu = *m_vcpus[vcpu_id];
+    UpdateTrack(vcpu, vcpu_id, ts);
+    m_vmi.LogCall(vcpu_id, function);
+    if (!vcpu.traced_task)
+      return;
+    if (vcpu.backtrace->empty() || vcpu.backtrace->back().sp != sp ||
+        vcpu.backtrace->back().exception) {
+      // Just a jump inside of the current function
+      return;
     }
-    track_backtrace[track_uuid].pop_back();
+    PopFrames(vcpu, vcpu.backtrace->size() - 1, ts);
+    // Tail calls out of the filtered code only end the caller
+    if (!function)
+      return;
+    FunctionId resolved = ResolveFunction(vcpu, vcpu_id, function);
+    if (m_filter.IncludesFunction(function, resolved))
+      PushFrame(vcpu, resolved, ts, sp, false);
   }
-  void WriteToDisk();
+
+  // Sampling mode: records the function the block at |addr| is in, along
+  // with its callers unwound from frame pointers (kernels need
+  // CONFIG_FRAME_POINTER). Must be called from a callback registered with
+  // QEMU_CB_R_REGS on the first instruction of the block.
+  void LogSample(uint64_t addr, unsigned int vcpu_id, uint64_t ts);
+
+  // Logs an access of |size| bytes at |address| by an instruction of
+  // |function| matched to |watch| at translation time, if it did touch the
+  // watched range. Must be called from a memory callback.
+  void LogWatchHit(size_t watch, FunctionId function, unsigned int vcpu_id,
+                   uint64_t ts, uint64_t address, uint64_t size,
+                   uint64_t value, bool write);
+
+  // Flushes pending events and closes the trace file.
+  void Finish();
 
 private:
-  void StoreQemuInfo();
-  uint64_t GetTrackUuid();
-  uint64_t GetFunctionUuid(dejaview::protos::pbzero::TracePacket *packet, uint64_t addr);
+  // Only this many innermost frames are searched for a matching stack pointer,
+  // which keeps every event O(1).
+  static constexpr size_t kMaxUnwindScan = 64;
+  // Samples are unwound up to this many frames, stacks can be corrupted.
+  static constexpr size_t kMaxSampleDepth = 64;
+
+  // A slice opened on the shadow call stack. Frames hidden by max_depth or
+  // ignore_below are still tracked to match their rets, but emit no events.
+  struct Frame {
+    FunctionId function;
+    bool exception;
+    bool visible;
+    uint64_t sp;
+  };
+
+  // State only ever touched by the thread of a given vCPU.
+  struct VcpuState {
+    EventRing *ring;
+    uint64_t track_uuid = 0;
+    std::vector<Frame> *backtrace = nullptr;
+    // Whether the current task passes the filter
+    bool traced_task = true;
+    // The last event is held back so that a short slice can still be dropped
+    // when its end comes right after its begin.
+    tracing_event pending;
+    bool has_pending = false;
+    // The current task
+    uint32_t pid = 0;
+    uint32_t tgid = 0;
+    // The userspace of the current task, when symbolizing it
+    UserSymbols::AddressSpace *address_space = nullptr;
+  };
+
+  // Userspace functions are interned by address at translation time, they
+  // only resolve to a symbol in the context of a process.
+  inline FunctionId ResolveFunction(VcpuState &vcpu, unsigned int vcpu_id,
+                                    FunctionId function) {
+    if (!vcpu.address_space || function <= m_symbolizer.symbolCount())
+      return function;
+    return m_userSymbols->Resolve(vcpu_id, vcpu.address_space, function);
+  }
+
+  inline void PushEvent(VcpuState &vcpu, FunctionId function, uint64_t ts,
+                        uint64_t track_uuid) {
+    if (vcpu.has_pending)
+      vcpu.ring->Push(vcpu.pending);
+    vcpu.pending.function = function;
+    vcpu.pending.ts = ts;
+    vcpu.pending.track_uuid = track_uuid;
+    vcpu.has_pending = true;
+  }
+
+  // Returns false if events are still inhibited, even after |function|.
+  inline bool CheckInhibited(FunctionId function) {
+    if (m_inhibited.load(std::memory_order_relaxed)) {
+      if (function == m_startingFrom) {
+        m_inhibited.store(false, std::memory_order_relaxed);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns the index of the innermost call frame entered with |sp|, or -1.
+  inline ssize_t FindFrame(VcpuState &vcpu, uint64_t sp) {
+    const std::vector<Frame> &backtrace = *vcpu.backtrace;
+    size_t end = backtrace.size() > kMaxUnwindScan
+                     ? backtrace.size() - kMaxUnwindScan
+                     : 0;
+    for (size_t i = backtrace.size(); i > end; i--) {
+      const Frame &frame = backtrace[i - 1];
+      if (frame.sp == sp && !frame.exception)
+        return static_cast<ssize_t>(i - 1);
+    }
+    return -1;
+  }
+
+  inline void PushFrame(VcpuState &vcpu, FunctionId function, uint64_t ts,
+                        uint64_t sp, bool exception) {
+    std::vector<Frame> &backtrace = *vcpu.backtrace;
+    bool visible = backtrace.size() < m_filter.max_depth();
+    if (!backtrace.empty()) {
+      const Frame &parent = backtrace.back();
+      visible &= parent.visible && !m_filter.IgnoresBelow(parent.function);
+    }
+    backtrace.push_back(Frame{function, exception, visible, sp});
+    if (visible)
+      PushEvent(vcpu, function, ts, vcpu.track_uuid);
+  }
+
+  // Closes the slices of all frames from |index| up.
+  inline void PopFrames(VcpuState &vcpu, size_t index, uint64_t ts) {
+    while (vcpu.backtrace->size() > index) {
+      bool visible = vcpu.backtrace->back().visible;
+      vcpu.backtrace->pop_back();
+      if (!visible)
+        continue;
+      // Drop slices shorter than min_insns while their begin is still pending
+      if (vcpu.has_pending && vcpu.pending.function &&
+          vcpu.pending.track_uuid == vcpu.track_uuid &&
+          ts - vcpu.pending.ts < m_minInsns) {
+        vcpu.has_pending = false;
+        continue;
+      }
+      PushEvent(vcpu, 0, ts, vcpu.track_uuid);
+    }
+  }
+
+  inline void UpdateTrack(VcpuState &vcpu, unsigned int vcpu_id, uint64_t ts) {
+    uint64_t track_uuid = GetTrackUuid(vcpu, vcpu_id);
+    // When context switching
+    if (track_uuid != vcpu.track_uuid)
+      SwitchTrack(vcpu, track_uuid, ts);
+  }
+
+  // Initializes the symbolizer from the symbol cache at |cachePath|, if any.
+  // Returns false when it can't be used.
+  bool LoadCachedSymbols(const std::string &cachePath,
+                         TaskStructLayout *task_struct);
+  // Initializes the symbolizer from the ELF and its debug info instead, and
+  // saves them to |cachePath| for the next runs.
+  void LoadSymbols(ElfFile &elf, const DebugSections &debugSections,
+                   const dwarf::TypeIndex &types, const std::string &cachePath,
+                   TaskStructLayout *task_struct);
+  void SwitchTrack(VcpuState &vcpu, uint64_t track_uuid, uint64_t ts);
+  // Also starts saving snapshots every |snapshotEvery| instructions, if any.
+  void StoreQemuInfo(uint64_t snapshotEvery);
+  // Called from the snapshot thread.
+  void StoreSnapshot(const std::string &name, uint64_t icount);
+  uint64_t GetTrackUuid(VcpuState &vcpu, unsigned int vcpu_id);
+  // Updates what is known of the task |vcpu| switched to.
+  void SetTask(VcpuState &vcpu, const TaskInfo &task);
+  // Returns the track of |task|, describing it the first time.
+  uint64_t GetTaskTrack(const TaskInfo &task, unsigned int vcpu_id);
 
   std::string m_destPath;
   std::string m_kernelPath;
-  uint64_t m_startingFrom;
-  bool m_inhibited;
+  FunctionId m_startingFrom;
+  std::atomic<bool> m_inhibited;
   Symbolizer m_symbolizer;
+  Filter m_filter;
+  Watchpoints m_watchpoints;
   VMI m_vmi;
-  protozero::HeapBuffered<dejaview::protos::pbzero::Trace> *protos;
+  std::unique_ptr<UserSymbols> m_userSymbols;
+  std::unique_ptr<TraceWriter> m_writer;
+  std::unique_ptr<Snapshotter> m_snapshotter;
+  std::vector<std::unique_ptr<VcpuState>> m_vcpus;
+
+  // Tasks migrate between vCPUs so tracks are shared, but they are only looked
+  // up when a vCPU switches to another task.
+  std::mutex m_tracksMutex;
   std::unordered_map<uint64_t, uint64_t> pid_to_uuid;
-  std::unordered_map<uint64_t, uint64_t> addr_to_uuid;
-  std::unordered_map<uint64_t, std::vector<uint64_t>> track_backtrace;
+  std::unordered_map<uint64_t, std::vector<Frame>> track_backtrace;
 
-  struct tracing_event {
-    uint64_t addr;
-    uint64_t ts;
-    uint64_t track_uuid;
-  };
-  std::deque<tracing_event> m_queue;
   uint64_t m_minInsns;
-  uint64_t m_prevTrackUuid;
 };
 
 #endif  // SRC_QEMU_PLUGIN_TRACER_H_
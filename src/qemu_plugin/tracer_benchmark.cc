@@ -0,0 +1,358 @@
+#include "tracer.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "dejaview/ext/base/file_utils.h"
+#include "dejaview/ext/base/temp_file.h"
+
+#include "debug_sections.h"
+#include "dwarf/elf.h"
+#include "fake_qemu_api.h"
+#include "symbol_cache.h"
+#include "symbolizer.h"
+#include "vmi.h"
+
+// Measures what the tracer costs per event, without QEMU: synthetic streams of
+// calls, rets and context switches are replayed against a Tracer whose guest
+// is faked by fake_qemu_api.cc.
+
+namespace {
+
+using benchmark::Counter;
+
+// A kernel-like address space: tens of thousands of functions, mostly small
+constexpr uint64_t kTextStart = 0xffffffff81000000ull;
+constexpr size_t kFunctionCount = 40000;
+constexpr size_t kEventsPerRun = 1 << 20;
+// Call stacks wander around kMeanDepth frames, up to kMaxDepth
+constexpr size_t kMeanDepth = 16;
+constexpr size_t kMaxDepth = 48;
+// Roughly how many events a task runs before being switched out
+constexpr uint32_t kEventsPerSlice = 4096;
+constexpr uint32_t kMaxTasks = 16;
+
+// What VMI reads from the guest: the current task from the per-CPU area
+// gs_base points to, then the ids and name of the task
+struct FakePerCpu {
+  uint64_t unused;
+  uint64_t current_task;
+};
+struct FakeTask {
+  uint32_t tgid;
+  uint32_t pid;
+  char comm[16];
+};
+
+struct ElfSymbol {
+  std::string name;
+  uint64_t address;
+  uint64_t size;
+};
+
+// Just enough of an ELF for the symbolizer and the symbol cache: the symbol
+// table and a build-id.
+std::string MakeElf(const std::vector<ElfSymbol> &symbols) {
+  std::string strtab(1, '\0');
+  std::vector<Elf64_Sym> symtab(1);
+  for (const ElfSymbol &symbol : symbols) {
+    Elf64_Sym sym = {};
+    sym.st_name = static_cast<Elf64_Word>(strtab.size());
+    sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    sym.st_shndx = 1;
+    sym.st_value = symbol.address;
+    sym.st_size = symbol.size;
+    symtab.push_back(sym);
+    strtab += symbol.name;
+    strtab.push_back('\0');
+  }
+  std::string note(sizeof(Elf64_Nhdr), '\0');
+  Elf64_Nhdr nhdr = {4, 20, NT_GNU_BUILD_ID};
+  memcpy(&note[0], &nhdr, sizeof(nhdr));
+  note += std::string("GNU\0", 4) + std::string(20, '\x42');
+  const char shstrtab[] =
+      "\0.text\0.symtab\0.strtab\0.note.gnu.build-id\0.shstrtab";
+
+  std::string elf(sizeof(Elf64_Ehdr), '\0');
+  std::vector<Elf64_Shdr> headers(1);
+  auto add_section = [&elf, &headers](Elf64_Word name, Elf64_Word type,
+                                      const void *data, size_t size,
+                                      Elf64_Word link, Elf64_Xword entsize) {
+    Elf64_Shdr header = {};
+    header.sh_name = name;
+    header.sh_type = type;
+    header.sh_offset = elf.size();
+    header.sh_size = size;
+    header.sh_link = link;
+    header.sh_addralign = 8;
+    header.sh_entsize = entsize;
+    headers.push_back(header);
+    elf.append(static_cast<const char *>(data), size);
+    elf.resize((elf.size() + 7) & ~size_t(7));
+  };
+  // Symbols are defined in section 1
+  add_section(1, SHT_PROGBITS, "", 0, 0, 0);
+  add_section(7, SHT_SYMTAB, symtab.data(), symtab.size() * sizeof(Elf64_Sym),
+              3, sizeof(Elf64_Sym));
+  add_section(15, SHT_STRTAB, strtab.data(), strtab.size(), 0, 0);
+  add_section(23, SHT_NOTE, note.data(), note.size(), 0, 0);
+  add_section(42, SHT_STRTAB, shstrtab, sizeof(shstrtab), 0, 0);
+  uint64_t section_headers = elf.size();
+  elf.append(reinterpret_cast<const char *>(headers.data()),
+             headers.size() * sizeof(Elf64_Shdr));
+
+  Elf64_Ehdr ehdr = {};
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_type = ET_EXEC;
+  ehdr.e_machine = EM_X86_64;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr.e_shentsize = sizeof(Elf64_Shdr);
+  ehdr.e_shnum = static_cast<Elf64_Half>(headers.size());
+  ehdr.e_shstrndx = 5;
+  ehdr.e_shoff = section_headers;
+  memcpy(&elf[0], &ehdr, sizeof(ehdr));
+  return elf;
+}
+
+// The kernel the tracer symbolizes, along with a symbol cache which provides
+// the task_struct layout that DWARF would.
+class SyntheticKernel {
+public:
+  SyntheticKernel() : m_dir(dejaview::base::TempDir::Create()) {
+    std::minstd_rand rng(1);
+    std::lognormal_distribution<double> size_dist(5.0, 1.0);
+    std::vector<ElfSymbol> symbols;
+    uint64_t address = kTextStart;
+    for (size_t i = 0; i < kFunctionCount; i++) {
+      uint64_t size = std::clamp<uint64_t>(
+          static_cast<uint64_t>(size_dist(rng)) & ~uint64_t(15), 16, 16384);
+      symbols.push_back({"func_" + std::to_string(i), address, size});
+      address += size;
+    }
+    symbols.push_back({"__switch_to_asm", address, 64});
+    // Per-CPU symbols are offsets in the per-CPU area
+    symbols.push_back({"pcpu_hot", offsetof(FakePerCpu, current_task), 8});
+
+    m_elfPath = m_dir.path() + "/vmlinux";
+    std::string elf_data = MakeElf(symbols);
+    dejaview::base::ScopedFile fd = dejaview::base::OpenFile(
+        m_elfPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dejaview::base::WriteAll(*fd, elf_data.data(), elf_data.size());
+    fd.reset();
+
+    ElfFile elf(elf_data);
+    DebugSections debug_sections;
+    debug_sections.Init(elf);
+    Symbolizer symbolizer;
+    symbolizer.Init(elf, debug_sections.dwarf());
+    for (size_t i = 0; i < kFunctionCount; i++)
+      m_functions.push_back(symbolizer.internAddress(symbols[i].address));
+    m_switchTo = symbolizer.internAddress(symbols[kFunctionCount].address);
+
+    TaskStructLayout layout;
+    layout.tgid = offsetof(FakeTask, tgid);
+    layout.pid = offsetof(FakeTask, pid);
+    layout.comm = offsetof(FakeTask, comm);
+    SymbolCache cache;
+    cache.Append(layout);
+    symbolizer.Save(cache);
+    m_cachePath = SymbolCache::PathFor(m_dir.path(), elf);
+    cache.Save(m_cachePath);
+  }
+
+  ~SyntheticKernel() {
+    remove(m_cachePath.c_str());
+    remove(m_elfPath.c_str());
+  }
+
+  const std::string &dir() const { return m_dir.path(); }
+  const std::string &elf_path() const { return m_elfPath; }
+  const std::vector<FunctionId> &functions() const { return m_functions; }
+  FunctionId switch_to() const { return m_switchTo; }
+
+private:
+  dejaview::base::TempDir m_dir;
+  std::string m_elfPath;
+  std::string m_cachePath;
+  std::vector<FunctionId> m_functions;
+  FunctionId m_switchTo = 0;
+};
+
+// Built once, removed at exit
+const SyntheticKernel &GetKernel() {
+  static SyntheticKernel kernel;
+  return kernel;
+}
+
+struct Event {
+  enum Kind : uint8_t { kCall, kRet, kSwitch };
+  Kind kind;
+  // For kSwitch, the task switched to
+  uint8_t task;
+  // Instructions executed since the previous event
+  uint16_t insns;
+  FunctionId function;
+  uint64_t sp;
+};
+
+// Every task has its own kernel stack, frames are entered 64 bytes apart
+uint64_t StackPointer(uint32_t task, size_t depth) {
+  return 0xffffc90000000000ull + (task + 1) * 0x10000ull - depth * 64;
+}
+
+// A random walk of the call depth of |tasks| tasks, calling functions picked
+// with a heavy skew towards a few hot ones, like real workloads.
+std::vector<Event> MakeStream(const SyntheticKernel &kernel, uint32_t tasks) {
+  std::minstd_rand rng(42);
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::vector<FunctionId> by_hotness = kernel.functions();
+  std::shuffle(by_hotness.begin(), by_hotness.end(), rng);
+
+  std::vector<Event> events;
+  events.reserve(kEventsPerRun);
+  std::vector<size_t> depth(tasks, 0);
+  std::vector<bool> switched_out(tasks, false);
+  uint32_t current = 0;
+  while (events.size() < kEventsPerRun) {
+    Event event = {};
+    event.insns = static_cast<uint16_t>(1 + rng() % 64);
+
+    if (tasks > 1 && rng() % kEventsPerSlice == 0) {
+      // Switching out is a call to the scheduler, which returns once the
+      // task gets switched back in
+      uint32_t next =
+          (current + 1 + static_cast<uint32_t>(rng() % (tasks - 1))) % tasks;
+      event.kind = Event::kSwitch;
+      event.task = static_cast<uint8_t>(next);
+      event.sp = StackPointer(current, ++depth[current]);
+      switched_out[current] = true;
+      events.push_back(event);
+      current = next;
+      if (switched_out[current]) {
+        event.kind = Event::kRet;
+        event.sp = StackPointer(current, depth[current]--);
+        switched_out[current] = false;
+        events.push_back(event);
+      }
+      continue;
+    }
+
+    double p_call = 0.5 + (static_cast<double>(kMeanDepth) -
+                           static_cast<double>(depth[current])) * 0.02;
+    if (depth[current] == 0)
+      p_call = 1;
+    if (depth[current] >= kMaxDepth)
+      p_call = 0;
+    if (unit(rng) < p_call) {
+      size_t hotness = static_cast<size_t>(
+          static_cast<double>(by_hotness.size()) * std::pow(unit(rng), 4));
+      event.kind = Event::kCall;
+      event.function = by_hotness[hotness];
+      event.sp = StackPointer(current, ++depth[current]);
+    } else {
+      event.kind = Event::kRet;
+      event.sp = StackPointer(current, depth[current]--);
+    }
+    events.push_back(event);
+  }
+  return events;
+}
+
+void Replay(Tracer &tracer, const std::vector<Event> &events,
+            FunctionId switch_to, FakePerCpu &per_cpu, FakeTask *tasks) {
+  uint64_t ts = 0;
+  for (const Event &event : events) {
+    ts += event.insns;
+    switch (event.kind) {
+      case Event::kCall:
+        tracer.LogCall(event.function, 0, ts, event.sp);
+        break;
+      case Event::kRet:
+        tracer.LogRet(0, ts, event.sp);
+        break;
+      case Event::kSwitch:
+        tracer.LogCall(switch_to, 0, ts, event.sp);
+        per_cpu.current_task = reinterpret_cast<uintptr_t>(&tasks[event.task]);
+        break;
+    }
+  }
+}
+
+void BM_QemuPluginTracer(benchmark::State &state) {
+  uint32_t task_count = static_cast<uint32_t>(state.range(0));
+  bool compress = state.range(1) != 0;
+  const SyntheticKernel &kernel = GetKernel();
+  std::vector<Event> events = MakeStream(kernel, task_count);
+
+  FakeTask tasks[kMaxTasks];
+  for (uint32_t i = 0; i < kMaxTasks; i++) {
+    tasks[i].tgid = 100 + i / 2;
+    tasks[i].pid = 100 + i;
+    snprintf(tasks[i].comm, sizeof(tasks[i].comm), "task%u", i);
+  }
+  FakePerCpu per_cpu = {};
+  fake_qemu::SetRegister("gs_base", reinterpret_cast<uintptr_t>(&per_cpu));
+
+  std::string trace_path = kernel.dir() + "/trace.dvtrace";
+  uint64_t bytes = 0;
+  for (auto _ : state) {
+    // Only the vCPU side is timed, the writer thread runs concurrently
+    state.PauseTiming();
+    auto tracer = std::make_unique<Tracer>(
+        trace_path, kernel.elf_path(), "", 0, 1, kernel.dir(), Filter(),
+        Watchpoints(), "", compress, 0);
+    tracer->InitVcpu(0);
+    per_cpu.current_task = reinterpret_cast<uintptr_t>(&tasks[0]);
+    state.ResumeTiming();
+
+    Replay(*tracer, events, kernel.switch_to(), per_cpu, tasks);
+
+    state.PauseTiming();
+    tracer->Finish();
+    tracer.reset();
+    std::optional<uint64_t> size = dejaview::base::GetFileSize(trace_path);
+    bytes += size.value_or(0);
+    state.ResumeTiming();
+  }
+  remove(trace_path.c_str());
+
+  double total_events = static_cast<double>(events.size()) *
+                        static_cast<double>(state.iterations());
+  state.counters["s/event"] =
+      Counter(static_cast<double>(events.size()),
+              Counter::kIsIterationInvariantRate | Counter::kInvert);
+  state.counters["bytes/event"] =
+      Counter(static_cast<double>(bytes) / total_events);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  state.counters["peak_rss"] =
+      Counter(static_cast<double>(usage.ru_maxrss) * 1024, Counter::kDefaults,
+              Counter::OneK::kIs1024);
+}
+
+}  // namespace
+
+BENCHMARK(BM_QemuPluginTracer)
+    ->ArgNames({"tasks", "compress"})
+    ->Args({1, 0})
+    ->Args({8, 0})
+    ->Args({8, 1})
+    ->Unit(benchmark::kMillisecond);
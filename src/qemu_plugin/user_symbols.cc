@@ -0,0 +1,138 @@
+#include "user_symbols.h"
+
+#include <algorithm>
+#include <string_view>
+#include <utility>
+
+#include "dejaview/ext/base/scoped_mmap.h"
+
+#include "debug_sections.h"
+#include "dwarf/elf.h"
+
+#include "qemu_helpers.h"
+
+// vm_pgoff counts pages, assumed to be 4K
+static constexpr uint64_t kPageSize = 4096;
+
+UserSymbols::UserSymbols(std::string sysroot, VMI *vmi, Symbolizer *symbolizer,
+                         size_t maxVcpus)
+    : m_sysroot(std::move(sysroot)), m_vmi(vmi), m_symbolizer(symbolizer),
+      m_vcpus(maxVcpus) {}
+
+UserSymbols::AddressSpace *UserSymbols::AddressSpaceOf(const TaskInfo &task) {
+  if (!task.mm)
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::unique_ptr<AddressSpace> &space = m_spaces[task.mm];
+  // mm_structs get reused once their process exits
+  if (space && space->tgid != task.tgid)
+    m_retired.push_back(std::move(space));
+  if (!space) {
+    space = std::make_unique<AddressSpace>();
+    space->mm = task.mm;
+    space->tgid = task.tgid;
+    space->stale = true;
+  }
+  // Userspace may not map the kernel, so VMAs are only listed from here
+  if (space->stale) {
+    m_vmi->ReadMappings(space->mm, &space->mappings);
+    space->stale = false;
+  }
+  return space.get();
+}
+
+FunctionId UserSymbols::ResolveSlow(AddressSpace *space, FunctionId function,
+                                    bool *cacheable) {
+  *cacheable = true;
+  uint64_t address;
+  // Kernel functions, and symbols of modules already
+  if (!m_symbolizer->unknownAddress(function, &address) || address >> 63)
+    return function;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto it = space->resolved.find(function);
+  if (it != space->resolved.end())
+    return it->second;
+
+  const std::vector<VMI::Mapping> &mappings = space->mappings;
+  auto mapping = std::upper_bound(
+      mappings.begin(), mappings.end(), address,
+      [](uint64_t addr, const VMI::Mapping &m) { return addr < m.start; });
+  if (mapping == mappings.begin() || address >= (--mapping)->end) {
+    // Mapped after the VMAs were listed, they are listed again on the next
+    // switch to this process
+    space->stale = true;
+    *cacheable = false;
+    return function;
+  }
+  if (mapping->path.empty()) {
+    space->resolved.insert(std::make_pair(function, function));
+    return function;
+  }
+
+  // The mappings may be listed again once unlocked
+  std::string path = mapping->path;
+  uint64_t offset = address - mapping->start + mapping->pgoff * kPageSize;
+  std::unique_ptr<ModuleSlot> &slot = m_modules[path];
+  if (!slot)
+    slot = std::make_unique<ModuleSlot>();
+  ModuleSlot *module_slot = slot.get();
+  lock.unlock();
+
+  // Reading a binary and its debug info takes a while, other vCPUs keep
+  // resolving what is already loaded meanwhile
+  std::call_once(module_slot->loaded,
+                 [&]() { module_slot->module = LoadModule(path); });
+  const Module *module = module_slot->module.get();
+
+  FunctionId resolved = function;
+  if (module) {
+    for (const Module::Segment &segment : module->segments) {
+      if (offset - segment.offset >= segment.size)
+        continue;
+      FunctionId id = m_symbolizer->internModuleAddress(
+          module->symbols, offset - segment.offset + segment.vaddr);
+      if (id)
+        resolved = id;
+      break;
+    }
+  }
+
+  lock.lock();
+  space->resolved.insert(std::make_pair(function, resolved));
+  return resolved;
+}
+
+std::unique_ptr<UserSymbols::Module>
+UserSymbols::LoadModule(const std::string &path) const {
+  std::string host_path = m_sysroot + path;
+  dejaview::base::ScopedMmap mmap =
+      dejaview::base::ReadMmapWholeFile(host_path.c_str());
+  if (!mmap.IsValid()) {
+    QEMU_LOG() << "Can't read " << host_path << ", its code won't be "
+               << "symbolized" << std::endl;
+    return nullptr;
+  }
+  ElfFile elf(std::string_view(static_cast<char *>(mmap.data()),
+                               mmap.length()));
+  if (!elf.IsOpen()) {
+    QEMU_LOG() << host_path << " isn't an ELF file" << std::endl;
+    return nullptr;
+  }
+
+  auto module = std::make_unique<Module>();
+  for (Elf64_Xword i = 0; i < elf.header().e_phnum; i++) {
+    ElfFile::Segment segment;
+    elf.ReadSegment(i, &segment);
+    const Elf64_Phdr &header = segment.header();
+    if (header.p_type == PT_LOAD)
+      module->segments.push_back(
+          Module::Segment{header.p_offset, header.p_filesz, header.p_vaddr});
+  }
+  DebugSections debug_sections;
+  debug_sections.Init(elf);
+  module->symbols.Init(elf, debug_sections.dwarf());
+  QEMU_LOG() << "Loaded symbols of " << path << std::endl;
+  return module;
+}
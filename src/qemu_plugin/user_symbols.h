@@ -0,0 +1,111 @@
+#ifndef SRC_QEMU_PLUGIN_USER_SYMBOLS_H_
+#define SRC_QEMU_PLUGIN_USER_SYMBOLS_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "symbolizer.h"
+#include "vmi.h"
+
+// Symbolizes userspace code with the binaries a process maps, read from a
+// sysroot on the host, eg. the guest's root filesystem mounted somewhere.
+//
+// Userspace blocks are interned at translation time by address only, as
+// unknown functions, since the same address means different code in different
+// processes. Those IDs are mapped to symbols once per process: the VMAs of a
+// process are listed through VMI when it is first switched to, binaries are
+// loaded in a Symbolizer of their own the first time any process maps them
+// (so libc is only loaded once), and their symbols are interned in the kernel
+// Symbolizer next to the unknown functions. Resolved IDs are then kept in a
+// small per-vCPU cache, which makes most lookups a couple of loads.
+class UserSymbols {
+public:
+  // The userspace of a process, shared by its threads.
+  struct AddressSpace {
+    uint64_t mm;
+    uint32_t tgid;
+    // Set when an address isn't in any known VMA, to list them again
+    bool stale;
+    std::vector<VMI::Mapping> mappings;
+    std::unordered_map<FunctionId, FunctionId> resolved;
+  };
+
+  UserSymbols(std::string sysroot, VMI *vmi, Symbolizer *symbolizer,
+              size_t maxVcpus);
+
+  // Returns the address space of |task|, nullptr for kernel threads. Must be
+  // called from a vCPU thread running kernel code, when switching to |task|.
+  AddressSpace *AddressSpaceOf(const TaskInfo &task);
+
+  // Maps a function interned by address at translation time, for code running
+  // in |space|, to the symbol it is in. Must be called from the thread of
+  // |vcpu_id|.
+  inline FunctionId Resolve(unsigned int vcpu_id, AddressSpace *space,
+                            FunctionId function) {
+    CacheEntry &entry = m_vcpus[vcpu_id].cache[function % kCacheSize];
+    if (entry.space == space && entry.from == function)
+      return entry.to;
+    bool cacheable;
+    FunctionId to = ResolveSlow(space, function, &cacheable);
+    if (cacheable)
+      entry = CacheEntry{space, function, to};
+    return to;
+  }
+
+private:
+  static constexpr size_t kCacheSize = 1024;
+
+  struct CacheEntry {
+    const AddressSpace *space;
+    FunctionId from;
+    FunctionId to;
+  };
+
+  // Per-vCPU cache, padded to avoid false sharing between vCPU threads.
+  struct alignas(64) VcpuCache {
+    CacheEntry cache[kCacheSize] = {};
+  };
+
+  // A binary mapped by any process.
+  struct Module {
+    // Where PT_LOAD segments of the file get loaded
+    struct Segment {
+      uint64_t offset;
+      uint64_t size;
+      uint64_t vaddr;
+    };
+    Symbolizer symbols;
+    std::vector<Segment> segments;
+  };
+  // Binaries are loaded by the first thread needing them, without holding
+  // m_mutex. Other threads needing them meanwhile wait on |loaded|.
+  struct ModuleSlot {
+    std::once_flag loaded;
+    std::unique_ptr<Module> module;
+  };
+
+  // |cacheable| is false for results which may change once the VMAs are
+  // listed again.
+  FunctionId ResolveSlow(AddressSpace *space, FunctionId function,
+                         bool *cacheable);
+  // Returns nullptr if the binary can't be read. Slow, called once per path.
+  std::unique_ptr<Module> LoadModule(const std::string &path) const;
+
+  std::string m_sysroot;
+  VMI *m_vmi;
+  Symbolizer *m_symbolizer;
+  std::vector<VcpuCache> m_vcpus;
+
+  std::mutex m_mutex;
+  std::unordered_map<uint64_t, std::unique_ptr<AddressSpace>> m_spaces;
+  // Address spaces of exited processes, which per-vCPU caches may still
+  // point to
+  std::vector<std::unique_ptr<AddressSpace>> m_retired;
+  std::unordered_map<std::string, std::unique_ptr<ModuleSlot>> m_modules;
+};
+
+#endif  // SRC_QEMU_PLUGIN_USER_SYMBOLS_H_
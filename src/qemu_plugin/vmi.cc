@@ -1,8 +1,13 @@
 #include "vmi.h"
 
+#include <algorithm>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <cstring>
 #include <iostream>
+#include <unordered_map>
+#include <utility>
 
 #include <assert.h>
 #include <fcntl.h>
@@ -10,6 +15,7 @@
 
 #include "dwarf/debug_info.h"
 #include "dwarf/elf.h"
+#include "dwarf/type_index.h"
 
 #include "qemu_helpers.h"
 
@@ -19,206 +25,86 @@ extern "C" {
 
 using namespace dwarf2reader;
 
-// Helper function to find member offsets within task_struct
-static bool findMemberOffset(dwarf::CU &cu, dwarf::DIEReader &die_reader,
-                             const dwarf::AbbrevTable::Abbrev* abbrev,
-                             long* tgidOffset, long* pidOffset, long* commOffset) {
-  if (abbrev->tag == DW_TAG_member) {
-    std::string name = "";
-    long val = -1;
-    die_reader.ReadAttributes(
-        cu, abbrev, [&cu, &name, &val](uint16_t tag, dwarf::AttrValue value) {
-          if (tag == DW_AT_name && value.IsString()) {
-            name = value.GetString(cu);
-          } else if (tag == DW_AT_data_member_location) {
-            std::optional<uint64_t> uintValue = value.ToUint(cu);
-            if (uintValue.has_value()) {
-              val = static_cast<long>(uintValue.value());
-            }
-          }
-        });
-    if (val == -1) {
-      return false;
-    }
-    if (name == "tgid") {
-      *tgidOffset = val;
-      return true;
-    }
-    if (name == "pid") {
-      *pidOffset = val;
-      return true;
-    }
-    if (name == "comm") {
-      *commOffset = val;
-      return true;
-    }
-  }
-  return false;
+// Returns the offset of |member| in the struct named |type|, or -1.
+static int64_t findMemberOffset(const dwarf::TypeIndex &types,
+                                std::string_view type,
+                                std::string_view member) {
+  std::optional<dwarf::TypeIndex::Member> found =
+      types.FindMember(type, member);
+  return found ? static_cast<int64_t>(found->offset) : -1;
 }
 
-std::string_view* dwarf::File::GetFieldByName(std::string_view name) {
-  if (name == "aranges") {
-    return &debug_aranges;
-  } else if (name == "addr") {
-    return &debug_addr;
-  } else if (name == "str") {
-    return &debug_str;
-  } else if (name == "str_offsets") {
-    return &debug_str_offsets;
-  } else if (name == "line_str") {
-    return &debug_line_str;
-  } else if (name == "info") {
-    return &debug_info;
-  } else if (name == "types") {
-    return &debug_types;
-  } else if (name == "abbrev") {
-    return &debug_abbrev;
-  } else if (name == "line") {
-    return &debug_line;
-  } else if (name == "loc") {
-    return &debug_loc;
-  } else if (name == "pubnames") {
-    return &debug_pubnames;
-  } else if (name == "pubtypes") {
-    return &debug_pubtypes;
-  } else if (name == "ranges") {
-    return &debug_ranges;
-  } else if (name == "rnglists") {
-    return &debug_rnglists;
-  } else {
-    return nullptr;
-  }
-}
+// Assume these are provided externally
+static uint64_t TASK_STRUCT_COMM_LEN = 16;
 
-struct ChdrMunger {
-  template <class From, class Func>
-  void operator()(const From& from, Elf64_Chdr* to, Func func) {
-    to->ch_type = func(from.ch_type);
-    to->ch_size = func(from.ch_size);
-    to->ch_addralign   = func(from.ch_addralign);
-  }
+// Userspace mappings are never walked further than this
+static constexpr size_t kMaxMappings = 1 << 16;
+static constexpr int kMaxPathDepth = 64;
+static constexpr uint32_t kMaxNameLength = 255;
+
+// Maple tree nodes, from include/linux/maple_tree.h. Nodes are 256 bytes
+// aligned, the low bits of pointers to them encode their type.
+static constexpr uint64_t kMapleNodeMask = 0xff;
+static constexpr int kMaxMapleDepth = 16;
+enum MapleType : uint64_t {
+  kMapleDense,
+  kMapleLeaf64,
+  kMapleRange64,
+  kMapleArange64,
 };
+struct MapleNode {
+  uint64_t parent;
+  // Pivots, then slots, then metadata in the last bytes
+  uint64_t words[31];
+};
+static_assert(sizeof(MapleNode) == 256, "Maple nodes are 256 bytes");
 
-// Function to get task_struct offsets
-static bool getTaskStructOffsets(ElfFile &elf,
-                                 long* tgidOffset, long* pidOffset,
-                                 long* commOffset) {
-  *tgidOffset = -1;
-  *pidOffset = -1;
-  *commOffset = -1;
-  bool struct_found = false;
-
-  dwarf::File dwarf;
-  for (Elf64_Xword i = 1; i < elf.section_count(); i++) {
-    ElfFile::Section section;
-    elf.ReadSection(i, &section);
-    string_view name = section.GetName();
-    string_view contents = section.contents();
-    uint64_t uncompressed_size = 0;
-
-    if (section.header().sh_flags & SHF_COMPRESSED) {
-      // Standard ELF section compression, produced when you link with
-      //   --compress-debug-sections=zlib-gabi
-      Elf64_Chdr chdr;
-      std::string_view range;
-      elf.ReadStruct<Elf32_Chdr>(contents, 0, ChdrMunger(), &range, &chdr);
-      if (chdr.ch_type != ELFCOMPRESS_ZLIB) {
-        // Unknown compression format.
-        continue;
-      }
-      uncompressed_size = chdr.ch_size;
-      contents.remove_prefix(range.size());
-    }
-
-    if (name.find(".debug_") == 0) {
-      name.remove_prefix(string_view(".debug_").size());
-    } else if (name.find(".zdebug_") == 0) {
-      // GNU format compressed debug info, produced when you link with
-      //   --compress-debug-sections=zlib-gnu
-      name.remove_prefix(string_view(".zdebug_").size());
-      if (ReadBytes(4, &contents) != "ZLIB") {
-        continue;  // Bad compression header.
-      }
-      uncompressed_size = ReadBigEndian<uint64_t>(&contents);
-    }
-
-    static constexpr string_view dwo_str(".dwo");
-    if (name.size() >= dwo_str.size() &&
-        name.rfind(".dwo") == name.size() - dwo_str.size()) {
-      name.remove_suffix(dwo_str.size());
-    }
-
-    if (string_view* member = dwarf.GetFieldByName(name)) {
-      if (uncompressed_size) {
-        // TODO: We could probably wire up zlib here...
-	      QEMU_LOG() << "Unhandled zlib compressed debugging info" << std::endl;
-        exit(1);
-      } else {
-        *member = section.contents();
-      }
-    }
-  }
-
-  dwarf::InfoReader reader(dwarf, /*skeleton=*/nullptr);
-  dwarf::CUIter iter = reader.GetCUIter(dwarf::InfoReader::Section::kDebugInfo);
-  dwarf::CU cu;
-
-  // Iterate over compilation units
-  while (iter.NextCU(reader, &cu)) {
-    dwarf::DIEReader die_reader = cu.GetDIEReader();
-    // Iterate over DIEs
-    while (auto abbrev = die_reader.ReadCode(cu)) {
-      // Only consider structure types
-      if (abbrev->tag == DW_TAG_structure_type) {
-        // Only consider those with the name tag "task_struct"
-        bool is_task_struct = false;
-        die_reader.ReadAttributes(
-            cu, abbrev, [&cu, &is_task_struct](uint16_t tag, dwarf::AttrValue value) {
-              if (tag == DW_AT_name && value.IsString() && value.GetString(cu) == "task_struct") {
-                is_task_struct = true;
-              }
-            });
-        if (is_task_struct) {
-          long found_count = 0;
-          die_reader.ReadChildren(cu, abbrev, [&cu, &die_reader, &found_count, &tgidOffset, &pidOffset, &commOffset](const dwarf::AbbrevTable::Abbrev* child) {
-            bool found = findMemberOffset(cu, die_reader, child, tgidOffset, pidOffset, commOffset);
-            if (found)
-              found_count++;
-          });
-
-          if (found_count == 3)
-            return true;  // Found all three members
-
-          QEMU_LOG() << "Error: Could not find tgid, pid, and comm offsets in task_struct" << std::endl;
-          return false;
-        }
-      } else {
-        die_reader.ReadAttributes(
-            cu, abbrev, [](uint16_t, dwarf::AttrValue) { });
-      }
-    }
-  }
+static bool isMapleNode(uint64_t entry) {
+  return (entry & 3) == 2 && entry > 4096;
+}
 
-  if (!struct_found) {
-      QEMU_LOG() << "Error: Structure task_struct not found" << std::endl;
-      return false;
+bool VMI::FindTaskStructLayout(const dwarf::TypeIndex &types,
+                               TaskStructLayout *layout) {
+  struct {
+    const char *type;
+    const char *member;
+    int64_t *offset;
+  } members[] = {
+      {"task_struct", "tgid", &layout->tgid},
+      {"task_struct", "pid", &layout->pid},
+      {"task_struct", "comm", &layout->comm},
+      {"task_struct", "mm", &layout->mm},
+      {"mm_struct", "mm_mt", &layout->mm_mt},
+      {"maple_tree", "ma_root", &layout->maple_root},
+      {"mm_struct", "mmap", &layout->mm_mmap},
+      {"vm_area_struct", "vm_next", &layout->vma_next},
+      {"vm_area_struct", "vm_start", &layout->vma_start},
+      {"vm_area_struct", "vm_end", &layout->vma_end},
+      {"vm_area_struct", "vm_pgoff", &layout->vma_pgoff},
+      {"vm_area_struct", "vm_file", &layout->vma_file},
+      {"file", "f_path", &layout->file_path},
+      {"path", "dentry", &layout->path_dentry},
+      {"dentry", "d_parent", &layout->dentry_parent},
+      {"dentry", "d_name", &layout->dentry_name},
+  };
+  for (const auto &member : members)
+    *member.offset = findMemberOffset(types, member.type, member.member);
+
+  if (layout->tgid < 0 || layout->pid < 0 || layout->comm < 0) {
+    QEMU_LOG() << "Error: Could not find tgid, pid and comm offsets in task_struct" << std::endl;
+    return false;
   }
-  QEMU_LOG() << "Error: Could not find tgid, pid and comm offsets in task_struct" << std::endl;
-  return false;
+  return true;
 }
 
-// Assume these are provided externally
-static uint64_t TASK_STRUCT_COMM_LEN = 16;
-
-int VMI::Init(ElfFile &elf, Symbolizer *symbolizer) {
-  if (!getTaskStructOffsets(elf,
-                           &m_tgidOffset, &m_pidOffset, &m_commOffset))
+int VMI::Init(const TaskStructLayout &layout, Symbolizer *symbolizer) {
+  if (layout.tgid < 0 || layout.pid < 0 || layout.comm < 0)
     return -1;
+  m_taskStruct = layout;
 
+  // Recent kernels keep the current task in pcpu_hot, older ones in a
+  // standalone current_task per-CPU variable.
   m_pcpuHotOffset = symbolizer->lookupSymbol("pcpu_hot");
-  if (!m_pcpuHotOffset)
-    return -1;
-
   if (!m_pcpuHotOffset) {
     m_perCpuOffset = symbolizer->lookupSymbol("__per_cpu_offset");
     if (!m_perCpuOffset)
@@ -229,33 +115,43 @@ int VMI::Init(ElfFile &elf, Symbolizer *symbolizer) {
       return -1;
   }
 
-  m_switchToAddr = symbolizer->lookupSymbol("__switch_to_asm");
-  if (!m_switchToAddr)
+  uint64_t switch_to_addr = symbolizer->lookupSymbol("__switch_to_asm");
+  if (!switch_to_addr)
     return -1;
+  m_switchTo = symbolizer->internAddress(switch_to_addr);
 
+  const TaskStructLayout &l = m_taskStruct;
+  bool has_vmas = (l.mm_mt >= 0 && l.maple_root >= 0) ||
+                  (l.mm_mmap >= 0 && l.vma_next >= 0);
+  m_canReadMappings = has_vmas && l.mm >= 0 && l.vma_start >= 0 &&
+                      l.vma_end >= 0 && l.vma_pgoff >= 0 && l.vma_file >= 0 &&
+                      l.file_path >= 0 && l.path_dentry >= 0 &&
+                      l.dentry_parent >= 0 && l.dentry_name >= 0;
+
+  m_initialized = true;
   return 0;
 }
 
-uint64_t VMI::GetCurrentTaskStruct() {
+uint64_t VMI::GetCurrentTaskStruct(unsigned int vcpu_id) {
   uint64_t ret = 0;
-  uint64_t gs_base = 0;
+  uint64_t per_cpu_base = 0;
   GLibArray *reg = g_byte_array_new();
 
-  if (qemu_plugin_read_register(get_gs_base_handle(), reg) < 0)
-    goto exit;
-
-  memcpy(&gs_base, reg->data, sizeof(gs_base));
-  
   if (m_pcpuHotOffset) {
-    if (!qemu_plugin_read_memory_vaddr(gs_base + m_pcpuHotOffset, reg, sizeof(ret)))
+    // The kernel's per-CPU area of this vCPU is pointed to by gs_base
+    if (qemu_plugin_read_register(get_gs_base_handle(), reg) < 0)
+      goto exit;
+    memcpy(&per_cpu_base, reg->data, sizeof(per_cpu_base));
+
+    if (!qemu_plugin_read_memory_vaddr(per_cpu_base + m_pcpuHotOffset, reg, sizeof(ret)))
       goto exit;
   } else {
-    if (!qemu_plugin_read_memory_vaddr(m_perCpuOffset, reg, sizeof(ret)))
+    // __per_cpu_offset[vcpu_id] + &current_task
+    if (!qemu_plugin_read_memory_vaddr(m_perCpuOffset + vcpu_id * sizeof(uint64_t), reg, sizeof(per_cpu_base)))
       goto exit;
+    memcpy(&per_cpu_base, reg->data, sizeof(per_cpu_base));
 
-    memcpy(&ret, reg->data, sizeof(ret));
-
-    if (!qemu_plugin_read_memory_vaddr(ret + m_currentTaskOffset, reg, sizeof(ret)))
+    if (!qemu_plugin_read_memory_vaddr(per_cpu_base + m_currentTaskOffset, reg, sizeof(ret)))
       goto exit;
   }
 
@@ -266,31 +162,200 @@ exit:
   return ret;
 }
 
+bool VMI::RefreshCurrentTask(unsigned int vcpu_id, TaskInfo *task) {
+  VcpuTask &vcpu = m_vcpus[vcpu_id];
+  if (!m_initialized)
+    return false;
+
+  uint64_t task_struct = GetCurrentTaskStruct(vcpu_id);
+  // The scheduler was entered but hasn't switched tasks yet: keep the flag so
+  // that the next event checks again.
+  if (!task_struct || task_struct == vcpu.task_struct)
+    return false;
+
+  vcpu.task_struct = task_struct;
+  vcpu.invalidated = false;
+  task->task_struct = task_struct;
+  GetProcessInfo(task_struct, task->tgid, task->pid, task->comm, task->mm);
+  return true;
+}
+
 // Function to extract process information
-int VMI::GetProcessInfo(uint32_t &tgid, uint32_t &pid, std::string &comm) {
+int VMI::GetProcessInfo(uint64_t current_task_addr, uint32_t &tgid,
+                        uint32_t &pid, std::string &comm, uint64_t &mm) {
   int ret = -1;
   GLibArray *data = g_byte_array_new();
 
-  uint64_t current_task_addr = GetCurrentTaskStruct();
-  if (!current_task_addr)
-    goto exit;
-
-  if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_tgidOffset), data, sizeof(tgid)))
+  if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_taskStruct.tgid), data, sizeof(tgid)))
     goto exit;
   memcpy(&tgid, data->data, sizeof(uint32_t));
 
-  if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_pidOffset), data, sizeof(pid)))
+  if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_taskStruct.pid), data, sizeof(pid)))
     goto exit;
   memcpy(&pid, data->data, sizeof(pid));
 
-  if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_commOffset), data, TASK_STRUCT_COMM_LEN))
+  if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_taskStruct.comm), data, TASK_STRUCT_COMM_LEN))
     goto exit;
   comm = std::string(reinterpret_cast<char *>(data->data), TASK_STRUCT_COMM_LEN);
   comm = comm.substr(0, comm.find('\0'));
 
-  m_processInvalidated = false;
+  // Kernel threads have no mm
+  mm = 0;
+  if (m_taskStruct.mm >= 0) {
+    if (!qemu_plugin_read_memory_vaddr(current_task_addr + static_cast<uint64_t>(m_taskStruct.mm), data, sizeof(mm)))
+      goto exit;
+    memcpy(&mm, data->data, sizeof(mm));
+  }
+
   ret = 0;
 exit:
   g_byte_array_free(data, true);
   return ret;
 }
+
+bool VMI::ReadMappings(uint64_t mm, std::vector<Mapping> *mappings) {
+  const TaskStructLayout &l = m_taskStruct;
+  mappings->clear();
+  if (!m_canReadMappings)
+    return false;
+
+  std::vector<uint64_t> vmas;
+  if (l.mm_mt >= 0) {
+    uint64_t root;
+    if (!read_memory(mm + static_cast<uint64_t>(l.mm_mt + l.maple_root), &root,
+                     sizeof(root)))
+      return false;
+    CollectMapleEntries(root, UINT64_MAX, 0, &vmas);
+  } else {
+    uint64_t vma;
+    if (!read_memory(mm + static_cast<uint64_t>(l.mm_mmap), &vma, sizeof(vma)))
+      return false;
+    while (vma && vmas.size() < kMaxMappings) {
+      vmas.push_back(vma);
+      if (!read_memory(vma + static_cast<uint64_t>(l.vma_next), &vma,
+                       sizeof(vma)))
+        break;
+    }
+  }
+
+  // Binaries are mapped several times, with different permissions
+  std::unordered_map<uint64_t, std::string> paths;
+  for (uint64_t vma : vmas) {
+    Mapping mapping;
+    uint64_t file;
+    if (!read_memory(vma + static_cast<uint64_t>(l.vma_start), &mapping.start,
+                     sizeof(mapping.start)) ||
+        !read_memory(vma + static_cast<uint64_t>(l.vma_end), &mapping.end,
+                     sizeof(mapping.end)) ||
+        !read_memory(vma + static_cast<uint64_t>(l.vma_pgoff), &mapping.pgoff,
+                     sizeof(mapping.pgoff)) ||
+        !read_memory(vma + static_cast<uint64_t>(l.vma_file), &file,
+                     sizeof(file)) ||
+        mapping.start >= mapping.end)
+      continue;
+    if (file) {
+      auto it = paths.find(file);
+      if (it == paths.end())
+        it = paths.emplace(file, ReadFilePath(file)).first;
+      mapping.path = it->second;
+    }
+    mappings->push_back(std::move(mapping));
+  }
+  std::sort(mappings->begin(), mappings->end(),
+            [](const Mapping &a, const Mapping &b) { return a.start < b.start; });
+  return true;
+}
+
+void VMI::CollectMapleEntries(uint64_t entry, uint64_t max, int depth,
+                              std::vector<uint64_t> *vmas) {
+  if (!entry || vmas->size() >= kMaxMappings)
+    return;
+  // A tree of a single range keeps its entry in the root
+  if (!isMapleNode(entry)) {
+    if (!(entry & 3))
+      vmas->push_back(entry);
+    return;
+  }
+  if (depth >= kMaxMapleDepth)
+    return;
+
+  uint64_t type = (entry >> 3) & 0xf;
+  size_t slot_count;
+  if (type == kMapleLeaf64 || type == kMapleRange64)
+    slot_count = 16;
+  else if (type == kMapleArange64)
+    slot_count = 10;
+  else
+    return;
+  MapleNode node;
+  if (!read_memory(entry & ~kMapleNodeMask, &node, sizeof(node)))
+    return;
+  const uint64_t *pivots = node.words;
+  const uint64_t *slots = node.words + slot_count - 1;
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&node);
+
+  // Index of the last slot in use, like ma_data_end()
+  size_t end;
+  if (type == kMapleArange64) {
+    // After the slots and their gaps
+    end = bytes[sizeof(uint64_t) * (1 + 9 + 10 + 10)];
+  } else if (!pivots[slot_count - 2]) {
+    // In place of the last slot
+    end = bytes[sizeof(uint64_t) * (1 + 15 + 15)];
+  } else if (pivots[slot_count - 2] == max) {
+    end = slot_count - 2;
+  } else {
+    end = slot_count - 1;
+  }
+  end = std::min(end, slot_count - 1);
+
+  for (size_t i = 0; i <= end; i++) {
+    if (type == kMapleLeaf64) {
+      if (slots[i] && !(slots[i] & 3))
+        vmas->push_back(slots[i]);
+    } else {
+      uint64_t child_max = i < slot_count - 1 ? pivots[i] : max;
+      CollectMapleEntries(slots[i], child_max, depth + 1, vmas);
+    }
+  }
+}
+
+std::string VMI::ReadFilePath(uint64_t file) {
+  const TaskStructLayout &l = m_taskStruct;
+  uint64_t dentry;
+  if (!read_memory(file + static_cast<uint64_t>(l.file_path + l.path_dentry),
+                   &dentry, sizeof(dentry)))
+    return "";
+
+  // From the file up to the root, which is its own parent
+  std::vector<std::string> names;
+  for (int depth = 0; depth < kMaxPathDepth; depth++) {
+    uint64_t parent;
+    if (!read_memory(dentry + static_cast<uint64_t>(l.dentry_parent), &parent,
+                     sizeof(parent)))
+      return "";
+    if (parent == dentry) {
+      std::string path;
+      for (auto it = names.rbegin(); it != names.rend(); ++it)
+        path += "/" + *it;
+      return path;
+    }
+
+    // The layout of struct qstr hasn't changed in years
+    struct {
+      uint32_t hash;
+      uint32_t len;
+      uint64_t name;
+    } qstr;
+    if (!read_memory(dentry + static_cast<uint64_t>(l.dentry_name), &qstr,
+                     sizeof(qstr)) ||
+        !qstr.len || qstr.len > kMaxNameLength)
+      return "";
+    std::string name(qstr.len, '\0');
+    if (!read_memory(qstr.name, name.data(), name.size()))
+      return "";
+    names.push_back(std::move(name));
+    dentry = parent;
+  }
+  return "";
+}
@@ -4,31 +4,118 @@
 #include <cinttypes>
 
 #include <string>
+#include <vector>
 
 #include "symbolizer.h"
 #include "qemu_helpers.h"
 
-class ElfFile;
+namespace dwarf {
+class TypeIndex;
+}
+
+struct TaskInfo {
+  uint64_t task_struct = 0;
+  uint32_t tgid = 0;
+  uint32_t pid = 0;
+  std::string comm = "Boot";
+  // The userspace address space, 0 for kernel threads
+  uint64_t mm = 0;
+};
+
+// Offsets of the task_struct members read by VMI, and of the members of the
+// structures reached from it, -1 when unknown.
+struct TaskStructLayout {
+  int64_t tgid = -1;
+  int64_t pid = -1;
+  int64_t comm = -1;
+  int64_t mm = -1;
+
+  // VMAs are kept in a maple tree since Linux 6.1, in a linked list before.
+  int64_t mm_mt = -1;
+  int64_t maple_root = -1;
+  int64_t mm_mmap = -1;
+  int64_t vma_next = -1;
+
+  int64_t vma_start = -1;
+  int64_t vma_end = -1;
+  int64_t vma_pgoff = -1;
+  int64_t vma_file = -1;
+  int64_t file_path = -1;
+  int64_t path_dentry = -1;
+  int64_t dentry_parent = -1;
+  int64_t dentry_name = -1;
+};
 
 class VMI {
 public:
-  explicit VMI() : m_processInvalidated(true) {}
-  int Init(ElfFile &elf, Symbolizer *symbolizer);
-  int GetProcessInfo(uint32_t &tgid, uint32_t &pid, std::string &comm);
-  inline bool LogCall(uint64_t addr) {
-    if (addr == m_switchToAddr) {
-      m_processInvalidated = true;
+  // A VMA of a userspace address space. |path| is empty for anonymous memory.
+  struct Mapping {
+    uint64_t start;
+    uint64_t end;
+    // In pages
+    uint64_t pgoff;
+    std::string path;
+  };
+
+  explicit VMI(size_t maxVcpus) : m_vcpus(maxVcpus) {}
+  // Expensive: reads the debug info of many structs. The result is worth
+  // caching.
+  static bool FindTaskStructLayout(const dwarf::TypeIndex &types,
+                                   TaskStructLayout *layout);
+  int Init(const TaskStructLayout &layout, Symbolizer *symbolizer);
+
+  // Whether calls to |function| switch the task of the vCPU making them.
+  inline bool SwitchesTask(FunctionId function) const {
+    return m_switchTo && function == m_switchTo;
+  }
+  // Marks the current task of a vCPU as stale when it enters the scheduler.
+  inline bool LogCall(unsigned int vcpu_id, FunctionId function) {
+    if (SwitchesTask(function)) {
+      m_vcpus[vcpu_id].invalidated = true;
       return true;
     }
     return false;
   }
-  bool IsProcessInvalidated() { return m_processInvalidated; }
+  inline bool IsTaskInvalidated(unsigned int vcpu_id) const {
+    return m_vcpus[vcpu_id].invalidated;
+  }
+
+  // Must be called from the vCPU's own thread. Reads the task_struct pointer
+  // of the task running on that vCPU and, only if it differs from the cached
+  // one, the rest of |task|. Returns whether the task changed.
+  bool RefreshCurrentTask(unsigned int vcpu_id, TaskInfo *task);
+
+  // Whether the layout of the kernel allows listing mappings.
+  bool CanReadMappings() const { return m_canReadMappings; }
+  // Lists the VMAs of the address space |mm|, sorted by address. Must be called
+  // from a vCPU thread running kernel code: the kernel may not be mapped in
+  // userspace page tables. Paths are relative to the root of the filesystem
+  // of each file, which is the root of the guest for most binaries.
+  bool ReadMappings(uint64_t mm, std::vector<Mapping> *mappings);
 
 private:
-  uint64_t GetCurrentTaskStruct();
-  long m_tgidOffset, m_pidOffset, m_commOffset;
-  uint64_t m_pcpuHotOffset, m_switchToAddr, m_perCpuOffset, m_currentTaskOffset;
-  bool m_processInvalidated;
+  // Per-vCPU cache, padded to avoid false sharing between vCPU threads.
+  struct alignas(64) VcpuTask {
+    bool invalidated = true;
+    uint64_t task_struct = 0;
+  };
+
+  uint64_t GetCurrentTaskStruct(unsigned int vcpu_id);
+  int GetProcessInfo(uint64_t task_struct, uint32_t &tgid, uint32_t &pid,
+                     std::string &comm, uint64_t &mm);
+  // Appends the entries of the maple tree node |entry|, covering addresses up
+  // to |max|, to |vmas|.
+  void CollectMapleEntries(uint64_t entry, uint64_t max, int depth,
+                           std::vector<uint64_t> *vmas);
+  // Returns the path of a struct file, or an empty string.
+  std::string ReadFilePath(uint64_t file);
+
+  bool m_initialized = false;
+  bool m_canReadMappings = false;
+  TaskStructLayout m_taskStruct;
+  uint64_t m_pcpuHotOffset = 0, m_perCpuOffset = 0, m_currentTaskOffset = 0;
+  FunctionId m_switchTo = 0;
+  std::vector<VcpuTask> m_vcpus;
 };
 
 #endif  // SRC_QEMU_PLUGIN_VMI_H_
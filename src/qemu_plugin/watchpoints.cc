@@ -0,0 +1,118 @@
+#include "watchpoints.h"
+
+#include <optional>
+
+#include "dejaview/ext/base/string_splitter.h"
+#include "dejaview/ext/base/string_utils.h"
+
+#include "dwarf/type_index.h"
+
+#include "qemu_helpers.h"
+#include "symbolizer.h"
+
+bool Watchpoints::Parse(const std::string &spec) {
+  for (dejaview::base::StringSplitter splitter(spec, ';'); splitter.Next();) {
+    if (!ParseClause(splitter.cur_token())) {
+      QEMU_LOG() << "Bad watch clause: " << splitter.cur_token() << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Watchpoints::ParseClause(const std::string &clause) {
+  size_t colon = clause.find(':');
+  if (colon == std::string::npos)
+    return false;
+  std::string key = clause.substr(0, colon);
+  std::string value = clause.substr(colon + 1);
+  if (value.empty())
+    return false;
+
+  if (key == "sym") {
+    m_watches.push_back(Watch{kSymbol, value, 0, 0});
+  } else if (key == "addr") {
+    size_t dash = value.find('-');
+    if (dash == std::string::npos)
+      return false;
+    // Base 0 accepts both decimal and 0x prefixed addresses
+    std::optional<uint64_t> start =
+        dejaview::base::StringToUInt64(value.substr(0, dash), 0);
+    std::optional<uint64_t> end =
+        dejaview::base::StringToUInt64(value.substr(dash + 1), 0);
+    if (!start || !end || *start >= *end)
+      return false;
+    m_watches.push_back(Watch{kRange, value, *start, *end - *start});
+  } else if (key == "field") {
+    size_t dot = value.find('.');
+    if (dot == 0 || dot == std::string::npos || dot + 1 == value.size())
+      return false;
+    m_watches.push_back(Watch{kField, value, 0, 0});
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool Watchpoints::ParseAccess(const std::string &value) {
+  if (value == "read")
+    m_access = kRead;
+  else if (value == "write")
+    m_access = kWrite;
+  else if (value == "any")
+    m_access = kRead | kWrite;
+  else
+    return false;
+  return true;
+}
+
+bool Watchpoints::Resolve(Symbolizer &symbolizer,
+                          const dwarf::TypeIndex *types) {
+  for (Watch &watch : m_watches) {
+    if (watch.kind == kSymbol) {
+      watch.start = symbolizer.lookupSymbol(watch.name, &watch.size);
+      if (!watch.start) {
+        QEMU_LOG() << "Watched symbol " << watch.name << " not found\n";
+        return false;
+      }
+    } else if (watch.kind == kField) {
+      size_t dot = watch.name.find('.');
+      std::optional<dwarf::TypeIndex::Member> member = types->FindMember(
+          watch.name.substr(0, dot), watch.name.substr(dot + 1));
+      if (!member) {
+        QEMU_LOG() << "Watched field " << watch.name
+                   << " not found in the debug info\n";
+        return false;
+      }
+      watch.start = member->offset;
+      watch.size = member->type ? types->TypeSize(*member->type) : 0;
+      // Arrays are sized by their subranges, take everything up to the next
+      // member instead
+      if (!watch.size)
+        watch.size = member->end > member->offset ? member->end - member->offset
+                                                  : 1;
+    }
+  }
+  return true;
+}
+
+bool Watchpoints::HasFields() const {
+  for (const Watch &watch : m_watches) {
+    if (watch.kind == kField)
+      return true;
+  }
+  return false;
+}
+
+ssize_t Watchpoints::Match(bool field, uint64_t start, uint8_t size) const {
+  for (size_t i = 0; i < m_watches.size(); i++) {
+    const Watch &w = m_watches[i];
+    if ((w.kind == kField) != field)
+      continue;
+    bool overlaps = size ? start < w.start + w.size && w.start < start + size
+                         : start - w.start < w.size;
+    if (overlaps)
+      return static_cast<ssize_t>(i);
+  }
+  return -1;
+}
@@ -0,0 +1,95 @@
+#ifndef SRC_QEMU_PLUGIN_WATCHPOINTS_H_
+#define SRC_QEMU_PLUGIN_WATCHPOINTS_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Symbolizer;
+namespace dwarf {
+class TypeIndex;
+}
+
+// Decides which guest memory accesses get logged, from the watch= arguments
+// of the plugin.
+//
+// A spec is a list of clauses separated by ';':
+//   sym:<name>               a global variable, as sized by the symbol table
+//   addr:<start>-<end>       memory between two addresses, end excluded
+//   field:<struct>.<member>  a member of any instance of a struct, from DWARF
+//
+// Watches are matched against the memory operands of instructions at
+// translation time, only the instructions which can touch a watched range get
+// a memory callback. sym and addr watches match operands whose address is
+// known statically: RIP-relative or absolute ones on x86_64, relative to a
+// page loaded by adrp in the same block on aarch64. Struct instances can live
+// anywhere, so field watches match operands addressing the member's offset
+// from a register. They can't tell apart structs sharing that offset, which
+// makes them most selective for members far into large structs.
+//
+// Implicit accesses (push, string instructions...) are never matched.
+class Watchpoints {
+public:
+  enum Access : uint8_t {
+    kRead = 1 << 0,
+    kWrite = 1 << 1,
+  };
+
+  Watchpoints() {}
+
+  // Adds the clauses of |spec|. Returns false and logs why on syntax errors.
+  bool Parse(const std::string &spec);
+  // Parses the watch_access= argument: read, write (the default) or any.
+  bool ParseAccess(const std::string &value);
+  // Must be called once the symbols are loaded, before any match. |types| is
+  // only needed by field clauses. Returns false and logs what isn't found.
+  bool Resolve(Symbolizer &symbolizer, const dwarf::TypeIndex *types);
+
+  bool empty() const { return m_watches.empty(); }
+  bool HasFields() const;
+  // Which accesses are logged, a combination of Access flags.
+  uint8_t access() const { return m_access; }
+  const std::string &name(size_t watch) const { return m_watches[watch].name; }
+
+  // Translation time: returns the watch an operand of |size| bytes at a
+  // static |address| overlaps, or -1. A |size| of 0 means unknown, the operand
+  // then has to start in the watched range.
+  ssize_t MatchAddress(uint64_t address, uint8_t size) const {
+    return Match(false, address, size);
+  }
+  // Same for an operand |offset| bytes away from a base register.
+  ssize_t MatchOffset(int64_t offset, uint8_t size) const {
+    return Match(true, static_cast<uint64_t>(offset), size);
+  }
+
+  // Execution time: whether an access of |size| bytes at |address|, by an
+  // instruction matched to |watch|, actually touched it. Field watches can't
+  // be checked further.
+  bool Hits(size_t watch, uint64_t address, uint64_t size) const {
+    const Watch &w = m_watches[watch];
+    return w.kind == kField ||
+           (address < w.start + w.size && w.start < address + size);
+  }
+
+private:
+  enum Kind { kSymbol, kRange, kField };
+
+  struct Watch {
+    Kind kind;
+    // As given, eg. "jiffies" or "task_struct.pid"
+    std::string name;
+    // An address, or the offset of a member in its struct
+    uint64_t start;
+    uint64_t size;
+  };
+
+  bool ParseClause(const std::string &clause);
+  ssize_t Match(bool field, uint64_t start, uint8_t size) const;
+
+  std::vector<Watch> m_watches;
+  uint8_t m_access = kWrite;
+};
+
+#endif  // SRC_QEMU_PLUGIN_WATCHPOINTS_H_
@@ -83,6 +83,31 @@ class BitVector {
       global_bit_offset_ += BitWord::kBits;
     }
 
+    // Appends |count| whole words to the Builder, which the caller has to
+    // write through the returned pointer before building. Builder has to end
+    // on a word boundary before calling this function.
+    uint64_t* AppendWords(uint32_t count) {
+      DEJAVIEW_DCHECK(global_bit_offset_ % BitWord::kBits == 0);
+      DEJAVIEW_DCHECK(global_bit_offset_ + count * BitWord::kBits <= size_);
+
+      uint64_t* words = words_.data() + global_bit_offset_ / BitWord::kBits;
+      global_bit_offset_ += count * BitWord::kBits;
+      return words;
+    }
+
+    // Appends all the bits of |other|, which has to be full. Builder has to
+    // end on a word boundary before calling this function.
+    void Append(const Builder& other) {
+      DEJAVIEW_DCHECK(global_bit_offset_ % BitWord::kBits == 0);
+      DEJAVIEW_DCHECK(other.global_bit_offset_ == other.size_);
+      DEJAVIEW_DCHECK(global_bit_offset_ + other.size_ <= size_);
+
+      std::copy(other.words_.begin(),
+                other.words_.begin() + WordCount(other.size_),
+                words_.begin() + global_bit_offset_ / BitWord::kBits);
+      global_bit_offset_ += other.size_;
+    }
+
     // Creates a BitVector from this Builder.
     BitVector Build() && {
       if (size_ == 0)
@@ -409,6 +434,11 @@ class BitVector {
   // in the BitVector.
   std::vector<uint32_t> GetSetBitIndices() const;
 
+  // Returns the (size() + 63) / 64 words holding the bits of the BitVector,
+  // with the first bit in the lowest bit of the first word. Builder's
+  // AppendWords() takes them back.
+  const uint64_t* words() const { return words_.data(); }
+
   // Serialize internals of BitVector to proto.
   void Serialize(protos::pbzero::SerializedColumn_BitVector* msg) const;
 
@@ -16,15 +16,50 @@
 
 #include "src/trace_processor/containers/string_pool.h"
 
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <string>
 #include <tuple>
 
 #include "dejaview/base/logging.h"
+#include "dejaview/ext/base/string_view.h"
 #include "dejaview/ext/base/utils.h"
+#include "dejaview/protozero/proto_utils.h"
 
 namespace dejaview {
 namespace trace_processor {
 
+namespace {
+
+// Returns whether |block| is a sequence of strings as Block::TryInsert()
+// writes them: the varint size, the string and a null terminator.
+// Returns the end of the string at |ptr|, or nullptr if it doesn't end with a
+// null terminator before |end|.
+const uint8_t* EndOfString(const uint8_t* ptr, const uint8_t* end) {
+  uint64_t size = 0;
+  const uint8_t* str = protozero::proto_utils::ParseVarInt(ptr, end, &size);
+  if (str == ptr || size >= static_cast<uint64_t>(end - str) ||
+      str[size] != '\0') {
+    return nullptr;
+  }
+  return str + size + 1;
+}
+
+bool IsValidBlock(base::StringView block) {
+  const auto* ptr = reinterpret_cast<const uint8_t*>(block.data());
+  const uint8_t* end = ptr + block.size();
+  while (ptr < end) {
+    ptr = EndOfString(ptr, end);
+    if (!ptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 StringPool::StringPool() {
   static_assert(
       StringPool::kMinLargeStringSizeBytes <= StringPool::kBlockSizeBytes + 1,
@@ -42,6 +77,95 @@ StringPool::~StringPool() = default;
 StringPool::StringPool(StringPool&&) noexcept = default;
 StringPool& StringPool::operator=(StringPool&&) noexcept = default;
 
+StringPool::Snapshot StringPool::GetSnapshot() const {
+  Snapshot snapshot;
+  for (const Block& block : blocks_) {
+    snapshot.blocks.emplace_back(reinterpret_cast<const char*>(block.Get(0)),
+                                 block.pos());
+  }
+  for (const auto& str : large_strings_) {
+    snapshot.large_strings.emplace_back(*str);
+  }
+  return snapshot;
+}
+
+bool StringPool::CanRestoreSnapshot(const Snapshot& snapshot) const {
+  if (snapshot.blocks.size() < blocks_.size() ||
+      snapshot.blocks.size() > (1u << kNumBlockIndexBits) ||
+      snapshot.large_strings.size() < large_strings_.size()) {
+    return false;
+  }
+
+  // The strings already in the pool have to be at the same place in the
+  // snapshot, so that their ids stay valid.
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    uint32_t pos = blocks_[i].pos();
+    base::StringView block = snapshot.blocks[i];
+    bool is_last = i + 1 == blocks_.size();
+    if (block.size() < pos || (!is_last && block.size() != pos) ||
+        memcmp(blocks_[i].Get(0), block.data(), pos) != 0) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < large_strings_.size(); ++i) {
+    if (base::StringView(*large_strings_[i]) != snapshot.large_strings[i]) {
+      return false;
+    }
+  }
+  for (base::StringView block : snapshot.blocks) {
+    if (block.empty() || block.size() > kBlockSizeBytes ||
+        !IsValidBlock(block)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StringPool::RestoreSnapshot(const Snapshot& snapshot) {
+  if (!CanRestoreSnapshot(snapshot)) {
+    return false;
+  }
+  for (size_t i = 0; i < snapshot.blocks.size(); ++i) {
+    if (i == blocks_.size()) {
+      blocks_.emplace_back(kBlockSizeBytes);
+    }
+    const base::StringView& block = snapshot.blocks[i];
+    blocks_[i].Assign(reinterpret_cast<const uint8_t*>(block.data()),
+                      static_cast<uint32_t>(block.size()));
+  }
+  for (size_t i = large_strings_.size(); i < snapshot.large_strings.size();
+       ++i) {
+    large_strings_.emplace_back(
+        new std::string(snapshot.large_strings[i].ToStdString()));
+  }
+
+  // The index is not part of the snapshot: hash the strings again.
+  for (auto it = CreateIterator(); it; ++it) {
+    Id id = it.StringId();
+    if (!id.is_null()) {
+      string_index_.Insert(it.StringView().Hash(), id);
+    }
+  }
+  return true;
+}
+
+// static
+bool StringPool::IsValidSnapshotId(const Snapshot& snapshot, Id id) {
+  if (id.is_null()) {
+    return true;
+  }
+  if (id.is_large_string()) {
+    return id.large_string_index() < snapshot.large_strings.size();
+  }
+  if (id.block_index() >= snapshot.blocks.size()) {
+    return false;
+  }
+  base::StringView block = snapshot.blocks[id.block_index()];
+  const auto* start = reinterpret_cast<const uint8_t*>(block.data());
+  return id.block_offset() < block.size() &&
+         EndOfString(start + id.block_offset(), start + block.size());
+}
+
 StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
   // Try and find enough space in the current block for the string and the
   // metadata (varint-encoded size + the string data + the null terminator).
@@ -122,6 +246,20 @@ std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
 
 StringPool::Iterator::Iterator(const StringPool* pool) : pool_(pool) {}
 
+StringPool::Iterator::Iterator(const StringPool* pool, Id from)
+    : pool_(pool),
+      block_index_(from.block_index()),
+      block_offset_(from.block_offset()) {
+  DEJAVIEW_DCHECK(!from.is_large_string());
+  DEJAVIEW_DCHECK(block_index_ < pool_->blocks_.size());
+
+  // |from| is the end of its block if a new block was started since.
+  if (pool_->blocks_[block_index_].pos() <= block_offset_) {
+    block_index_++;
+    block_offset_ = 0;
+  }
+}
+
 StringPool::Iterator& StringPool::Iterator::operator++() {
   if (block_index_ < pool_->blocks_.size()) {
     // Try and go to the next string in the current block.
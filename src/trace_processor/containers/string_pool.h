@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <limits>
 #include <memory>
@@ -93,10 +94,20 @@ class StringPool {
     uint32_t id;
   };
 
+  // The strings of a pool in a snapshot: the bytes of each block, up to the
+  // end of its last string, and the large strings.
+  struct Snapshot {
+    std::vector<base::StringView> blocks;
+    std::vector<base::StringView> large_strings;
+  };
+
   // Iterator over the strings in the pool.
   class Iterator {
    public:
     explicit Iterator(const StringPool*);
+    // Iterates over the strings interned from |from| on, which is a value
+    // returned by MaxSmallStringId().
+    Iterator(const StringPool*, Id from);
 
     explicit operator bool() const;
     Iterator& operator++();
@@ -163,6 +174,11 @@ class StringPool {
 
   Iterator CreateIterator() const { return Iterator(this); }
 
+  // Creates an iterator over the strings interned since MaxSmallStringId()
+  // returned |from|: small strings are appended to the last block, so the ones
+  // before |from| don't have to be walked through.
+  Iterator CreateIterator(Id from) const { return Iterator(this, from); }
+
   size_t size() const { return string_index_.size(); }
 
   // Maximum Id of a small (not large) string in the string pool.
@@ -173,6 +189,25 @@ class StringPool {
   // Returns whether there is at least one large string in a string pool
   bool HasLargeString() const { return !large_strings_.empty(); }
 
+  // Returns the strings of the pool, as views which are valid until the next
+  // string is interned.
+  Snapshot GetSnapshot() const;
+
+  // Replaces the strings of the pool with the strings of |snapshot|, which
+  // keep their ids. The strings already in the pool (e.g. interned by the
+  // constructors of the trackers) have to be at the start of the snapshot.
+  // Returns false, without changing the pool, otherwise or if the snapshot is
+  // malformed.
+  bool RestoreSnapshot(const Snapshot& snapshot);
+
+  // Returns whether RestoreSnapshot() would accept |snapshot|.
+  bool CanRestoreSnapshot(const Snapshot& snapshot) const;
+
+  // Returns whether Get() can read |id| once |snapshot| is restored, i.e.
+  // whether it is null, a large string of |snapshot| or points to a null
+  // terminated string within one of its blocks.
+  static bool IsValidSnapshotId(const Snapshot& snapshot, Id id);
+
  private:
   using StringHash = uint64_t;
 
@@ -206,6 +241,15 @@ class StringPool {
 
     uint32_t pos() const { return pos_; }
 
+    // Replaces the strings of the block with the |size| bytes at |data|, the
+    // strings of a block in a snapshot.
+    void Assign(const uint8_t* data, uint32_t size) {
+      DEJAVIEW_CHECK(size <= size_);
+      mem_.EnsureCommitted(size);
+      memcpy(Get(0), data, size);
+      pos_ = size;
+    }
+
    private:
     base::PagedMemory mem_;
     uint32_t pos_ = 0;
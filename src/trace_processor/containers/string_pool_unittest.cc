@@ -17,7 +17,9 @@
 #include "src/trace_processor/containers/string_pool.h"
 
 #include <array>
+#include <optional>
 #include <random>
+#include <string>
 
 #include "test/gtest_and_gmock.h"
 
@@ -88,6 +90,32 @@ TEST_F(StringPoolTest, ConstIterator) {
   ASSERT_FALSE(++it);
 }
 
+TEST_F(StringPoolTest, IteratorFrom) {
+  pool_.InternString("foo");
+  StringPool::Id from = pool_.MaxSmallStringId();
+  ASSERT_FALSE(pool_.CreateIterator(from));
+
+  StringPool::Id bar = pool_.InternString("bar");
+  auto it = pool_.CreateIterator(from);
+  ASSERT_TRUE(it);
+  ASSERT_EQ(it.StringId(), bar);
+  ASSERT_FALSE(++it);
+
+  // Strings which don't fit in the last block anymore start a new one.
+  std::string medium(kMinLargeStringSizeBytes / 2, 'a');
+  StringPool::Id id;
+  do {
+    from = pool_.MaxSmallStringId();
+    medium[0]++;
+    id = pool_.InternString(base::StringView(medium));
+  } while (id.block_index() == 0);
+
+  it = pool_.CreateIterator(from);
+  ASSERT_TRUE(it);
+  ASSERT_EQ(it.StringId(), id);
+  ASSERT_FALSE(++it);
+}
+
 TEST_F(StringPoolTest, StressTest) {
   // First create a buffer with 33MB of random characters, so that we insert
   // into at least two chunks.
@@ -197,6 +225,57 @@ TEST_F(StringPoolTest, BigString) {
   }
 }
 
+TEST_F(StringPoolTest, RestoreSnapshot) {
+  StringPool::Id common = pool_.InternString("common");
+  StringPool::Id foo = pool_.InternString("foo");
+  StringPool::Id large = pool_.InternString(
+      base::StringView(std::string(kBlockSizeBytes + 1, 'a')));
+  ASSERT_TRUE(large.is_large_string());
+
+  StringPool restored;
+  ASSERT_EQ(restored.InternString("common"), common);
+  ASSERT_TRUE(restored.RestoreSnapshot(pool_.GetSnapshot()));
+
+  ASSERT_EQ(restored.Get(foo), "foo");
+  ASSERT_EQ(restored.Get(large).size(), kBlockSizeBytes + 1);
+  ASSERT_EQ(restored.GetId("foo"), foo);
+  ASSERT_EQ(restored.InternString("common"), common);
+  ASSERT_EQ(restored.InternString("bar"), pool_.InternString("bar"));
+}
+
+TEST_F(StringPoolTest, RestoreSnapshotNotPrefix) {
+  pool_.InternString("foo");
+
+  StringPool other;
+  other.InternString("bar");
+  ASSERT_FALSE(other.RestoreSnapshot(pool_.GetSnapshot()));
+  ASSERT_EQ(other.GetId("foo"), std::nullopt);
+  ASSERT_TRUE(other.GetId("bar"));
+}
+
+TEST_F(StringPoolTest, RestoreSnapshotMalformed) {
+  StringPool::Snapshot snapshot = pool_.GetSnapshot();
+  std::string block = snapshot.blocks[0].ToStdString() + "\x05" "ab";
+  snapshot.blocks[0] = base::StringView(block);
+
+  StringPool restored;
+  ASSERT_FALSE(restored.RestoreSnapshot(snapshot));
+}
+
+TEST_F(StringPoolTest, IsValidSnapshotId) {
+  StringPool::Id foo = pool_.InternString("foo");
+  StringPool::Snapshot snapshot = pool_.GetSnapshot();
+
+  ASSERT_TRUE(StringPool::IsValidSnapshotId(snapshot, StringPool::Id::Null()));
+  ASSERT_TRUE(StringPool::IsValidSnapshotId(snapshot, foo));
+  ASSERT_FALSE(StringPool::IsValidSnapshotId(
+      snapshot, StringPool::Id::Raw(foo.raw_id() + 4)));
+  ASSERT_FALSE(StringPool::IsValidSnapshotId(
+      snapshot, StringPool::Id::BlockString(1, 0)));
+  ASSERT_FALSE(StringPool::IsValidSnapshotId(
+      snapshot, StringPool::Id::LargeString(0)));
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace dejaview
@@ -166,6 +166,39 @@ Range DataLayerChain::OrderedIndexSearchValidated(
   DEJAVIEW_FATAL("For GCC");
 }
 
+RangeOrBitVector DataLayerChain::SearchBetweenValidated(FilterOp lower_op,
+                                                        SqlValue lower,
+                                                        FilterOp upper_op,
+                                                        SqlValue upper,
+                                                        Range range) const {
+  RangeOrBitVector lower_res = SearchValidated(lower_op, lower, range);
+  if (lower_res.IsRange()) {
+    // Only search the upper bound in the range of the lower one.
+    Range lower_range = std::move(lower_res).TakeIfRange();
+    if (lower_range.empty()) {
+      return RangeOrBitVector(Range());
+    }
+    RangeOrBitVector res = SearchValidated(upper_op, upper, lower_range);
+    if (res.IsRange()) {
+      return res;
+    }
+    BitVector bv = std::move(res).TakeIfBitVector();
+    bv.Resize(range.end, false);
+    return RangeOrBitVector(std::move(bv));
+  }
+
+  BitVector bv = std::move(lower_res).TakeIfBitVector();
+  RangeOrBitVector upper_res = SearchValidated(upper_op, upper, range);
+  if (upper_res.IsRange()) {
+    Range upper_range = std::move(upper_res).TakeIfRange();
+    BitVector res = bv.IntersectRange(upper_range.start, upper_range.end);
+    res.Resize(range.end, false);
+    return RangeOrBitVector(std::move(res));
+  }
+  bv.And(std::move(upper_res).TakeIfBitVector());
+  return RangeOrBitVector(std::move(bv));
+}
+
 ArrangementOverlay::ArrangementOverlay(
     const std::vector<uint32_t>* arrangement,
     DataLayerChain::Indices::State arrangement_state)
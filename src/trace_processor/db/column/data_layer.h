@@ -168,6 +168,39 @@ class DataLayerChain {
     DEJAVIEW_FATAL("For GCC");
   }
 
+  // Searches for elements between two bounds, such as `ts >= a AND ts < b`,
+  // between |range.start| and |range.end|: elements which match both
+  // |lower_op| (kGt or kGe) and |lower|, and |upper_op| (kLt or kLe) and
+  // |upper|.
+  //
+  // Returns the same as intersecting the results of |Search| for both bounds,
+  // which implementations may compute in a single pass over the elements.
+  DEJAVIEW_ALWAYS_INLINE RangeOrBitVector SearchBetween(FilterOp lower_op,
+                                                        SqlValue lower,
+                                                        FilterOp upper_op,
+                                                        SqlValue upper,
+                                                        Range range) const {
+    DEJAVIEW_DCHECK(lower_op == FilterOp::kGt || lower_op == FilterOp::kGe);
+    DEJAVIEW_DCHECK(upper_op == FilterOp::kLt || upper_op == FilterOp::kLe);
+    switch (ValidateSearchConstraints(lower_op, lower)) {
+      case SearchValidationResult::kAllData:
+        return Search(upper_op, upper, range);
+      case SearchValidationResult::kNoData:
+        return RangeOrBitVector(Range());
+      case SearchValidationResult::kOk:
+        break;
+    }
+    switch (ValidateSearchConstraints(upper_op, upper)) {
+      case SearchValidationResult::kAllData:
+        return SearchValidated(lower_op, lower, range);
+      case SearchValidationResult::kNoData:
+        return RangeOrBitVector(Range());
+      case SearchValidationResult::kOk:
+        return SearchBetweenValidated(lower_op, lower, upper_op, upper, range);
+    }
+    DEJAVIEW_FATAL("For GCC");
+  }
+
   // Searches for elements which match |op| and |value| at the positions given
   // by |indices| array.
   //
@@ -290,6 +323,15 @@ class DataLayerChain {
   // Post-validated implementation of |Search|. See |Search|'s documentation.
   virtual RangeOrBitVector SearchValidated(FilterOp, SqlValue, Range) const = 0;
 
+  // Post-validated implementation of |SearchBetween|. See |SearchBetween|'s
+  // documentation. By default, intersects the results of |SearchValidated| for
+  // both bounds.
+  virtual RangeOrBitVector SearchBetweenValidated(FilterOp lower_op,
+                                                  SqlValue lower,
+                                                  FilterOp upper_op,
+                                                  SqlValue upper,
+                                                  Range) const;
+
   // Post-validated implementation of |IndexSearch|. See |IndexSearch|'s
   // documentation.
   virtual void IndexSearchValidated(FilterOp, SqlValue, Indices&) const = 0;
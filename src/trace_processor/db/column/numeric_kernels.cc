@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/numeric_kernels.h"
+
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#include "dejaview/base/build_config.h"
+#include "dejaview/base/logging.h"
+#include "src/trace_processor/db/column/types.h"
+
+// The AVX2 kernels are compiled for AVX2 whatever the flags of the build, and
+// only called if the CPU supports it.
+#if DEJAVIEW_BUILDFLAG(DEJAVIEW_ARCH_CPU_X86_64) &&  \
+    (DEJAVIEW_BUILDFLAG(DEJAVIEW_COMPILER_CLANG) || \
+     DEJAVIEW_BUILDFLAG(DEJAVIEW_COMPILER_GCC)) &&  \
+    !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WIN)
+#define DEJAVIEW_AVX2_KERNELS() 1
+#include <immintrin.h>
+#define DEJAVIEW_AVX2 __attribute__((target("avx2")))
+#else
+#define DEJAVIEW_AVX2_KERNELS() 0
+#endif
+
+namespace dejaview::trace_processor::column::kernels {
+namespace {
+
+constexpr uint32_t kBitsInWord = 64;
+
+// Calls |fn| with the std comparator of |op|.
+template <typename T, typename Fn>
+void VisitComparator(FilterOp op, const Fn& fn) {
+  switch (op) {
+    case FilterOp::kEq:
+      return fn(std::equal_to<T>());
+    case FilterOp::kNe:
+      return fn(std::not_equal_to<T>());
+    case FilterOp::kLt:
+      return fn(std::less<T>());
+    case FilterOp::kLe:
+      return fn(std::less_equal<T>());
+    case FilterOp::kGt:
+      return fn(std::greater<T>());
+    case FilterOp::kGe:
+      return fn(std::greater_equal<T>());
+    case FilterOp::kGlob:
+    case FilterOp::kRegex:
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      DEJAVIEW_FATAL("Not a valid operation on numeric type.");
+  }
+}
+
+// Calls |fn| with the std comparators of the bounds of a range.
+template <typename T, typename Fn>
+void VisitBoundComparators(FilterOp lower_op, FilterOp upper_op, const Fn& fn) {
+  DEJAVIEW_DCHECK(lower_op == FilterOp::kGt || lower_op == FilterOp::kGe);
+  DEJAVIEW_DCHECK(upper_op == FilterOp::kLt || upper_op == FilterOp::kLe);
+  if (lower_op == FilterOp::kGt) {
+    if (upper_op == FilterOp::kLt) {
+      return fn(std::greater<T>(), std::less<T>());
+    }
+    return fn(std::greater<T>(), std::less_equal<T>());
+  }
+  if (upper_op == FilterOp::kLt) {
+    return fn(std::greater_equal<T>(), std::less<T>());
+  }
+  return fn(std::greater_equal<T>(), std::less_equal<T>());
+}
+
+// The scalar version of the kernels. The loop over the values of a whole word
+// is simple enough for the compiler to auto-vectorize it.
+template <typename T, typename Predicate>
+void ScalarWords(const T* data,
+                 uint32_t count,
+                 uint64_t* out,
+                 const Predicate& predicate) {
+  for (; count >= kBitsInWord; count -= kBitsInWord, data += kBitsInWord) {
+    uint64_t word = 0;
+    for (uint32_t k = 0; k < kBitsInWord; ++k) {
+      word |= static_cast<uint64_t>(predicate(data[k])) << k;
+    }
+    *out++ = word;
+  }
+  if (count > 0) {
+    uint64_t word = 0;
+    for (uint32_t k = 0; k < count; ++k) {
+      word |= static_cast<uint64_t>(predicate(data[k])) << k;
+    }
+    *out = word;
+  }
+}
+
+#if DEJAVIEW_AVX2_KERNELS()
+
+bool CpuHasAvx2() {
+#if DEJAVIEW_BUILDFLAG(DEJAVIEW_X64_CPU_OPT)
+  // CheckCpuOptimizations() already exits at startup without AVX2.
+  return true;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// The lanes of an AVX2 register for each type of column, comparing 4 or 8
+// values at once into a mask of 1 bit per value.
+template <typename T>
+struct Avx2Lanes;
+
+template <>
+struct Avx2Lanes<int64_t> {
+  using Vec = __m256i;
+  static constexpr uint32_t kLanes = 4;
+  DEJAVIEW_AVX2 static Vec Set(int64_t val) { return _mm256_set1_epi64x(val); }
+  DEJAVIEW_AVX2 static Vec Load(const int64_t* data) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+  }
+  DEJAVIEW_AVX2 static uint32_t Eq(Vec a, Vec b) {
+    return Mask(_mm256_cmpeq_epi64(a, b));
+  }
+  DEJAVIEW_AVX2 static uint32_t Gt(Vec a, Vec b) {
+    return Mask(_mm256_cmpgt_epi64(a, b));
+  }
+  DEJAVIEW_AVX2 static uint32_t Mask(Vec cmp) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_pd(_mm256_castsi256_pd(cmp)));
+  }
+};
+
+template <>
+struct Avx2Lanes<int32_t> {
+  using Vec = __m256i;
+  static constexpr uint32_t kLanes = 8;
+  DEJAVIEW_AVX2 static Vec Set(int32_t val) { return _mm256_set1_epi32(val); }
+  DEJAVIEW_AVX2 static Vec Load(const int32_t* data) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+  }
+  DEJAVIEW_AVX2 static uint32_t Eq(Vec a, Vec b) {
+    return Mask(_mm256_cmpeq_epi32(a, b));
+  }
+  DEJAVIEW_AVX2 static uint32_t Gt(Vec a, Vec b) {
+    return Mask(_mm256_cmpgt_epi32(a, b));
+  }
+  DEJAVIEW_AVX2 static uint32_t Mask(Vec cmp) {
+    return static_cast<uint32_t>(
+        _mm256_movemask_ps(_mm256_castsi256_ps(cmp)));
+  }
+};
+
+// AVX2 has no unsigned comparison: flipping the sign bit of both sides maps
+// the order of unsigned values to the order of signed ones.
+template <>
+struct Avx2Lanes<uint32_t> {
+  using Vec = __m256i;
+  static constexpr uint32_t kLanes = 8;
+  DEJAVIEW_AVX2 static Vec Set(uint32_t val) {
+    return _mm256_set1_epi32(static_cast<int32_t>(val ^ 0x80000000u));
+  }
+  DEJAVIEW_AVX2 static Vec Load(const uint32_t* data) {
+    return _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)),
+        _mm256_set1_epi32(static_cast<int32_t>(0x80000000u)));
+  }
+  DEJAVIEW_AVX2 static uint32_t Eq(Vec a, Vec b) {
+    return Avx2Lanes<int32_t>::Eq(a, b);
+  }
+  DEJAVIEW_AVX2 static uint32_t Gt(Vec a, Vec b) {
+    return Avx2Lanes<int32_t>::Gt(a, b);
+  }
+};
+
+template <>
+struct Avx2Lanes<double> {
+  using Vec = __m256d;
+  static constexpr uint32_t kLanes = 4;
+  DEJAVIEW_AVX2 static Vec Set(double val) { return _mm256_set1_pd(val); }
+  DEJAVIEW_AVX2 static Vec Load(const double* data) {
+    return _mm256_loadu_pd(data);
+  }
+};
+
+// Compares the lanes of |x| to those of |val| with |kOp|, as the std
+// comparators do: comparisons with NaN are false, except for kNe.
+template <typename T, FilterOp kOp>
+DEJAVIEW_AVX2 uint32_t Match(typename Avx2Lanes<T>::Vec x,
+                             typename Avx2Lanes<T>::Vec val) {
+  using Lanes = Avx2Lanes<T>;
+  if constexpr (std::is_same_v<T, double>) {
+    constexpr int kPredicate =
+        kOp == FilterOp::kEq   ? _CMP_EQ_OQ
+        : kOp == FilterOp::kNe ? _CMP_NEQ_UQ
+        : kOp == FilterOp::kLt ? _CMP_LT_OQ
+        : kOp == FilterOp::kLe ? _CMP_LE_OQ
+        : kOp == FilterOp::kGt ? _CMP_GT_OQ
+                               : _CMP_GE_OQ;
+    return static_cast<uint32_t>(
+        _mm256_movemask_pd(_mm256_cmp_pd(x, val, kPredicate)));
+  } else {
+    constexpr uint32_t kAll = (1u << Lanes::kLanes) - 1;
+    switch (kOp) {
+      case FilterOp::kEq:
+        return Lanes::Eq(x, val);
+      case FilterOp::kNe:
+        return ~Lanes::Eq(x, val) & kAll;
+      case FilterOp::kLt:
+        return Lanes::Gt(val, x);
+      case FilterOp::kLe:
+        return ~Lanes::Gt(x, val) & kAll;
+      case FilterOp::kGt:
+        return Lanes::Gt(x, val);
+      case FilterOp::kGe:
+        return ~Lanes::Gt(val, x) & kAll;
+      case FilterOp::kGlob:
+      case FilterOp::kRegex:
+      case FilterOp::kIsNull:
+      case FilterOp::kIsNotNull:
+        break;
+    }
+    return 0;
+  }
+}
+
+template <typename T, FilterOp kOp>
+struct Avx2ComparePredicate {
+  DEJAVIEW_AVX2 uint32_t operator()(typename Avx2Lanes<T>::Vec x) const {
+    return Match<T, kOp>(x, val);
+  }
+  typename Avx2Lanes<T>::Vec val;
+};
+
+template <typename T, FilterOp kLowerOp, FilterOp kUpperOp>
+struct Avx2BetweenPredicate {
+  DEJAVIEW_AVX2 uint32_t operator()(typename Avx2Lanes<T>::Vec x) const {
+    return Match<T, kLowerOp>(x, lower) & Match<T, kUpperOp>(x, upper);
+  }
+  typename Avx2Lanes<T>::Vec lower;
+  typename Avx2Lanes<T>::Vec upper;
+};
+
+// Writes |words| whole words of results, comparing a register of values at a
+// time.
+template <typename T, typename Predicate>
+DEJAVIEW_AVX2 void Avx2Words(const T* data,
+                             uint32_t words,
+                             uint64_t* out,
+                             const Predicate& predicate) {
+  using Lanes = Avx2Lanes<T>;
+  for (uint32_t i = 0; i < words; ++i, data += kBitsInWord) {
+    uint64_t word = 0;
+    for (uint32_t k = 0; k < kBitsInWord; k += Lanes::kLanes) {
+      word |= static_cast<uint64_t>(predicate(Lanes::Load(data + k))) << k;
+    }
+    out[i] = word;
+  }
+}
+
+template <typename T>
+DEJAVIEW_AVX2 void Avx2CompareWords(FilterOp op,
+                               T val,
+                               const T* data,
+                               uint32_t words,
+                               uint64_t* out) {
+  auto v = Avx2Lanes<T>::Set(val);
+  switch (op) {
+    case FilterOp::kEq:
+      return Avx2Words(data, words, out,
+                       Avx2ComparePredicate<T, FilterOp::kEq>{v});
+    case FilterOp::kNe:
+      return Avx2Words(data, words, out,
+                       Avx2ComparePredicate<T, FilterOp::kNe>{v});
+    case FilterOp::kLt:
+      return Avx2Words(data, words, out,
+                       Avx2ComparePredicate<T, FilterOp::kLt>{v});
+    case FilterOp::kLe:
+      return Avx2Words(data, words, out,
+                       Avx2ComparePredicate<T, FilterOp::kLe>{v});
+    case FilterOp::kGt:
+      return Avx2Words(data, words, out,
+                       Avx2ComparePredicate<T, FilterOp::kGt>{v});
+    case FilterOp::kGe:
+      return Avx2Words(data, words, out,
+                       Avx2ComparePredicate<T, FilterOp::kGe>{v});
+    case FilterOp::kGlob:
+    case FilterOp::kRegex:
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      DEJAVIEW_FATAL("Not a valid operation on numeric type.");
+  }
+}
+
+template <typename T>
+DEJAVIEW_AVX2 void Avx2BetweenWords(FilterOp lower_op,
+                               T lower,
+                               FilterOp upper_op,
+                               T upper,
+                               const T* data,
+                               uint32_t words,
+                               uint64_t* out) {
+  auto l = Avx2Lanes<T>::Set(lower);
+  auto u = Avx2Lanes<T>::Set(upper);
+  if (lower_op == FilterOp::kGt) {
+    if (upper_op == FilterOp::kLt) {
+      return Avx2Words(
+          data, words, out,
+          Avx2BetweenPredicate<T, FilterOp::kGt, FilterOp::kLt>{l, u});
+    }
+    return Avx2Words(
+        data, words, out,
+        Avx2BetweenPredicate<T, FilterOp::kGt, FilterOp::kLe>{l, u});
+  }
+  if (upper_op == FilterOp::kLt) {
+    return Avx2Words(
+        data, words, out,
+        Avx2BetweenPredicate<T, FilterOp::kGe, FilterOp::kLt>{l, u});
+  }
+  return Avx2Words(data, words, out,
+                   Avx2BetweenPredicate<T, FilterOp::kGe, FilterOp::kLe>{l, u});
+}
+
+#else  // DEJAVIEW_AVX2_KERNELS()
+
+bool CpuHasAvx2() {
+  return false;
+}
+
+#endif  // DEJAVIEW_AVX2_KERNELS()
+
+}  // namespace
+
+bool UsesAvx2() {
+  static const bool uses_avx2 = CpuHasAvx2();
+  return uses_avx2;
+}
+
+template <typename T>
+void Compare(FilterOp op, T val, const T* data, uint32_t count, uint64_t* out) {
+#if DEJAVIEW_AVX2_KERNELS()
+  if (UsesAvx2()) {
+    uint32_t words = count / kBitsInWord;
+    Avx2CompareWords(op, val, data, words, out);
+    data += words * kBitsInWord;
+    out += words;
+    count %= kBitsInWord;
+  }
+#endif
+  VisitComparator<T>(op, [&](auto comparator) {
+    ScalarWords(data, count, out, [&](T x) { return comparator(x, val); });
+  });
+}
+
+template <typename T>
+void Between(FilterOp lower_op,
+             T lower,
+             FilterOp upper_op,
+             T upper,
+             const T* data,
+             uint32_t count,
+             uint64_t* out) {
+#if DEJAVIEW_AVX2_KERNELS()
+  if (UsesAvx2()) {
+    uint32_t words = count / kBitsInWord;
+    Avx2BetweenWords(lower_op, lower, upper_op, upper, data, words, out);
+    data += words * kBitsInWord;
+    out += words;
+    count %= kBitsInWord;
+  }
+#endif
+  VisitBoundComparators<T>(
+      lower_op, upper_op, [&](auto lower_comparator, auto upper_comparator) {
+        ScalarWords(data, count, out, [&](T x) {
+          return lower_comparator(x, lower) && upper_comparator(x, upper);
+        });
+      });
+}
+
+template void Compare(FilterOp, int64_t, const int64_t*, uint32_t, uint64_t*);
+template void Compare(FilterOp, int32_t, const int32_t*, uint32_t, uint64_t*);
+template void Compare(FilterOp,
+                      uint32_t,
+                      const uint32_t*,
+                      uint32_t,
+                      uint64_t*);
+template void Compare(FilterOp, double, const double*, uint32_t, uint64_t*);
+
+template void Between(FilterOp,
+                      int64_t,
+                      FilterOp,
+                      int64_t,
+                      const int64_t*,
+                      uint32_t,
+                      uint64_t*);
+template void Between(FilterOp,
+                      int32_t,
+                      FilterOp,
+                      int32_t,
+                      const int32_t*,
+                      uint32_t,
+                      uint64_t*);
+template void Between(FilterOp,
+                      uint32_t,
+                      FilterOp,
+                      uint32_t,
+                      const uint32_t*,
+                      uint32_t,
+                      uint64_t*);
+template void Between(FilterOp,
+                      double,
+                      FilterOp,
+                      double,
+                      const double*,
+                      uint32_t,
+                      uint64_t*);
+
+}  // namespace dejaview::trace_processor::column::kernels
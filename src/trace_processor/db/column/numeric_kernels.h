@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_NUMERIC_KERNELS_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_NUMERIC_KERNELS_H_
+
+#include <cstdint>
+
+#include "src/trace_processor/db/column/types.h"
+
+// Kernels comparing numeric columns to values, which output the result of 64
+// rows per word, the first row in the lowest bit, so that it can be written
+// directly in the words of a BitVector. On x86-64, they use AVX2 when the CPU
+// supports it, and a scalar loop otherwise.
+namespace dejaview::trace_processor::column::kernels {
+
+// Writes whether each of the |count| values from |data| compares to |val| with
+// |op| in the (count + 63) / 64 words at |out|. The bits of the last word past
+// |count| are cleared. |op| has to be a comparison, not kGlob, kRegex, kIsNull
+// or kIsNotNull.
+template <typename T>
+void Compare(FilterOp op, T val, const T* data, uint32_t count, uint64_t* out);
+
+// Same as Compare(), for values which compare to |lower| with |lower_op|, kGt
+// or kGe, and to |upper| with |upper_op|, kLt or kLe: the values of a range
+// such as `ts >= a AND ts < b`, compared in a single pass.
+template <typename T>
+void Between(FilterOp lower_op,
+             T lower,
+             FilterOp upper_op,
+             T upper,
+             const T* data,
+             uint32_t count,
+             uint64_t* out);
+
+// Returns whether the kernels use AVX2 on this CPU.
+bool UsesAvx2();
+
+extern template void Compare(FilterOp, int64_t, const int64_t*, uint32_t,
+                             uint64_t*);
+extern template void Compare(FilterOp, int32_t, const int32_t*, uint32_t,
+                             uint64_t*);
+extern template void Compare(FilterOp, uint32_t, const uint32_t*, uint32_t,
+                             uint64_t*);
+extern template void Compare(FilterOp, double, const double*, uint32_t,
+                             uint64_t*);
+
+extern template void Between(FilterOp, int64_t, FilterOp, int64_t,
+                             const int64_t*, uint32_t, uint64_t*);
+extern template void Between(FilterOp, int32_t, FilterOp, int32_t,
+                             const int32_t*, uint32_t, uint64_t*);
+extern template void Between(FilterOp, uint32_t, FilterOp, uint32_t,
+                             const uint32_t*, uint32_t, uint64_t*);
+extern template void Between(FilterOp, double, FilterOp, double,
+                             const double*, uint32_t, uint64_t*);
+
+}  // namespace dejaview::trace_processor::column::kernels
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_NUMERIC_KERNELS_H_
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/numeric_kernels.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "src/trace_processor/db/column/types.h"
+#include "test/gtest_and_gmock.h"
+
+namespace dejaview::trace_processor::column::kernels {
+namespace {
+
+constexpr FilterOp kOps[] = {FilterOp::kEq, FilterOp::kNe, FilterOp::kLt,
+                             FilterOp::kLe, FilterOp::kGt, FilterOp::kGe};
+
+template <typename T>
+bool Matches(FilterOp op, T a, T b) {
+  switch (op) {
+    case FilterOp::kEq:
+      return a == b;
+    case FilterOp::kNe:
+      return a != b;
+    case FilterOp::kLt:
+      return a < b;
+    case FilterOp::kLe:
+      return a <= b;
+    case FilterOp::kGt:
+      return a > b;
+    case FilterOp::kGe:
+      return a >= b;
+    case FilterOp::kGlob:
+    case FilterOp::kRegex:
+    case FilterOp::kIsNull:
+    case FilterOp::kIsNotNull:
+      break;
+  }
+  return false;
+}
+
+// Values around |pivot| and the extremes of T, over a few words and a partial
+// one.
+template <typename T>
+std::vector<T> MakeData(T pivot) {
+  std::vector<T> data;
+  for (uint32_t i = 0; i < 3 * 64 + 17; ++i) {
+    switch (i % 5) {
+      case 0:
+        data.push_back(pivot);
+        break;
+      case 1:
+        data.push_back(std::numeric_limits<T>::max());
+        break;
+      case 2:
+        data.push_back(std::numeric_limits<T>::lowest());
+        break;
+      default:
+        data.push_back(static_cast<T>(pivot + static_cast<T>(i % 7) - 3));
+        break;
+    }
+  }
+  return data;
+}
+
+template <typename T>
+void CheckCompare(const std::vector<T>& data, T val) {
+  auto count = static_cast<uint32_t>(data.size());
+  for (FilterOp op : kOps) {
+    std::vector<uint64_t> out((count + 63) / 64, ~0ull);
+    Compare(op, val, data.data(), count, out.data());
+    for (uint32_t i = 0; i < out.size() * 64; ++i) {
+      bool expected = i < count && Matches(op, data[i], val);
+      ASSERT_EQ((out[i / 64] >> (i % 64)) & 1, expected)
+          << "op " << static_cast<int>(op) << " row " << i;
+    }
+  }
+}
+
+template <typename T>
+void CheckBetween(const std::vector<T>& data, T lower, T upper) {
+  auto count = static_cast<uint32_t>(data.size());
+  for (FilterOp lower_op : {FilterOp::kGt, FilterOp::kGe}) {
+    for (FilterOp upper_op : {FilterOp::kLt, FilterOp::kLe}) {
+      std::vector<uint64_t> out((count + 63) / 64, ~0ull);
+      Between(lower_op, lower, upper_op, upper, data.data(), count,
+              out.data());
+      for (uint32_t i = 0; i < out.size() * 64; ++i) {
+        bool expected = i < count && Matches(lower_op, data[i], lower) &&
+                        Matches(upper_op, data[i], upper);
+        ASSERT_EQ((out[i / 64] >> (i % 64)) & 1, expected) << "row " << i;
+      }
+    }
+  }
+}
+
+TEST(NumericKernels, CompareInt64) {
+  CheckCompare<int64_t>(MakeData<int64_t>(-100), -100);
+  CheckCompare<int64_t>(MakeData<int64_t>(0), 1);
+}
+
+TEST(NumericKernels, CompareInt32) {
+  CheckCompare<int32_t>(MakeData<int32_t>(-100), -100);
+  CheckCompare<int32_t>(MakeData<int32_t>(0), 1);
+}
+
+TEST(NumericKernels, CompareUint32) {
+  CheckCompare<uint32_t>(MakeData<uint32_t>(100), 100);
+  CheckCompare<uint32_t>(MakeData<uint32_t>(0x80000000u), 0x7fffffffu);
+}
+
+TEST(NumericKernels, CompareDouble) {
+  std::vector<double> data = MakeData<double>(1.5);
+  data[7] = std::nan("");
+  data[64] = std::nan("");
+  CheckCompare<double>(data, 1.5);
+  CheckCompare<double>(data, std::nan(""));
+}
+
+TEST(NumericKernels, Between) {
+  CheckBetween<int64_t>(MakeData<int64_t>(1000), 998, 1002);
+  CheckBetween<int32_t>(MakeData<int32_t>(-5), -7, -5);
+  CheckBetween<uint32_t>(MakeData<uint32_t>(0x80000000u), 0x7fffffffu,
+                         0x80000002u);
+  std::vector<double> data = MakeData<double>(0.5);
+  data[3] = std::nan("");
+  CheckBetween<double>(data, -1.5, 0.5);
+}
+
+TEST(NumericKernels, Empty) {
+  uint64_t word = 42;
+  Compare<int64_t>(FilterOp::kEq, 0, nullptr, 0, &word);
+  ASSERT_EQ(word, 42u);
+}
+
+}  // namespace
+}  // namespace dejaview::trace_processor::column::kernels
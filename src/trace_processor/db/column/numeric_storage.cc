@@ -33,6 +33,7 @@
 #include "dejaview/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/numeric_kernels.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
 #include "src/trace_processor/tp_metatrace.h"
@@ -141,31 +142,12 @@ void TypedLinearSearch(T typed_val,
                        const T* start,
                        FilterOp op,
                        BitVector::Builder& builder) {
-  switch (op) {
-    case FilterOp::kEq:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::equal_to<T>(), builder);
-    case FilterOp::kNe:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::not_equal_to<T>(), builder);
-    case FilterOp::kLe:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::less_equal<T>(), builder);
-    case FilterOp::kLt:
-      return utils::LinearSearchWithComparator(typed_val, start, std::less<T>(),
-                                               builder);
-    case FilterOp::kGt:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::greater<T>(), builder);
-    case FilterOp::kGe:
-      return utils::LinearSearchWithComparator(
-          typed_val, start, std::greater_equal<T>(), builder);
-    case FilterOp::kGlob:
-    case FilterOp::kRegex:
-    case FilterOp::kIsNotNull:
-    case FilterOp::kIsNull:
-      DEJAVIEW_DFATAL("Illegal argument");
-  }
+  utils::LinearSearchWithKernel(
+      start,
+      [op, typed_val](const T* data, uint32_t count, uint64_t* out) {
+        kernels::Compare(op, typed_val, data, count, out);
+      },
+      builder);
 }
 
 SearchValidationResult IntColumnWithDouble(FilterOp op, SqlValue* sql_val) {
@@ -403,6 +385,51 @@ RangeOrBitVector NumericStorageBase::ChainImpl::SearchValidated(
   return RangeOrBitVector(LinearSearchInternal(op, val, search_range));
 }
 
+RangeOrBitVector NumericStorageBase::ChainImpl::SearchBetweenValidated(
+    FilterOp lower_op,
+    SqlValue lower,
+    FilterOp upper_op,
+    SqlValue upper,
+    Range search_range) const {
+  DEJAVIEW_DCHECK(search_range.end <= size());
+
+  // Sorted columns are binary searched for each bound, and values of another
+  // type than the column need the conversions of SearchValidated().
+  SqlValue::Type type = storage_type_ == ColumnType::kDouble ? SqlValue::kDouble
+                                                             : SqlValue::kLong;
+  if (is_sorted_ || lower.type != type || upper.type != type) {
+    return DataLayerChain::SearchBetweenValidated(lower_op, lower, upper_op,
+                                                  upper, search_range);
+  }
+
+  DEJAVIEW_TP_TRACE(
+      metatrace::Category::DB, "NumericStorage::ChainImpl::SearchBetween",
+      [&search_range](metatrace::Record* r) {
+        r->AddArg("Start", std::to_string(search_range.start));
+        r->AddArg("End", std::to_string(search_range.end));
+      });
+
+  NumericValue upper_val = GetNumericTypeVariant(storage_type_, upper);
+  BitVector::Builder builder(search_range.end, search_range.start);
+  std::visit(
+      [&](auto lower_typed) {
+        using T = decltype(lower_typed);
+        T upper_typed = std::get<T>(upper_val);
+        const auto* start =
+            static_cast<const std::vector<T>*>(vector_ptr_)->data() +
+            search_range.start;
+        utils::LinearSearchWithKernel(
+            start,
+            [=](const T* data, uint32_t count, uint64_t* out) {
+              kernels::Between(lower_op, lower_typed, upper_op, upper_typed,
+                               data, count, out);
+            },
+            builder);
+      },
+      GetNumericTypeVariant(storage_type_, lower));
+  return RangeOrBitVector(std::move(builder).Build());
+}
+
 void NumericStorageBase::ChainImpl::IndexSearchValidated(
     FilterOp op,
     SqlValue sql_val,
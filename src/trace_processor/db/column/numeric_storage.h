@@ -30,6 +30,7 @@
 #include "dejaview/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/parallel.h"
 #include "src/trace_processor/db/column/storage_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
@@ -46,6 +47,12 @@ class NumericStorageBase : public StorageLayer {
 
     RangeOrBitVector SearchValidated(FilterOp, SqlValue, Range) const override;
 
+    RangeOrBitVector SearchBetweenValidated(FilterOp lower_op,
+                                            SqlValue lower,
+                                            FilterOp upper_op,
+                                            SqlValue upper,
+                                            Range) const override;
+
     void IndexSearchValidated(FilterOp, SqlValue, Indices&) const override;
 
     std::string DebugString() const override { return "NumericStorage"; }
@@ -150,14 +157,16 @@ class NumericStorage final : public NumericStorageBase {
       const T* base = vector_->data();
       switch (direction) {
         case SortDirection::kAscending:
-          std::stable_sort(start, end, [base](const Token& a, const Token& b) {
-            return base[a.index] < base[b.index];
-          });
+          parallel::StableSort(start, end,
+                               [base](const Token& a, const Token& b) {
+                                 return base[a.index] < base[b.index];
+                               });
           break;
         case SortDirection::kDescending:
-          std::stable_sort(start, end, [base](const Token& a, const Token& b) {
-            return base[a.index] > base[b.index];
-          });
+          parallel::StableSort(start, end,
+                               [base](const Token& a, const Token& b) {
+                                 return base[a.index] > base[b.index];
+                               });
           break;
       }
     }
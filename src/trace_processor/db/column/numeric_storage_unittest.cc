@@ -220,6 +220,45 @@ TEST(NumericStorage, Search) {
   ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 3));
 }
 
+TEST(NumericStorage, SearchBetween) {
+  std::vector<int64_t> data_vec{-5, 5, -4, 4, -3, 3, 0};
+  NumericStorage<int64_t> storage(&data_vec, ColumnType::kInt64, false);
+  auto chain = storage.MakeChain();
+  Range test_range(1, 6);
+
+  auto res = chain->SearchBetween(FilterOp::kGe, SqlValue::Long(-4),
+                                  FilterOp::kLt, SqlValue::Long(4), test_range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(2, 4, 5));
+
+  res = chain->SearchBetween(FilterOp::kGt, SqlValue::Long(-4), FilterOp::kLe,
+                             SqlValue::Long(4), test_range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(3, 4, 5));
+
+  // Mismatched types go through the search of each bound.
+  res = chain->SearchBetween(FilterOp::kGe, SqlValue::Double(-3.5),
+                             FilterOp::kLt, SqlValue::Long(5), test_range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(3, 4, 5));
+}
+
+TEST(NumericStorage, SearchBetweenSorted) {
+  std::vector<uint32_t> data_vec{0, 1, 2, 3, 4, 5, 6, 7};
+  NumericStorage<uint32_t> storage(&data_vec, ColumnType::kUint32, true);
+  auto chain = storage.MakeChain();
+  Range test_range(1, 7);
+
+  auto res = chain->SearchBetween(FilterOp::kGe, SqlValue::Long(2),
+                                  FilterOp::kLt, SqlValue::Long(5), test_range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(2, 3, 4));
+
+  res = chain->SearchBetween(FilterOp::kGt, SqlValue::Long(-1), FilterOp::kLe,
+                             SqlValue::Long(1), test_range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1));
+
+  res = chain->SearchBetween(FilterOp::kGt, SqlValue::Long(5), FilterOp::kLt,
+                             SqlValue::Long(3), test_range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), IsEmpty());
+}
+
 TEST(NumericStorage, SearchCompareWithNegative) {
   std::vector<int32_t> data_vec{-5, 5, -4, 4, -3, 3, 0};
   NumericStorage<int32_t> storage(&data_vec, ColumnType::kInt32, false);
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/parallel.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "dejaview/base/build_config.h"
+#include "dejaview/ext/base/no_destructor.h"
+
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+#include "dejaview/ext/base/threading/thread_pool.h"
+#endif
+
+namespace dejaview::trace_processor::column::parallel {
+
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+namespace {
+
+struct Pool {
+  std::mutex mutex;
+  uint32_t max_threads = 0;
+  std::unique_ptr<base::ThreadPool> thread_pool;
+};
+
+Pool& GetPool() {
+  static base::NoDestructor<Pool> pool;
+  return pool.ref();
+}
+
+// Set on the threads of the pool, which must not wait for other morsels.
+thread_local bool g_is_pool_thread = false;
+
+}  // namespace
+
+uint32_t MaxThreads() {
+  Pool& pool = GetPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  if (pool.max_threads)
+    return pool.max_threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void SetMaxThreads(uint32_t max_threads) {
+  Pool& pool = GetPool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  if (pool.max_threads == max_threads)
+    return;
+  pool.max_threads = max_threads;
+  pool.thread_pool.reset();
+}
+
+void ForEach(uint32_t count, const std::function<void(uint32_t)>& fn) {
+  uint32_t threads = MaxThreads();
+  if (count <= 1 || threads <= 1 || g_is_pool_thread) {
+    for (uint32_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  Pool& pool = GetPool();
+  base::ThreadPool* thread_pool;
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (!pool.thread_pool)
+      pool.thread_pool = std::make_unique<base::ThreadPool>(threads);
+    thread_pool = pool.thread_pool.get();
+  }
+
+  thread_pool->RunAndWait(count, [&fn](size_t i) {
+    g_is_pool_thread = true;
+    fn(static_cast<uint32_t>(i));
+  });
+}
+
+#else  // DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+
+uint32_t MaxThreads() {
+  return 1;
+}
+
+void SetMaxThreads(uint32_t) {}
+
+void ForEach(uint32_t count, const std::function<void(uint32_t)>& fn) {
+  for (uint32_t i = 0; i < count; ++i)
+    fn(i);
+}
+
+#endif  // !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+
+}  // namespace dejaview::trace_processor::column::parallel
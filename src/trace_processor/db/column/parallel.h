@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_PARALLEL_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_PARALLEL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "src/trace_processor/db/column/types.h"
+
+// Morsel-driven parallelism for searching and sorting large columns: the rows
+// are split in morsels of contiguous rows, each processed by a thread of a
+// pool shared by every table of the process, and the results of the morsels
+// are concatenated or merged in order.
+namespace dejaview::trace_processor::column::parallel {
+
+// The number of rows of a morsel. It's a multiple of 64 so that morsels of a
+// search fill whole words of a BitVector.
+constexpr uint32_t kMorselRows = 1 << 20;
+
+// Returns the number of threads which may process the morsels of an
+// operation, 1 if operations should run on the calling thread only.
+uint32_t MaxThreads();
+
+// Sets the number of threads which may process morsels. 0 uses one thread per
+// core, the default. Must not be called while a table is being searched or
+// sorted. Ignored in WASM builds, which have no threads.
+void SetMaxThreads(uint32_t);
+
+// Runs |fn| with every index in [0, count) on the thread pool, and returns
+// once all of them returned. Runs them on the calling thread if it's a thread
+// of the pool itself.
+void ForEach(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+// Same as std::stable_sort, sorting morsels in parallel and merging them by
+// pairs.
+template <typename Comparator>
+void StableSort(Token* start, Token* end, Comparator comparator) {
+  auto count = static_cast<size_t>(end - start);
+  uint32_t threads = MaxThreads();
+  if (threads <= 1 || count < 2 * kMorselRows) {
+    std::stable_sort(start, end, comparator);
+    return;
+  }
+
+  // One run per thread keeps merges few, while morsels stay large.
+  auto runs = static_cast<uint32_t>(
+      std::min<size_t>(threads, count / kMorselRows));
+  std::vector<size_t> bounds(runs + 1);
+  for (uint32_t i = 0; i <= runs; ++i) {
+    bounds[i] = count * i / runs;
+  }
+  ForEach(runs, [&](uint32_t i) {
+    std::stable_sort(start + bounds[i], start + bounds[i + 1], comparator);
+  });
+
+  // std::merge keeps elements of the first run before equal elements of the
+  // second one, which keeps the sort stable.
+  std::vector<Token> buffer(count);
+  Token* src = start;
+  Token* dst = buffer.data();
+  while (bounds.size() > 2) {
+    auto pairs = static_cast<uint32_t>(bounds.size() / 2);
+    ForEach(pairs, [&](uint32_t i) {
+      size_t first = bounds[2 * i];
+      size_t middle = bounds[2 * i + 1];
+      if (2 * i + 2 >= bounds.size()) {
+        std::copy(src + first, src + middle, dst + first);
+        return;
+      }
+      size_t last = bounds[2 * i + 2];
+      std::merge(src + first, src + middle, src + middle, src + last,
+                 dst + first, comparator);
+    });
+    std::vector<size_t> merged;
+    for (size_t i = 0; i < bounds.size(); i += 2) {
+      merged.push_back(bounds[i]);
+    }
+    if (merged.back() != count) {
+      merged.push_back(count);
+    }
+    bounds = std::move(merged);
+    std::swap(src, dst);
+  }
+  if (src != start) {
+    std::copy(src, src + count, start);
+  }
+}
+
+}  // namespace dejaview::trace_processor::column::parallel
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_PARALLEL_H_
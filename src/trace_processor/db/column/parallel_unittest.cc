@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/column/parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column/utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace dejaview::trace_processor::column {
+namespace {
+
+// Enough rows to be split in a few morsels, the last one being partial.
+constexpr uint32_t kRows = 3 * parallel::kMorselRows + 12345;
+
+class ParallelTest : public ::testing::Test {
+ protected:
+  void SetUp() override { parallel::SetMaxThreads(4); }
+  void TearDown() override { parallel::SetMaxThreads(0); }
+};
+
+TEST_F(ParallelTest, ForEachRunsEveryIndex) {
+  std::vector<uint32_t> runs(100);
+  parallel::ForEach(100, [&](uint32_t i) { runs[i]++; });
+  ASSERT_TRUE(std::all_of(runs.begin(), runs.end(),
+                          [](uint32_t r) { return r == 1; }));
+}
+
+TEST_F(ParallelTest, StableSortMatchesStdStableSort) {
+  std::vector<Token> tokens(kRows);
+  for (uint32_t i = 0; i < kRows; ++i) {
+    // Few distinct keys, in a scrambled order, so that stability matters.
+    tokens[i].index = (i * 2654435761u) % 1000;
+    tokens[i].payload = i;
+  }
+  std::vector<Token> expected = tokens;
+  auto comparator = [](const Token& a, const Token& b) {
+    return a.index < b.index;
+  };
+  std::stable_sort(expected.begin(), expected.end(), comparator);
+  parallel::StableSort(tokens.data(), tokens.data() + tokens.size(),
+                       comparator);
+
+  for (uint32_t i = 0; i < kRows; ++i) {
+    ASSERT_EQ(tokens[i].index, expected[i].index);
+    ASSERT_EQ(tokens[i].payload, expected[i].payload);
+  }
+}
+
+TEST_F(ParallelTest, LinearSearchMatchesSerialSearch) {
+  std::vector<uint32_t> data(kRows);
+  for (uint32_t i = 0; i < kRows; ++i) {
+    data[i] = (i * 2654435761u) % 1000;
+  }
+  // Starting off a word boundary exercises the head of the search.
+  constexpr uint32_t kStart = 37;
+  auto search = [&] {
+    BitVector::Builder builder(kRows, kStart);
+    utils::LinearSearchWithComparator(500u, data.data() + kStart,
+                                      std::less<>(), builder);
+    return std::move(builder).Build();
+  };
+
+  BitVector parallel_result = search();
+  parallel::SetMaxThreads(1);
+  BitVector serial_result = search();
+
+  ASSERT_EQ(parallel_result.size(), serial_result.size());
+  ASSERT_EQ(parallel_result.CountSetBits(), serial_result.CountSetBits());
+  for (uint32_t i = 0; i < kRows; ++i) {
+    ASSERT_EQ(parallel_result.IsSet(i), serial_result.IsSet(i));
+  }
+}
+
+}  // namespace
+}  // namespace dejaview::trace_processor::column
@@ -35,6 +35,8 @@
 #include "src/trace_processor/containers/null_term_string_view.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/numeric_kernels.h"
+#include "src/trace_processor/db/column/parallel.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
 #include "src/trace_processor/tp_metatrace.h"
@@ -88,22 +90,6 @@ struct Glob {
   const StringPool* pool_;
 };
 
-struct GlobFullStringPool {
-  GlobFullStringPool(StringPool* pool, const util::GlobMatcher& matcher)
-      : pool_(pool), matches_(pool->MaxSmallStringId().raw_id()) {
-    DEJAVIEW_DCHECK(!pool->HasLargeString());
-    for (auto it = pool->CreateIterator(); it; ++it) {
-      auto id = it.StringId();
-      matches_[id.raw_id()] = matcher.Matches(pool->Get(id));
-    }
-  }
-  bool operator()(StringPool::Id lhs, StringPool::Id) const {
-    return lhs != StringPool::Id::Null() && matches_[lhs.raw_id()];
-  }
-  StringPool* pool_;
-  std::vector<uint8_t> matches_;
-};
-
 struct Regex {
   bool operator()(StringPool::Id lhs, const regex::Regex& pattern) const {
     return lhs != StringPool::Id::Null() &&
@@ -112,21 +98,13 @@ struct Regex {
   const StringPool* pool_;
 };
 
-struct RegexFullStringPool {
-  RegexFullStringPool(StringPool* pool, const regex::Regex& regex)
-      : pool_(pool), matches_(pool->MaxSmallStringId().raw_id()) {
-    DEJAVIEW_DCHECK(!pool->HasLargeString());
-    for (auto it = pool->CreateIterator(); it; ++it) {
-      auto id = it.StringId();
-      matches_[id.raw_id()] =
-          id != StringPool::Id::Null() && regex.Search(pool_->Get(id).c_str());
-    }
-  }
+// Looks up whether the string of a row matches in the PoolMatches of the
+// string pool.
+struct MatchesInPool {
   bool operator()(StringPool::Id lhs, StringPool::Id) const {
-    return matches_[lhs.raw_id()];
+    return matches_->IsSet(lhs.raw_id());
   }
-  StringPool* pool_;
-  std::vector<uint8_t> matches_;
+  const BitVector* matches_;
 };
 
 struct IsNull {
@@ -141,6 +119,23 @@ struct IsNotNull {
   }
 };
 
+// Searches the rows whose raw id compares to the raw id of |val| with |op|
+// using the numeric kernels: as strings are interned, kEq compares the strings.
+void LinearSearchRawIds(FilterOp op,
+                        StringPool::Id val,
+                        const StringPool::Id* start,
+                        BitVector::Builder& builder) {
+  static_assert(sizeof(StringPool::Id) == sizeof(uint32_t),
+                "StringPool::Id has to be a raw uint32_t");
+  utils::LinearSearchWithKernel(
+      reinterpret_cast<const uint32_t*>(start),
+      [op, raw_id = val.raw_id()](const uint32_t* data, uint32_t count,
+                                  uint64_t* out) {
+        kernels::Compare(op, raw_id, data, count, out);
+      },
+      builder);
+}
+
 uint32_t LowerBoundIntrinsic(StringPool* pool,
                              const StringPool::Id* data,
                              NullTermStringView val,
@@ -351,8 +346,11 @@ void StringStorage::ChainImpl::IndexSearchValidated(FilterOp op,
         r->AddArg("Op", std::to_string(static_cast<uint32_t>(op)));
       });
 
+  // Globs and regexes are matched against strings rather than compared to an
+  // id: their patterns aren't interned, which would grow the pool.
   StringPool::Id val =
-      (op == FilterOp::kIsNull || op == FilterOp::kIsNotNull)
+      (op == FilterOp::kIsNull || op == FilterOp::kIsNotNull ||
+       op == FilterOp::kGlob || op == FilterOp::kRegex)
           ? StringPool::Id::Null()
           : string_pool_->InternString(base::StringView(sql_val.AsString()));
   const StringPool::Id* start = data_->data();
@@ -383,10 +381,26 @@ void StringStorage::ChainImpl::IndexSearchValidated(FilterOp op,
       util::GlobMatcher matcher =
           util::GlobMatcher::FromPattern(sql_val.AsString());
       if (matcher.IsEquality()) {
-        utils::IndexSearchWithComparator(val, start, indices,
+        // No row matches a string which isn't in the pool.
+        std::optional<StringPool::Id> id =
+            string_pool_->GetId(base::StringView(sql_val.AsString()));
+        if (!id) {
+          indices.tokens.clear();
+          break;
+        }
+        utils::IndexSearchWithComparator(*id, start, indices,
                                          std::equal_to<>());
         break;
       }
+      const BitVector* matches = GetPoolMatches(
+          op, sql_val.AsString(),
+          [&matcher](NullTermStringView str) { return matcher.Matches(str); },
+          indices.tokens.size() >= string_pool_->size());
+      if (matches) {
+        utils::IndexSearchWithComparator(val, start, indices,
+                                         MatchesInPool{matches});
+        break;
+      }
       utils::IndexSearchWithComparator(std::move(matcher), start, indices,
                                        Glob{string_pool_});
       break;
@@ -394,6 +408,17 @@ void StringStorage::ChainImpl::IndexSearchValidated(FilterOp op,
     case FilterOp::kRegex: {
       base::StatusOr<regex::Regex> regex =
           regex::Regex::Create(sql_val.AsString());
+      const BitVector* matches = GetPoolMatches(
+          op, sql_val.AsString(),
+          [&regex](NullTermStringView str) {
+            return regex->Search(str.c_str());
+          },
+          indices.tokens.size() >= string_pool_->size());
+      if (matches) {
+        utils::IndexSearchWithComparator(val, start, indices,
+                                         MatchesInPool{matches});
+        break;
+      }
       utils::IndexSearchWithComparator(std::move(regex.value()), start, indices,
                                        Regex{string_pool_});
       break;
@@ -410,8 +435,11 @@ void StringStorage::ChainImpl::IndexSearchValidated(FilterOp op,
 BitVector StringStorage::ChainImpl::LinearSearch(FilterOp op,
                                                  SqlValue sql_val,
                                                  Range range) const {
+  // Globs and regexes are matched against strings rather than compared to an
+  // id: their patterns aren't interned, which would grow the pool.
   StringPool::Id val =
-      (op == FilterOp::kIsNull || op == FilterOp::kIsNotNull)
+      (op == FilterOp::kIsNull || op == FilterOp::kIsNotNull ||
+       op == FilterOp::kGlob || op == FilterOp::kRegex)
           ? StringPool::Id::Null()
           : string_pool_->InternString(base::StringView(sql_val.AsString()));
 
@@ -420,7 +448,7 @@ BitVector StringStorage::ChainImpl::LinearSearch(FilterOp op,
   BitVector::Builder builder(range.end, range.start);
   switch (op) {
     case FilterOp::kEq:
-      utils::LinearSearchWithComparator(val, start, std::equal_to<>(), builder);
+      LinearSearchRawIds(FilterOp::kEq, val, start, builder);
       break;
     case FilterOp::kNe:
       utils::LinearSearchWithComparator(val, start, NotEqual(), builder);
@@ -446,25 +474,32 @@ BitVector StringStorage::ChainImpl::LinearSearch(FilterOp op,
           util::GlobMatcher::FromPattern(sql_val.AsString());
 
       // If glob pattern doesn't involve any special characters, the function
-      // called should be equality.
+      // called should be equality: no row matches a string which isn't in the
+      // pool.
       if (matcher.IsEquality()) {
-        utils::LinearSearchWithComparator(val, start, std::equal_to<>(),
-                                          builder);
+        std::optional<StringPool::Id> id =
+            string_pool_->GetId(base::StringView(sql_val.AsString()));
+        if (id) {
+          LinearSearchRawIds(FilterOp::kEq, *id, start, builder);
+        }
         break;
       }
 
-      // For very big string pools (or small ranges) or pools with large strings
-      // run a standard glob function.
-      if (range.size() < string_pool_->size() ||
-          string_pool_->HasLargeString()) {
-        utils::LinearSearchWithComparator(std::move(matcher), start,
-                                          Glob{string_pool_}, builder);
+      // Unless the pattern was already matched on the pool by a previous
+      // search, only match it once per string of the pool if there are at
+      // least as many rows as strings: for very big string pools (or small
+      // ranges) run a standard glob function.
+      const BitVector* matches = GetPoolMatches(
+          op, sql_val.AsString(),
+          [&matcher](NullTermStringView str) { return matcher.Matches(str); },
+          range.size() >= string_pool_->size());
+      if (matches) {
+        utils::LinearSearchWithComparator(val, start, MatchesInPool{matches},
+                                          builder);
         break;
       }
-
-      utils::LinearSearchWithComparator(
-          StringPool::Id::Null(), start,
-          GlobFullStringPool{string_pool_, matcher}, builder);
+      utils::LinearSearchWithComparator(std::move(matcher), start,
+                                        Glob{string_pool_}, builder);
       break;
     }
     case FilterOp::kRegex: {
@@ -473,29 +508,82 @@ BitVector StringStorage::ChainImpl::LinearSearch(FilterOp op,
           regex::Regex::Create(sql_val.AsString());
       DEJAVIEW_CHECK(regex.status().ok());
 
-      // For very big string pools (or small ranges) or pools with large
-      // strings run a standard regex function.
-      if (range.size() < string_pool_->size() ||
-          string_pool_->HasLargeString()) {
-        utils::LinearSearchWithComparator(std::move(regex.value()), start,
-                                          Regex{string_pool_}, builder);
+      // As for globs, for very big string pools (or small ranges) run a
+      // standard regex function.
+      const BitVector* matches = GetPoolMatches(
+          op, sql_val.AsString(),
+          [&regex](NullTermStringView str) {
+            return regex->Search(str.c_str());
+          },
+          range.size() >= string_pool_->size());
+      if (matches) {
+        utils::LinearSearchWithComparator(val, start, MatchesInPool{matches},
+                                          builder);
         break;
       }
-      utils::LinearSearchWithComparator(
-          StringPool::Id::Null(), start,
-          RegexFullStringPool{string_pool_, regex.value()}, builder);
+      utils::LinearSearchWithComparator(std::move(regex.value()), start,
+                                        Regex{string_pool_}, builder);
       break;
     }
     case FilterOp::kIsNull:
-      utils::LinearSearchWithComparator(val, start, IsNull(), builder);
+      LinearSearchRawIds(FilterOp::kEq, StringPool::Id::Null(), start, builder);
       break;
     case FilterOp::kIsNotNull:
-      utils::LinearSearchWithComparator(val, start, IsNotNull(), builder);
+      LinearSearchRawIds(FilterOp::kNe, StringPool::Id::Null(), start, builder);
   }
 
   return std::move(builder).Build();
 }
 
+const BitVector* StringStorage::ChainImpl::GetPoolMatches(
+    FilterOp op,
+    const char* pattern,
+    const std::function<bool(NullTermStringView)>& match,
+    bool create) const {
+  // Large strings don't have ids which can index the matches.
+  if (string_pool_->HasLargeString()) {
+    return nullptr;
+  }
+  auto it = std::find_if(pool_matches_.begin(), pool_matches_.end(),
+                         [op, pattern](const PoolMatches& matches) {
+                           return matches.op == op &&
+                                  matches.pattern == pattern;
+                         });
+  if (it == pool_matches_.end()) {
+    if (!create) {
+      return nullptr;
+    }
+    if (pool_matches_.size() == kMaxCachedPoolMatches) {
+      pool_matches_.erase(pool_matches_.begin());
+    }
+    pool_matches_.push_back(PoolMatches{op, pattern, 0, BitVector()});
+    it = std::prev(pool_matches_.end());
+  }
+
+  // Strings are only ever appended to the pool, so only the ones interned
+  // since the last search have to be matched.
+  uint32_t end_id = string_pool_->MaxSmallStringId().raw_id();
+  if (it->matched_until_id < end_id) {
+    DEJAVIEW_TP_TRACE(
+        metatrace::Category::DB, "StringStorage::ChainImpl::GetPoolMatches",
+        [&it, end_id](metatrace::Record* r) {
+          r->AddArg("Start", std::to_string(it->matched_until_id));
+          r->AddArg("End", std::to_string(end_id));
+        });
+    it->matches.Resize(end_id, false);
+    for (auto str = string_pool_->CreateIterator(
+             StringPool::Id::Raw(it->matched_until_id));
+         str; ++str) {
+      StringPool::Id id = str.StringId();
+      if (!id.is_null() && match(str.StringView())) {
+        it->matches.Set(id.raw_id());
+      }
+    }
+    it->matched_until_id = end_id;
+  }
+  return &it->matches;
+}
+
 Range StringStorage::ChainImpl::BinarySearchIntrinsic(
     FilterOp op,
     SqlValue sql_val,
@@ -545,46 +633,48 @@ void StringStorage::ChainImpl::StableSort(Token* start,
                     "StringStorage::ChainImpl::StableSort");
   switch (direction) {
     case SortDirection::kAscending: {
-      std::stable_sort(start, end, [this](const Token& lhs, const Token& rhs) {
-        // If RHS is NULL, we know that LHS is not less than
-        // NULL, as nothing is less then null. This check is
-        // only required to keep the stability of the sort.
-        if ((*data_)[rhs.index] == StringPool::Id::Null()) {
-          return false;
-        }
-
-        // If LHS is NULL, it will always be smaller than any
-        // RHS value.
-        if ((*data_)[lhs.index] == StringPool::Id::Null()) {
-          return true;
-        }
-
-        // If neither LHS or RHS are NULL, we have to simply
-        // check which string is smaller.
-        return string_pool_->Get((*data_)[lhs.index]) <
-               string_pool_->Get((*data_)[rhs.index]);
-      });
+      parallel::StableSort(
+          start, end, [this](const Token& lhs, const Token& rhs) {
+            // If RHS is NULL, we know that LHS is not less than
+            // NULL, as nothing is less then null. This check is
+            // only required to keep the stability of the sort.
+            if ((*data_)[rhs.index] == StringPool::Id::Null()) {
+              return false;
+            }
+
+            // If LHS is NULL, it will always be smaller than any
+            // RHS value.
+            if ((*data_)[lhs.index] == StringPool::Id::Null()) {
+              return true;
+            }
+
+            // If neither LHS or RHS are NULL, we have to simply
+            // check which string is smaller.
+            return string_pool_->Get((*data_)[lhs.index]) <
+                   string_pool_->Get((*data_)[rhs.index]);
+          });
       return;
     }
     case SortDirection::kDescending: {
-      std::stable_sort(start, end, [this](const Token& lhs, const Token& rhs) {
-        // If LHS is NULL, we know that it's not greater than
-        // any RHS. This check is only required to keep the
-        // stability of the sort.
-        if ((*data_)[lhs.index] == StringPool::Id::Null()) {
-          return false;
-        }
-
-        // If RHS is NULL, everything will be greater from it.
-        if ((*data_)[rhs.index] == StringPool::Id::Null()) {
-          return true;
-        }
-
-        // If neither LHS or RHS are NULL, we have to simply
-        // check which string is smaller.
-        return string_pool_->Get((*data_)[lhs.index]) >
-               string_pool_->Get((*data_)[rhs.index]);
-      });
+      parallel::StableSort(
+          start, end, [this](const Token& lhs, const Token& rhs) {
+            // If LHS is NULL, we know that it's not greater than
+            // any RHS. This check is only required to keep the
+            // stability of the sort.
+            if ((*data_)[lhs.index] == StringPool::Id::Null()) {
+              return false;
+            }
+
+            // If RHS is NULL, everything will be greater from it.
+            if ((*data_)[rhs.index] == StringPool::Id::Null()) {
+              return true;
+            }
+
+            // If neither LHS or RHS are NULL, we have to simply
+            // check which string is smaller.
+            return string_pool_->Get((*data_)[lhs.index]) >
+                   string_pool_->Get((*data_)[rhs.index]);
+          });
       return;
     }
   }
@@ -17,6 +17,7 @@
 #define SRC_TRACE_PROCESSOR_DB_COLUMN_STRING_STORAGE_H_
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
@@ -24,6 +25,7 @@
 
 #include "dejaview/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/containers/null_term_string_view.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/storage_layer.h"
@@ -79,6 +81,33 @@ class StringStorage final : public StorageLayer {
     std::string DebugString() const override { return "StringStorage"; }
 
    private:
+    // Whether each string of the pool matches a GLOB or REGEXP pattern,
+    // indexed by the raw StringPool::Id of the string: the pattern is matched
+    // once per distinct string and searching the rows only looks up their ids.
+    struct PoolMatches {
+      FilterOp op;
+      std::string pattern;
+
+      // The strings with ids from this one were interned after the pattern
+      // was matched, and are matched when the PoolMatches are used again.
+      uint32_t matched_until_id = 0;
+      BitVector matches;
+    };
+
+    // Maximum number of PoolMatches kept for the following searches. Each
+    // one costs one bit per byte of the pool.
+    static constexpr uint32_t kMaxCachedPoolMatches = 4;
+
+    // Returns the PoolMatches of |op| and |pattern| for all the strings in the
+    // pool, matching with |match| the strings not matched yet. If they are not
+    // cached, they are only created if |create| is true: otherwise (or if the
+    // pool contains large strings, which can't be indexed) returns nullptr.
+    const BitVector* GetPoolMatches(
+        FilterOp op,
+        const char* pattern,
+        const std::function<bool(NullTermStringView)>& match,
+        bool create) const;
+
     BitVector LinearSearch(FilterOp, SqlValue, Range) const;
 
     RangeOrBitVector IndexSearchInternal(FilterOp op,
@@ -115,6 +144,9 @@ class StringStorage final : public StorageLayer {
     const std::vector<StringPool::Id>* data_ = nullptr;
     StringPool* string_pool_ = nullptr;
     const bool is_sorted_ = false;
+
+    // The PoolMatches of the last searches, oldest first.
+    mutable std::vector<PoolMatches> pool_matches_;
   };
 
   const std::vector<StringPool::Id>* data_ = nullptr;
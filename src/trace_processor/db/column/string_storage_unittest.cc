@@ -208,6 +208,38 @@ TEST(StringStorage, IndexSearch) {
   ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(2, 4, 5));
 }
 
+TEST(StringStorage, SearchGlobAfterInterningStrings) {
+  std::vector<std::string> strings{"cheese",  "pasta", "pizza",
+                                   "pierogi", "onion", "fries"};
+  std::vector<StringPool::Id> ids;
+  StringPool pool;
+  for (const auto& string : strings) {
+    ids.push_back(pool.InternString(base::StringView(string)));
+  }
+  ids.insert(ids.begin() + 3, StringPool::Id::Null());
+  StringStorage storage(&pool, &ids);
+  auto chain = storage.MakeChain();
+
+  auto res =
+      chain->Search(FilterOp::kGlob, SqlValue::String("p*"), Range(0, 7));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 2, 4));
+
+  // The pattern has to be matched on the strings interned since the last
+  // search.
+  ids.push_back(pool.InternString(base::StringView("pesto")));
+  ids.push_back(pool.InternString(base::StringView("salad")));
+  res = chain->Search(FilterOp::kGlob, SqlValue::String("p*"), Range(0, 9));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 2, 4, 7));
+
+  res = chain->Search(FilterOp::kGlob, SqlValue::String("p*"), Range(6, 9));
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(7));
+
+  Indices indices = Indices::CreateWithIndexPayloadForTesting(
+      {8, 7, 2}, Indices::State::kNonmonotonic);
+  chain->IndexSearch(FilterOp::kGlob, SqlValue::String("p*"), indices);
+  ASSERT_THAT(utils::ExtractPayloadForTesting(indices), ElementsAre(1, 2));
+}
+
 #if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WIN)
 TEST(StringStorage, LinearSearchRegex) {
   std::vector<std::string> strings{"cheese",  "pasta", "pizza",
@@ -28,6 +28,7 @@
 #include "dejaview/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/parallel.h"
 #include "src/trace_processor/db/column/types.h"
 
 namespace dejaview::trace_processor::column::utils {
@@ -60,12 +61,10 @@ SingleSearchResult SingleSearchNumeric(T left, const SqlValue& right_v) {
   }
 }
 
-}  // namespace internal
-
 template <typename Comparator, typename ValType, typename DataType>
-void LinearSearchWithComparator(ValType val,
+void LinearSearchWithComparator(const ValType& val,
                                 const DataType* data_ptr,
-                                Comparator comparator,
+                                const Comparator& comparator,
                                 BitVector::Builder& builder) {
   // Slow path: we compare <64 elements and append to get us to a word
   // boundary.
@@ -95,6 +94,123 @@ void LinearSearchWithComparator(ValType val,
   }
 }
 
+// Appends the results of |kernel| for the |count| rows from |data_ptr|, less
+// than a word of them, one bit at a time.
+template <typename DataType, typename Kernel>
+void AppendKernelBits(const DataType* data_ptr,
+                      uint32_t count,
+                      const Kernel& kernel,
+                      BitVector::Builder& builder) {
+  if (count == 0) {
+    return;
+  }
+  uint64_t word;
+  kernel(data_ptr, count, &word);
+  for (uint32_t i = 0; i < count; ++i) {
+    builder.Append((word >> i) & 1);
+  }
+}
+
+template <typename DataType, typename Kernel>
+void LinearSearchWithKernel(const DataType* data_ptr,
+                            const Kernel& kernel,
+                            BitVector::Builder& builder) {
+  uint32_t front_elements = builder.BitsUntilWordBoundaryOrFull();
+  AppendKernelBits(data_ptr, front_elements, kernel, builder);
+  data_ptr += front_elements;
+
+  // The kernel writes the complete words straight into the builder.
+  uint32_t fast_path_elements = builder.BitsInCompleteWordsUntilFull();
+  if (fast_path_elements > 0) {
+    kernel(data_ptr, fast_path_elements,
+           builder.AppendWords(fast_path_elements / BitVector::kBitsInWord));
+    data_ptr += fast_path_elements;
+  }
+
+  AppendKernelBits(data_ptr, builder.BitsUntilFull(), kernel, builder);
+}
+
+// Appends the results of |search(data, morsel_builder)| for the |rows| rows
+// from |data_ptr| to |builder|, which has to end on a word boundary, searching
+// morsels of rows on several threads.
+template <typename DataType, typename Search>
+void SearchMorsels(const DataType* data_ptr,
+                   uint32_t rows,
+                   const Search& search,
+                   BitVector::Builder& builder) {
+  uint32_t morsels = (rows + parallel::kMorselRows - 1) / parallel::kMorselRows;
+  std::vector<BitVector::Builder> results;
+  results.reserve(morsels);
+  for (uint32_t i = 0; i < morsels; ++i) {
+    results.emplace_back(
+        std::min(parallel::kMorselRows, rows - i * parallel::kMorselRows));
+  }
+  parallel::ForEach(morsels, [&](uint32_t i) {
+    search(data_ptr + static_cast<size_t>(i) * parallel::kMorselRows,
+           results[i]);
+  });
+  for (const BitVector::Builder& result : results) {
+    builder.Append(result);
+  }
+}
+
+inline bool ShouldSearchMorsels(uint32_t rows) {
+  return rows >= 2 * parallel::kMorselRows && parallel::MaxThreads() > 1;
+}
+
+}  // namespace internal
+
+// Appends whether each of the rows from |data_ptr| compares to |val| until
+// |builder| is full. Large searches are split in morsels searched by several
+// threads.
+template <typename Comparator, typename ValType, typename DataType>
+void LinearSearchWithComparator(ValType val,
+                                const DataType* data_ptr,
+                                Comparator comparator,
+                                BitVector::Builder& builder) {
+  uint32_t rows = builder.BitsUntilFull();
+  if (!internal::ShouldSearchMorsels(rows)) {
+    internal::LinearSearchWithComparator(val, data_ptr, comparator, builder);
+    return;
+  }
+
+  // Search until a word boundary first, so that morsels fill whole words.
+  uint32_t front_elements = builder.BitsUntilWordBoundaryOrFull();
+  for (uint32_t i = 0; i < front_elements; ++i, ++data_ptr) {
+    builder.Append(comparator(*data_ptr, val));
+  }
+  internal::SearchMorsels(
+      data_ptr, rows - front_elements,
+      [&](const DataType* data, BitVector::Builder& morsel) {
+        internal::LinearSearchWithComparator(val, data, comparator, morsel);
+      },
+      builder);
+}
+
+// Same as LinearSearchWithComparator, with the rows compared by
+// |kernel(data, count, out)|, which writes whether each of the |count| rows
+// from |data| matches in the bits of the (count + 63) / 64 words at |out|.
+template <typename DataType, typename Kernel>
+void LinearSearchWithKernel(const DataType* data_ptr,
+                            Kernel kernel,
+                            BitVector::Builder& builder) {
+  uint32_t rows = builder.BitsUntilFull();
+  if (!internal::ShouldSearchMorsels(rows)) {
+    internal::LinearSearchWithKernel(data_ptr, kernel, builder);
+    return;
+  }
+
+  // Search until a word boundary first, so that morsels fill whole words.
+  uint32_t front_elements = builder.BitsUntilWordBoundaryOrFull();
+  internal::AppendKernelBits(data_ptr, front_elements, kernel, builder);
+  internal::SearchMorsels(
+      data_ptr + front_elements, rows - front_elements,
+      [&](const DataType* data, BitVector::Builder& morsel) {
+        internal::LinearSearchWithKernel(data, kernel, morsel);
+      },
+      builder);
+}
+
 template <typename Comparator, typename ValType, typename DataType>
 void IndexSearchWithComparator(ValType val,
                                const DataType* data_ptr,
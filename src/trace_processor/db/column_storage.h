@@ -19,7 +19,10 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <optional>
+#include <type_traits>
 #include <vector>
 
 #include "dejaview/base/compiler.h"
@@ -46,6 +49,18 @@ class ColumnStorageBase {
   virtual const BitVector* bv() const = 0;
   virtual uint32_t size() const = 0;
   virtual uint32_t non_null_size() const = 0;
+
+  // Replaces the contents of the storage with the |size| bytes of values at
+  // |data| (i.e. what data() points to, for non_null_size() values) and, for
+  // nullable storage, the BitVector of non-null rows |non_null|. Used to load
+  // snapshots of tables. Returns false if the values don't match |non_null|.
+  virtual bool Restore(const void* data, size_t size, BitVector non_null) = 0;
+
+  // Returns the size() of the storage once restored with |size| bytes of
+  // values and |non_null|, or std::nullopt if Restore() would return false.
+  virtual std::optional<uint32_t> RestoredSize(
+      size_t size,
+      const BitVector& non_null) const = 0;
 };
 
 // Class used for implementing storage for non-null columns.
@@ -77,6 +92,28 @@ class ColumnStorage final : public ColumnStorageBase {
   uint32_t size() const final { return static_cast<uint32_t>(vector_.size()); }
   uint32_t non_null_size() const final { return size(); }
 
+  bool Restore(const void* data, size_t size, BitVector non_null) final {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (!RestoredSize(size, non_null)) {
+      return false;
+    }
+    vector_.resize(size / sizeof(T));
+    if (size > 0) {
+      memcpy(vector_.data(), data, size);
+    }
+    return true;
+  }
+
+  std::optional<uint32_t> RestoredSize(
+      size_t size,
+      const BitVector& non_null) const final {
+    if (size % sizeof(T) != 0 || non_null.size() != 0 ||
+        size / sizeof(T) > std::numeric_limits<uint32_t>::max()) {
+      return std::nullopt;
+    }
+    return static_cast<uint32_t>(size / sizeof(T));
+  }
+
   template <bool IsDense>
   static ColumnStorage<T> Create() {
     static_assert(!IsDense, "Invalid for non-null storage to be dense.");
@@ -174,6 +211,31 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
     return static_cast<uint32_t>(non_null_vector().size());
   }
 
+  bool Restore(const void* data, size_t size, BitVector non_null) final {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (!RestoredSize(size, non_null)) {
+      return false;
+    }
+    data_.resize(size / sizeof(T));
+    if (size > 0) {
+      memcpy(data_.data(), data, size);
+    }
+    // Assigned in place: null overlays point to |valid_|.
+    valid_ = std::move(non_null);
+    return true;
+  }
+
+  std::optional<uint32_t> RestoredSize(
+      size_t size,
+      const BitVector& non_null) const final {
+    uint32_t count = mode_ == Mode::kDense ? non_null.size()
+                                           : non_null.CountSetBits();
+    if (size != count * sizeof(T)) {
+      return std::nullopt;
+    }
+    return non_null.size();
+  }
+
   template <bool IsDense>
   static ColumnStorage<std::optional<T>> Create() {
     return IsDense ? ColumnStorage<std::optional<T>>(Mode::kDense)
@@ -89,6 +89,45 @@ void QueryExecutor::ApplyConstraint(const Constraint& c,
   LinearSearch(c, chain, rm);
 }
 
+bool QueryExecutor::IsBetween(const Constraint& a, const Constraint& b) {
+  auto is_lower = [](FilterOp op) {
+    return op == FilterOp::kGt || op == FilterOp::kGe;
+  };
+  auto is_upper = [](FilterOp op) {
+    return op == FilterOp::kLt || op == FilterOp::kLe;
+  };
+  return a.col_idx == b.col_idx && ((is_lower(a.op) && is_upper(b.op)) ||
+                                    (is_upper(a.op) && is_lower(b.op)));
+}
+
+void QueryExecutor::ApplyBetweenConstraints(const Constraint& a,
+                                            const Constraint& b,
+                                            const column::DataLayerChain& chain,
+                                            RowMap* rm) {
+  DEJAVIEW_DCHECK(IsBetween(a, b));
+
+  // Only linear searches of ranges scan the column: single rows and index
+  // searches filter with one bound at a time.
+  if (!rm->IsRange() || rm->size() <= 1) {
+    ApplyConstraint(a, chain, rm);
+    ApplyConstraint(b, chain, rm);
+    return;
+  }
+
+  bool a_is_lower = a.op == FilterOp::kGt || a.op == FilterOp::kGe;
+  const Constraint& lower = a_is_lower ? a : b;
+  const Constraint& upper = a_is_lower ? b : a;
+  Range bounds(rm->Get(0), rm->Get(rm->size() - 1) + 1);
+  RangeOrBitVector res = chain.SearchBetween(lower.op, lower.value, upper.op,
+                                             upper.value, bounds);
+  if (res.IsRange()) {
+    Range range = std::move(res).TakeIfRange();
+    *rm = RowMap(range.start, range.end);
+    return;
+  }
+  *rm = RowMap(std::move(res).TakeIfBitVector());
+}
+
 void QueryExecutor::LinearSearch(const Constraint& c,
                                  const column::DataLayerChain& chain,
                                  RowMap* rm) {
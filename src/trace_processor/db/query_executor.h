@@ -41,8 +41,14 @@ class QueryExecutor {
   // Apply all the constraints on the data and return the filtered RowMap.
   RowMap Filter(const std::vector<Constraint>& cs) {
     RowMap rm(0, row_count_);
-    for (const auto& c : cs) {
-      ApplyConstraint(c, *columns_[c.col_idx], &rm);
+    for (uint32_t i = 0; i < cs.size(); ++i) {
+      if (i + 1 < cs.size() && IsBetween(cs[i], cs[i + 1])) {
+        ApplyBetweenConstraints(cs[i], cs[i + 1], *columns_[cs[i].col_idx],
+                                &rm);
+        ++i;
+        continue;
+      }
+      ApplyConstraint(cs[i], *columns_[cs[i].col_idx], &rm);
     }
     return rm;
   }
@@ -67,6 +73,18 @@ class QueryExecutor {
                               const column::DataLayerChain&,
                               RowMap*);
 
+  // Returns whether |a| and |b| are the bounds, in any order, of a range of
+  // values of the same column, such as `ts >= x AND ts < y`.
+  static bool IsBetween(const Constraint& a, const Constraint& b);
+
+  // Updates RowMap with the result of filtering a single column with both
+  // bounds of a range, for which IsBetween() is true, in a single pass over
+  // the column where possible.
+  static void ApplyBetweenConstraints(const Constraint&,
+                                      const Constraint&,
+                                      const column::DataLayerChain&,
+                                      RowMap*);
+
  private:
   // Filters the column using Range algorithm - tries to find the smallest Range
   // to filter the storage with.
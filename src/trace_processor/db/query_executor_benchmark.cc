@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <initializer_list>
 #include <optional>
+#include <random>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -31,6 +32,7 @@
 #include "dejaview/trace_processor/basic_types.h"
 #include "src/base/test/utils.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column/parallel.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/tables/metadata_tables_py.h"
@@ -144,6 +146,37 @@ struct SliceTableForBenchmark {
   SliceTable table_;
 };
 
+// A slice table shaped like the call graph of a QEMU plugin trace, with
+// millions of slices of a few thousand functions, large enough to be searched
+// and sorted by several threads.
+struct CallGraphSliceTableForBenchmark {
+  explicit CallGraphSliceTableForBenchmark(uint32_t rows) : table_{&pool_} {
+    std::vector<StringPool::Id> names;
+    for (uint32_t i = 0; i < 5000; ++i) {
+      std::string name = (i % 10 ? "func_" : "tcp_") + std::to_string(i);
+      names.push_back(pool_.InternString(base::StringView(name)));
+    }
+    std::minstd_rand rnd(42);
+    int64_t ts = 0;
+    for (uint32_t i = 0; i < rows; ++i) {
+      ts += rnd() % 100;
+      SliceTable::Row row;
+      row.ts = ts;
+      row.dur = rnd() % 10000;
+      row.track_id = ThreadTrackTable::Id(rnd() % 16);
+      row.name = names[rnd() % names.size()];
+      row.depth = rnd() % 32;
+      table_.Insert(row);
+    }
+  }
+  StringPool pool_;
+  SliceTable table_;
+};
+
+// Enough rows for 8 morsels. Benchmarks of this table take the number of
+// threads searching or sorting it as argument.
+constexpr uint32_t kCallGraphSliceTableRows = 8 * 1024 * 1024;
+
 struct ExpectedFrameTimelineTableForBenchmark {
   explicit ExpectedFrameTimelineTableForBenchmark(benchmark::State& state)
       : table_{&pool_, &parent_} {
@@ -203,8 +236,9 @@ struct HeapGraphObjectTableForBenchmark {
   HeapGraphObjectTable table_{&pool_};
 };
 
+template <typename T>
 void BenchmarkSliceTableFilter(benchmark::State& state,
-                               SliceTableForBenchmark& table,
+                               T& table,
                                std::initializer_list<Constraint> c) {
   Query q;
   q.constraints = c;
@@ -221,8 +255,9 @@ void BenchmarkSliceTableFilter(benchmark::State& state,
                              benchmark::Counter::kInvert);
 }
 
+template <typename T>
 void BenchmarkSliceTableSort(benchmark::State& state,
-                             SliceTableForBenchmark& table,
+                             T& table,
                              std::initializer_list<Order> ob) {
   for (auto _ : state) {
     benchmark::DoNotOptimize(table.table_.Sort(ob));
@@ -555,5 +590,40 @@ void BM_QEDistinctSortedWithArrangement(benchmark::State& state) {
 }
 BENCHMARK(BM_QEDistinctSortedWithArrangement);
 
+void BM_QECallGraphSliceTableNameGlob(benchmark::State& state) {
+  CallGraphSliceTableForBenchmark table(kCallGraphSliceTableRows);
+  column::parallel::SetMaxThreads(static_cast<uint32_t>(state.range(0)));
+  BenchmarkSliceTableFilter(state, table, {table.table_.name().glob("tcp_*")});
+  column::parallel::SetMaxThreads(0);
+}
+BENCHMARK(BM_QECallGraphSliceTableNameGlob)->RangeMultiplier(2)->Range(1, 16);
+
+void BM_QECallGraphSliceTableDurGt(benchmark::State& state) {
+  CallGraphSliceTableForBenchmark table(kCallGraphSliceTableRows);
+  column::parallel::SetMaxThreads(static_cast<uint32_t>(state.range(0)));
+  BenchmarkSliceTableFilter(state, table, {table.table_.dur().gt(9000)});
+  column::parallel::SetMaxThreads(0);
+}
+BENCHMARK(BM_QECallGraphSliceTableDurGt)->RangeMultiplier(2)->Range(1, 16);
+
+void BM_QECallGraphSliceTableDurBetween(benchmark::State& state) {
+  CallGraphSliceTableForBenchmark table(kCallGraphSliceTableRows);
+  column::parallel::SetMaxThreads(static_cast<uint32_t>(state.range(0)));
+  BenchmarkSliceTableFilter(
+      state, table, {table.table_.dur().ge(4000), table.table_.dur().lt(6000)});
+  column::parallel::SetMaxThreads(0);
+}
+BENCHMARK(BM_QECallGraphSliceTableDurBetween)
+    ->RangeMultiplier(2)
+    ->Range(1, 16);
+
+void BM_QECallGraphSliceTableSortDur(benchmark::State& state) {
+  CallGraphSliceTableForBenchmark table(kCallGraphSliceTableRows);
+  column::parallel::SetMaxThreads(static_cast<uint32_t>(state.range(0)));
+  BenchmarkSliceTableSort(state, table, {table.table_.dur().ascending()});
+  column::parallel::SetMaxThreads(0);
+}
+BENCHMARK(BM_QECallGraphSliceTableSortDur)->RangeMultiplier(2)->Range(1, 16);
+
 }  // namespace
 }  // namespace dejaview::trace_processor
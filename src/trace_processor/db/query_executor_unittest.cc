@@ -416,6 +416,34 @@ TEST(QueryExecutor, BinarySearch) {
   ASSERT_EQ(res.Get(1), 4u);
 }
 
+TEST(QueryExecutor, Between) {
+  std::vector<int64_t> storage_data{7, 1, 4, 9, 3, 5, 2, 8, 6, 0};
+  column::NumericStorage<int64_t> storage(&storage_data, ColumnType::kInt64,
+                                          false);
+  auto chain = storage.MakeChain();
+
+  QueryExecutor exec({chain.get()}, chain->size());
+  RowMap res = exec.Filter({{0, FilterOp::kLt, SqlValue::Long(6)},
+                            {0, FilterOp::kGe, SqlValue::Long(3)}});
+  ASSERT_THAT(res.GetAllIndices(), ElementsAre(2, 4, 5));
+}
+
+TEST(QueryExecutor, BetweenWithNulls) {
+  std::vector<int64_t> storage_data{0, 1, 2, 3, 4, 5, 6};
+  auto numeric = std::make_unique<column::NumericStorage<int64_t>>(
+      &storage_data, ColumnType::kInt64, false);
+
+  // Final vector {0, 1, NULL, NULL, 2, 3, NULL, NULL, 4, 5, 6, NULL}.
+  BitVector null_bv{1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 1, 0};
+  column::NullOverlay storage(&null_bv);
+  auto chain = storage.MakeChain(numeric->MakeChain());
+
+  QueryExecutor exec({chain.get()}, 12);
+  RowMap res = exec.Filter({{0, FilterOp::kGt, SqlValue::Long(1)},
+                            {0, FilterOp::kLe, SqlValue::Long(5)}});
+  ASSERT_THAT(res.GetAllIndices(), ElementsAre(4, 5, 8, 9));
+}
+
 TEST(QueryExecutor, BinarySearchIsNull) {
   std::vector<int64_t> storage_data{0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
   auto numeric = std::make_unique<column::NumericStorage<int64_t>>(
@@ -17,6 +17,7 @@
 #include "src/trace_processor/db/table.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -40,6 +41,7 @@
 #include "src/trace_processor/db/column/selector_overlay.h"
 #include "src/trace_processor/db/column/storage_layer.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column_storage.h"
 #include "src/trace_processor/db/column_storage_overlay.h"
 #include "src/trace_processor/db/query_executor.h"
 
@@ -171,6 +173,13 @@ RowMap Table::QueryToRowMap(const Query& q) const {
   // Filter on constraints that are not using index.
   for (; cs_offset < cs.size(); cs_offset++) {
     const Constraint& c = cs[cs_offset];
+    if (cs_offset + 1 < cs.size() &&
+        QueryExecutor::IsBetween(c, cs[cs_offset + 1])) {
+      QueryExecutor::ApplyBetweenConstraints(c, cs[cs_offset + 1],
+                                             ChainForColumn(c.col_idx), &rm);
+      cs_offset++;
+      continue;
+    }
     QueryExecutor::ApplyConstraint(c, ChainForColumn(c.col_idx), &rm);
   }
 
@@ -260,6 +269,100 @@ void Table::OnConstructionCompleted(
   overlay_layers_ = std::move(overlay_layers);
 }
 
+const ColumnStorageBase* Table::OwnedColumnStorage(uint32_t col_idx) const {
+  const ColumnLegacy& col = columns_[col_idx];
+  if (!col.storage_ || col.overlay_index() + 1 != overlays_.size()) {
+    return nullptr;
+  }
+  return col.storage_;
+}
+
+std::vector<uint32_t> Table::ParentRowCounts() const {
+  std::vector<uint32_t> row_counts;
+  for (const Table* parent = parent_table(); parent;
+       parent = parent->parent_table()) {
+    row_counts.push_back(parent->row_count());
+  }
+  DEJAVIEW_CHECK(row_counts.size() + 1 == overlays_.size());
+  std::reverse(row_counts.begin(), row_counts.end());
+  return row_counts;
+}
+
+std::vector<const BitVector*> Table::ParentRowSelectors() const {
+  std::vector<const BitVector*> selectors;
+  for (uint32_t i = 0; i + 1 < overlays_.size(); ++i) {
+    DEJAVIEW_CHECK(overlays_[i].row_map().IsBitVector());
+    selectors.push_back(overlays_[i].row_map().GetIfBitVector());
+  }
+  return selectors;
+}
+
+base::Status Table::RestoreRows(uint32_t row_count,
+                                std::vector<BitVector> parent_row_selectors) {
+  if (auto status = CheckRestoredRows(row_count, parent_row_selectors,
+                                      ParentRowCounts());
+      !status.ok()) {
+    return status;
+  }
+  // The overlays are assigned in place: the selector overlays of the columns
+  // of parent tables point to their BitVectors.
+  for (uint32_t i = 0; i < parent_row_selectors.size(); ++i) {
+    overlays_[i] = ColumnStorageOverlay(std::move(parent_row_selectors[i]));
+  }
+  overlays_.back() = ColumnStorageOverlay(row_count);
+  row_count_ = row_count;
+  chains_.clear();
+  indexes_.clear();
+  return base::OkStatus();
+}
+
+base::Status Table::RestoreColumn(uint32_t col_idx,
+                                  const void* data,
+                                  size_t size,
+                                  BitVector non_null) {
+  if (auto status = CheckRestoredColumn(col_idx, size, non_null, row_count_);
+      !status.ok()) {
+    return status;
+  }
+  DEJAVIEW_CHECK(columns_[col_idx].storage_->Restore(data, size,
+                                                     std::move(non_null)));
+  chains_.clear();
+  return base::OkStatus();
+}
+
+base::Status Table::CheckRestoredRows(
+    uint32_t row_count,
+    const std::vector<BitVector>& parent_row_selectors,
+    const std::vector<uint32_t>& parent_row_counts) const {
+  if (parent_row_selectors.size() + 1 != overlays_.size() ||
+      parent_row_counts.size() != parent_row_selectors.size()) {
+    return base::ErrStatus("Table has %zu parents, not %zu",
+                           overlays_.size() - 1, parent_row_selectors.size());
+  }
+  for (uint32_t i = 0; i < parent_row_selectors.size(); ++i) {
+    if (!overlays_[i].row_map().IsBitVector() ||
+        parent_row_selectors[i].size() != parent_row_counts[i] ||
+        parent_row_selectors[i].CountSetBits() != row_count) {
+      return base::ErrStatus("Invalid rows selected in parent table %u", i);
+    }
+  }
+  return base::OkStatus();
+}
+
+base::Status Table::CheckRestoredColumn(uint32_t col_idx,
+                                        size_t size,
+                                        const BitVector& non_null,
+                                        uint32_t row_count) const {
+  const ColumnLegacy& col = columns_[col_idx];
+  if (!OwnedColumnStorage(col_idx)) {
+    return base::ErrStatus("Column %s is not stored by the table", col.name());
+  }
+  if (col.storage_->RestoredSize(size, non_null) != row_count) {
+    return base::ErrStatus("Invalid values for column %s", col.name());
+  }
+  return base::OkStatus();
+}
+
 bool Table::HasNullOrOverlayLayer(uint32_t col_idx) const {
   if (null_layers_[col_idx].get()) {
     return true;
@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_DB_TABLE_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -29,6 +30,7 @@
 #include "dejaview/base/status.h"
 #include "dejaview/trace_processor/basic_types.h"
 #include "dejaview/trace_processor/ref_counted.h"
+#include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/db/column.h"
@@ -36,6 +38,7 @@
 #include "src/trace_processor/db/column/overlay_layer.h"
 #include "src/trace_processor/db/column/storage_layer.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column_storage.h"
 #include "src/trace_processor/db/column_storage_overlay.h"
 
 namespace dejaview::trace_processor {
@@ -211,6 +214,51 @@ class Table {
     return null_layers_;
   }
 
+  // Returns the storage of the column |col_idx| if this table holds its
+  // values, nullptr for columns of parent tables, id and dummy columns.
+  const ColumnStorageBase* OwnedColumnStorage(uint32_t col_idx) const;
+
+  // Returns the table this table extends, nullptr for root tables.
+  virtual const Table* parent_table() const { return nullptr; }
+
+  // Returns the row count of each parent table, from the root table.
+  std::vector<uint32_t> ParentRowCounts() const;
+
+  // Returns, for each parent table, the BitVector selecting the rows of this
+  // table among the rows of the parent. It stops at the last row selected
+  // rather than spanning all the rows of the parent.
+  std::vector<const BitVector*> ParentRowSelectors() const;
+
+  // Replaces the rows of this table with |row_count| rows, selected in the
+  // parent tables by |parent_row_selectors|, which have a bit for each row of
+  // their parent (see ParentRowCounts()): parent tables have to be restored
+  // first. The values of the columns owned by the table have to be restored
+  // with RestoreColumn(). Used to load snapshots of tables.
+  base::Status RestoreRows(uint32_t row_count,
+                           std::vector<BitVector> parent_row_selectors);
+
+  // Replaces the values of the column |col_idx|, owned by this table (see
+  // OwnedColumnStorage()), as ColumnStorageBase::Restore() does. Used to load
+  // snapshots of tables.
+  base::Status RestoreColumn(uint32_t col_idx,
+                             const void* data,
+                             size_t size,
+                             BitVector non_null);
+
+  // Returns the error RestoreRows() would return if the parent tables had
+  // |parent_row_counts| rows, without changing the table.
+  base::Status CheckRestoredRows(
+      uint32_t row_count,
+      const std::vector<BitVector>& parent_row_selectors,
+      const std::vector<uint32_t>& parent_row_counts) const;
+
+  // Returns the error RestoreColumn() would return once the table has
+  // |row_count| rows, without changing the table.
+  base::Status CheckRestoredColumn(uint32_t col_idx,
+                                   size_t size,
+                                   const BitVector& non_null,
+                                   uint32_t row_count) const;
+
  protected:
   Table(StringPool*,
         uint32_t row_count,
@@ -98,6 +98,21 @@ struct alignas(8) TrackEventData {
 };
 static_assert(sizeof(TracePacketData) % 8 == 0);
 
+// A call or a return unpacked from a CallGraphBundle, with its interned data
+// already resolved.
+struct alignas(8) CallGraphEventData {
+  uint64_t track_uuid;
+  uint32_t packet_sequence_id;
+  // Calls begin a slice and returns end one.
+  bool is_call;
+  // The name of the function called.
+  StringPool::Id name;
+  // The source location of the function called, if known.
+  StringPool::Id file_name;
+  uint32_t line_number;
+};
+static_assert(sizeof(CallGraphEventData) % 8 == 0);
+
 struct alignas(8) LegacyV8CpuProfileEvent {
   uint64_t session_id;
   uint32_t pid;
@@ -171,6 +171,13 @@ std::optional<SliceId> SliceTracker::StartSlice(
   std::optional<tables::SliceTable::RowReference> parent_ref =
       depth == 0 ? std::nullopt
                  : std::make_optional(stack.back().row.ToRowReference(slices));
+  if (!parent_ref && external_topmost_slice_callback_) {
+    if (std::optional<SliceId> external_parent =
+            external_topmost_slice_callback_(track_id)) {
+      parent_ref = *slices->FindById(*external_parent);
+      depth = parent_ref->depth() + 1;
+    }
+  }
   int64_t parent_stack_id = parent_ref ? parent_ref->stack_id() : 0;
   std::optional<tables::SliceTable::Id> parent_id =
       parent_ref ? std::make_optional(parent_ref->id()) : std::nullopt;
@@ -339,6 +346,11 @@ void SliceTracker::SetOnSliceBeginCallback(OnSliceBeginCallback callback) {
   on_slice_begin_callback_ = callback;
 }
 
+void SliceTracker::SetExternalTopmostSliceCallback(
+    TopmostSliceCallback callback) {
+  external_topmost_slice_callback_ = callback;
+}
+
 std::optional<SliceId> SliceTracker::GetTopmostSliceOnTrack(
     TrackId track_id) const {
   const auto* iter = stacks_.Find(track_id);
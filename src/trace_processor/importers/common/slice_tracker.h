@@ -34,6 +34,7 @@ class SliceTracker {
  public:
   using SetArgsCallback = std::function<void(ArgsTracker::BoundInserter*)>;
   using OnSliceBeginCallback = std::function<void(TrackId, SliceId)>;
+  using TopmostSliceCallback = std::function<std::optional<SliceId>(TrackId)>;
 
   explicit SliceTracker(TraceProcessorContext*);
   virtual ~SliceTracker();
@@ -111,6 +112,11 @@ class SliceTracker {
 
   void SetOnSliceBeginCallback(OnSliceBeginCallback callback);
 
+  // Lets slices begun on a track without open slices of its own nest under
+  // the topmost slice that another importer keeps open on the track, for
+  // slices which that importer inserts without this class.
+  void SetExternalTopmostSliceCallback(TopmostSliceCallback callback);
+
   std::optional<SliceId> GetTopmostSliceOnTrack(TrackId track_id) const;
 
  private:
@@ -171,6 +177,7 @@ class SliceTracker {
   void MaybeAddTranslatableArgs(SliceInfo& slice_info);
 
   OnSliceBeginCallback on_slice_begin_callback_;
+  TopmostSliceCallback external_topmost_slice_callback_;
 
   // Timestamp of the previous event. Used to discard events arriving out
   // of order.
@@ -35,6 +35,7 @@ struct PerfTextEvent;
 }
 
 struct AndroidLogEvent;
+struct CallGraphEventData;
 class PacketSequenceStateGeneration;
 class TraceBlobView;
 struct InlineSchedSwitch;
@@ -47,6 +48,7 @@ class ProtoTraceParser {
   virtual ~ProtoTraceParser();
   virtual void ParseTracePacket(int64_t, TracePacketData) = 0;
   virtual void ParseTrackEvent(int64_t, TrackEventData) = 0;
+  virtual void ParseCallGraphEvent(int64_t, CallGraphEventData) = 0;
 };
 
 class JsonTraceParser {
@@ -16,12 +16,16 @@
 
 #include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
+#include "dejaview/base/build_config.h"
 #include "dejaview/base/logging.h"
 #include "dejaview/base/status.h"
 #include "dejaview/ext/base/string_utils.h"
@@ -30,9 +34,15 @@
 #include "dejaview/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/forwarding_trace_parser.h"
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/gzip_frames.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
 
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+#include "dejaview/ext/base/threading/thread_pool.h"
+#endif
+
 namespace dejaview::trace_processor {
 
 namespace {
@@ -74,8 +84,13 @@ base::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
       len -= strlen(kSystraceFileHeader) + offset;
     }
     first_chunk_parsed_ = true;
+    framed_ = len >= util::kGzipFrameHeaderSize &&
+              util::GetGzipFrameSize(start, len) != 0;
   }
 
+  if (framed_)
+    return ParseFrames(start, len);
+
   // Our default uncompressed buffer size is 32MB as it allows for good
   // throughput.
   constexpr size_t kUncompressedBufferSize = 32ul * 1024 * 1024;
@@ -122,7 +137,127 @@ base::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
   }
 }
 
+base::Status GzipTraceParser::ParseFrames(const uint8_t* data, size_t size) {
+  // Only the bytes completing the frame left over from the previous chunk are
+  // copied, the frames after it are inflated in place.
+  while (!partial_frame_.empty()) {
+    size_t frame_size = util::kGzipFrameHeaderSize;
+    if (partial_frame_.size() >= util::kGzipFrameHeaderSize) {
+      frame_size =
+          util::GetGzipFrameSize(partial_frame_.data(), partial_frame_.size());
+      if (frame_size == 0) {
+        // Something else than frames was appended to the trace, fall back to
+        // inflating the rest as a regular gzip stream.
+        std::vector<uint8_t> rest = std::move(partial_frame_);
+        partial_frame_.clear();
+        framed_ = false;
+        RETURN_IF_ERROR(ParseUnowned(rest.data(), rest.size()));
+        return ParseUnowned(data, size);
+      }
+      if (frame_size < util::kGzipFrameHeaderSize)
+        return base::ErrStatus("Corrupt gzip frame");
+      if (partial_frame_.size() == frame_size) {
+        std::vector<uint8_t> frame = std::move(partial_frame_);
+        partial_frame_.clear();
+        RETURN_IF_ERROR(InflateFrames(frame.data(), {{0, frame.size()}}));
+        break;
+      }
+    }
+    size_t missing = std::min(frame_size - partial_frame_.size(), size);
+    if (missing == 0)
+      return base::OkStatus();
+    partial_frame_.insert(partial_frame_.end(), data, data + missing);
+    data += missing;
+    size -= missing;
+  }
+
+  std::vector<std::pair<size_t, size_t>> frames;
+  size_t offset = 0;
+  while (size - offset >= util::kGzipFrameHeaderSize) {
+    size_t frame_size = util::GetGzipFrameSize(data + offset, size - offset);
+    if (frame_size == 0) {
+      // Something else than frames was appended to the trace, fall back to
+      // inflating the rest as a regular gzip stream.
+      RETURN_IF_ERROR(InflateFrames(data, frames));
+      framed_ = false;
+      return ParseUnowned(data + offset, size - offset);
+    }
+    if (frame_size < util::kGzipFrameHeaderSize)
+      return base::ErrStatus("Corrupt gzip frame");
+    if (size - offset < frame_size)
+      break;
+    frames.emplace_back(offset, frame_size);
+    offset += frame_size;
+  }
+  RETURN_IF_ERROR(InflateFrames(data, frames));
+  partial_frame_.assign(data + offset, data + size);
+  return base::OkStatus();
+}
+
+base::Status GzipTraceParser::InflateFrames(
+    const uint8_t* data,
+    const std::vector<std::pair<size_t, size_t>>& frames) {
+  // Frames store their inflated size so each one gets its own blob, filled
+  // by any thread. Frames with an implausible size are inflated as a stream
+  // instead, so that corrupt ones can't allocate gigabytes.
+  std::vector<TraceBlob> blobs;
+  blobs.reserve(frames.size());
+  std::unique_ptr<bool[]> streamed(new bool[frames.size()]());
+  for (size_t i = 0; i < frames.size(); i++) {
+    const uint8_t* frame = data + frames[i].first;
+    size_t size = frames[i].second;
+    streamed[i] = !util::IsGzipFrameInflatedSizePlausible(frame, size);
+    blobs.push_back(TraceBlob::Allocate(
+        streamed[i] ? 0 : util::GetGzipFrameInflatedSize(frame, size)));
+  }
+  std::unique_ptr<bool[]> inflated(new bool[frames.size()]());
+  auto inflate = [&](size_t i) {
+    if (streamed[i]) {
+      std::vector<uint8_t> out;
+      inflated[i] =
+          util::InflateGzipFrame(data + frames[i].first, frames[i].second, &out);
+      blobs[i] = TraceBlob::CopyFrom(out.data(), out.size());
+      return;
+    }
+    if (blobs[i].size() == 0) {
+      inflated[i] = true;
+      return;
+    }
+    util::GzipDecompressor decompressor;
+    decompressor.Feed(data + frames[i].first, frames[i].second);
+    auto result = decompressor.ExtractOutput(blobs[i].data(), blobs[i].size());
+    inflated[i] = result.ret == ResultCode::kEof &&
+                  result.bytes_written == blobs[i].size();
+  };
+
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+  uint32_t num_threads = context_ ? context_->config.parse_threads : 0;
+  if (!num_threads)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (frames.size() > 1 && num_threads > 1) {
+    if (!thread_pool_)
+      thread_pool_ = std::make_unique<base::ThreadPool>(num_threads);
+    thread_pool_->RunAndWait(frames.size(), inflate);
+  } else
+#endif
+  {
+    for (size_t i = 0; i < frames.size(); i++)
+      inflate(i);
+  }
+
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (!inflated[i])
+      return base::ErrStatus("Failed to decompress trace frame");
+    if (blobs[i].size() == 0)
+      continue;
+    RETURN_IF_ERROR(inner_->Parse(TraceBlobView(std::move(blobs[i]))));
+  }
+  return base::OkStatus();
+}
+
 base::Status GzipTraceParser::NotifyEndOfFile() {
+  if (!partial_frame_.empty())
+    return base::ErrStatus("GZIP frame incomplete, trace is likely corrupt");
   if (output_state_ != kStreamBoundary || decompressor_.AvailIn() > 0) {
     return base::ErrStatus("GZIP stream incomplete, trace is likely corrupt");
   }
@@ -20,11 +20,18 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <utility>
+#include <vector>
 
+#include "dejaview/base/build_config.h"
 #include "dejaview/base/status.h"
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/util/gzip_utils.h"
 
+namespace dejaview::base {
+class ThreadPool;
+}  // namespace dejaview::base
+
 namespace dejaview::trace_processor {
 
 class TraceProcessorContext;
@@ -42,6 +49,13 @@ class GzipTraceParser : public ChunkedTraceReader {
   base::Status ParseUnowned(const uint8_t*, size_t);
 
  private:
+  // Traces made of gzip frames (see util/gzip_frames.h) are split in frames
+  // which are inflated in parallel.
+  base::Status ParseFrames(const uint8_t*, size_t);
+  base::Status InflateFrames(
+      const uint8_t* data,
+      const std::vector<std::pair<size_t, size_t>>& frames);
+
   TraceProcessorContext* const context_;
   util::GzipDecompressor decompressor_;
   std::unique_ptr<ChunkedTraceReader> inner_;
@@ -51,6 +65,13 @@ class GzipTraceParser : public ChunkedTraceReader {
 
   bool first_chunk_parsed_ = false;
   enum { kStreamBoundary, kMidStream } output_state_ = kStreamBoundary;
+
+  bool framed_ = false;
+  // The start of a frame whose end wasn't received yet.
+  std::vector<uint8_t> partial_frame_;
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+  std::unique_ptr<base::ThreadPool> thread_pool_;
+#endif
 };
 
 }  // namespace dejaview::trace_processor
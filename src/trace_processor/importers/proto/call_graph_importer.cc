@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/call_graph_importer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "dejaview/base/build_config.h"
+#include "dejaview/base/compiler.h"
+#include "dejaview/base/logging.h"
+#include "dejaview/ext/base/hash.h"
+#include "protos/dejaview/trace/interned_data/interned_data.pbzero.h"
+#include "protos/dejaview/trace/qemu/call_graph_bundle.pbzero.h"
+#include "protos/dejaview/trace/track_event/source_location.pbzero.h"
+#include "protos/dejaview/trace/track_event/track_event.pbzero.h"
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/common/slice_tracker.h"
+#include "src/trace_processor/importers/common/slice_translation_table.h"
+#include "src/trace_processor/importers/proto/track_event_tracker.h"
+#include "src/trace_processor/sorter/trace_sorter.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/types/variadic.h"
+
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+#include "dejaview/ext/base/threading/thread_pool.h"
+#endif
+
+namespace dejaview::trace_processor {
+
+namespace {
+
+// Same as the SliceTracker: the duration of slices which haven't ended yet.
+constexpr int64_t kPendingDuration = -1;
+
+// Same as the SliceTracker: deeper slices are dropped.
+constexpr size_t kMaxDepth = std::numeric_limits<uint8_t>::max();
+
+// Same as the SliceTracker: stack ids are kept representable in Javascript.
+constexpr uint64_t kSafeBitmask = (1ull << 53) - 1;
+
+// Events are decoded in runs of about this many events when there is no
+// thread pool, so that the memory of parsed events gets freed along the way.
+constexpr size_t kRunSize = 64 * 1024;
+
+// Bundles of a sequence are decoded by a worker thread in batches of about
+// this many bytes, and a few batches per thread are decoded at once.
+constexpr size_t kBatchSize = 1024 * 1024;
+constexpr size_t kBatchesPerThread = 4;
+
+}  // namespace
+
+CallGraphImporter::CallGraphImporter(TraceProcessorContext* context,
+                                     TrackEventTracker* track_event_tracker)
+    : context_(context),
+      track_event_tracker_(track_event_tracker),
+      slices_(context->storage->mutable_slice_table()),
+      source_location_file_name_key_id_(
+          context->storage->InternString("source.file_name")),
+      source_location_line_number_key_id_(
+          context->storage->InternString("source.line_number")) {
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+  num_threads_ = context->config.parse_threads;
+  if (!num_threads_)
+    num_threads_ = std::max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+CallGraphImporter::~CallGraphImporter() = default;
+
+uint32_t CallGraphImporter::ResolveFunction(
+    uint32_t packet_sequence_id,
+    PacketSequenceStateGeneration& state,
+    uint64_t iid) {
+  FunctionCache& functions = *GetSequence(packet_sequence_id).functions;
+  if (uint32_t* index = functions.Find(iid))
+    return *index;
+  return *functions.Insert(iid, AddFunction(state, iid)).first;
+}
+
+void CallGraphImporter::AddBundle(uint32_t packet_sequence_id,
+                                  int64_t packet_timestamp,
+                                  uint64_t track_uuid,
+                                  TraceBlobView bundle,
+                                  RefPtr<PacketSequenceStateGeneration> state) {
+  if (!registered_) {
+    context_->sorter->SetSortedEventParser(this);
+    context_->slice_tracker->SetExternalTopmostSliceCallback(
+        [this](TrackId track_id) { return GetTopmostSlice(track_id); });
+    registered_ = true;
+  }
+
+  uint32_t track = AddTrack(track_uuid, packet_sequence_id);
+  Sequence& sequence = GetSequence(packet_sequence_id);
+  PendingBundle pending{std::move(bundle), packet_timestamp, track,
+                        std::move(state)};
+
+  if (num_threads_ <= 1) {
+    if (sequence.runs.empty() || sequence.runs.back().size() >= kRunSize)
+      sequence.runs.emplace_back();
+    std::vector<Event>& run = sequence.runs.back();
+    size_t first = run.size();
+    Decoded decoded;
+    decoded.events = &run;
+    decoded.last_ts = sequence.last_ts;
+    DecodeBundle(pending, 0, *sequence.functions, &decoded);
+    FinishDecoding(sequence, *sequence.functions, &pending, first, &decoded);
+    return;
+  }
+
+  // The events of the bundle aren't known yet, but none is older than the
+  // packet.
+  context_->sorter->NotifySortedEvents(packet_timestamp, packet_timestamp);
+  if (sequence.pending.empty() ||
+      sequence.pending.back().functions != sequence.functions ||
+      sequence.pending.back().size >= kBatchSize) {
+    sequence.pending.emplace_back();
+    sequence.pending.back().functions = sequence.functions;
+    num_pending_batches_++;
+  }
+  Batch& batch = sequence.pending.back();
+  batch.size += pending.bundle.size();
+  batch.bundles.push_back(std::move(pending));
+  if (num_pending_batches_ > num_threads_ * kBatchesPerThread)
+    DecodePendingBundles();
+}
+
+void CallGraphImporter::OnIncrementalStateCleared(
+    uint32_t packet_sequence_id) {
+  // Pending batches keep the functions of the previous state.
+  GetSequence(packet_sequence_id).functions =
+      std::make_shared<FunctionCache>();
+}
+
+CallGraphImporter::Sequence& CallGraphImporter::GetSequence(
+    uint32_t packet_sequence_id) {
+  auto [index, inserted] = sequence_indices_.Insert(
+      packet_sequence_id, static_cast<uint32_t>(sequences_.size()));
+  if (inserted)
+    sequences_.emplace_back();
+  return sequences_[*index];
+}
+
+uint32_t CallGraphImporter::AddTrack(uint64_t track_uuid,
+                                     uint32_t packet_sequence_id) {
+  auto [index, inserted] = track_indices_.Insert(
+      std::make_pair(track_uuid, packet_sequence_id),
+      static_cast<uint32_t>(tracks_.size()));
+  if (inserted)
+    tracks_.push_back(Track{track_uuid, packet_sequence_id, std::nullopt});
+  return *index;
+}
+
+uint32_t CallGraphImporter::AddFunction(PacketSequenceStateGeneration& state,
+                                        uint64_t iid) {
+  Function function{kNullStringId, kNullStringId, kNullStringId, 0,
+                    std::nullopt};
+  auto* event_name = state.LookupInternedMessage<
+      protos::pbzero::InternedData::kEventNamesFieldNumber,
+      protos::pbzero::EventName>(iid);
+  if (event_name) {
+    function.raw_name = context_->storage->InternString(event_name->name());
+
+    // Functions share their iid with their source location
+    auto* source_location = state.LookupInternedMessage<
+        protos::pbzero::InternedData::kSourceLocationsFieldNumber,
+        protos::pbzero::SourceLocation>(iid);
+    if (source_location) {
+      function.file_name =
+          context_->storage->InternString(source_location->file_name());
+      function.line_number = source_location->line_number();
+    }
+  } else {
+    context_->storage->IncrementStats(stats::track_event_tokenizer_errors);
+  }
+  function.name =
+      context_->slice_translation_table->TranslateName(function.raw_name);
+  functions_.push_back(function);
+  return static_cast<uint32_t>(functions_.size() - 1);
+}
+
+void CallGraphImporter::DecodeBundle(const PendingBundle& pending,
+                                     uint32_t index,
+                                     const FunctionCache& functions,
+                                     Decoded* out) {
+  protos::pbzero::CallGraphBundle::Decoder bundle(pending.bundle.data(),
+                                                  pending.bundle.size());
+  bool parse_error = false;
+  auto delta_it = bundle.timestamp_delta(&parse_error);
+  auto name_iid_it = bundle.name_iid(&parse_error);
+  int64_t ts = pending.packet_timestamp;
+  for (; delta_it && name_iid_it; ++delta_it, ++name_iid_it) {
+    ts += static_cast<int64_t>(*delta_it);
+    if (DEJAVIEW_UNLIKELY(ts < out->last_ts)) {
+      out->out_of_order++;
+      continue;
+    }
+    out->last_ts = ts;
+
+    uint32_t function = kReturn;
+    if (uint64_t iid = *name_iid_it) {
+      const uint32_t* cached = functions.Find(iid);
+      if (DEJAVIEW_LIKELY(cached)) {
+        function = *cached;
+      } else {
+        out->misses.push_back(Miss{out->events->size(), index, iid});
+      }
+    }
+    out->events->push_back(Event{ts, pending.track, function});
+  }
+  if (parse_error || delta_it || name_iid_it)
+    out->malformed++;
+}
+
+void CallGraphImporter::FinishDecoding(Sequence& sequence,
+                                       FunctionCache& functions,
+                                       const PendingBundle* bundles,
+                                       size_t first,
+                                       Decoded* out) {
+  std::vector<Event>& events = *out->events;
+  for (const Miss& miss : out->misses) {
+    uint32_t* index = functions.Find(miss.iid);
+    if (!index) {
+      index = functions
+                  .Insert(miss.iid,
+                          AddFunction(*bundles[miss.bundle].state, miss.iid))
+                  .first;
+    }
+    events[miss.event].function = *index;
+  }
+
+  // Batches are decoded without knowing where the previous one ended.
+  auto begin = events.begin() + static_cast<ptrdiff_t>(first);
+  auto newer = std::lower_bound(
+      begin, events.end(), sequence.last_ts,
+      [](const Event& event, int64_t ts) { return event.ts < ts; });
+  out->out_of_order += static_cast<uint32_t>(newer - begin);
+  events.erase(begin, newer);
+
+  if (out->out_of_order) {
+    context_->storage->IncrementStats(stats::slice_out_of_order,
+                                      out->out_of_order);
+  }
+  if (out->malformed) {
+    DEJAVIEW_DLOG("Malformed CallGraphBundle");
+    context_->storage->IncrementStats(stats::track_event_tokenizer_errors,
+                                      out->malformed);
+  }
+
+  if (events.size() == first) {
+    if (events.empty() && !sequence.runs.empty() &&
+        &events == &sequence.runs.back()) {
+      sequence.runs.pop_back();
+    }
+    return;
+  }
+  context_->sorter->NotifySortedEvents(events[first].ts, events.back().ts);
+  sequence.last_ts = events.back().ts;
+}
+
+void CallGraphImporter::DecodePendingBundles() {
+  std::vector<Batch*> batches;
+  for (Sequence& sequence : sequences_) {
+    for (Batch& batch : sequence.pending) {
+      batch.decoded.events = &batch.events;
+      batches.push_back(&batch);
+    }
+  }
+  if (batches.empty())
+    return;
+
+  auto decode = [](Batch& batch) {
+    for (uint32_t i = 0; i < batch.bundles.size(); i++)
+      DecodeBundle(batch.bundles[i], i, *batch.functions, &batch.decoded);
+  };
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+  if (!thread_pool_)
+    thread_pool_ = std::make_unique<base::ThreadPool>(num_threads_);
+  thread_pool_->RunAndWait(batches.size(),
+                           [&](size_t i) { decode(*batches[i]); });
+#else
+  for (Batch* batch : batches)
+    decode(*batch);
+#endif
+
+  // Functions missed by the workers and table appends are left to this
+  // thread, in the order of the sequence.
+  for (Sequence& sequence : sequences_) {
+    for (Batch& batch : sequence.pending) {
+      FinishDecoding(sequence, *batch.functions, batch.bundles.data(), 0,
+                     &batch.decoded);
+      if (!batch.events.empty())
+        sequence.runs.push_back(std::move(batch.events));
+    }
+    sequence.pending.clear();
+  }
+  num_pending_batches_ = 0;
+}
+
+// Like the sorter, this finds the sequence with the oldest event and parses
+// its events until the oldest event of the other sequences, over and over.
+// Sequences are vCPUs, so there are few of them.
+int64_t CallGraphImporter::ParseEventsUntil(int64_t ts) {
+  constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
+  DecodePendingBundles();
+  // The slice table is sorted by timestamp: calls older than the slices
+  // parsed already, here or by the sorter, come from bundles tokenized too
+  // late for the sorting window and are dropped.
+  latest_ts_ = std::max(latest_ts_, context_->sorter->latest_pushed_event_ts());
+  uint32_t late = 0;
+  for (;;) {
+    Sequence* min_sequence = nullptr;
+    int64_t min_ts = kTsMax;
+    int64_t next_ts = kTsMax;
+    for (Sequence& sequence : sequences_) {
+      if (sequence.runs.empty())
+        continue;
+      int64_t front_ts = sequence.runs.front()[sequence.next].ts;
+      if (!min_sequence || front_ts < min_ts) {
+        next_ts = min_ts;
+        min_ts = front_ts;
+        min_sequence = &sequence;
+      } else {
+        next_ts = std::min(next_ts, front_ts);
+      }
+    }
+    if (!min_sequence || min_ts > ts) {
+      if (late) {
+        context_->storage->IncrementStats(
+            stats::sorter_push_event_out_of_order, late);
+      }
+      return min_ts;
+    }
+
+    int64_t limit = std::min(ts, next_ts);
+    std::deque<std::vector<Event>>& runs = min_sequence->runs;
+    size_t& next = min_sequence->next;
+    while (!runs.empty()) {
+      const std::vector<Event>& run = runs.front();
+      if (next == run.size()) {
+        runs.pop_front();
+        next = 0;
+        continue;
+      }
+      const Event& event = run[next];
+      if (event.ts > limit)
+        break;
+      next++;
+
+      Track& track = tracks_[event.track];
+      uint32_t stack_index = track.stack ? *track.stack : ResolveStack(track);
+      Stack& stack = stacks_[stack_index];
+      if (event.function == kReturn) {
+        ParseReturn(event, stack);
+      } else if (DEJAVIEW_UNLIKELY(event.ts < latest_ts_)) {
+        stack.overflow++;
+        late++;
+      } else {
+        latest_ts_ = event.ts;
+        ParseCall(event, stack);
+      }
+    }
+  }
+}
+
+uint32_t CallGraphImporter::ResolveStack(Track& track) {
+  std::optional<TrackId> track_id = track_event_tracker_->GetDescriptorTrack(
+      track.uuid, kNullStringId, track.packet_sequence_id);
+  if (!track_id) {
+    track_event_tracker_->ReserveDescriptorChildTrack(
+        track.uuid, /*parent_uuid=*/0, kNullStringId);
+    track_id = track_event_tracker_->GetDescriptorTrack(
+        track.uuid, kNullStringId, track.packet_sequence_id);
+  }
+
+  // Tracks of different sequences may be the same, eg. for a thread which
+  // migrated to another vCPU.
+  auto [index, inserted] = stack_indices_.Insert(
+      *track_id, static_cast<uint32_t>(stacks_.size()));
+  if (inserted)
+    stacks_.push_back(Stack{*track_id, {}, 0});
+  track.stack = *index;
+  return *index;
+}
+
+void CallGraphImporter::ParseCall(const Event& event, Stack& stack) {
+  // Calls made under a dropped one are dropped until it returns, they would
+  // otherwise take its place as the parent of the next ones.
+  if (DEJAVIEW_UNLIKELY(stack.overflow)) {
+    stack.overflow++;
+    return;
+  }
+  if (DEJAVIEW_UNLIKELY(stack.frames.size() >= kMaxDepth)) {
+    DEJAVIEW_DLOG("Dropping call graph slice deeper than %zu", kMaxDepth);
+    stack.overflow++;
+    return;
+  }
+
+  Function& function = functions_[event.function];
+  const Frame* parent = stack.frames.empty() ? nullptr : &stack.frames.back();
+  base::Hasher stack_hash = parent ? parent->stack_hash : base::Hasher();
+  stack_hash.Update(kNullStringId.raw_id());
+  stack_hash.Update(function.name.raw_id());
+
+  tables::SliceTable::Row row(event.ts, kPendingDuration, stack.track_id,
+                              kNullStringId, function.name);
+  row.depth = static_cast<uint32_t>(stack.frames.size());
+  row.stack_id = static_cast<int64_t>(stack_hash.digest() & kSafeBitmask);
+  if (parent) {
+    row.parent_stack_id = parent->stack_id;
+    row.parent_id = parent->id;
+  }
+  if (function.arg_set_id)
+    row.arg_set_id = *function.arg_set_id;
+  auto id_and_row = slices_->Insert(row);
+
+  if (DEJAVIEW_UNLIKELY(!function.arg_set_id)) {
+    if (!function.file_name.is_null()) {
+      ArgsTracker args_tracker(context_);
+      auto inserter = args_tracker.AddArgsTo(id_and_row.id);
+      inserter.AddArg(source_location_file_name_key_id_,
+                      Variadic::String(function.file_name));
+      inserter.AddArg(source_location_line_number_key_id_,
+                      Variadic::UnsignedInteger(function.line_number));
+      args_tracker.Flush();
+    }
+    function.arg_set_id = id_and_row.row_reference.arg_set_id();
+  }
+
+  stack.frames.push_back(Frame{id_and_row.row_number, id_and_row.id, event.ts,
+                               row.stack_id, stack_hash});
+}
+
+void CallGraphImporter::ParseReturn(const Event& event, Stack& stack) {
+  if (DEJAVIEW_UNLIKELY(stack.overflow)) {
+    stack.overflow--;
+    return;
+  }
+  // Returns from calls made before the trace started
+  if (stack.frames.empty())
+    return;
+  const Frame& frame = stack.frames.back();
+  frame.row.ToRowReference(slices_).set_dur(event.ts - frame.ts);
+  stack.frames.pop_back();
+}
+
+std::optional<SliceId> CallGraphImporter::GetTopmostSlice(
+    TrackId track_id) const {
+  const uint32_t* index = stack_indices_.Find(track_id);
+  if (!index || stacks_[*index].frames.empty())
+    return std::nullopt;
+  return stacks_[*index].frames.back().id;
+}
+
+}  // namespace dejaview::trace_processor
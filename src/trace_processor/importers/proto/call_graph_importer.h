@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_CALL_GRAPH_IMPORTER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_CALL_GRAPH_IMPORTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "dejaview/base/build_config.h"
+#include "dejaview/ext/base/flat_hash_map.h"
+#include "dejaview/ext/base/hash.h"
+#include "dejaview/trace_processor/ref_counted.h"
+#include "dejaview/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
+#include "src/trace_processor/sorter/trace_sorter.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/tables/slice_tables_py.h"
+
+namespace dejaview::base {
+class ThreadPool;
+}  // namespace dejaview::base
+
+namespace dejaview::trace_processor {
+
+class TraceProcessorContext;
+class TrackEventTracker;
+
+// Imports the calls and returns of CallGraphBundles flagged as sorted in bulk.
+//
+// Those bundles hold most events of qemu plugin traces. Their events are
+// buffered per sequence in 16 bytes each, rather than going through the
+// TraceTokenBuffer and queues of the sorter, and are turned into rows of the
+// slice table in a tight loop when the sorter reaches their timestamps: the
+// depth, parent and stack of slices are computed from a stack per track kept
+// here rather than by the SliceTracker, and the args of a function are only
+// built once.
+//
+// Unless the parse_threads config is 1, the varints of those bundles are
+// decoded on a thread pool: bundles are queued as they get tokenized, then
+// decoded in batches of consecutive bundles of a sequence, many batches at
+// once, before their events get parsed. Workers look functions up in the
+// interned data of their sequence resolved so far, which is only written
+// while they don't run, and leave the others to the importing thread.
+class CallGraphImporter : public TraceSorter::SortedEventParser {
+ public:
+  // The interned data of a function called in a CallGraphBundle.
+  struct Function {
+    StringId raw_name;
+    // |raw_name| as translated by the SliceTranslationTable
+    StringId name;
+    StringId file_name;
+    uint32_t line_number;
+    // Built when the first slice of the function is inserted.
+    std::optional<uint32_t> arg_set_id;
+  };
+
+  CallGraphImporter(TraceProcessorContext*, TrackEventTracker*);
+  ~CallGraphImporter() override;
+
+  // Returns the index of the function interned as |iid| on
+  // |packet_sequence_id|. Bundles hold millions of calls to a few thousand
+  // functions: their interned data is resolved once per sequence rather than
+  // once per call.
+  uint32_t ResolveFunction(uint32_t packet_sequence_id,
+                           PacketSequenceStateGeneration& state,
+                           uint64_t iid);
+
+  const Function& function(uint32_t index) const { return functions_[index]; }
+
+  // Imports the events of a CallGraphBundle flagged as sorted, once the
+  // sorter reaches their timestamps. Events older than the previous ones of
+  // the sequence are dropped, and so are calls older than the slices parsed
+  // when the sorter reaches them.
+  void AddBundle(uint32_t packet_sequence_id,
+                 int64_t packet_timestamp,
+                 uint64_t track_uuid,
+                 TraceBlobView bundle,
+                 RefPtr<PacketSequenceStateGeneration> state);
+
+  void OnIncrementalStateCleared(uint32_t packet_sequence_id);
+
+  int64_t ParseEventsUntil(int64_t ts) override;
+
+ private:
+  // A call, or a return if |function| is kReturn.
+  struct Event {
+    int64_t ts;
+    // Index in |tracks_|
+    uint32_t track;
+    // Index in |functions_|
+    uint32_t function;
+  };
+  static constexpr uint32_t kReturn = std::numeric_limits<uint32_t>::max();
+
+  // Maps the iids of a sequence to indices in |functions_|, until its
+  // incremental state gets cleared.
+  using FunctionCache = base::FlatHashMap<uint64_t, uint32_t>;
+
+  struct PendingBundle {
+    TraceBlobView bundle;
+    int64_t packet_timestamp;
+    uint32_t track;
+    RefPtr<PacketSequenceStateGeneration> state;
+  };
+
+  // A call whose function wasn't resolved yet when it got decoded.
+  struct Miss {
+    // Index of the event in the decoded events
+    size_t event;
+    // Index of the bundle it comes from
+    uint32_t bundle;
+    uint64_t iid;
+  };
+
+  // What DecodeBundle() outputs, which may be written by any thread.
+  struct Decoded {
+    std::vector<Event>* events = nullptr;
+    std::vector<Miss> misses;
+    int64_t last_ts = std::numeric_limits<int64_t>::min();
+    uint32_t out_of_order = 0;
+    uint32_t malformed = 0;
+  };
+
+  // Consecutive bundles of a sequence, decoded by a worker thread.
+  struct Batch {
+    std::shared_ptr<FunctionCache> functions;
+    std::vector<PendingBundle> bundles;
+    size_t size = 0;
+    std::vector<Event> events;
+    Decoded decoded;
+  };
+
+  struct Frame {
+    tables::SliceTable::RowNumber row;
+    SliceId id;
+    int64_t ts;
+    int64_t stack_id;
+    // Hash of the names of the slices from the bottom of the stack to this
+    // one, which is updated rather than recomputed for each new slice.
+    base::Hasher stack_hash;
+  };
+
+  struct Stack {
+    TrackId track_id;
+    std::vector<Frame> frames;
+    // Calls dropped for being too deep or too late, or for being made under
+    // such a call, whose returns are dropped too.
+    uint32_t overflow = 0;
+  };
+
+  struct Track {
+    uint64_t uuid;
+    uint32_t packet_sequence_id;
+    // Index in |stacks_|, resolved when the first event of the track is
+    // parsed.
+    std::optional<uint32_t> stack;
+  };
+
+  struct TrackKeyHasher {
+    size_t operator()(const std::pair<uint64_t, uint32_t>& p) const {
+      return static_cast<size_t>(base::Hasher::Combine(p.first, p.second));
+    }
+  };
+
+  struct Sequence {
+    // Runs of events not parsed yet, from |next| in the first one. There are
+    // no empty runs.
+    std::deque<std::vector<Event>> runs;
+    size_t next = 0;
+    int64_t last_ts = std::numeric_limits<int64_t>::min();
+    std::shared_ptr<FunctionCache> functions =
+        std::make_shared<FunctionCache>();
+    // Bundles which weren't decoded yet.
+    std::vector<Batch> pending;
+  };
+
+  Sequence& GetSequence(uint32_t packet_sequence_id);
+  uint32_t AddTrack(uint64_t track_uuid, uint32_t packet_sequence_id);
+  uint32_t AddFunction(PacketSequenceStateGeneration& state, uint64_t iid);
+
+  // Decodes the events of |bundle| into |out|. Only reads |functions|, so
+  // that it can run on any thread.
+  static void DecodeBundle(const PendingBundle& bundle,
+                           uint32_t index,
+                           const FunctionCache& functions,
+                           Decoded* out);
+  // Resolves the functions missed by DecodeBundle(), from |first| in
+  // |out->events| on, and gets those events parsed.
+  void FinishDecoding(Sequence&,
+                      FunctionCache& functions,
+                      const PendingBundle* bundles,
+                      size_t first,
+                      Decoded* out);
+  void DecodePendingBundles();
+
+  uint32_t ResolveStack(Track&);
+  void ParseCall(const Event&, Stack&);
+  void ParseReturn(const Event&, Stack&);
+  std::optional<SliceId> GetTopmostSlice(TrackId) const;
+
+  TraceProcessorContext* const context_;
+  TrackEventTracker* const track_event_tracker_;
+  tables::SliceTable* const slices_;
+  const StringId source_location_file_name_key_id_;
+  const StringId source_location_line_number_key_id_;
+
+  std::vector<Function> functions_;
+  std::vector<Track> tracks_;
+  base::FlatHashMap<std::pair<uint64_t, uint32_t>, uint32_t, TrackKeyHasher>
+      track_indices_;
+  std::vector<Stack> stacks_;
+  base::FlatHashMap<TrackId, uint32_t> stack_indices_;
+  std::vector<Sequence> sequences_;
+  base::FlatHashMap<uint32_t, uint32_t> sequence_indices_;
+  // The timestamp of the newest call parsed here or event parsed by the
+  // sorter.
+  int64_t latest_ts_ = std::numeric_limits<int64_t>::min();
+  bool registered_ = false;
+
+  uint32_t num_threads_ = 1;
+  size_t num_pending_batches_ = 0;
+#if !DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_WASM)
+  std::unique_ptr<base::ThreadPool> thread_pool_;
+#endif
+};
+
+}  // namespace dejaview::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_CALL_GRAPH_IMPORTER_H_
@@ -135,10 +135,23 @@ void MetadataModule::ParseQemuInfo(ConstBytes blob) {
     cmdline_it++;
   }
 
-  StringId cwd_id = context_->storage->InternString(info.record_cwd());
-  context_->metadata_tracker->SetDynamicMetadata(
-      context_->storage->InternString("qemu_record_cwd"),
-      Variadic::String(cwd_id));
+  if (info.has_record_cwd()) {
+    StringId cwd_id = context_->storage->InternString(info.record_cwd());
+    context_->metadata_tracker->SetDynamicMetadata(
+        context_->storage->InternString("qemu_record_cwd"),
+        Variadic::String(cwd_id));
+  }
+
+  // One row per snapshot, with its name as str_value and the instruction
+  // count it was saved at as int_value.
+  for (auto it = info.snapshots(); it; ++it) {
+    protos::pbzero::QemuInfo::Snapshot::Decoder snapshot(*it);
+    StringId name_id = context_->storage->InternString(snapshot.name());
+    MetadataId id = context_->metadata_tracker->AppendMetadata(
+        metadata::qemu_snapshot, Variadic::String(name_id));
+    context_->storage->mutable_metadata_table()->FindById(id)->set_int_value(
+        static_cast<int64_t>(snapshot.icount()));
+  }
 }
 
 void MetadataModule::ParseTraceUuid(ConstBytes blob) {
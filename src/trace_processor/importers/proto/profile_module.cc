@@ -62,6 +62,7 @@ ProfileModule::ProfileModule(TraceProcessorContext* context)
   // note: deobfuscation mappings also handled by HeapGraphModule.
   RegisterForField(TracePacket::kDeobfuscationMappingFieldNumber, context);
   RegisterForField(TracePacket::kSmapsPacketFieldNumber, context);
+  RegisterForField(TracePacket::kPerfSampleFieldNumber, context);
 }
 
 ProfileModule::~ProfileModule() = default;
@@ -105,6 +106,11 @@ void ProfileModule::ParseTracePacketData(
     case TracePacket::kSmapsPacketFieldNumber:
       ParseSmapsPacket(ts, decoder.smaps_packet());
       return;
+    case TracePacket::kPerfSampleFieldNumber:
+      ParsePerfSample(ts, data.sequence_state.get(),
+                      decoder.trusted_packet_sequence_id(),
+                      decoder.perf_sample());
+      return;
   }
 }
 
@@ -473,6 +479,55 @@ void ProfileModule::ParseSmapsPacket(int64_t ts, ConstBytes blob) {
   }
 }
 
+void ProfileModule::ParsePerfSample(
+    int64_t ts,
+    PacketSequenceStateGeneration* sequence_state,
+    uint32_t seq_id,
+    ConstBytes blob) {
+  protos::pbzero::PerfSample::Decoder sample(blob.data, blob.size);
+
+  // Samples without a callstack only report data losses.
+  if (!sample.has_callstack_iid()) {
+    context_->storage->IncrementStats(stats::perf_samples_skipped);
+    return;
+  }
+
+  ProcessTracker* procs = context_->process_tracker.get();
+  UniqueTid utid = procs->UpdateThread(sample.tid(), sample.pid());
+  UniquePid upid = procs->GetOrCreateProcess(sample.pid());
+
+  StackProfileSequenceState& stack_profile_sequence_state =
+      *sequence_state->GetCustomState<StackProfileSequenceState>();
+  std::optional<CallsiteId> callsite_id =
+      stack_profile_sequence_state.FindOrInsertCallstack(
+          upid, sample.callstack_iid());
+  if (!callsite_id) {
+    context_->storage->IncrementStats(stats::stackprofile_parser_error);
+    return;
+  }
+
+  tables::PerfSessionTable::Id* session_id = perf_sessions_.Find(seq_id);
+  if (!session_id) {
+    auto id = context_->storage->mutable_perf_session_table()->Insert({}).id;
+    session_id = perf_sessions_.Insert(seq_id, id).first;
+  }
+
+  auto cpu_mode = static_cast<protos::pbzero::Profiling::CpuMode>(
+      sample.cpu_mode());
+  if (cpu_mode == protos::pbzero::Profiling::MODE_UNKNOWN)
+    context_->storage->IncrementStats(stats::perf_samples_cpu_mode_unknown);
+
+  tables::PerfSampleTable::Row row;
+  row.ts = ts;
+  row.utid = utid;
+  row.cpu = sample.cpu();
+  row.cpu_mode = context_->storage->InternString(
+      ProfilePacketUtils::StringifyCpuMode(cpu_mode));
+  row.callsite_id = *callsite_id;
+  row.perf_session_id = *session_id;
+  context_->storage->mutable_perf_sample_table()->Insert(row);
+}
+
 void ProfileModule::NotifyEndOfFile() {
   for (auto it = context_->storage->stack_profile_mapping_table().IterateRows();
        it; ++it) {
@@ -17,9 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_PROFILE_MODULE_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_PROFILE_MODULE_H_
 
+#include "dejaview/ext/base/flat_hash_map.h"
 #include "dejaview/protozero/field.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
 #include "src/trace_processor/importers/proto/proto_importer_module.h"
+#include "src/trace_processor/tables/profiler_tables_py.h"
 
 #include "protos/dejaview/trace/trace_packet.pbzero.h"
 
@@ -69,7 +71,15 @@ class ProfileModule : public ProtoImporterModule {
   void ParseModuleSymbols(protozero::ConstBytes);
   void ParseSmapsPacket(int64_t ts, protozero::ConstBytes);
 
+  // perf and QEMU plugin sampling:
+  void ParsePerfSample(int64_t ts,
+                       PacketSequenceStateGeneration*,
+                       uint32_t seq_id,
+                       protozero::ConstBytes);
+
   TraceProcessorContext* context_;
+  // Samples of a packet sequence belong to the same session.
+  base::FlatHashMap<uint32_t, tables::PerfSessionTable::Id> perf_sessions_;
 };
 
 }  // namespace trace_processor
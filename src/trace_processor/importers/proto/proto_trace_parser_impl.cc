@@ -97,6 +97,12 @@ void ProtoTraceParserImpl::ParseTrackEvent(int64_t ts, TrackEventData data) {
   context_->args_tracker->Flush();
 }
 
+void ProtoTraceParserImpl::ParseCallGraphEvent(int64_t ts,
+                                               CallGraphEventData data) {
+  context_->track_module->ParseCallGraphEventData(ts, data);
+  context_->args_tracker->Flush();
+}
+
 void ProtoTraceParserImpl::ParseMetatraceEvent(int64_t ts, ConstBytes blob) {
   protos::pbzero::DejaViewMetatrace::Decoder event(blob.data, blob.size);
   auto utid = context_->process_tracker->GetOrCreateThread(event.thread_id());
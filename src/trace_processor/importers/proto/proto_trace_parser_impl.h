@@ -43,6 +43,7 @@ class ProtoTraceParserImpl : public ProtoTraceParser {
   ~ProtoTraceParserImpl() override;
 
   void ParseTrackEvent(int64_t ts, TrackEventData data) override;
+  void ParseCallGraphEvent(int64_t ts, CallGraphEventData data) override;
   void ParseTracePacket(int64_t ts, TracePacketData data) override;
 
  private:
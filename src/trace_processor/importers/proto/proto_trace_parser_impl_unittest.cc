@@ -28,6 +28,7 @@
 
 #include "dejaview/base/status.h"
 #include "dejaview/ext/base/string_view.h"
+#include "dejaview/protozero/packed_repeated_fields.h"
 #include "dejaview/protozero/scattered_heap_buffer.h"
 #include "dejaview/trace_processor/basic_types.h"
 #include "dejaview/trace_processor/trace_blob.h"
@@ -68,6 +69,7 @@
 #include "protos/dejaview/trace/interned_data/interned_data.pbzero.h"
 #include "protos/dejaview/trace/profiling/profile_common.pbzero.h"
 #include "protos/dejaview/trace/profiling/profile_packet.pbzero.h"
+#include "protos/dejaview/trace/qemu/call_graph_bundle.pbzero.h"
 #include "protos/dejaview/trace/ps/process_tree.pbzero.h"
 #include "protos/dejaview/trace/sys_stats/sys_stats.pbzero.h"
 #include "protos/dejaview/trace/trace.pbzero.h"
@@ -1574,6 +1576,201 @@ TEST_F(ProtoTraceParserTest, TrackEventWithTaskExecution) {
   context_.sorter->ExtractEventsForced();
 }
 
+TEST_F(ProtoTraceParserTest, CallGraphBundle) {
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(true);
+    auto* track_desc = packet->set_track_descriptor();
+    track_desc->set_uuid(42);
+    track_desc->set_name("task");
+  }
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(1000);
+
+    auto* interned_data = packet->set_interned_data();
+    auto* ev1 = interned_data->add_event_names();
+    ev1->set_iid(1);
+    ev1->set_name("func1");
+    auto* loc1 = interned_data->add_source_locations();
+    loc1->set_iid(1);
+    loc1->set_file_name("file1");
+    loc1->set_line_number(42);
+    auto* ev2 = interned_data->add_event_names();
+    ev2->set_iid(2);
+    ev2->set_name("func2");
+
+    // func1 calls func2 twice.
+    protozero::PackedVarInt deltas;
+    protozero::PackedVarInt name_iids;
+    for (auto [delta, iid] : std::vector<std::pair<uint64_t, uint64_t>>{
+             {0, 1}, {10, 2}, {5, 0}, {1, 2}, {2, 0}, {7, 0}}) {
+      deltas.Append(delta);
+      name_iids.Append(iid);
+    }
+    auto* bundle = packet->set_call_graph_bundle();
+    bundle->set_track_uuid(42);
+    bundle->set_timestamp_delta(deltas);
+    bundle->set_name_iid(name_iids);
+  }
+
+  Tokenize();
+
+  constexpr TrackId track{0u};
+
+  StringId func_1 = storage_->InternString("func1");
+  StringId func_2 = storage_->InternString("func2");
+  StringId file_1 = storage_->InternString("file1");
+
+  InSequence in_sequence;  // Below slices should be sorted by timestamp.
+
+  MockBoundInserter inserter;
+  EXPECT_CALL(*slice_, Begin(1000, track, kNullStringId, func_1, _))
+      .WillOnce(DoAll(InvokeArgument<4>(&inserter), Return(SliceId(0u))));
+  EXPECT_CALL(inserter, AddArg(_, _, Variadic::String(file_1), _));
+  EXPECT_CALL(inserter, AddArg(_, _, Variadic::UnsignedInteger(42), _));
+  EXPECT_CALL(*slice_, Begin(1010, track, kNullStringId, func_2, _));
+  EXPECT_CALL(*slice_, End(1015, track, kNullStringId, kNullStringId, _));
+  EXPECT_CALL(*slice_, Begin(1016, track, kNullStringId, func_2, _));
+  EXPECT_CALL(*slice_, End(1018, track, kNullStringId, kNullStringId, _));
+  EXPECT_CALL(*slice_, End(1025, track, kNullStringId, kNullStringId, _));
+
+  context_.sorter->ExtractEventsForced();
+}
+
+TEST_F(ProtoTraceParserTest, SortedCallGraphBundles) {
+  for (uint32_t sequence_id : {1u, 2u}) {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(sequence_id);
+    packet->set_incremental_state_cleared(true);
+    auto* track_desc = packet->set_track_descriptor();
+    track_desc->set_uuid(41 + sequence_id);
+    track_desc->set_name("task");
+  }
+  auto add_bundle = [this](uint32_t sequence_id, uint64_t track_uuid,
+                           int64_t timestamp,
+                           std::vector<std::pair<uint64_t, uint64_t>> events) {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(sequence_id);
+    packet->set_timestamp(static_cast<uint64_t>(timestamp));
+
+    auto* interned_data = packet->set_interned_data();
+    auto* ev1 = interned_data->add_event_names();
+    ev1->set_iid(1);
+    ev1->set_name("func1");
+    auto* loc1 = interned_data->add_source_locations();
+    loc1->set_iid(1);
+    loc1->set_file_name("file1");
+    loc1->set_line_number(42);
+    auto* ev2 = interned_data->add_event_names();
+    ev2->set_iid(2);
+    ev2->set_name("func2");
+
+    protozero::PackedVarInt deltas;
+    protozero::PackedVarInt name_iids;
+    for (auto [delta, iid] : events) {
+      deltas.Append(delta);
+      name_iids.Append(iid);
+    }
+    auto* bundle = packet->set_call_graph_bundle();
+    bundle->set_track_uuid(track_uuid);
+    bundle->set_timestamp_delta(deltas);
+    bundle->set_name_iid(name_iids);
+    bundle->set_sorted(true);
+  };
+  // func1 calls func2 twice on the first sequence, and once on the second in
+  // the meantime.
+  add_bundle(1, 42, 1000, {{0, 1}, {10, 2}, {5, 0}, {1, 2}});
+  add_bundle(2, 43, 1005, {{0, 2}, {15, 0}});
+  add_bundle(1, 42, 1018, {{0, 0}, {7, 0}});
+
+  Tokenize();
+
+  // The slices are added without the SliceTracker.
+  EXPECT_CALL(*slice_, Begin(_, _, _, _, _)).Times(0);
+  EXPECT_CALL(*slice_, End(_, _, _, _, _)).Times(0);
+  context_.sorter->ExtractEventsForced();
+
+  StringId func_1 = storage_->InternString("func1");
+  StringId func_2 = storage_->InternString("func2");
+  StringId file_1 = storage_->InternString("file1");
+
+  const auto& slices = storage_->slice_table();
+  ASSERT_EQ(slices.row_count(), 4u);
+  EXPECT_EQ(slices.ts()[0], 1000);
+  EXPECT_EQ(slices.dur()[0], 25);
+  EXPECT_EQ(slices.name()[0], func_1);
+  EXPECT_EQ(slices.depth()[0], 0u);
+  EXPECT_EQ(slices.parent_id()[0], std::nullopt);
+  EXPECT_TRUE(HasArg(slices.arg_set_id()[0],
+                     storage_->InternString("source.file_name"),
+                     Variadic::String(file_1)));
+  EXPECT_TRUE(HasArg(slices.arg_set_id()[0],
+                     storage_->InternString("source.line_number"),
+                     Variadic::UnsignedInteger(42)));
+
+  // Slices of both sequences are in timestamp order.
+  EXPECT_EQ(slices.ts()[1], 1005);
+  EXPECT_EQ(slices.dur()[1], 15);
+  EXPECT_EQ(slices.name()[1], func_2);
+  EXPECT_EQ(slices.depth()[1], 0u);
+  EXPECT_NE(slices.track_id()[1], slices.track_id()[0]);
+
+  for (uint32_t row : {2u, 3u}) {
+    EXPECT_EQ(slices.name()[row], func_2);
+    EXPECT_EQ(slices.depth()[row], 1u);
+    EXPECT_EQ(slices.parent_id()[row], SliceId(0u));
+    EXPECT_EQ(slices.parent_stack_id()[row], slices.stack_id()[0]);
+    EXPECT_EQ(slices.stack_id()[row], slices.stack_id()[2]);
+  }
+  EXPECT_EQ(slices.ts()[2], 1010);
+  EXPECT_EQ(slices.dur()[2], 5);
+  EXPECT_EQ(slices.ts()[3], 1016);
+  EXPECT_EQ(slices.dur()[3], 2);
+}
+
+// Functions interned by other packets than the bundles calling them are only
+// resolved once the bundles are decoded.
+TEST_F(ProtoTraceParserTest, SortedCallGraphBundlesInternedBefore) {
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(true);
+    auto* ev1 = packet->set_interned_data()->add_event_names();
+    ev1->set_iid(1);
+    ev1->set_name("func1");
+  }
+  for (int64_t timestamp : {1000, 1010}) {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(static_cast<uint64_t>(timestamp));
+    protozero::PackedVarInt deltas;
+    protozero::PackedVarInt name_iids;
+    deltas.Append(0);
+    name_iids.Append(1);
+    deltas.Append(5);
+    name_iids.Append(0);
+    auto* bundle = packet->set_call_graph_bundle();
+    bundle->set_track_uuid(42);
+    bundle->set_timestamp_delta(deltas);
+    bundle->set_name_iid(name_iids);
+    bundle->set_sorted(true);
+  }
+
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  const auto& slices = storage_->slice_table();
+  ASSERT_EQ(slices.row_count(), 2u);
+  for (uint32_t row : {0u, 1u}) {
+    EXPECT_EQ(slices.name()[row], storage_->InternString("func1"));
+    EXPECT_EQ(slices.dur()[row], 5);
+  }
+  EXPECT_EQ(slices.ts()[1], 1010);
+}
+
 TEST_F(ProtoTraceParserTest, TrackEventWithLogMessage) {
   {
     auto* packet = trace_->add_packet();
@@ -1894,6 +2091,66 @@ TEST_F(ProtoTraceParserTest, ParseCPUProfileSamplesIntoTable) {
       "3BBCFBD372448A727265C3E7C4D954F91");
 }
 
+TEST_F(ProtoTraceParserTest, ParsePerfSamplesIntoTable) {
+  {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_incremental_state_cleared(true);
+
+    auto* interned_data = packet->set_interned_data();
+
+    auto* mapping = interned_data->add_mappings();
+    mapping->set_iid(1);
+
+    auto* function_name = interned_data->add_function_names();
+    function_name->set_iid(1);
+    function_name->set_str("do_idle");
+
+    auto* frame = interned_data->add_frames();
+    frame->set_iid(1);
+    frame->set_function_name_id(1);
+    frame->set_mapping_id(1);
+
+    auto* callstack = interned_data->add_callstacks();
+    callstack->set_iid(1);
+    callstack->add_frame_ids(1);
+  }
+
+  for (uint64_t ts : {1000u, 2000u}) {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(1);
+    packet->set_timestamp(ts);
+
+    auto* sample = packet->set_perf_sample();
+    sample->set_cpu(2);
+    sample->set_pid(15);
+    sample->set_tid(16);
+    sample->set_cpu_mode(protos::pbzero::Profiling::MODE_KERNEL);
+    sample->set_callstack_iid(1);
+  }
+
+  EXPECT_CALL(*process_, UpdateThread(16, 15)).WillRepeatedly(Return(1u));
+
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  const auto& samples = storage_->perf_sample_table();
+  ASSERT_EQ(samples.row_count(), 2u);
+  EXPECT_EQ(samples[0].ts(), 1000);
+  EXPECT_EQ(samples[1].ts(), 2000);
+  EXPECT_EQ(samples[0].utid(), 1u);
+  EXPECT_EQ(samples[0].cpu(), 2u);
+  EXPECT_EQ(samples[0].callsite_id(), CallsiteId{0});
+  EXPECT_EQ(context_.storage->GetString(samples[0].cpu_mode()), "kernel");
+  // Both samples belong to the session of their sequence.
+  EXPECT_EQ(storage_->perf_session_table().row_count(), 1u);
+  EXPECT_EQ(samples[0].perf_session_id(), samples[1].perf_session_id());
+
+  const auto& frames = storage_->stack_profile_frame_table();
+  ASSERT_EQ(frames.row_count(), 1u);
+  EXPECT_EQ(context_.storage->GetString(frames[0].name()), "do_idle");
+}
+
 TEST_F(ProtoTraceParserTest, CPUProfileSamplesTimestampsAreClockMonotonic) {
   {
     auto* packet = trace_->add_packet();
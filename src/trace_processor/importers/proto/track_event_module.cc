@@ -35,13 +35,15 @@ using dejaview::protos::pbzero::TracePacket;
 
 TrackEventModule::TrackEventModule(TraceProcessorContext* context)
     : track_event_tracker_(new TrackEventTracker(context)),
-      tokenizer_(context, track_event_tracker_.get()),
+      call_graph_importer_(context, track_event_tracker_.get()),
+      tokenizer_(context, track_event_tracker_.get(), &call_graph_importer_),
       parser_(context, track_event_tracker_.get()) {
   RegisterForField(TracePacket::kTrackEventRangeOfInterestFieldNumber, context);
   RegisterForField(TracePacket::kTrackEventFieldNumber, context);
   RegisterForField(TracePacket::kTrackDescriptorFieldNumber, context);
   RegisterForField(TracePacket::kThreadDescriptorFieldNumber, context);
   RegisterForField(TracePacket::kProcessDescriptorFieldNumber, context);
+  RegisterForField(TracePacket::kCallGraphBundleFieldNumber, context);
 }
 
 TrackEventModule::~TrackEventModule() = default;
@@ -62,6 +64,9 @@ ModuleResult TrackEventModule::TokenizePacket(
     case TracePacket::kTrackEventFieldNumber:
       return tokenizer_.TokenizeTrackEventPacket(std::move(state), decoder,
                                                  packet, packet_timestamp);
+    case TracePacket::kCallGraphBundleFieldNumber:
+      return tokenizer_.TokenizeCallGraphBundlePacket(std::move(state), decoder,
+                                                      packet, packet_timestamp);
     case TracePacket::kThreadDescriptorFieldNumber:
       // TODO(eseckler): Remove once Chrome has switched to TrackDescriptors.
       return tokenizer_.TokenizeThreadDescriptorPacket(std::move(state),
@@ -89,12 +94,14 @@ void TrackEventModule::ParseTracePacketData(const TracePacket::Decoder& decoder,
       parser_.ParseThreadDescriptor(decoder.thread_descriptor());
       break;
     case TracePacket::kTrackEventFieldNumber:
+    case TracePacket::kCallGraphBundleFieldNumber:
       DEJAVIEW_DFATAL("Wrong TracePacket number");
   }
 }
 
 void TrackEventModule::OnIncrementalStateCleared(uint32_t packet_sequence_id) {
   track_event_tracker_->OnIncrementalStateCleared(packet_sequence_id);
+  tokenizer_.OnIncrementalStateCleared(packet_sequence_id);
 }
 
 void TrackEventModule::OnFirstPacketOnSequence(uint32_t packet_sequence_id) {
@@ -108,6 +115,11 @@ void TrackEventModule::ParseTrackEventData(const TracePacket::Decoder& decoder,
                           decoder.trusted_packet_sequence_id());
 }
 
+void TrackEventModule::ParseCallGraphEventData(int64_t ts,
+                                               const CallGraphEventData& data) {
+  parser_.ParseCallGraphEvent(ts, data);
+}
+
 void TrackEventModule::NotifyEndOfFile() {
   parser_.NotifyEndOfFile();
 }
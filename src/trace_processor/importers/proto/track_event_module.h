@@ -22,6 +22,7 @@
 
 #include "dejaview/trace_processor/ref_counted.h"
 #include "src/trace_processor/importers/common/parser_types.h"
+#include "src/trace_processor/importers/proto/call_graph_importer.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
 #include "src/trace_processor/importers/proto/proto_importer_module.h"
 #include "src/trace_processor/importers/proto/track_event_parser.h"
@@ -57,10 +58,13 @@ class TrackEventModule : public ProtoImporterModule {
                            int64_t ts,
                            const TrackEventData& data);
 
+  void ParseCallGraphEventData(int64_t ts, const CallGraphEventData& data);
+
   void NotifyEndOfFile() override;
 
  private:
   std::unique_ptr<TrackEventTracker> track_event_tracker_;
+  CallGraphImporter call_graph_importer_;
   TrackEventTokenizer tokenizer_;
   TrackEventParser parser_;
 };
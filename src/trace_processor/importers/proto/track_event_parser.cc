@@ -1581,6 +1581,36 @@ void TrackEventParser::ParseTrackEvent(int64_t ts,
   }
 }
 
+void TrackEventParser::ParseCallGraphEvent(int64_t ts,
+                                           const CallGraphEventData& event) {
+  std::optional<TrackId> opt_track_id =
+      track_event_tracker_->GetDescriptorTrack(event.track_uuid, kNullStringId,
+                                               event.packet_sequence_id);
+  if (!opt_track_id) {
+    track_event_tracker_->ReserveDescriptorChildTrack(event.track_uuid,
+                                                      /*parent_uuid=*/0,
+                                                      kNullStringId);
+    opt_track_id = track_event_tracker_->GetDescriptorTrack(
+        event.track_uuid, kNullStringId, event.packet_sequence_id);
+  }
+  TrackId track_id = *opt_track_id;
+
+  if (!event.is_call) {
+    context_->slice_tracker->End(ts, track_id);
+    return;
+  }
+  auto args_inserter = [this, &event](ArgsTracker::BoundInserter* inserter) {
+    if (event.file_name.is_null())
+      return;
+    inserter->AddArg(source_location_file_name_key_id_,
+                     Variadic::String(event.file_name));
+    inserter->AddArg(source_location_line_number_key_id_,
+                     Variadic::UnsignedInteger(event.line_number));
+  };
+  context_->slice_tracker->Begin(ts, track_id, kNullStringId, event.name,
+                                 args_inserter);
+}
+
 void TrackEventParser::NotifyEndOfFile() {
 }
 
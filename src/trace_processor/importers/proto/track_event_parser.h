@@ -60,6 +60,10 @@ class TrackEventParser {
                        protozero::ConstBytes,
                        uint32_t packet_sequence_id);
 
+  // Adds a slice boundary from a CallGraphBundle, whose interned data was
+  // already resolved by the tokenizer.
+  void ParseCallGraphEvent(int64_t ts, const CallGraphEventData& event);
+
   void NotifyEndOfFile();
 
  private:
@@ -49,10 +49,12 @@
 #include "src/trace_processor/storage/trace_storage.h"
 
 #include "protos/dejaview/common/builtin_clock.pbzero.h"
+#include "protos/dejaview/trace/qemu/call_graph_bundle.pbzero.h"
 #include "protos/dejaview/trace/trace_packet.pbzero.h"
 #include "protos/dejaview/trace/track_event/counter_descriptor.pbzero.h"
 #include "protos/dejaview/trace/track_event/process_descriptor.pbzero.h"
 #include "protos/dejaview/trace/track_event/range_of_interest.pbzero.h"
+#include "protos/dejaview/trace/track_event/source_location.pbzero.h"
 #include "protos/dejaview/trace/track_event/thread_descriptor.pbzero.h"
 #include "protos/dejaview/trace/track_event/track_descriptor.pbzero.h"
 #include "protos/dejaview/trace/track_event/track_event.pbzero.h"
@@ -65,10 +67,13 @@ namespace {
 using protos::pbzero::CounterDescriptor;
 }
 
-TrackEventTokenizer::TrackEventTokenizer(TraceProcessorContext* context,
-                                         TrackEventTracker* track_event_tracker)
+TrackEventTokenizer::TrackEventTokenizer(
+    TraceProcessorContext* context,
+    TrackEventTracker* track_event_tracker,
+    CallGraphImporter* call_graph_importer)
     : context_(context),
       track_event_tracker_(track_event_tracker),
+      call_graph_importer_(call_graph_importer),
       counter_name_thread_time_id_(
           context_->storage->InternString("thread_time")),
       counter_name_thread_instruction_count_id_(
@@ -399,6 +404,78 @@ ModuleResult TrackEventTokenizer::TokenizeTrackEventPacket(
   return ModuleResult::Handled();
 }
 
+ModuleResult TrackEventTokenizer::TokenizeCallGraphBundlePacket(
+    RefPtr<PacketSequenceStateGeneration> state,
+    const protos::pbzero::TracePacket::Decoder& packet,
+    TraceBlobView* packet_blob,
+    int64_t packet_timestamp) {
+  if (DEJAVIEW_UNLIKELY(!packet.has_trusted_packet_sequence_id())) {
+    DEJAVIEW_ELOG("CallGraphBundle packet without trusted_packet_sequence_id");
+    context_->storage->IncrementStats(stats::track_event_tokenizer_errors);
+    return ModuleResult::Handled();
+  }
+
+  uint32_t packet_sequence_id = packet.trusted_packet_sequence_id();
+  protozero::ConstBytes bundle_bytes = packet.call_graph_bundle();
+  protos::pbzero::CallGraphBundle::Decoder bundle(bundle_bytes);
+
+  // Events of sorted sequences are handed to the CallGraphImporter, which
+  // decodes them, maybe on other threads, and parses them in bulk. The
+  // functions interned along with them are resolved now so that it finds
+  // them. Other events are pushed to the sorter on their own, with their
+  // interned data already resolved, so that parsing them is only a matter
+  // of adding a slice.
+  if (bundle.sorted() && !context_->machine_id()) {
+    if (packet.has_interned_data()) {
+      protos::pbzero::InternedData::Decoder interned_data(
+          packet.interned_data());
+      for (auto it = interned_data.event_names(); it; ++it) {
+        protos::pbzero::EventName::Decoder event_name(*it);
+        call_graph_importer_->ResolveFunction(packet_sequence_id, *state,
+                                              event_name.iid());
+      }
+    }
+    call_graph_importer_->AddBundle(
+        packet_sequence_id, packet_timestamp, bundle.track_uuid(),
+        packet_blob->slice(bundle_bytes.data, bundle_bytes.size),
+        std::move(state));
+    return ModuleResult::Handled();
+  }
+
+  bool parse_error = false;
+  auto delta_it = bundle.timestamp_delta(&parse_error);
+  auto name_iid_it = bundle.name_iid(&parse_error);
+  int64_t timestamp = packet_timestamp;
+  for (; delta_it && name_iid_it; ++delta_it, ++name_iid_it) {
+    timestamp += static_cast<int64_t>(*delta_it);
+
+    CallGraphEventData event{bundle.track_uuid(), packet_sequence_id, false,
+                             kNullStringId, kNullStringId, 0};
+    if (uint64_t iid = *name_iid_it) {
+      const CallGraphImporter::Function& function =
+          call_graph_importer_->function(call_graph_importer_->ResolveFunction(
+              packet_sequence_id, *state, iid));
+      event.is_call = true;
+      event.name = function.raw_name;
+      event.file_name = function.file_name;
+      event.line_number = function.line_number;
+    }
+    context_->sorter->PushCallGraphEvent(timestamp, event,
+                                         context_->machine_id());
+  }
+
+  if (parse_error || delta_it || name_iid_it) {
+    DEJAVIEW_DLOG("Malformed CallGraphBundle");
+    context_->storage->IncrementStats(stats::track_event_tokenizer_errors);
+  }
+  return ModuleResult::Handled();
+}
+
+void TrackEventTokenizer::OnIncrementalStateCleared(
+    uint32_t packet_sequence_id) {
+  call_graph_importer_->OnIncrementalStateCleared(packet_sequence_id);
+}
+
 template <typename T>
 base::Status TrackEventTokenizer::AddExtraCounterValues(
     TrackEventData& data,
@@ -23,6 +23,7 @@
 #include "dejaview/base/status.h"
 #include "dejaview/protozero/proto_decoder.h"
 #include "dejaview/trace_processor/ref_counted.h"
+#include "src/trace_processor/importers/proto/call_graph_importer.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
 #include "src/trace_processor/importers/proto/proto_importer_module.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -47,7 +48,9 @@ struct TrackEventData;
 
 class TrackEventTokenizer {
  public:
-  explicit TrackEventTokenizer(TraceProcessorContext*, TrackEventTracker*);
+  TrackEventTokenizer(TraceProcessorContext*,
+                      TrackEventTracker*,
+                      CallGraphImporter*);
 
   ModuleResult TokenizeRangeOfInterestPacket(
       RefPtr<PacketSequenceStateGeneration> state,
@@ -65,6 +68,13 @@ class TrackEventTokenizer {
       const protos::pbzero::TracePacket_Decoder&,
       TraceBlobView* packet,
       int64_t packet_timestamp);
+  ModuleResult TokenizeCallGraphBundlePacket(
+      RefPtr<PacketSequenceStateGeneration> state,
+      const protos::pbzero::TracePacket_Decoder&,
+      TraceBlobView* packet,
+      int64_t packet_timestamp);
+
+  void OnIncrementalStateCleared(uint32_t packet_sequence_id);
 
  private:
   void TokenizeThreadDescriptor(
@@ -85,6 +95,7 @@ class TrackEventTokenizer {
 
   TraceProcessorContext* context_;
   TrackEventTracker* track_event_tracker_;
+  CallGraphImporter* call_graph_importer_;
 
   const StringId counter_name_thread_time_id_;
   const StringId counter_name_thread_instruction_count_id_;
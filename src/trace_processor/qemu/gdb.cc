@@ -24,7 +24,8 @@
 
 namespace dejaview::trace_processor {
 
-Gdb::Gdb(base::TaskRunner *task_runner, std::string elfPath, int port) : task_runner_(task_runner) {
+Gdb::Gdb(base::TaskRunner *task_runner, std::string elfPath, int port)
+    : task_runner_(task_runner), port_(port) {
     int master_fd = -1, slave_fd = -1;
     DEJAVIEW_CHECK(openpty(&master_fd, &slave_fd, nullptr, nullptr, nullptr) != -1);
 
@@ -50,7 +51,7 @@ Gdb::Gdb(base::TaskRunner *task_runner, std::string elfPath, int port) : task_ru
     args.exec_cmd.push_back(elfPath);
     args.exec_cmd.push_back("-q");
     args.exec_cmd.push_back("-ex");
-    args.exec_cmd.push_back("target remote :" + std::to_string(port));
+    args.exec_cmd.push_back("target remote :" + std::to_string(port_));
     args.env.push_back("TERM=xterm-256color");
     args.env.push_back("HOME=" + std::string(getenv("HOME")));
 }
@@ -71,6 +72,17 @@ void Gdb::Stdin(const uint8_t *data, size_t len) {
     write(*pty_master_fd_, data, len);
 }
 
+void Gdb::Disconnect() {
+    // Ctrl-U first clears whatever the user was typing
+    std::string cmd = "\x15" "disconnect\n";
+    Stdin(reinterpret_cast<const uint8_t*>(cmd.data()), cmd.size());
+}
+
+void Gdb::Reconnect() {
+    std::string cmd = "\x15" "target remote :" + std::to_string(port_) + "\n";
+    Stdin(reinterpret_cast<const uint8_t*>(cmd.data()), cmd.size());
+}
+
 void Gdb::Resize(uint16_t rows, uint16_t cols) {
     if (!pty_master_fd_)
         return;
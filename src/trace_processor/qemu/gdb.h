@@ -45,6 +45,15 @@ public:
   void Stdin(const uint8_t *data, size_t len);
   void Resize(uint16_t rows, uint16_t cols);
 
+  // Whether gdb is still around, ie. the user didn't quit it.
+  bool IsRunning() const { return !!pty_master_fd_; }
+
+  // Lets QEMU seek elsewhere and attaches again once it got there, without
+  // restarting gdb. The commands are typed in gdb's terminal, so they show up
+  // there like any other.
+  void Disconnect();
+  void Reconnect();
+
 private:
   StdoutFunction stdout_fn_;
   std::function<void()> stopped_fn_;
@@ -52,6 +61,7 @@ private:
   base::ScopedPlatformHandle pty_master_fd_;
   base::ScopedPlatformHandle pty_slave_fd_;
   base::TaskRunner* const task_runner_;
+  const int port_;
 };
 
 }  // namespace dejaview::trace_processor
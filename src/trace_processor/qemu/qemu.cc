@@ -20,6 +20,7 @@
 
 #include "dejaview/base/status.h"
 #include "dejaview/base/task_runner.h"
+#include "dejaview/base/time.h"
 #include "dejaview/ext/base/string_utils.h"
 #include "dejaview/trace_processor/trace_processor.h"
 
@@ -71,7 +72,43 @@ std::optional<std::string> ReplayCwd(TraceProcessor &trace_processor) {
   return it.Get(0).AsString();
 }
 
-std::vector<std::string> ReplayCmd(TraceProcessor &trace_processor, std::string &elfPath) {
+// Returns the name of the last snapshot saved before |icount|, if the record
+// saved any.
+std::optional<std::string> NearestSnapshot(TraceProcessor &trace_processor,
+                                           uint64_t icount) {
+  std::optional<std::string> nearest;
+  int64_t nearestIcount = -1;
+  auto snapshotsSql = "SELECT str_value, int_value FROM metadata "
+                      "WHERE name = 'qemu_snapshot'";
+  for (auto it = trace_processor.ExecuteQuery(snapshotsSql); it.Next();) {
+    int64_t snapshotIcount = it.Get(1).AsLong();
+    if (snapshotIcount <= static_cast<int64_t>(icount) &&
+        snapshotIcount > nearestIcount) {
+      nearest = it.Get(0).AsString();
+      nearestIcount = snapshotIcount;
+    }
+  }
+  return nearest;
+}
+
+// Turns the -icount options of the record into replay ones, starting from
+// |snapshot| rather than from the snapshot of the record if there's one.
+std::string ReplayIcountOptions(const std::string &options,
+                                const std::optional<std::string> &snapshot) {
+  std::string replay = base::ReplaceAll(options, "record", "replay");
+  if (!snapshot.has_value())
+    return replay;
+  std::vector<std::string> kept;
+  for (const std::string &option : base::SplitString(replay, ",")) {
+    if (!base::StartsWith(option, "rrsnapshot="))
+      kept.push_back(option);
+  }
+  kept.push_back("rrsnapshot=" + snapshot.value());
+  return base::Join(kept, ",");
+}
+
+std::vector<std::string> ReplayCmd(TraceProcessor &trace_processor, std::string &elfPath,
+                                   const std::optional<std::string> &snapshot) {
   std::vector<std::string> ret;
   auto cmdSql = "SELECT str_value FROM metadata WHERE name = 'qemu_record_cmd'";
   bool isIcount = false;
@@ -117,7 +154,7 @@ std::vector<std::string> ReplayCmd(TraceProcessor &trace_processor, std::string
 
     // Replay instead of recording
     if (isIcount)
-      val = base::ReplaceAll(val, "record", "replay");
+      val = ReplayIcountOptions(val, snapshot);
     isIcount = (val == "-icount");
 
     ret.push_back(val);
@@ -128,7 +165,33 @@ std::vector<std::string> ReplayCmd(TraceProcessor &trace_processor, std::string
 }
 
 base::Status Qemu::Debug(uint64_t target_icount, TraceProcessor &trace_processor) {
-  debugger_.reset();
+  RestartIdleTimeout();
+  target_icount_ = target_icount;
+
+  if (!IsReplaying())
+    return StartReplay(trace_processor);
+
+  // QEMU seeks once connected, to whatever the latest target is by then
+  if (!qmpServer_->IsConnected())
+    return base::OkStatus();
+
+  if (debugger_ && debugger_->IsRunning())
+    debugger_->Disconnect();
+  current_icount_ms_ = base::GetWallTimeMs().count();
+  // Seeking to where QEMU already is wouldn't report any icount change
+  if (target_icount_ == current_icount_) {
+    target_icount_ = std::numeric_limits<uint64_t>::max();
+    AttachDebugger();
+    return base::OkStatus();
+  }
+  // replay-seek loads the nearest snapshot by itself when seeking backward, or
+  // forward past one, and only replays from the current icount otherwise
+  qmpServer_->SeekTo(target_icount_);
+  return base::OkStatus();
+}
+
+base::Status Qemu::StartReplay(TraceProcessor &trace_processor) {
+  StopReplay();
 
   process_ = std::make_unique<base::Subprocess>();
   process_->args.stdin_mode = base::Subprocess::InputMode::kDevNull;
@@ -136,40 +199,30 @@ base::Status Qemu::Debug(uint64_t target_icount, TraceProcessor &trace_processor
   process_->args.stderr_mode = base::Subprocess::OutputMode::kDevNull;
 
   process_->args.cwd = ReplayCwd(trace_processor);
-  std::string elfPath;
-  process_->args.exec_cmd = ReplayCmd(trace_processor, elfPath);
+  // Starting from the nearest snapshot bounds how much has to be replayed
+  // before reaching |target_icount_| by the interval between snapshots
+  std::optional<std::string> snapshot =
+      NearestSnapshot(trace_processor, target_icount_);
+  elf_path_.clear();
+  process_->args.exec_cmd = ReplayCmd(trace_processor, elf_path_, snapshot);
   if (process_->args.cwd.has_value()) {
-    elfPath = AbsolutePath(elfPath, process_->args.cwd.value());
+    elf_path_ = AbsolutePath(elf_path_, process_->args.cwd.value());
   }
 
-  int gdbPort = FreeTcpPort();
-  if (gdbPort == -1) {
+  gdb_port_ = FreeTcpPort();
+  if (gdb_port_ == -1) {
     return base::ErrStatus("Failed to find a free port");
   }
   process_->args.exec_cmd.push_back("-gdb");
-  process_->args.exec_cmd.push_back("tcp::" + std::to_string(gdbPort));
+  process_->args.exec_cmd.push_back("tcp::" + std::to_string(gdb_port_));
   process_->args.exec_cmd.push_back("-S");
 
   qmpServer_ = std::make_unique<QMPServer>(task_runner_);
-  target_icount_ = target_icount;
   qmpServer_->SetOnConnected([this] () {
     qmpServer_->SeekTo(target_icount_);
   });
-  qmpServer_->SetOnIcountUpdate([this, gdbPort, elfPath] (uint64_t current_icount) {
-    icount_changed_fn_(current_icount);
-
-    if (current_icount == target_icount_) {
-      target_icount_ = std::numeric_limits<uint64_t>::max();
-      debugger_ = std::make_unique<Gdb>(task_runner_, elfPath, gdbPort);
-      debugger_->SetStdoutFunction([this] (const uint8_t* data, size_t size) {
-        debugger_stdout_fn_(data, size);
-      });
-      debugger_->SetStoppedFunction([this] () {
-        debugger_stopped_fn_();
-      });
-      debugger_started_fn_();
-      debugger_->Start();
-    }
+  qmpServer_->SetOnIcountUpdate([this] (uint64_t current_icount) {
+    OnIcountUpdate(current_icount);
   });
   process_->args.exec_cmd.push_back("-qmp");
   process_->args.exec_cmd.push_back("unix:" + qmpServer_->sock_path());
@@ -181,4 +234,72 @@ base::Status Qemu::Debug(uint64_t target_icount, TraceProcessor &trace_processor
   return base::OkStatus();
 }
 
+bool Qemu::IsReplaying() {
+  return process_ && qmpServer_ &&
+         process_->Poll() == base::Subprocess::kRunning;
+}
+
+void Qemu::OnIcountUpdate(uint64_t current_icount) {
+  // Only forward progress tells the replay speed, going backward is loading a
+  // snapshot
+  int64_t now_ms = base::GetWallTimeMs().count();
+  if (current_icount_ != std::numeric_limits<uint64_t>::max() &&
+      current_icount > current_icount_ && now_ms > current_icount_ms_) {
+    double speed = static_cast<double>(current_icount - current_icount_) /
+                   static_cast<double>(now_ms - current_icount_ms_);
+    icount_per_ms_ = icount_per_ms_ > 0 ? kSpeedSmoothing * speed +
+                                              (1 - kSpeedSmoothing) * icount_per_ms_
+                                        : speed;
+  }
+  current_icount_ = current_icount;
+  current_icount_ms_ = now_ms;
+
+  std::optional<uint64_t> eta_ms;
+  if (target_icount_ != std::numeric_limits<uint64_t>::max() &&
+      current_icount < target_icount_ && icount_per_ms_ > 0) {
+    eta_ms = static_cast<uint64_t>(
+        static_cast<double>(target_icount_ - current_icount) / icount_per_ms_);
+  }
+  icount_changed_fn_(current_icount, eta_ms);
+
+  if (current_icount == target_icount_) {
+    target_icount_ = std::numeric_limits<uint64_t>::max();
+    AttachDebugger();
+  }
+}
+
+void Qemu::AttachDebugger() {
+  // gdb outlives seeks unless the user quit it
+  if (debugger_ && debugger_->IsRunning()) {
+    debugger_->Reconnect();
+    return;
+  }
+  debugger_ = std::make_unique<Gdb>(task_runner_, elf_path_, gdb_port_);
+  debugger_->SetStdoutFunction([this] (const uint8_t* data, size_t size) {
+    debugger_stdout_fn_(data, size);
+  });
+  debugger_->SetStoppedFunction([this] () {
+    debugger_stopped_fn_();
+  });
+  debugger_started_fn_();
+  debugger_->Start();
+}
+
+void Qemu::RestartIdleTimeout() {
+  uint64_t generation = ++idle_generation_;
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask([weak_this, generation] {
+    if (weak_this && weak_this->idle_generation_ == generation)
+      weak_this->StopReplay();
+  }, kIdleTimeoutMs);
+}
+
+void Qemu::StopReplay() {
+  debugger_.reset();
+  qmpServer_.reset();
+  // Kills QEMU if it's still running
+  process_.reset();
+  current_icount_ = std::numeric_limits<uint64_t>::max();
+}
+
 }
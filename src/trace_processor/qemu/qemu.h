@@ -17,10 +17,15 @@
 #ifndef SRC_TRACE_PROCESSOR_QEMU_QEMU_H_
 #define SRC_TRACE_PROCESSOR_QEMU_QEMU_H_
 
+#include <limits>
+#include <optional>
+#include <string>
+
 #include "src/trace_processor/qemu/gdb.h"
 #include "src/trace_processor/qemu/qmp_server.h"
 
 #include "dejaview/ext/base/subprocess.h"
+#include "dejaview/ext/base/weak_ptr.h"
 
 namespace dejaview {
 
@@ -33,13 +38,21 @@ namespace trace_processor {
 
 class TraceProcessor;
 
+// Replays the record of a trace in QEMU up to an instruction and attaches gdb
+// there. The replay is kept around between debug requests: later ones seek
+// within the running QEMU, forward by replaying further or backward from the
+// nearest snapshot, and gdb only reattaches. It is torn down after a while
+// without any request or debugger input.
 class Qemu {
 public:
-  Qemu(base::TaskRunner *task_runner) : task_runner_(task_runner) {}
+  Qemu(base::TaskRunner *task_runner)
+      : task_runner_(task_runner), weak_factory_(this) {}
   base::Status Debug(uint64_t target_icount, TraceProcessor &trace_processor);
 
+  // |eta_ms| predicts when a seek reaches its target, from the replay speed.
   using IcountChangedFunction =
-      std::function<void(uint64_t /*icount*/)>;
+      std::function<void(uint64_t /*icount*/,
+                         std::optional<uint64_t> /*eta_ms*/)>;
   void SetIcountChangedFunction(IcountChangedFunction f) {
     icount_changed_fn_ = std::move(f);
   }
@@ -57,14 +70,30 @@ public:
   }
 
   void DebuggerStdin(const uint8_t *data, size_t len) {
+    if (!debugger_)
+      return;
+    RestartIdleTimeout();
     debugger_->Stdin(data, len);
   }
 
   void DebuggerResize(uint16_t rows, uint16_t cols) {
-    debugger_->Resize(rows, cols);
+    if (debugger_)
+      debugger_->Resize(rows, cols);
   }
 
 private:
+  // The replay is shut down after that long without any activity
+  static constexpr uint32_t kIdleTimeoutMs = 10 * 60 * 1000;
+  // Weight of the latest sample in the smoothed replay speed
+  static constexpr double kSpeedSmoothing = 0.3;
+
+  base::Status StartReplay(TraceProcessor &trace_processor);
+  bool IsReplaying();
+  void OnIcountUpdate(uint64_t current_icount);
+  void AttachDebugger();
+  void RestartIdleTimeout();
+  void StopReplay();
+
   IcountChangedFunction icount_changed_fn_;
   Gdb::StdoutFunction debugger_stdout_fn_;
   std::function<void()> debugger_started_fn_, debugger_stopped_fn_;
@@ -72,7 +101,16 @@ private:
   std::unique_ptr<Gdb> debugger_;
   std::unique_ptr<QMPServer> qmpServer_;
   base::TaskRunner* const task_runner_;
-  uint64_t target_icount_;
+  uint64_t target_icount_ = std::numeric_limits<uint64_t>::max();
+  uint64_t current_icount_ = std::numeric_limits<uint64_t>::max();
+  // When |current_icount_| was reported or the current seek started
+  int64_t current_icount_ms_ = 0;
+  // Replayed instructions per ms, 0 until measured
+  double icount_per_ms_ = 0;
+  std::string elf_path_;
+  int gdb_port_ = -1;
+  uint64_t idle_generation_ = 0;
+  base::WeakPtrFactory<Qemu> weak_factory_;  // Keep last.
 };
 
 }  // namespace dejaview::trace_processor
@@ -15,14 +15,15 @@
  */
 
 #include "src/trace_processor/qemu/qmp_server.h"
-#include "dejaview/ext/base/string_splitter.h"
 
-#include <json/json.h>
+#include <algorithm>
 
 #include "dejaview/base/task_runner.h"
 
 namespace {
 
+constexpr char kIcountQueryId[] = "icount";
+
 std::string ToJsonString(const Json::Value& value) {
   Json::StreamWriterBuilder builder;
   builder["commentStyle"] = "None";
@@ -35,20 +36,11 @@ std::string ToJsonString(const Json::Value& value) {
 namespace dejaview::trace_processor {
 
 QMPServer::QMPServer(base::TaskRunner *task_runner) : base::UnixSocket::EventListener(), tmp_dir_(base::TempDir::Create()),
-                                            task_runner_(task_runner), icount_poller_(task_runner_) {
+                                            task_runner_(task_runner), icount_poller_(task_runner_),
+                                            reader_(Json::CharReaderBuilder().newCharReader()) {
   socket_ = base::UnixSocket::Listen(sock_path(), this, task_runner_,
                                       base::SockFamily::kUnix,
                                       base::SockType::kStream);
-
-  icount_poller_args_.period_ms = 40;
-  icount_poller_args_.task = [&] {
-    if (!client_socket_ || !capabilities_negotiated_ || inhibit_status_send_) return;
-
-    Json::Value cmd;
-    cmd["execute"] = "query-replay";
-    client_socket_->SendStr(ToJsonString(cmd));
-    inhibit_status_send_ = true;
-  };
 }
 
 QMPServer::~QMPServer() {
@@ -80,63 +72,106 @@ void QMPServer::OnNewIncomingConnection(base::UnixSocket *,
   client_socket_ = std::move(client);
 }
 
+void QMPServer::QueryIcount() {
+  if (!client_socket_ || !capabilities_negotiated_) return;
+
+  Json::Value cmd;
+  cmd["execute"] = "query-replay";
+  cmd["id"] = kIcountQueryId;
+  client_socket_->SendStr(ToJsonString(cmd));
+  queries_in_flight_++;
+}
+
+void QMPServer::SchedulePoll() {
+  base::PeriodicTask::Args args;
+  args.period_ms = poll_period_ms_;
+  args.one_shot = true;
+  args.task = [this] {
+    // Don't pile up queries if QEMU is too busy to answer
+    if (running_ && !queries_in_flight_)
+      QueryIcount();
+  };
+  icount_poller_.Start(std::move(args));
+}
+
 void QMPServer::OnDataAvailable(base::UnixSocket *sock) {
-    if (sock != client_socket_.get())
-      return;
-  auto received = sock->ReceiveString();
-  base::StringSplitter s(received, '\n');
-  for (; s.Next();) {
-    if (!version_received_) {
-      // First message from QEMU is a capabilities handshake.
-      version_received_ = true;
-      Json::Value cmd;
-      cmd["execute"] = "qmp_capabilities";
-      sock->SendStr(ToJsonString(cmd));
-      return; // Wait for the capabilities response
-    }
+  if (sock != client_socket_.get())
+    return;
+  char buf[4096];
+  for (;;) {
+    size_t rsize = sock->Receive(buf, sizeof(buf));
+    if (!rsize)
+      break;
+    received_.append(buf, rsize);
+  }
 
-    if (!capabilities_negotiated_) {
-      // Second message is the response to our qmp_capabilities command.
-      capabilities_negotiated_ = true;
-      connected_();
-      return; // Handshake complete, ready for periodic queries
-    }
+  size_t start = 0;
+  for (size_t end = received_.find('\n'); end != std::string::npos;
+       end = received_.find('\n', start)) {
+    OnMessage(received_.data() + start, end - start);
+    start = end + 1;
+  }
+  received_.erase(0, start);
+}
 
-    // Parse responses to our "query-replay" commands.
-    Json::Value root;
-    Json::CharReaderBuilder reader_builder;
-    std::string errors;
-    std::unique_ptr<Json::CharReader> const reader(reader_builder.newCharReader());
+void QMPServer::OnMessage(const char* data, size_t size) {
+  if (!version_received_) {
+    // First message from QEMU is a capabilities handshake.
+    version_received_ = true;
+    Json::Value cmd;
+    cmd["execute"] = "qmp_capabilities";
+    client_socket_->SendStr(ToJsonString(cmd));
+    return; // Wait for the capabilities response
+  }
 
-    if (!reader->parse(s.cur_token(), s.cur_token() + s.cur_token_size(), &root, &errors)) {
-      fprintf(stderr, "Failed to parse JSON: %s %s\n", s.cur_token(), errors.c_str());
-      return;
-    }
+  if (!capabilities_negotiated_) {
+    // Second message is the response to our qmp_capabilities command.
+    capabilities_negotiated_ = true;
+    connected_();
+    return; // Handshake complete, ready for icount queries
+  }
+
+  Json::Value root;
+  std::string errors;
+  if (!reader_->parse(data, data + size, &root, &errors)) {
+    fprintf(stderr, "Failed to parse JSON: %.*s %s\n", static_cast<int>(size),
+            data, errors.c_str());
+    return;
+  }
 
+  // Replies to our queries, successful or not, carry their id
+  if (root["id"].asString() == kIcountQueryId) {
+    if (queries_in_flight_)
+      queries_in_flight_--;
     // The icount is inside the "return" object of a successful query.
-    const Json::Value& returnValue = root["return"];
-    if (returnValue.isObject() && returnValue.isMember("icount")) {
-      const Json::Value& icountValue = returnValue["icount"];
-      if (icountValue.isUInt64()) {
-        uint64_t icount = icountValue.asUInt64();
-        static uint64_t last_icount = 0;
-        inhibit_status_send_ = false;
-        if (last_icount != icount) {
-          icount_update_(icount);
-          last_icount = icount;
-        }
-      }
-    }
-    const Json::Value& eventValue = root["event"];
-    if (eventValue.isString()) {
-      std::string event = eventValue.asString();
-      if (event == "STOP") {
-        icount_poller_.Reset();
-        icount_poller_args_.task();
+    const Json::Value& icountValue = root["return"]["icount"];
+    if (icountValue.isUInt64()) {
+      uint64_t icount = icountValue.asUInt64();
+      // Poll faster while the icount moves and back off while it doesn't
+      if (last_icount_ != icount) {
+        poll_period_ms_ = kMinPollPeriodMs;
+        icount_update_(icount);
+        last_icount_ = icount;
       } else {
-        icount_poller_.Start(icount_poller_args_);
+        poll_period_ms_ = std::min(poll_period_ms_ * 2, kMaxPollPeriodMs);
       }
     }
+    if (running_)
+      SchedulePoll();
+  }
+  const Json::Value& eventValue = root["event"];
+  if (eventValue.isString()) {
+    std::string event = eventValue.asString();
+    if (event == "STOP") {
+      // Report where the VM stopped without waiting for the next poll
+      running_ = false;
+      icount_poller_.Reset();
+      QueryIcount();
+    } else if (event == "RESUME") {
+      running_ = true;
+      poll_period_ms_ = kMinPollPeriodMs;
+      SchedulePoll();
+    }
   }
 }
 
@@ -17,18 +17,27 @@
 #ifndef SRC_TRACE_PROCESSOR_QEMU_QMP_SERVER_H_
 #define SRC_TRACE_PROCESSOR_QEMU_QMP_SERVER_H_
 
+#include <json/json.h>
+
 #include "dejaview/ext/base/periodic_task.h"
 #include "dejaview/ext/base/temp_file.h"
 #include "dejaview/ext/base/unix_socket.h"
 
 namespace dejaview::trace_processor {
 
+// Talks to the QMP monitor of a replaying QEMU to seek and report progress.
+//
+// While the VM runs, the icount is polled with query-replay: often while it
+// moves, backing off while it doesn't, eg. while QEMU loads a snapshot. It is
+// queried right away when the VM stops, which is how seeks end.
 class QMPServer : public base::UnixSocket::EventListener {
  public:
   QMPServer(base::TaskRunner *task_runner);
   ~QMPServer() override;
 
   void SeekTo(uint64_t target_icount);
+  // Whether QEMU connected and accepts commands.
+  bool IsConnected() const { return capabilities_negotiated_; }
 
   std::string sock_path();
 
@@ -40,6 +49,13 @@ class QMPServer : public base::UnixSocket::EventListener {
   void SetOnConnected(std::function<void()> callback);
 
  private:
+  static constexpr uint32_t kMinPollPeriodMs = 40;
+  static constexpr uint32_t kMaxPollPeriodMs = 640;
+
+  void OnMessage(const char* data, size_t size);
+  void QueryIcount();
+  void SchedulePoll();
+
   base::TempDir tmp_dir_;
   base::TaskRunner *task_runner_;
   std::unique_ptr<base::UnixSocket> socket_;
@@ -47,8 +63,14 @@ class QMPServer : public base::UnixSocket::EventListener {
   base::PeriodicTask icount_poller_;
   std::function<void(uint64_t)> icount_update_;
   std::function<void()> connected_;
-  bool version_received_ = false, capabilities_negotiated_ = false, inhibit_status_send_ = false;
-  base::PeriodicTask::Args icount_poller_args_;
+  bool version_received_ = false, capabilities_negotiated_ = false;
+  bool running_ = false;
+  uint32_t queries_in_flight_ = 0;
+  uint32_t poll_period_ms_ = kMinPollPeriodMs;
+  uint64_t last_icount_ = 0;
+  // Messages are newline separated but may be split across reads.
+  std::string received_;
+  std::unique_ptr<Json::CharReader> reader_;
 };
 
 }  // namespace dejaview::trace_processor
@@ -21,6 +21,7 @@
 #include <cstdio>
 #include <cstring>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -106,12 +107,15 @@ Rpc::Rpc(std::unique_ptr<TraceProcessor> preloaded_instance, base::TaskRunner *t
   if (!trace_processor_)
     ResetTraceProcessorInternal(Config());
 #if DEJAVIEW_BUILDFLAG(DEJAVIEW_OS_LINUX)
-  qemu_.SetIcountChangedFunction([this](uint64_t icount){
+  qemu_.SetIcountChangedFunction([this](uint64_t icount,
+                                        std::optional<uint64_t> eta_ms){
     std::lock_guard<std::mutex> lock(send_mu_);
     if (rpc_response_fn_) {
       Response icountResp(tx_seq_id_++, RpcProto::TPM_DEBUG);
       auto* debugResult = icountResp->set_debug_result();
       debugResult->set_current_icount(icount);
+      if (eta_ms.has_value())
+        debugResult->set_eta_ms(*eta_ms);
       icountResp.Send(rpc_response_fn_);
     }
   });
@@ -487,6 +491,9 @@ void Rpc::ResetTraceProcessor(const uint8_t* args, size_t len) {
             ? SoftDropFtraceDataBefore::kAllPerCpuBuffersValid
             : SoftDropFtraceDataBefore::kNoDrop;
   }
+  if (reset_trace_processor_args.has_parse_threads()) {
+    config.parse_threads = reset_trace_processor_args.parse_threads();
+  }
   ResetTraceProcessorInternal(config);
 }
 
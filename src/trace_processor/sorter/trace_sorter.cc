@@ -47,6 +47,8 @@ TraceSorter::TraceSorter(TraceProcessorContext* context,
     DEJAVIEW_ELOG("TEST MODE: bypassing protobuf parsing stage");
 }
 
+TraceSorter::SortedEventParser::~SortedEventParser() = default;
+
 TraceSorter::~TraceSorter() {
   // If trace processor encountered a fatal error, it's possible for some events
   // to have been pushed without evicting them by pushing to the next stage. Do
@@ -183,6 +185,8 @@ void TraceSorter::SortAndExtractEventsUntilAllocId(
       }
 
       ++num_extracted;
+      // Sorted events go first when their timestamps are the same.
+      ParseSortedEventsUntil(event.ts);
       MaybeExtractEvent(min_machine_idx, min_queue_idx, event);
     }  // for (event: events)
 
@@ -221,6 +225,10 @@ void TraceSorter::ParseTracePacket(TraceProcessorContext& context,
       context.proto_trace_parser->ParseTrackEvent(
           event.ts, token_buffer_.Extract<TrackEventData>(id));
       return;
+    case TimestampedEvent::Type::kCallGraphEvent:
+      context.proto_trace_parser->ParseCallGraphEvent(
+          event.ts, token_buffer_.Extract<CallGraphEventData>(id));
+      return;
     case TimestampedEvent::Type::kJsonValue:
       context.json_trace_parser->ParseJsonPacket(
           event.ts, std::move(token_buffer_.Extract<JsonEvent>(id).value));
@@ -242,6 +250,9 @@ void TraceSorter::ExtractAndDiscardTokenizedObject(
     case TimestampedEvent::Type::kTrackEvent:
       base::ignore_result(token_buffer_.Extract<TrackEventData>(id));
       return;
+    case TimestampedEvent::Type::kCallGraphEvent:
+      base::ignore_result(token_buffer_.Extract<CallGraphEventData>(id));
+      return;
     case TimestampedEvent::Type::kJsonValue:
       base::ignore_result(token_buffer_.Extract<JsonEvent>(id));
       return;
@@ -96,6 +96,18 @@ class TraceSorter {
     kFullSort,
   };
 
+  // Parses events which are tokenized in timestamp order already, and buffered
+  // outside of the queues so that they can be parsed in bulk rather than one
+  // by one. The sorter interleaves them with the events of its queues.
+  class SortedEventParser {
+   public:
+    virtual ~SortedEventParser();
+
+    // Parses the buffered events with a timestamp up to |ts|. Returns the
+    // timestamp of the next buffered event, or int64 max if there is none.
+    virtual int64_t ParseEventsUntil(int64_t ts) = 0;
+  };
+
   TraceSorter(TraceProcessorContext* context, SortingMode sorting_mode);
 
   ~TraceSorter();
@@ -145,6 +157,31 @@ class TraceSorter {
     AppendNonFtraceEvent(timestamp, TimestampedEvent::Type::kJsonValue, id);
   }
 
+  inline void PushCallGraphEvent(
+      int64_t timestamp,
+      CallGraphEventData event,
+      std::optional<MachineId> machine_id = std::nullopt) {
+    TraceTokenBuffer::Id id = token_buffer_.Append(std::move(event));
+    AppendNonFtraceEvent(timestamp, TimestampedEvent::Type::kCallGraphEvent,
+                         id, machine_id);
+  }
+
+  // Registers the parser of sorted events, there can only be one.
+  void SetSortedEventParser(SortedEventParser* parser) {
+    DEJAVIEW_DCHECK(!sorted_event_parser_ || sorted_event_parser_ == parser);
+    sorted_event_parser_ = parser;
+  }
+
+  // Called by the SortedEventParser when it buffered events between |min_ts|
+  // and |max_ts|.
+  inline void NotifySortedEvents(int64_t min_ts, int64_t max_ts) {
+    sorted_events_min_ts_ = std::min(sorted_events_min_ts_, min_ts);
+    append_max_ts_ = std::max(append_max_ts_, max_ts);
+  }
+
+  // The timestamp of the newest event extracted from the queues so far.
+  int64_t latest_pushed_event_ts() const { return latest_pushed_event_ts_; }
+
   inline void PushTrackEventPacket(
       int64_t timestamp,
       TrackEventData track_event,
@@ -157,6 +194,7 @@ class TraceSorter {
   void ExtractEventsForced() {
     BumpAllocator::AllocId end_id = token_buffer_.PastTheEndAllocId();
     SortAndExtractEventsUntilAllocId(end_id);
+    ParseSortedEventsUntil(std::numeric_limits<int64_t>::max());
     for (auto& sorter_data : sorter_data_by_machine_) {
       for (const auto& queue : sorter_data.queues) {
         DEJAVIEW_CHECK(queue.events_.empty());
@@ -190,7 +228,8 @@ class TraceSorter {
       kJsonValueWithDur,
       kTracePacket,
       kTrackEvent,
-      kMax = kTrackEvent,
+      kCallGraphEvent,
+      kMax = kCallGraphEvent,
     };
 
     // Number of bits required to store the max element in |Type|.
@@ -354,6 +393,11 @@ class TraceSorter {
                       uint32_t cpu,
                       const TimestampedEvent&);
 
+  void ParseSortedEventsUntil(int64_t ts) {
+    if (DEJAVIEW_UNLIKELY(sorted_events_min_ts_ <= ts) && sorted_event_parser_)
+      sorted_events_min_ts_ = sorted_event_parser_->ParseEventsUntil(ts);
+  }
+
   void MaybeExtractEvent(size_t machine_idx,
                          size_t queue_idx,
                          const TimestampedEvent&);
@@ -408,6 +452,11 @@ class TraceSorter {
   // Whether when std::sorting the queues, we should use the slow
   // sorting algorithm
   bool use_slow_sorting_ = false;
+
+  SortedEventParser* sorted_event_parser_ = nullptr;
+
+  // min(e.ts for e buffered by |sorted_event_parser_|)
+  int64_t sorted_events_min_ts_ = std::numeric_limits<int64_t>::max();
 };
 
 }  // namespace dejaview::trace_processor
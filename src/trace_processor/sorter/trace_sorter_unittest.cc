@@ -48,6 +48,7 @@ class MockTraceParser : public ProtoTraceParserImpl {
               (int64_t ts, const uint8_t* data, size_t length));
 
   void ParseTrackEvent(int64_t, TrackEventData) override {}
+  void ParseCallGraphEvent(int64_t, CallGraphEventData) override {}
 
   void ParseTracePacket(int64_t ts, TracePacketData data) override {
     TraceBlobView& tbv = data.packet;
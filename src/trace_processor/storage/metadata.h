@@ -65,7 +65,8 @@ namespace metadata {
   F(ui_state,                          KeyType::kSingle,  Variadic::kString), \
   F(unique_session_name,               KeyType::kSingle,  Variadic::kString), \
   F(qemu_record_cmd,                   KeyType::kMulti,   Variadic::kString), \
-  F(qemu_record_cwd,                   KeyType::kSingle,  Variadic::kString)
+  F(qemu_record_cwd,                   KeyType::kSingle,  Variadic::kString), \
+  F(qemu_snapshot,                     KeyType::kMulti,   Variadic::kString)
 // clang-format on
 
 // Compile time list of metadata items.
@@ -902,9 +902,125 @@ class TraceStorage {
     return static_cast<Variadic::Type>(idx);
   }
 
+  // Calls |fn| with the name and a pointer of each table in the storage, in a
+  // fixed order where tables come after the tables they extend.
+  template <typename Fn>
+  void ForEachTable(Fn fn) {
+    ForEachTableImpl(this, fn);
+  }
+  template <typename Fn>
+  void ForEachTable(Fn fn) const {
+    ForEachTableImpl(this, fn);
+  }
+
  private:
   using StringHash = uint64_t;
 
+  template <typename Self, typename Fn>
+  static void ForEachTableImpl(Self* self, Fn& fn) {
+    fn(tables::MetadataTable::Name(), &self->metadata_table_);
+    fn(tables::ClockSnapshotTable::Name(), &self->clock_snapshot_table_);
+    fn(tables::TrackTable::Name(), &self->track_table_);
+    fn(tables::ThreadStateTable::Name(), &self->thread_state_table_);
+    fn(tables::CpuTrackTable::Name(), &self->cpu_track_table_);
+    fn(tables::GpuTrackTable::Name(), &self->gpu_track_table_);
+    fn(tables::UidTrackTable::Name(), &self->uid_track_table_);
+    fn(tables::GpuWorkPeriodTrackTable::Name(),
+       &self->gpu_work_period_track_table_);
+    fn(tables::ProcessTrackTable::Name(), &self->process_track_table_);
+    fn(tables::ThreadTrackTable::Name(), &self->thread_track_table_);
+    fn(tables::LinuxDeviceTrackTable::Name(), &self->linux_device_track_table_);
+    fn(tables::CounterTrackTable::Name(), &self->counter_track_table_);
+    fn(tables::ThreadCounterTrackTable::Name(),
+       &self->thread_counter_track_table_);
+    fn(tables::ProcessCounterTrackTable::Name(),
+       &self->process_counter_track_table_);
+    fn(tables::CpuCounterTrackTable::Name(), &self->cpu_counter_track_table_);
+    fn(tables::IrqCounterTrackTable::Name(), &self->irq_counter_track_table_);
+    fn(tables::SoftirqCounterTrackTable::Name(),
+       &self->softirq_counter_track_table_);
+    fn(tables::GpuCounterTrackTable::Name(), &self->gpu_counter_track_table_);
+    fn(tables::EnergyCounterTrackTable::Name(),
+       &self->energy_counter_track_table_);
+    fn(tables::UidCounterTrackTable::Name(), &self->uid_counter_track_table_);
+    fn(tables::EnergyPerUidCounterTrackTable::Name(),
+       &self->energy_per_uid_counter_track_table_);
+    fn(tables::GpuCounterGroupTable::Name(), &self->gpu_counter_group_table_);
+    fn(tables::PerfCounterTrackTable::Name(), &self->perf_counter_track_table_);
+    fn(tables::ArgTable::Name(), &self->arg_table_);
+    fn(tables::ThreadTable::Name(), &self->thread_table_);
+    fn(tables::ProcessTable::Name(), &self->process_table_);
+    fn(tables::FiledescriptorTable::Name(), &self->filedescriptor_table_);
+    fn(tables::SliceTable::Name(), &self->slice_table_);
+    fn(tables::FlowTable::Name(), &self->flow_table_);
+    fn(tables::SchedSliceTable::Name(), &self->sched_slice_table_);
+    fn(tables::SpuriousSchedWakeupTable::Name(),
+       &self->spurious_sched_wakeup_table_);
+    fn(tables::GpuSliceTable::Name(), &self->gpu_slice_table_);
+    fn(tables::CounterTable::Name(), &self->counter_table_);
+    fn(tables::RawTable::Name(), &self->raw_table_);
+    fn(tables::MachineTable::Name(), &self->machine_table_);
+    fn(tables::CpuTable::Name(), &self->cpu_table_);
+    fn(tables::CpuFreqTable::Name(), &self->cpu_freq_table_);
+    fn(tables::AndroidLogTable::Name(), &self->android_log_table_);
+    fn(tables::AndroidDumpstateTable::Name(), &self->android_dumpstate_table_);
+    fn(tables::AndroidKeyEventsTable::Name(), &self->android_key_events_table_);
+    fn(tables::AndroidMotionEventsTable::Name(),
+       &self->android_motion_events_table_);
+    fn(tables::AndroidInputEventDispatchTable::Name(),
+       &self->android_input_event_dispatch_table_);
+    fn(tables::StackProfileMappingTable::Name(),
+       &self->stack_profile_mapping_table_);
+    fn(tables::StackProfileFrameTable::Name(),
+       &self->stack_profile_frame_table_);
+    fn(tables::StackProfileCallsiteTable::Name(),
+       &self->stack_profile_callsite_table_);
+    fn(tables::HeapProfileAllocationTable::Name(),
+       &self->heap_profile_allocation_table_);
+    fn(tables::CpuProfileStackSampleTable::Name(),
+       &self->cpu_profile_stack_sample_table_);
+    fn(tables::PerfSessionTable::Name(), &self->perf_session_table_);
+    fn(tables::PerfSampleTable::Name(), &self->perf_sample_table_);
+    fn(tables::InstrumentsSampleTable::Name(),
+       &self->instruments_sample_table_);
+    fn(tables::PackageListTable::Name(), &self->package_list_table_);
+    fn(tables::AndroidGameInterventionListTable::Name(),
+       &self->android_game_intervention_list_table_);
+    fn(tables::ProfilerSmapsTable::Name(), &self->profiler_smaps_table_);
+    fn(tables::TraceFileTable::Name(), &self->trace_file_table_);
+    fn(tables::SymbolTable::Name(), &self->symbol_table_);
+    fn(tables::HeapGraphObjectTable::Name(), &self->heap_graph_object_table_);
+    fn(tables::HeapGraphClassTable::Name(), &self->heap_graph_class_table_);
+    fn(tables::HeapGraphReferenceTable::Name(),
+       &self->heap_graph_reference_table_);
+    fn(tables::VulkanMemoryAllocationsTable::Name(),
+       &self->vulkan_memory_allocations_table_);
+    fn(tables::GraphicsFrameSliceTable::Name(),
+       &self->graphics_frame_slice_table_);
+    fn(tables::MemorySnapshotTable::Name(), &self->memory_snapshot_table_);
+    fn(tables::ProcessMemorySnapshotTable::Name(),
+       &self->process_memory_snapshot_table_);
+    fn(tables::MemorySnapshotNodeTable::Name(),
+       &self->memory_snapshot_node_table_);
+    fn(tables::MemorySnapshotEdgeTable::Name(),
+       &self->memory_snapshot_edge_table_);
+    fn(tables::ExpectedFrameTimelineSliceTable::Name(),
+       &self->expected_frame_timeline_slice_table_);
+    fn(tables::ActualFrameTimelineSliceTable::Name(),
+       &self->actual_frame_timeline_slice_table_);
+    fn(tables::AndroidNetworkPacketsTable::Name(),
+       &self->android_network_packets_table_);
+    fn(tables::JitCodeTable::Name(), &self->jit_code_table_);
+    fn(tables::JitFrameTable::Name(), &self->jit_frame_table_);
+    fn(tables::SpeRecordTable::Name(), &self->spe_record_table_);
+    fn(tables::ExperimentalProtoPathTable::Name(),
+       &self->experimental_proto_path_table_);
+    fn(tables::ExperimentalProtoContentTable::Name(),
+       &self->experimental_proto_content_table_);
+    fn(tables::ExpMissingChromeProcTable::Name(),
+       &self->experimental_missing_chrome_processes_table_);
+  }
+
   TraceStorage(const TraceStorage&) = delete;
   TraceStorage& operator=(const TraceStorage&) = delete;
 
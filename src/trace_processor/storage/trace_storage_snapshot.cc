@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dejaview/base/logging.h"
+#include "dejaview/base/status.h"
+#include "dejaview/ext/base/file_utils.h"
+#include "dejaview/ext/base/scoped_file.h"
+#include "dejaview/ext/base/scoped_mmap.h"
+#include "dejaview/ext/base/string_view.h"
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/column_storage.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace dejaview::trace_processor {
+
+namespace {
+
+constexpr std::array<char, 8> kMagic = {'D', 'V', 'S', 'N', 'A', 'P', 0, 0};
+constexpr uint32_t kVersion = 1;
+
+// Alignment of arrays of at least a page, fixed so that snapshots don't depend
+// on the page size of the machine writing them.
+constexpr size_t kPageSize = 4096;
+constexpr size_t kWordSize = 8;
+
+// Size of the writes of the fields and small arrays buffered by the writer.
+constexpr size_t kWriteBufferSize = 1024 * 1024;
+
+size_t ArrayAlignment(size_t size) {
+  return size >= kPageSize ? kPageSize : kWordSize;
+}
+
+size_t PaddingTo(size_t offset, size_t alignment) {
+  return (alignment - offset % alignment) % alignment;
+}
+
+uint32_t BitVectorWordCount(uint32_t size) {
+  return (size + 63) / 64;
+}
+
+// Returns the size of the values of a column of type |type| in its storage.
+size_t ValueSize(ColumnType type) {
+  switch (type) {
+    case ColumnType::kInt32:
+      return sizeof(int32_t);
+    case ColumnType::kUint32:
+      return sizeof(uint32_t);
+    case ColumnType::kInt64:
+      return sizeof(int64_t);
+    case ColumnType::kDouble:
+      return sizeof(double);
+    case ColumnType::kString:
+      return sizeof(StringPool::Id);
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      break;
+  }
+  DEJAVIEW_FATAL("Column type without storage");
+}
+
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(base::ScopedFile fd) : fd_(std::move(fd)) {}
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Append(&value, sizeof(T));
+  }
+
+  void WriteArray(const void* data, size_t size) {
+    Write<uint64_t>(size);
+    buffer_.append(PaddingTo(offset_, ArrayAlignment(size)), '\0');
+    offset_ += PaddingTo(offset_, ArrayAlignment(size));
+    if (size < kPageSize) {
+      Append(data, size);
+      return;
+    }
+    // Large arrays are written directly, without going through the buffer.
+    Flush();
+    WriteToFile(data, size);
+    offset_ += size;
+  }
+
+  void WriteString(base::StringView str) {
+    WriteArray(str.data(), str.size());
+  }
+
+  void WriteBitVector(const BitVector* bv) {
+    uint32_t size = bv ? bv->size() : 0;
+    Write<uint32_t>(size);
+    WriteArray(size ? bv->words() : nullptr,
+               BitVectorWordCount(size) * sizeof(uint64_t));
+  }
+
+  // Writes the buffered data and returns whether all writes succeeded.
+  bool Finish() {
+    Flush();
+    return ok_;
+  }
+
+ private:
+  void Append(const void* data, size_t size) {
+    if (size > 0) {
+      buffer_.append(static_cast<const char*>(data), size);
+    }
+    offset_ += size;
+    if (buffer_.size() >= kWriteBufferSize) {
+      Flush();
+    }
+  }
+
+  void Flush() {
+    WriteToFile(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  void WriteToFile(const void* data, size_t size) {
+    if (ok_ && size > 0) {
+      ok_ = base::WriteAll(*fd_, data, size) == static_cast<ssize_t>(size);
+    }
+  }
+
+  base::ScopedFile fd_;
+  std::string buffer_;
+  size_t offset_ = 0;
+  bool ok_ = true;
+};
+
+// Reads the fields written by SnapshotWriter. Reading past the end of the
+// snapshot returns zeroes and empty arrays and makes ok() false.
+class SnapshotReader {
+ public:
+  SnapshotReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  T Read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value{};
+    if (!CanRead(sizeof(T))) {
+      return value;
+    }
+    memcpy(&value, data_ + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return value;
+  }
+
+  base::StringView ReadArray() {
+    auto size = Read<uint64_t>();
+    if (!CanRead(PaddingTo(offset_, ArrayAlignment(size)))) {
+      return {};
+    }
+    offset_ += PaddingTo(offset_, ArrayAlignment(size));
+    if (!CanRead(size)) {
+      return {};
+    }
+    const char* array = reinterpret_cast<const char*>(data_ + offset_);
+    offset_ += size;
+    return {array, static_cast<size_t>(size)};
+  }
+
+  BitVector ReadBitVector() {
+    auto size = Read<uint32_t>();
+    base::StringView words = ReadArray();
+    if (words.size() != BitVectorWordCount(size) * sizeof(uint64_t)) {
+      ok_ = false;
+      return {};
+    }
+    BitVector::Builder builder(size);
+    uint32_t full_words = size / 64;
+    if (full_words > 0) {
+      memcpy(builder.AppendWords(full_words), words.data(),
+             full_words * sizeof(uint64_t));
+    }
+    if (uint32_t last_bits = size % 64; last_bits > 0) {
+      uint64_t last_word;
+      memcpy(&last_word, words.data() + full_words * sizeof(uint64_t),
+             sizeof(uint64_t));
+      for (uint32_t i = 0; i < last_bits; ++i) {
+        builder.Append((last_word >> i) & 1);
+      }
+    }
+    return std::move(builder).Build();
+  }
+
+  bool ok() const { return ok_; }
+  bool at_end() const { return offset_ == size_; }
+
+ private:
+  bool CanRead(uint64_t size) {
+    ok_ = ok_ && size <= size_ - offset_;
+    return ok_;
+  }
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  bool ok_ = true;
+};
+
+base::Status CorruptSnapshot() {
+  return base::ErrStatus("Snapshot is truncated or corrupt");
+}
+
+void WriteTable(const Table& table, SnapshotWriter& writer) {
+  writer.Write<uint32_t>(table.row_count());
+  std::vector<const BitVector*> selectors = table.ParentRowSelectors();
+  std::vector<uint32_t> parent_row_counts = table.ParentRowCounts();
+  writer.Write<uint32_t>(static_cast<uint32_t>(selectors.size()));
+  for (uint32_t i = 0; i < selectors.size(); ++i) {
+    // Selectors are saved with a bit for each row of the parent, so that they
+    // can be checked against the parent when loaded.
+    BitVector selector = selectors[i]->Copy();
+    selector.Resize(parent_row_counts[i], false);
+    writer.WriteBitVector(&selector);
+  }
+  for (uint32_t i = 0; i < table.columns().size(); ++i) {
+    const ColumnStorageBase* storage = table.OwnedColumnStorage(i);
+    if (!storage) {
+      continue;
+    }
+    const ColumnLegacy& col = table.columns()[i];
+    writer.WriteString(col.name());
+    writer.WriteArray(storage->data(),
+                      storage->non_null_size() * ValueSize(col.col_type()));
+    writer.WriteBitVector(storage->bv());
+  }
+}
+
+// A table read from a snapshot. The whole snapshot is read and checked
+// before any table is restored, so that a malformed snapshot doesn't leave the
+// storage half restored.
+struct StagedTable {
+  struct Column {
+    uint32_t index;
+    base::StringView values;
+    BitVector non_null;
+  };
+  Table* table;
+  uint32_t row_count;
+  std::vector<BitVector> parent_row_selectors;
+  std::vector<Column> columns;
+};
+
+// Returns the row counts of the parents of |table| once |staged| are restored.
+// Parent tables are staged before their children.
+std::vector<uint32_t> StagedParentRowCounts(
+    const Table& table,
+    const std::vector<StagedTable>& staged) {
+  std::vector<uint32_t> row_counts;
+  for (const Table* parent = table.parent_table(); parent;
+       parent = parent->parent_table()) {
+    auto it = std::find_if(
+        staged.begin(), staged.end(),
+        [parent](const StagedTable& t) { return t.table == parent; });
+    row_counts.push_back(it == staged.end() ? parent->row_count()
+                                            : it->row_count);
+  }
+  std::reverse(row_counts.begin(), row_counts.end());
+  return row_counts;
+}
+
+// Returns whether |values| only hold ids of strings of |pool|.
+bool AreValidStringIds(base::StringView values,
+                       const StringPool::Snapshot& pool) {
+  for (size_t offset = 0; offset + sizeof(uint32_t) <= values.size();
+       offset += sizeof(uint32_t)) {
+    uint32_t raw_id;
+    memcpy(&raw_id, values.data() + offset, sizeof(uint32_t));
+    if (!StringPool::IsValidSnapshotId(pool, StringPool::Id::Raw(raw_id))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+base::Status ReadTable(SnapshotReader& reader,
+                       const StringPool::Snapshot& pool,
+                       const std::vector<StagedTable>& staged,
+                       Table* table,
+                       StagedTable* out) {
+  out->table = table;
+  out->row_count = reader.Read<uint32_t>();
+  auto selector_count = reader.Read<uint32_t>();
+  for (uint32_t i = 0; i < selector_count && reader.ok(); ++i) {
+    out->parent_row_selectors.push_back(reader.ReadBitVector());
+  }
+  if (!reader.ok()) {
+    return CorruptSnapshot();
+  }
+  if (auto status = table->CheckRestoredRows(
+          out->row_count, out->parent_row_selectors,
+          StagedParentRowCounts(*table, staged));
+      !status.ok()) {
+    return status;
+  }
+
+  for (uint32_t i = 0; i < table->columns().size(); ++i) {
+    if (!table->OwnedColumnStorage(i)) {
+      continue;
+    }
+    const ColumnLegacy& col = table->columns()[i];
+    base::StringView snapshot_name = reader.ReadArray();
+    base::StringView values = reader.ReadArray();
+    BitVector non_null = reader.ReadBitVector();
+    if (!reader.ok()) {
+      return CorruptSnapshot();
+    }
+    if (snapshot_name != base::StringView(col.name())) {
+      return base::ErrStatus("Snapshot has column %s instead of %s",
+                             snapshot_name.ToStdString().c_str(), col.name());
+    }
+    if (auto status = table->CheckRestoredColumn(i, values.size(), non_null,
+                                                 out->row_count);
+        !status.ok()) {
+      return status;
+    }
+    // Strings are read from the pool without bounds checks.
+    if (col.col_type() == ColumnType::kString &&
+        !AreValidStringIds(values, pool)) {
+      return base::ErrStatus("Invalid strings in column %s", col.name());
+    }
+    out->columns.push_back({i, values, std::move(non_null)});
+  }
+  return base::OkStatus();
+}
+
+base::Status ReadSnapshot(SnapshotReader& reader, TraceStorage* storage) {
+  if (reader.Read<std::array<char, 8>>() != kMagic) {
+    return base::ErrStatus("Not a trace processor snapshot");
+  }
+  if (auto version = reader.Read<uint32_t>(); version != kVersion) {
+    return base::ErrStatus("Unsupported snapshot version %u", version);
+  }
+
+  StringPool::Snapshot pool;
+  auto block_count = reader.Read<uint32_t>();
+  for (uint32_t i = 0; i < block_count && reader.ok(); ++i) {
+    pool.blocks.push_back(reader.ReadArray());
+  }
+  auto large_string_count = reader.Read<uint32_t>();
+  for (uint32_t i = 0; i < large_string_count && reader.ok(); ++i) {
+    pool.large_strings.push_back(reader.ReadArray());
+  }
+  if (!reader.ok()) {
+    return CorruptSnapshot();
+  }
+  if (!storage->string_pool().CanRestoreSnapshot(pool)) {
+    return base::ErrStatus(
+        "Snapshot strings don't match the strings of the storage: was the "
+        "snapshot written by another build of trace processor?");
+  }
+
+  uint32_t table_count = 0;
+  storage->ForEachTable([&](const char*, Table*) { table_count++; });
+  if (reader.Read<uint32_t>() != table_count) {
+    return base::ErrStatus("Snapshot doesn't have %u tables", table_count);
+  }
+  std::vector<StagedTable> tables;
+  tables.reserve(table_count);
+  base::Status status;
+  storage->ForEachTable([&](const char* name, Table* table) {
+    if (!status.ok()) {
+      return;
+    }
+    base::StringView snapshot_name = reader.ReadArray();
+    if (!reader.ok()) {
+      status = CorruptSnapshot();
+    } else if (snapshot_name != base::StringView(name)) {
+      status = base::ErrStatus("Snapshot has table %s instead of %s",
+                               snapshot_name.ToStdString().c_str(), name);
+    } else {
+      StagedTable staged;
+      status = ReadTable(reader, pool, tables, table, &staged);
+      tables.push_back(std::move(staged));
+    }
+  });
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (reader.Read<uint32_t>() != stats::kNumKeys) {
+    return base::ErrStatus("Snapshot doesn't have %zu stats",
+                           static_cast<size_t>(stats::kNumKeys));
+  }
+  TraceStorage::StatsMap stats;
+  for (size_t key = 0; key < stats::kNumKeys && reader.ok(); ++key) {
+    stats[key].value = reader.Read<int64_t>();
+    auto indexed_count = reader.Read<uint32_t>();
+    for (uint32_t i = 0; i < indexed_count && reader.ok(); ++i) {
+      auto index = reader.Read<int32_t>();
+      stats[key].indexed_values[index] = reader.Read<int64_t>();
+    }
+  }
+  if (!reader.ok() || !reader.at_end()) {
+    return CorruptSnapshot();
+  }
+
+  // Nothing can fail past this point.
+  DEJAVIEW_CHECK(storage->mutable_string_pool()->RestoreSnapshot(pool));
+  for (StagedTable& staged : tables) {
+    status = staged.table->RestoreRows(staged.row_count,
+                                       std::move(staged.parent_row_selectors));
+    DEJAVIEW_CHECK(status.ok());
+    for (StagedTable::Column& col : staged.columns) {
+      status = staged.table->RestoreColumn(col.index, col.values.data(),
+                                           col.values.size(),
+                                           std::move(col.non_null));
+      DEJAVIEW_CHECK(status.ok());
+    }
+  }
+  for (size_t key = 0; key < stats::kNumKeys; ++key) {
+    if (stats::kTypes[key] == stats::kSingle) {
+      storage->SetStats(key, stats[key].value);
+      continue;
+    }
+    for (const auto& [index, value] : stats[key].indexed_values) {
+      storage->SetIndexedStats(key, index, value);
+    }
+  }
+  return base::OkStatus();
+}
+
+}  // namespace
+
+base::Status WriteTraceStorageSnapshot(const TraceStorage& storage,
+                                       const std::string& path) {
+  base::ScopedFile fd(base::OpenFile(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (!fd) {
+    return base::ErrStatus("Could not open %s for writing", path.c_str());
+  }
+  SnapshotWriter writer(std::move(fd));
+  writer.Write(kMagic);
+  writer.Write<uint32_t>(kVersion);
+
+  StringPool::Snapshot pool = storage.string_pool().GetSnapshot();
+  writer.Write<uint32_t>(static_cast<uint32_t>(pool.blocks.size()));
+  for (base::StringView block : pool.blocks) {
+    writer.WriteString(block);
+  }
+  writer.Write<uint32_t>(static_cast<uint32_t>(pool.large_strings.size()));
+  for (base::StringView str : pool.large_strings) {
+    writer.WriteString(str);
+  }
+
+  uint32_t table_count = 0;
+  storage.ForEachTable([&](const char*, const Table*) { table_count++; });
+  writer.Write<uint32_t>(table_count);
+  storage.ForEachTable([&](const char* name, const Table* table) {
+    writer.WriteString(name);
+    WriteTable(*table, writer);
+  });
+
+  writer.Write<uint32_t>(stats::kNumKeys);
+  for (const TraceStorage::Stats& stats : storage.stats()) {
+    writer.Write<int64_t>(stats.value);
+    writer.Write<uint32_t>(static_cast<uint32_t>(stats.indexed_values.size()));
+    for (const auto& [index, value] : stats.indexed_values) {
+      writer.Write<int32_t>(index);
+      writer.Write<int64_t>(value);
+    }
+  }
+
+  if (!writer.Finish()) {
+    return base::ErrStatus("Failed to write snapshot to %s", path.c_str());
+  }
+  return base::OkStatus();
+}
+
+base::Status ReadTraceStorageSnapshot(const std::string& path,
+                                      TraceStorage* storage) {
+  base::ScopedMmap mapped;
+#if DEJAVIEW_HAS_MMAP()
+  mapped = base::ReadMmapWholeFile(path.c_str());
+#endif
+  std::string contents;
+  if (!mapped.IsValid() && !base::ReadFile(path, &contents)) {
+    return base::ErrStatus("Could not read snapshot %s", path.c_str());
+  }
+  SnapshotReader reader(
+      mapped.IsValid() ? static_cast<const uint8_t*>(mapped.data())
+                       : reinterpret_cast<const uint8_t*>(contents.data()),
+      mapped.IsValid() ? mapped.length() : contents.size());
+  return ReadSnapshot(reader, storage);
+}
+
+}  // namespace dejaview::trace_processor
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_SNAPSHOT_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_SNAPSHOT_H_
+
+#include <string>
+
+#include "dejaview/base/status.h"
+
+namespace dejaview::trace_processor {
+
+class TraceStorage;
+
+// Snapshots of the tables, strings and stats of a TraceStorage, so that a
+// trace parsed once can be opened again without parsing it.
+//
+// A snapshot is a file of native endian fields: a header, the blocks and large
+// strings of the string pool, then for each table its name, row count, the
+// rows it selects in its parent tables and the values of the columns it owns,
+// and finally the stats. Arrays (string pool blocks, column values, BitVector
+// words) are prefixed by their size in bytes and start at an offset aligned to
+// the page size when they are at least a page long, to 8 bytes otherwise: the
+// file is mmapped when loaded and each array is copied once into its
+// container, without decoding.
+//
+// Snapshots hold the data of the tables as laid out by the binary writing
+// them: they can only be loaded by the same build of trace processor.
+
+// Writes a snapshot of |storage| to the file at |path|.
+base::Status WriteTraceStorageSnapshot(const TraceStorage& storage,
+                                       const std::string& path);
+
+// Loads the snapshot at |path| into |storage|, which has to be a storage where
+// no trace was loaded. The whole snapshot is checked before anything is
+// restored: on error, |storage| is left unchanged.
+base::Status ReadTraceStorageSnapshot(const std::string& path,
+                                      TraceStorage* storage);
+
+}  // namespace dejaview::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_TRACE_STORAGE_SNAPSHOT_H_
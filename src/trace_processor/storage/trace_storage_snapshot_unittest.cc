@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include "dejaview/ext/base/file_utils.h"
+#include "dejaview/ext/base/temp_file.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "test/gtest_and_gmock.h"
+
+namespace dejaview::trace_processor {
+namespace {
+
+class TraceStorageSnapshotTest : public ::testing::Test {
+ protected:
+  TraceStorageSnapshotTest() {
+    tables::SliceTable::Row slice;
+    slice.ts = 10;
+    slice.dur = 5;
+    slice.name = storage_.InternString("foo");
+    storage_.mutable_slice_table()->Insert(slice);
+
+    tables::GpuSliceTable::Row gpu_slice;
+    gpu_slice.ts = 20;
+    gpu_slice.dur = 6;
+    gpu_slice.name = storage_.InternString("gpu");
+    gpu_slice.context_id = 7;
+    storage_.mutable_gpu_slice_table()->Insert(gpu_slice);
+
+    slice.ts = 30;
+    slice.parent_id = SliceId(0u);
+    slice.name = storage_.InternString("bar");
+    storage_.mutable_slice_table()->Insert(slice);
+
+    for (uint32_t i = 0; i < 5000; ++i) {
+      tables::CounterTable::Row counter;
+      counter.ts = i;
+      counter.value = i * 1.5;
+      counter.track_id = TrackId(1u);
+      storage_.mutable_counter_table()->Insert(counter);
+    }
+    storage_.SetStats(stats::counter_events_out_of_order, 42);
+  }
+
+  TraceStorage storage_;
+  base::TempFile file_ = base::TempFile::Create();
+};
+
+TEST_F(TraceStorageSnapshotTest, RoundTrip) {
+  ASSERT_TRUE(WriteTraceStorageSnapshot(storage_, file_.path()).ok());
+
+  TraceStorage restored;
+  base::Status status = ReadTraceStorageSnapshot(file_.path(), &restored);
+  ASSERT_TRUE(status.ok()) << status.message();
+
+  const auto& slices = restored.slice_table();
+  ASSERT_EQ(slices.row_count(), 3u);
+  ASSERT_EQ(slices[0].parent_id(), std::nullopt);
+  ASSERT_EQ(slices[2].parent_id(), SliceId(0u));
+  ASSERT_EQ(restored.GetString(slices[2].name().value()), "bar");
+
+  const auto& gpu_slices = restored.gpu_slice_table();
+  ASSERT_EQ(gpu_slices.row_count(), 1u);
+  ASSERT_EQ(gpu_slices[0].ts(), 20);
+  ASSERT_EQ(gpu_slices[0].context_id(), 7);
+  ASSERT_EQ(restored.GetString(slices[1].type()),
+            storage_.GetString(storage_.slice_table()[1].type()));
+
+  ASSERT_EQ(restored.counter_table().row_count(), 5000u);
+  ASSERT_EQ(restored.counter_table()[4999].value(), 4999 * 1.5);
+  ASSERT_EQ(restored.stats()[stats::counter_events_out_of_order].value, 42);
+
+  Query q;
+  q.constraints = {gpu_slices.ts().eq(20)};
+  ASSERT_EQ(gpu_slices.QueryToRowMap(q).size(), 1u);
+  q.constraints = {slices.ts().gt(15)};
+  ASSERT_EQ(slices.QueryToRowMap(q).size(), 2u);
+
+  // The restored tables and strings can be extended.
+  ASSERT_EQ(restored.InternString("bar"), storage_.InternString("bar"));
+  tables::SliceTable::Row slice;
+  slice.ts = 40;
+  ASSERT_EQ(restored.mutable_slice_table()->Insert(slice).id, SliceId(3u));
+}
+
+TEST_F(TraceStorageSnapshotTest, DifferentStrings) {
+  ASSERT_TRUE(WriteTraceStorageSnapshot(storage_, file_.path()).ok());
+
+  TraceStorage restored;
+  restored.InternString("different");
+  ASSERT_FALSE(ReadTraceStorageSnapshot(file_.path(), &restored).ok());
+}
+
+TEST_F(TraceStorageSnapshotTest, Truncated) {
+  ASSERT_TRUE(WriteTraceStorageSnapshot(storage_, file_.path()).ok());
+  std::string contents;
+  ASSERT_TRUE(base::ReadFile(file_.path(), &contents));
+  base::TempFile truncated = base::TempFile::Create();
+  base::WriteAll(truncated.fd(), contents.data(), contents.size() / 2);
+
+  TraceStorage restored;
+  ASSERT_FALSE(ReadTraceStorageSnapshot(truncated.path(), &restored).ok());
+
+  // Nothing was restored.
+  ASSERT_EQ(restored.slice_table().row_count(), 0u);
+  ASSERT_EQ(restored.string_pool().GetId("foo"), std::nullopt);
+}
+
+TEST_F(TraceStorageSnapshotTest, InvalidString) {
+  ASSERT_TRUE(WriteTraceStorageSnapshot(storage_, file_.path()).ok());
+  std::string contents;
+  ASSERT_TRUE(base::ReadFile(file_.path(), &contents));
+
+  // Points the name of the first slice past the end of the string pool.
+  std::string names;
+  for (uint32_t i = 0; i < storage_.slice_table().row_count(); ++i) {
+    uint32_t raw_id = storage_.slice_table()[i].name()->raw_id();
+    names.append(reinterpret_cast<const char*>(&raw_id), sizeof(raw_id));
+  }
+  size_t offset = contents.find(names);
+  ASSERT_NE(offset, std::string::npos);
+  uint32_t invalid_id = StringPool::Id::BlockString(0, 1u << 20).raw_id();
+  memcpy(&contents[offset], &invalid_id, sizeof(invalid_id));
+  base::TempFile corrupt = base::TempFile::Create();
+  base::WriteAll(corrupt.fd(), contents.data(), contents.size());
+
+  TraceStorage restored;
+  ASSERT_FALSE(ReadTraceStorageSnapshot(corrupt.path(), &restored).ok());
+  ASSERT_EQ(restored.slice_table().row_count(), 0u);
+}
+
+}  // namespace
+}  // namespace dejaview::trace_processor
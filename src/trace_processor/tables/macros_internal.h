@@ -81,6 +81,8 @@ class MacroTable : public Table {
   MacroTable(MacroTable&&) = delete;
   MacroTable& operator=(MacroTable&&) noexcept = delete;
 
+  const Table* parent_table() const override { return parent_; }
+
  protected:
   // Constructors for tables created by the regular constructor.
   DEJAVIEW_NO_INLINE explicit MacroTable(StringPool* pool,
@@ -97,6 +97,7 @@
 #include "src/trace_processor/sqlite/sql_stats_table.h"
 #include "src/trace_processor/sqlite/stats_table.h"
 #include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/storage/trace_storage_snapshot.h"
 #include "src/trace_processor/tp_metatrace.h"
 #include "src/trace_processor/trace_processor_storage_impl.h"
 #include "src/trace_processor/trace_reader_registry.h"
@@ -458,6 +459,36 @@ base::Status TraceProcessorImpl::NotifyEndOfFile() {
   return base::OkStatus();
 }
 
+base::Status TraceProcessorImpl::SaveSnapshot(const std::string& path) {
+  if (!notify_eof_called_) {
+    return base::ErrStatus(
+        "SaveSnapshot can only be called after NotifyEndOfFile");
+  }
+  return WriteTraceStorageSnapshot(*context_.storage, path);
+}
+
+base::Status TraceProcessorImpl::LoadSnapshot(const std::string& path) {
+  if (notify_eof_called_ || bytes_parsed_ > 0) {
+    return base::ErrStatus(
+        "LoadSnapshot can only be called before any trace data is parsed");
+  }
+
+  // The storage is left unchanged if the snapshot can't be loaded, so that
+  // another snapshot or a trace can be loaded instead.
+  RETURN_IF_ERROR(ReadTraceStorageSnapshot(path, context_.storage.get()));
+  notify_eof_called_ = true;
+
+  if (current_trace_name_.empty())
+    current_trace_name_ = path;
+
+  BuildBoundsTable(engine_->sqlite_engine()->db(),
+                   GetTraceTimestampBoundsNs(*context_.storage));
+
+  // The trackers are only needed to parse traces.
+  TraceProcessorStorageImpl::DestroyContext();
+  return base::OkStatus();
+}
+
 size_t TraceProcessorImpl::RestoreInitialTables() {
   // We should always have at least as many objects now as we did in the
   // constructor.
@@ -92,6 +92,9 @@ class TraceProcessorImpl : public TraceProcessor,
   std::string GetCurrentTraceName() override;
   void SetCurrentTraceName(const std::string&) override;
 
+  base::Status SaveSnapshot(const std::string& path) override;
+  base::Status LoadSnapshot(const std::string& path) override;
+
   void EnableMetatrace(MetatraceConfig config) override;
 
   base::Status DisableAndReadMetatrace(
@@ -26,6 +26,7 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <google/protobuf/compiler/parser.h>
@@ -53,6 +54,7 @@
 #include "src/trace_processor/read_trace_internal.h"
 #include "src/trace_processor/rpc/stdiod.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/util/gzip_frames.h"
 #include "src/trace_processor/util/sql_modules.h"
 #include "src/trace_processor/util/status_macros.h"
 
@@ -706,6 +708,10 @@ struct CommandLineOptions {
   std::string metric_names;
   std::string metric_output;
   std::string trace_file_path;
+  std::string save_snapshot_path;
+  std::string load_snapshot_path;
+  // Only set by --icount-range.
+  std::optional<std::pair<uint64_t, uint64_t>> icount_range;
   std::string port_number;
   std::string override_stdlib_path;
   std::vector<std::string> override_sql_module_paths;
@@ -715,6 +721,7 @@ struct CommandLineOptions {
   bool enable_stdiod = false;
   bool wide = false;
   bool force_full_sort = false;
+  uint32_t parse_threads = 0;
   std::string metatrace_path;
   size_t metatrace_buffer_capacity = 0;
   metatrace::MetatraceCategories metatrace_categories =
@@ -733,6 +740,7 @@ void PrintUsage(char** argv) {
   DEJAVIEW_ELOG(R"(
 Interactive trace processor shell.
 Usage: %s [FLAGS] trace_file.pb
+       %s [FLAGS] --load-snapshot FILE
 
 Options:
  -h, --help                           Prints this guide.
@@ -762,11 +770,28 @@ Options:
  -e, --export FILE                    Export the contents of trace processor
                                       into an SQLite database after running any
                                       metrics or queries specified.
+ --save-snapshot FILE                 Writes a snapshot of the tables of the
+                                      trace to FILE once it is loaded, which
+                                      --load-snapshot opens without parsing the
+                                      trace again.
+ --load-snapshot FILE                 Loads the tables of a trace from a
+                                      snapshot written by --save-snapshot,
+                                      instead of a trace file. The snapshot has
+                                      to be written by the same build of trace
+                                      processor.
+ --icount-range START:END             Only loads the events between these
+                                      instruction counts from a trace written
+                                      by the QEMU plugin in gzip frames,
+                                      without inflating the other frames.
 
 Feature flags:
  --full-sort                          Forces the trace processor into performing
                                       a full sort ignoring any windowing
                                       logic.
+ --parse-threads N                    Decompresses and decodes the trace on N
+                                      threads, or one per core if N is 0 (the
+                                      default). 1 parses it on the main thread
+                                      only.
  --no-ftrace-raw                      Prevents ingestion of typed ftrace events
                                       into the raw table. This significantly
                                       reduces the memory usage of trace
@@ -827,7 +852,7 @@ Metatracing:
                                       last N events.
  --metatrace-categories CATEGORIES    A comma-separated list of metatrace
                                       categories to enable.)",
-                argv[0]);
+                argv[0], argv[0]);
 }
 
 CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
@@ -837,6 +862,7 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_PRE_METRICS,
     OPT_METRICS_OUTPUT,
     OPT_FORCE_FULL_SORT,
+    OPT_PARSE_THREADS,
     OPT_HTTP_PORT,
     OPT_ADD_SQL_MODULE,
     OPT_METRIC_EXTENSION,
@@ -851,6 +877,9 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_CROP_TRACK_EVENTS,
     OPT_DEV_FLAG,
     OPT_STDIOD,
+    OPT_SAVE_SNAPSHOT,
+    OPT_LOAD_SNAPSHOT,
+    OPT_ICOUNT_RANGE,
   };
 
   static const option long_options[] = {
@@ -871,6 +900,7 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"metatrace-categories", required_argument, nullptr,
        OPT_METATRACE_CATEGORIES},
       {"full-sort", no_argument, nullptr, OPT_FORCE_FULL_SORT},
+      {"parse-threads", required_argument, nullptr, OPT_PARSE_THREADS},
       {"no-ftrace-raw", no_argument, nullptr, OPT_NO_FTRACE_RAW},
       {"analyze-trace-proto-content", no_argument, nullptr,
        OPT_ANALYZE_TRACE_PROTO_CONTENT},
@@ -886,6 +916,9 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"metrics-output", required_argument, nullptr, OPT_METRICS_OUTPUT},
       {"metric-extension", required_argument, nullptr, OPT_METRIC_EXTENSION},
       {"dev-flag", required_argument, nullptr, OPT_DEV_FLAG},
+      {"save-snapshot", required_argument, nullptr, OPT_SAVE_SNAPSHOT},
+      {"load-snapshot", required_argument, nullptr, OPT_LOAD_SNAPSHOT},
+      {"icount-range", required_argument, nullptr, OPT_ICOUNT_RANGE},
       {nullptr, 0, nullptr, 0}};
 
   bool explicit_interactive = false;
@@ -974,6 +1007,11 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_PARSE_THREADS) {
+      command_line_options.parse_threads = static_cast<uint32_t>(atoi(optarg));
+      continue;
+    }
+
     if (option == OPT_NO_FTRACE_RAW) {
       command_line_options.no_ftrace_raw = true;
       continue;
@@ -1039,6 +1077,31 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_SAVE_SNAPSHOT) {
+      command_line_options.save_snapshot_path = optarg;
+      continue;
+    }
+
+    if (option == OPT_LOAD_SNAPSHOT) {
+      command_line_options.load_snapshot_path = optarg;
+      continue;
+    }
+
+    if (option == OPT_ICOUNT_RANGE) {
+      std::vector<std::string> bounds = base::SplitString(optarg, ":");
+      std::optional<uint64_t> start, end;
+      if (bounds.size() == 2) {
+        start = base::StringToUInt64(bounds[0]);
+        end = base::StringToUInt64(bounds[1]);
+      }
+      if (!start || !end || *start > *end) {
+        DEJAVIEW_ELOG("Invalid --icount-range: %s", optarg);
+        exit(1);
+      }
+      command_line_options.icount_range = std::make_pair(*start, *end);
+      continue;
+    }
+
     PrintUsage(argv);
     exit(option == 'h' ? 0 : 1);
   }
@@ -1057,13 +1120,15 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     exit(1);
   }
 
-  // The only case where we allow omitting the trace file path is when running
-  // in --httpd or --stdiod mode. In all other cases, the last argument must be
-  // the trace file.
-  if (optind == argc - 1 && argv[optind]) {
+  // The only cases where we allow omitting the trace file path are when
+  // running in --httpd or --stdiod mode or loading a snapshot instead. In all
+  // other cases, the last argument must be the trace file.
+  bool load_snapshot = !command_line_options.load_snapshot_path.empty();
+  if (optind == argc - 1 && argv[optind] && !load_snapshot) {
     command_line_options.trace_file_path = argv[optind];
-  } else if (!command_line_options.enable_httpd &&
-             !command_line_options.enable_stdiod) {
+  } else if (load_snapshot ? optind != argc
+                           : !command_line_options.enable_httpd &&
+                                 !command_line_options.enable_stdiod) {
     PrintUsage(argv);
     exit(1);
   }
@@ -1085,12 +1150,40 @@ void ExtendPoolWithBinaryDescriptor(
   }
 }
 
-base::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
-  base::Status read_status = ReadTraceUnfinalized(
-      g_tp, trace_file_path.c_str(), [&size_mb](size_t parsed_size) {
-        *size_mb = static_cast<double>(parsed_size) / 1E6;
-        fprintf(stderr, "\rLoading trace: %.2f MB\r", *size_mb);
-      });
+// Parses the frames of a framed gzip trace which overlap [start, end], and
+// the metadata of the others.
+base::Status ReadTraceRange(const std::string& trace_file_path,
+                            uint64_t start,
+                            uint64_t end,
+                            double* size_mb) {
+  std::string file;
+  if (!base::ReadFile(trace_file_path, &file))
+    return base::ErrStatus("Could not open the file");
+  ASSIGN_OR_RETURN(std::vector<uint8_t> trace,
+                   util::InflateGzipFramesInRange(
+                       reinterpret_cast<const uint8_t*>(file.data()),
+                       file.size(), start, end));
+  *size_mb = static_cast<double>(trace.size()) / 1E6;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+  memcpy(buf.get(), trace.data(), trace.size());
+  return g_tp->Parse(std::move(buf), trace.size());
+}
+
+base::Status LoadTrace(const std::string& trace_file_path,
+                       const std::optional<std::pair<uint64_t, uint64_t>>&
+                           icount_range,
+                       double* size_mb) {
+  base::Status read_status;
+  if (icount_range) {
+    read_status = ReadTraceRange(trace_file_path, icount_range->first,
+                                 icount_range->second, size_mb);
+  } else {
+    read_status = ReadTraceUnfinalized(
+        g_tp, trace_file_path.c_str(), [&size_mb](size_t parsed_size) {
+          *size_mb = static_cast<double>(parsed_size) / 1E6;
+          fprintf(stderr, "\rLoading trace: %.2f MB\r", *size_mb);
+        });
+  }
   g_tp->Flush();
   if (!read_status.ok()) {
     return base::ErrStatus("Could not read trace file (path: %s): %s",
@@ -1613,6 +1706,7 @@ base::Status TraceProcessorMain(int argc, char** argv) {
   config.sorting_mode = options.force_full_sort
                             ? SortingMode::kForceFullSort
                             : SortingMode::kDefaultHeuristics;
+  config.parse_threads = options.parse_threads;
   config.ingest_ftrace_in_raw_table = !options.no_ftrace_raw;
   config.analyze_trace_proto_content = options.analyze_trace_proto_content;
   config.drop_track_event_data_before =
@@ -1683,7 +1777,8 @@ base::Status TraceProcessorMain(int argc, char** argv) {
   if (!options.trace_file_path.empty()) {
     base::TimeNanos t_load_start = base::GetWallTimeNs();
     double size_mb = 0;
-    RETURN_IF_ERROR(LoadTrace(options.trace_file_path, &size_mb));
+    RETURN_IF_ERROR(
+        LoadTrace(options.trace_file_path, options.icount_range, &size_mb));
     t_load = base::GetWallTimeNs() - t_load_start;
 
     double t_load_s = static_cast<double>(t_load.count()) / 1E9;
@@ -1691,6 +1786,18 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                   t_load_s, size_mb / t_load_s);
 
     RETURN_IF_ERROR(PrintStats());
+  } else if (!options.load_snapshot_path.empty()) {
+    base::TimeNanos t_load_start = base::GetWallTimeNs();
+    RETURN_IF_ERROR(g_tp->LoadSnapshot(options.load_snapshot_path));
+    t_load = base::GetWallTimeNs() - t_load_start;
+    DEJAVIEW_ILOG("Snapshot loaded in %.2fs",
+                  static_cast<double>(t_load.count()) / 1E9);
+
+    RETURN_IF_ERROR(PrintStats());
+  }
+
+  if (!options.save_snapshot_path.empty()) {
+    RETURN_IF_ERROR(g_tp->SaveSnapshot(options.save_snapshot_path));
   }
 
 #if DEJAVIEW_HAS_SIGNAL_H()
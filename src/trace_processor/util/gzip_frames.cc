@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/gzip_frames.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dejaview/base/build_config.h"
+#include "dejaview/base/logging.h"
+#include "dejaview/base/status.h"
+#include "dejaview/ext/base/status_or.h"
+#include "dejaview/protozero/proto_utils.h"
+#include "src/trace_processor/util/gzip_utils.h"
+
+#include "protos/dejaview/trace/qemu/trace_frame_index.pbzero.h"
+#include "protos/dejaview/trace/trace.pbzero.h"
+#include "protos/dejaview/trace/trace_packet.pbzero.h"
+
+#if DEJAVIEW_BUILDFLAG(DEJAVIEW_ZLIB)
+#include <zconf.h>
+#include <zlib.h>
+#endif
+
+namespace dejaview::trace_processor::util {
+
+namespace {
+
+// ID1, ID2, CM (deflate), FLG (FEXTRA), MTIME (none), XFL and OS (unknown).
+constexpr uint8_t kFixedHeader[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff};
+constexpr size_t kFixedHeaderSize = sizeof(kFixedHeader);
+// A final fixed Huffman block without any symbol but the end of block.
+constexpr uint8_t kEmptyDeflateStream[] = {0x03, 0x00};
+constexpr size_t kTrailerSize = 8;
+
+constexpr uint16_t kFrameSubfieldSize = 8;
+constexpr uint16_t kLocatorSubfieldSize = 12;
+
+void WriteLe(uint8_t* out, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint64_t ReadLe(const uint8_t* in, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; i++)
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  return value;
+}
+
+// Writes the header of a frame of |frame_size| bytes whose extra field is
+// |extra_size| bytes long, up to the end of its "DF" subfield.
+void WriteFrameHeader(uint8_t* out, uint16_t extra_size, uint32_t frame_size) {
+  memcpy(out, kFixedHeader, kFixedHeaderSize);
+  WriteLe(out + kFixedHeaderSize, extra_size, 2);
+  out[12] = 'D';
+  out[13] = 'F';
+  WriteLe(out + 14, 4, 2);
+  WriteLe(out + 16, frame_size, 4);
+}
+
+}  // namespace
+
+#if DEJAVIEW_BUILDFLAG(DEJAVIEW_ZLIB)
+std::string CompressGzipFrame(const uint8_t* data, size_t size, int level) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // Negative window bits for a raw deflate stream: the header is ours.
+  int status = deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8,
+                            Z_DEFAULT_STRATEGY);
+  DEJAVIEW_CHECK(status == Z_OK);
+
+  size_t bound = deflateBound(&stream, static_cast<uLong>(size));
+  std::string frame(kGzipFrameHeaderSize + bound + kTrailerSize, '\0');
+  auto* out = reinterpret_cast<uint8_t*>(&frame[0]);
+  stream.next_in = const_cast<uint8_t*>(data);
+  stream.avail_in = static_cast<uInt>(size);
+  stream.next_out = out + kGzipFrameHeaderSize;
+  stream.avail_out = static_cast<uInt>(bound);
+  status = deflate(&stream, Z_FINISH);
+  DEJAVIEW_CHECK(status == Z_STREAM_END);
+  size_t deflated_size = bound - stream.avail_out;
+  deflateEnd(&stream);
+
+  size_t frame_size = kGzipFrameHeaderSize + deflated_size + kTrailerSize;
+  WriteFrameHeader(out, kFrameSubfieldSize, static_cast<uint32_t>(frame_size));
+  uint8_t* trailer = out + kGzipFrameHeaderSize + deflated_size;
+  WriteLe(trailer, crc32(0, data, static_cast<uInt>(size)), 4);
+  WriteLe(trailer + 4, static_cast<uint32_t>(size), 4);
+  frame.resize(frame_size);
+  return frame;
+}
+#else
+std::string CompressGzipFrame(const uint8_t*, size_t, int) {
+  DEJAVIEW_FATAL("Gzip frames require zlib");
+}
+#endif  // DEJAVIEW_BUILDFLAG(DEJAVIEW_ZLIB)
+
+size_t GetGzipFrameSize(const uint8_t* data, size_t size) {
+  DEJAVIEW_DCHECK(size >= kGzipFrameHeaderSize);
+  if (memcmp(data, kFixedHeader, 4) != 0)
+    return 0;
+  uint64_t extra_size = ReadLe(data + kFixedHeaderSize, 2);
+  if (extra_size < kFrameSubfieldSize || data[12] != 'D' || data[13] != 'F' ||
+      ReadLe(data + 14, 2) != 4) {
+    return 0;
+  }
+  return static_cast<size_t>(ReadLe(data + 16, 4));
+}
+
+uint32_t GetGzipFrameInflatedSize(const uint8_t* data, size_t size) {
+  DEJAVIEW_DCHECK(size >= kGzipFrameHeaderSize + kTrailerSize);
+  return static_cast<uint32_t>(ReadLe(data + size - 4, 4));
+}
+
+bool IsGzipFrameInflatedSizePlausible(const uint8_t* data, size_t size) {
+  uint32_t inflated_size = GetGzipFrameInflatedSize(data, size);
+  return inflated_size <= kMaxGzipFrameInflatedSize &&
+         inflated_size <= static_cast<uint64_t>(size) * kMaxGzipFrameRatio;
+}
+
+bool InflateGzipFrame(const uint8_t* data,
+                      size_t size,
+                      std::vector<uint8_t>* out) {
+  uint32_t inflated_size = GetGzipFrameInflatedSize(data, size);
+  size_t out_offset = out->size();
+  GzipDecompressor decompressor;
+  if (!IsGzipFrameInflatedSizePlausible(data, size)) {
+    auto ret = decompressor.FeedAndExtract(
+        data, size, [out](const uint8_t* ptr, size_t len) {
+          out->insert(out->end(), ptr, ptr + len);
+        });
+    // The trailer holds the inflated size modulo 2^32.
+    return ret == GzipDecompressor::ResultCode::kEof &&
+           static_cast<uint32_t>(out->size() - out_offset) == inflated_size;
+  }
+
+  out->resize(out_offset + inflated_size);
+  if (inflated_size == 0)
+    return true;
+  decompressor.Feed(data, size);
+  auto result = decompressor.ExtractOutput(out->data() + out_offset,
+                                           inflated_size);
+  return result.ret == GzipDecompressor::ResultCode::kEof &&
+         result.bytes_written == inflated_size;
+}
+
+std::string MakeGzipFrameLocator(uint64_t index_offset) {
+  std::string locator(kGzipFrameLocatorSize, '\0');
+  auto* out = reinterpret_cast<uint8_t*>(&locator[0]);
+  WriteFrameHeader(out, kFrameSubfieldSize + kLocatorSubfieldSize,
+                   kGzipFrameLocatorSize);
+  out[20] = 'D';
+  out[21] = 'X';
+  WriteLe(out + 22, 8, 2);
+  WriteLe(out + 24, index_offset, 8);
+  memcpy(out + 32, kEmptyDeflateStream, sizeof(kEmptyDeflateStream));
+  // The CRC and size of nothing are both 0.
+  return locator;
+}
+
+std::optional<uint64_t> ParseGzipFrameLocator(const uint8_t* data,
+                                              size_t size) {
+  if (size != kGzipFrameLocatorSize ||
+      GetGzipFrameSize(data, size) != kGzipFrameLocatorSize ||
+      ReadLe(data + kFixedHeaderSize, 2) !=
+          kFrameSubfieldSize + kLocatorSubfieldSize ||
+      data[20] != 'D' || data[21] != 'X' || ReadLe(data + 22, 2) != 8) {
+    return std::nullopt;
+  }
+  return ReadLe(data + 24, 8);
+}
+
+base::StatusOr<std::vector<GzipFrame>> ReadGzipFrameIndex(const uint8_t* data,
+                                                          size_t size) {
+  if (size < kGzipFrameLocatorSize)
+    return base::ErrStatus("Trace too small to be framed");
+  std::optional<uint64_t> index_offset = ParseGzipFrameLocator(
+      data + size - kGzipFrameLocatorSize, kGzipFrameLocatorSize);
+  if (!index_offset)
+    return base::ErrStatus("Trace isn't framed or has no frame index");
+
+  uint64_t index_end = size - kGzipFrameLocatorSize;
+  if (*index_offset > index_end ||
+      index_end - *index_offset < kGzipFrameHeaderSize + kTrailerSize ||
+      GetGzipFrameSize(data + *index_offset, index_end - *index_offset) !=
+          index_end - *index_offset) {
+    return base::ErrStatus("Bad frame index location");
+  }
+  std::vector<uint8_t> index;
+  if (!InflateGzipFrame(data + *index_offset,
+                        static_cast<size_t>(index_end - *index_offset),
+                        &index)) {
+    return base::ErrStatus("Failed to inflate the frame index");
+  }
+
+  protos::pbzero::Trace::Decoder trace(index.data(), index.size());
+  for (auto it = trace.packet(); it; ++it) {
+    protos::pbzero::TracePacket::Decoder packet(*it);
+    if (!packet.has_trace_frame_index())
+      continue;
+    protos::pbzero::TraceFrameIndex::Decoder frame_index(
+        packet.trace_frame_index());
+    std::vector<GzipFrame> frames;
+    for (auto frame_it = frame_index.frames(); frame_it; ++frame_it) {
+      protos::pbzero::TraceFrameIndex::Frame::Decoder decoder(*frame_it);
+      GzipFrame frame;
+      frame.offset = decoder.offset();
+      frame.size = decoder.size();
+      if (decoder.has_min_timestamp())
+        frame.min_timestamp = decoder.min_timestamp();
+      if (decoder.has_max_timestamp())
+        frame.max_timestamp = decoder.max_timestamp();
+      frame.has_descriptors = decoder.has_descriptors();
+      if (frame.offset > *index_offset ||
+          frame.size > *index_offset - frame.offset ||
+          frame.size < kGzipFrameHeaderSize + kTrailerSize) {
+        return base::ErrStatus("Frame out of bounds in the frame index");
+      }
+      frames.push_back(frame);
+    }
+    return frames;
+  }
+  return base::ErrStatus("No TraceFrameIndex packet in the index frame");
+}
+
+base::StatusOr<std::vector<uint8_t>> InflateGzipFramesInRange(
+    const uint8_t* data,
+    size_t size,
+    uint64_t start,
+    uint64_t end) {
+  auto frames = ReadGzipFrameIndex(data, size);
+  if (!frames.ok())
+    return frames.status();
+
+  std::vector<uint8_t> trace;
+  std::vector<uint8_t> inflated;
+  for (const GzipFrame& frame : *frames) {
+    bool in_range = frame.min_timestamp && frame.max_timestamp &&
+                    *frame.min_timestamp <= end && *frame.max_timestamp >= start;
+    if (!in_range && !frame.has_descriptors)
+      continue;
+    if (GetGzipFrameSize(data + frame.offset, frame.size) != frame.size)
+      return base::ErrStatus("Frame index doesn't match the frames");
+    if (in_range) {
+      if (!InflateGzipFrame(data + frame.offset, frame.size, &trace))
+        return base::ErrStatus("Failed to inflate frame");
+      continue;
+    }
+
+    // Only keep what later frames may refer to, not the events.
+    inflated.clear();
+    if (!InflateGzipFrame(data + frame.offset, frame.size, &inflated))
+      return base::ErrStatus("Failed to inflate frame");
+    protos::pbzero::Trace::Decoder decoder(inflated.data(), inflated.size());
+    for (auto it = decoder.packet(); it; ++it) {
+      protos::pbzero::TracePacket::Decoder packet(*it);
+      if (packet.has_call_graph_bundle() || packet.has_track_event() ||
+          packet.has_perf_sample()) {
+        continue;
+      }
+      uint8_t preamble[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+      uint8_t* ptr = protozero::proto_utils::WriteVarInt(
+          protozero::proto_utils::MakeTagLengthDelimited(
+              protos::pbzero::Trace::kPacketFieldNumber),
+          preamble);
+      ptr = protozero::proto_utils::WriteVarInt(it->size(), ptr);
+      trace.insert(trace.end(), preamble, ptr);
+      trace.insert(trace.end(), it->data(), it->data() + it->size());
+    }
+  }
+  return trace;
+}
+
+}  // namespace dejaview::trace_processor::util
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_GZIP_FRAMES_H_
+#define SRC_TRACE_PROCESSOR_UTIL_GZIP_FRAMES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dejaview/ext/base/status_or.h"
+
+namespace dejaview::trace_processor::util {
+
+// Seekable gzip traces, as written by the qemu plugin.
+//
+// A framed trace is a multi-member gzip file (RFC 1952, section 2.2) so any
+// gzip reader can inflate it as a whole. Each member, or frame, is compressed
+// independently and holds whole TracePackets. Its header carries an extra
+// field (subfield ID "DF") with the compressed size of the frame, which lets
+// readers split a trace in frames without inflating anything, to inflate them
+// in parallel.
+//
+// The last frame of a complete trace is an empty locator (subfield ID "DX")
+// with the offset of the frame holding a TraceFrameIndex packet, which lets
+// readers seek to the frames overlapping a range of timestamps.
+
+// Frame headers are fixed size, the "DF" subfield always comes first.
+inline constexpr size_t kGzipFrameHeaderSize = 20;
+inline constexpr size_t kGzipFrameLocatorSize = 42;
+
+// Compresses |size| bytes at |data| into a frame. |level| is a zlib level.
+std::string CompressGzipFrame(const uint8_t* data, size_t size, int level);
+
+// Returns the size of the frame starting at |data|, or 0 if the gzip member
+// there isn't a frame. |size| must be at least kGzipFrameHeaderSize.
+size_t GetGzipFrameSize(const uint8_t* data, size_t size);
+
+// Returns the inflated size of the frame at |data|, as stored in its trailer.
+uint32_t GetGzipFrameInflatedSize(const uint8_t* data, size_t size);
+
+// Frames are a few MB once inflated and deflate can't compress more than
+// about 1032:1, so larger inflated sizes come from corrupt trailers.
+inline constexpr uint32_t kMaxGzipFrameInflatedSize = 64 * 1024 * 1024;
+inline constexpr uint32_t kMaxGzipFrameRatio = 1032;
+
+// Returns whether the inflated size in the trailer of the frame of |size|
+// bytes at |data| can be trusted to allocate its output upfront.
+bool IsGzipFrameInflatedSizePlausible(const uint8_t* data, size_t size);
+
+// Inflates the frame of |size| bytes at |data| and appends it to |out|. Frames
+// whose inflated size isn't plausible are inflated as a stream, so that
+// |out| only grows as much as they really inflate to.
+bool InflateGzipFrame(const uint8_t* data,
+                      size_t size,
+                      std::vector<uint8_t>* out);
+
+// Returns the locator frame pointing to the index frame at |index_offset|.
+std::string MakeGzipFrameLocator(uint64_t index_offset);
+
+// Returns the offset of the index frame if the last kGzipFrameLocatorSize
+// bytes of a trace, at |data|, are a locator.
+std::optional<uint64_t> ParseGzipFrameLocator(const uint8_t* data,
+                                              size_t size);
+
+// A frame of a trace, as described by its TraceFrameIndex.
+struct GzipFrame {
+  uint64_t offset = 0;
+  uint32_t size = 0;
+  std::optional<uint64_t> min_timestamp;
+  std::optional<uint64_t> max_timestamp;
+  bool has_descriptors = false;
+};
+
+// Reads the index of the framed trace of |size| bytes at |data|. Fails if the
+// trace isn't framed or was cut short before its index got written.
+base::StatusOr<std::vector<GzipFrame>> ReadGzipFrameIndex(const uint8_t* data,
+                                                          size_t size);
+
+// Inflates the frames of the framed trace at |data| which hold events between
+// |start| and |end|, both included, and returns their packets as a Trace.
+// Frames holding descriptors are read too, without their events, so that the
+// result can be parsed on its own. Only touches the bytes of those frames, so
+// |data| may well be a mapping of a huge file.
+base::StatusOr<std::vector<uint8_t>> InflateGzipFramesInRange(
+    const uint8_t* data,
+    size_t size,
+    uint64_t start,
+    uint64_t end);
+
+}  // namespace dejaview::trace_processor::util
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_GZIP_FRAMES_H_
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/gzip_frames.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dejaview/protozero/scattered_heap_buffer.h"
+#include "src/trace_processor/util/gzip_utils.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/dejaview/trace/qemu/call_graph_bundle.pbzero.h"
+#include "protos/dejaview/trace/qemu/trace_frame_index.pbzero.h"
+#include "protos/dejaview/trace/trace.pbzero.h"
+#include "protos/dejaview/trace/trace_packet.pbzero.h"
+#include "protos/dejaview/trace/track_event/track_descriptor.pbzero.h"
+
+namespace dejaview::trace_processor::util {
+namespace {
+
+using ::testing::ElementsAre;
+
+const uint8_t* Bytes(const std::string& str) {
+  return reinterpret_cast<const uint8_t*>(str.data());
+}
+
+std::string Frame(const std::string& data) {
+  return CompressGzipFrame(Bytes(data), data.size(), 6);
+}
+
+// A trace with one packet of each kind per frame: a descriptor and events.
+class GzipFramesTest : public ::testing::Test {
+ protected:
+  struct FrameSpec {
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    bool has_descriptors;
+  };
+
+  static std::string Packets(uint64_t timestamp, bool descriptor) {
+    protozero::HeapBuffered<protos::pbzero::Trace> trace;
+    if (descriptor) {
+      auto* packet = trace->add_packet();
+      packet->set_track_descriptor()->set_uuid(timestamp);
+    }
+    auto* packet = trace->add_packet();
+    packet->set_timestamp(timestamp);
+    packet->set_call_graph_bundle()->set_track_uuid(timestamp);
+    return trace.SerializeAsString();
+  }
+
+  void Write(const std::vector<FrameSpec>& specs) {
+    protozero::HeapBuffered<protos::pbzero::Trace> index;
+    auto* frame_index = index->add_packet()->set_trace_frame_index();
+    for (const FrameSpec& spec : specs) {
+      std::string frame =
+          Frame(Packets(spec.min_timestamp, spec.has_descriptors));
+      auto* entry = frame_index->add_frames();
+      entry->set_offset(file_.size());
+      entry->set_size(static_cast<uint32_t>(frame.size()));
+      entry->set_min_timestamp(spec.min_timestamp);
+      entry->set_max_timestamp(spec.max_timestamp);
+      entry->set_has_descriptors(spec.has_descriptors);
+      file_ += frame;
+    }
+    uint64_t index_offset = file_.size();
+    file_ += Frame(index.SerializeAsString());
+    file_ += MakeGzipFrameLocator(index_offset);
+  }
+
+  std::string file_;
+};
+
+TEST(GzipFramesStandaloneTest, FramesAreGzipMembers) {
+  std::string data(100000, 'a');
+  std::string frame = Frame(data);
+  ASSERT_GE(frame.size(), kGzipFrameHeaderSize);
+  EXPECT_EQ(GetGzipFrameSize(Bytes(frame), frame.size()), frame.size());
+  EXPECT_EQ(GetGzipFrameInflatedSize(Bytes(frame), frame.size()), data.size());
+
+  std::vector<uint8_t> inflated =
+      GzipDecompressor::DecompressFully(Bytes(frame), frame.size());
+  EXPECT_EQ(std::string(inflated.begin(), inflated.end()), data);
+}
+
+TEST(GzipFramesStandaloneTest, ImplausibleInflatedSizeIsStreamed) {
+  std::string data(100000, 'a');
+  std::string frame = Frame(data);
+  ASSERT_TRUE(IsGzipFrameInflatedSizePlausible(Bytes(frame), frame.size()));
+
+  // A corrupt trailer claiming 4 GiB mustn't be allocated upfront.
+  std::string corrupt = frame;
+  corrupt.replace(corrupt.size() - 4, 4, std::string(4, '\xff'));
+  EXPECT_FALSE(
+      IsGzipFrameInflatedSizePlausible(Bytes(corrupt), corrupt.size()));
+  std::vector<uint8_t> out;
+  EXPECT_FALSE(InflateGzipFrame(Bytes(corrupt), corrupt.size(), &out));
+  EXPECT_LE(out.size(), data.size());
+
+  out.clear();
+  EXPECT_TRUE(InflateGzipFrame(Bytes(frame), frame.size(), &out));
+  EXPECT_EQ(std::string(out.begin(), out.end()), data);
+}
+
+TEST(GzipFramesStandaloneTest, LocatorIsAnEmptyFrame) {
+  std::string locator = MakeGzipFrameLocator(1234);
+  ASSERT_EQ(locator.size(), kGzipFrameLocatorSize);
+  EXPECT_EQ(GetGzipFrameSize(Bytes(locator), locator.size()),
+            kGzipFrameLocatorSize);
+  EXPECT_EQ(ParseGzipFrameLocator(Bytes(locator), locator.size()), 1234u);
+  EXPECT_TRUE(
+      GzipDecompressor::DecompressFully(Bytes(locator), locator.size())
+          .empty());
+}
+
+TEST(GzipFramesStandaloneTest, NotAFrame) {
+  std::string header = "\x1f\x8b\x08\x00" + std::string(20, '\0');
+  EXPECT_EQ(GetGzipFrameSize(Bytes(header), header.size()), 0u);
+  EXPECT_FALSE(ParseGzipFrameLocator(Bytes(header), kGzipFrameLocatorSize));
+}
+
+TEST_F(GzipFramesTest, ReadIndex) {
+  Write({{10, 20, true}, {21, 30, false}});
+  auto frames = ReadGzipFrameIndex(Bytes(file_), file_.size());
+  ASSERT_TRUE(frames.ok()) << frames.status().message();
+  ASSERT_EQ(frames->size(), 2u);
+  EXPECT_EQ((*frames)[0].offset, 0u);
+  EXPECT_EQ((*frames)[1].offset, (*frames)[0].size);
+  EXPECT_EQ((*frames)[1].min_timestamp, 21u);
+  EXPECT_EQ((*frames)[1].max_timestamp, 30u);
+  EXPECT_TRUE((*frames)[0].has_descriptors);
+  EXPECT_FALSE((*frames)[1].has_descriptors);
+}
+
+TEST_F(GzipFramesTest, TruncatedTraceHasNoIndex) {
+  Write({{10, 20, true}});
+  file_.resize(file_.size() - 1);
+  EXPECT_FALSE(ReadGzipFrameIndex(Bytes(file_), file_.size()).ok());
+}
+
+TEST_F(GzipFramesTest, InflateRange) {
+  Write({{10, 20, true}, {21, 30, false}, {31, 40, true}, {41, 50, false}});
+  auto trace = InflateGzipFramesInRange(Bytes(file_), file_.size(), 25, 35);
+  ASSERT_TRUE(trace.ok()) << trace.status().message();
+
+  std::vector<uint64_t> descriptors;
+  std::vector<uint64_t> bundles;
+  protos::pbzero::Trace::Decoder decoder(trace->data(), trace->size());
+  for (auto it = decoder.packet(); it; ++it) {
+    protos::pbzero::TracePacket::Decoder packet(*it);
+    if (packet.has_track_descriptor()) {
+      protos::pbzero::TrackDescriptor::Decoder track(packet.track_descriptor());
+      descriptors.push_back(track.uuid());
+    }
+    if (packet.has_call_graph_bundle())
+      bundles.push_back(packet.timestamp());
+  }
+  // The first frame is only read for its descriptor.
+  EXPECT_THAT(descriptors, ElementsAre(10u, 31u));
+  EXPECT_THAT(bundles, ElementsAre(21u, 31u));
+}
+
+}  // namespace
+}  // namespace dejaview::trace_processor::util
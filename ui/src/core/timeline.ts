@@ -36,6 +36,7 @@ export class TimelineImpl implements Timeline {
   private _visibleWindow: HighPrecisionTimeSpan;
   private _hoverCursorTimestamp?: time;
   private _debugCursorTimestamp?: time;
+  private _debugCursorEtaMs?: number;
 
   // This is used to calculate the tracks within a Y range for area selection.
   areaY: Range = {};
@@ -148,6 +149,15 @@ export class TimelineImpl implements Timeline {
     raf.scheduleRedraw();
   }
 
+  get debugCursorEtaMs(): number | undefined {
+    return this._debugCursorEtaMs;
+  }
+
+  set debugCursorEtaMs(eta: number | undefined) {
+    this._debugCursorEtaMs = eta;
+    raf.scheduleRedraw();
+  }
+
   // Offset between t=0 and the configured time domain.
   timestampOffset(): time {
     return Time.ZERO;
@@ -422,7 +422,8 @@ export class ThreadSliceDetailsPanel implements TrackEventDetailsPanel {
       onclick: () => {
         globals.trace.engine.debug(
           Number(sliceInfo.ts),
-          (currentIcount?: number) => {
+          (currentIcount?: number, etaMs?: number) => {
+            globals.trace.timeline.debugCursorEtaMs = etaMs;
             if (currentIcount != undefined) {
               globals.trace.timeline.debugCursorTimestamp = Time.fromRaw(
                 BigInt(currentIcount),
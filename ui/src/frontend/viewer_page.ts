@@ -493,14 +493,26 @@ export function renderDebugCursorVertical(
   timescale: TimeScale,
   size: Size2D,
 ) {
-  if (globals.trace.timeline.debugCursorTimestamp !== undefined) {
+  const debugCursor = globals.trace.timeline.debugCursorTimestamp;
+  if (debugCursor !== undefined) {
     drawVerticalLineAtTime(
       ctx,
       timescale,
-      globals.trace.timeline.debugCursorTimestamp,
+      debugCursor,
       size.height,
       `#349650`,
     );
+    const etaMs = globals.trace.timeline.debugCursorEtaMs;
+    if (etaMs !== undefined && etaMs > 0) {
+      ctx.font = '12px Roboto Condensed';
+      ctx.fillStyle = `#349650`;
+      ctx.textBaseline = 'top';
+      ctx.fillText(
+        `ETA ${Math.ceil(etaMs / 1000)}s`,
+        Math.floor(timescale.timeToPx(debugCursor)) + 4,
+        4,
+      );
+    }
   }
 }
 
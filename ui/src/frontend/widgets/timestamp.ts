@@ -62,7 +62,8 @@ export class Timestamp implements m.ClassComponent<TimestampAttrs> {
         onclick: async () => {
           await globals.trace.engine.debug(
             Number(ts),
-            (currentIcount?: number) => {
+            (currentIcount?: number, etaMs?: number) => {
+              globals.trace.timeline.debugCursorEtaMs = etaMs;
               if (currentIcount != undefined) {
                 globals.trace.timeline.debugCursorTimestamp = Time.fromRaw(
                   BigInt(currentIcount),
@@ -31,6 +31,9 @@ export interface Timeline {
   // Render a vertical line on the timeline at this timestamp.
   debugCursorTimestamp: time | undefined;
 
+  // Predicted time until the debug cursor reaches its target, if it's moving.
+  debugCursorEtaMs: number | undefined;
+
   // Get the current timestamp offset.
   timestampOffset(): time;
 
@@ -134,7 +134,7 @@ export abstract class EngineBase implements Engine, Disposable {
   private _isMetatracingEnabled = false;
   private _numRequestsPending = 0;
   private _failed: Optional<string> = undefined;
-  private icountUpdate_?: (currentIcount?: number) => void;
+  private icountUpdate_?: (currentIcount?: number, etaMs?: number) => void;
   private debuggerStdout_?: (buf: Uint8Array) => void;
   private debuggerStarted_?: () => void;
   private debuggerStopped_?: () => void;
@@ -291,7 +291,10 @@ export abstract class EngineBase implements Engine, Disposable {
         }
         if (this.icountUpdate_) {
           if (exists(debugResult.currentIcount)) {
-            this.icountUpdate_(debugResult.currentIcount);
+            this.icountUpdate_(
+              debugResult.currentIcount,
+              exists(debugResult.etaMs) ? debugResult.etaMs : undefined,
+            );
           } else {
             this.icountUpdate_(undefined);
           }
@@ -376,7 +379,7 @@ export abstract class EngineBase implements Engine, Disposable {
 
   debug(
     targetIcount: number,
-    icountUpdate?: (currentIcount?: number) => void,
+    icountUpdate?: (currentIcount?: number, etaMs?: number) => void,
   ): Promise<void> {
     this.icountUpdate_ = icountUpdate;
 
@@ -672,7 +675,10 @@ export class EngineProxy implements Engine, Disposable {
     return this.engine.getProxy(`${this.tag}/${tag}`);
   }
 
-  debug(targetIcount: number, icountUpdate: (currentIcount?: number) => void) {
+  debug(
+    targetIcount: number,
+    icountUpdate: (currentIcount?: number, etaMs?: number) => void,
+  ) {
     return this.engine.debug(targetIcount, icountUpdate);
   }
 